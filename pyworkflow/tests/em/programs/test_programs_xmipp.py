@@ -25,6 +25,7 @@
 import math
 import os
 
+import xmipp
 import pyworkflow.utils as pwutils
 import pyworkflow.em.packages.xmipp3 as xmipp3
 from pyworkflow.tests import DataSet
@@ -1024,6 +1025,35 @@ class TransformGeometry(XmippProgramTest):
     def test_case9(self):
         self.runCase("-i input/phantomBacteriorhodopsin.vol --rotate_volume axis 90 1 1 1 -o %o/volume.vol --dont_wrap",
                 outputs=["volume.vol"])
+    def test_case10(self):
+        # The stack written by several threads should be the same as the
+        # one written by a single thread
+        self.runCase("-i input/header.doc --scale 0.5 --shift 5 10 -5 --rotate -45 --apply_transform -o %o/threads.stk --thr 3",
+                preruns=["xmipp_transform_geometry -i input/header.doc --scale 0.5 --shift 5 10 -5 --rotate -45 --apply_transform -o %o/serial.stk --thr 1"],
+                validate=self.validate_case10)
+
+    def validate_case10(self):
+        self.assertTrue(xmipp.compareTwoFiles(os.path.join(self.outputDir, "serial.stk"),
+                                              os.path.join(self.outputDir, "threads.stk"), 0))
+
+
+class TransformGeometryMpi(XmippProgramTest):
+    _owner = RM
+    @classmethod
+    def getProgram(cls):
+        return 'xmipp_mpi_transform_geometry'
+
+    def test_case1(self):
+        # The threads of each node share its blocks of images, the result
+        # should be the same as without MPI
+        self.runCase("-i input/header.doc --scale 0.5 --shift 5 10 -5 --rotate -45 --apply_transform -o %o/threads.stk --thr 2 --mpi_job_size 1",
+                mpi=3,
+                preruns=["xmipp_transform_geometry -i input/header.doc --scale 0.5 --shift 5 10 -5 --rotate -45 --apply_transform -o %o/serial.stk"],
+                validate=self.validate_case1)
+
+    def validate_case1(self):
+        self.assertTrue(xmipp.compareTwoFiles(os.path.join(self.outputDir, "serial.stk"),
+                                              os.path.join(self.outputDir, "threads.stk"), 0))
 
 
 class TransformMask(XmippProgramTest):
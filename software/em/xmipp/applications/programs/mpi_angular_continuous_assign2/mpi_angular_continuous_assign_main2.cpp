@@ -87,7 +87,7 @@ public:
     }
     void finishProcessing()
     {
-        node->gatherMetadatas(*getOutputMd(), fn_out);
+        node->gatherMetadatas(*getOutputMd());
     	MetaData MDaux;
     	MDaux.sort(*getOutputMd(), MDL_GATHER_ID);
         MDaux.removeLabel(MDL_GATHER_ID);
@@ -160,6 +160,7 @@ public:
         }
         //all ranks
         mysampling.setSampling(sampling);
+        mysampling.numberOfThreads=nThreads;
         //symmetry for sampling may be different from neighbourhs
         if (!mysampling.SL.isSymmetryGroup(fn_sym, symmetry, sym_order))
             REPORT_ERROR(ERR_NUMERICAL, (std::string)"angular_project_library::run Invalid symmetry" +  fn_sym);//set sampling must go before set noise
@@ -707,20 +707,88 @@ CL2D::~CL2D()
 		delete P[q];
 }
 
+/* Image cache -------------------------------------------------------- */
+CL2DImageCache::CL2DImageCache()
+{
+    Ydim = Xdim = 0;
+    maxMemoryImages = maxScratchImages = 0;
+}
+
+void CL2DImageCache::initialize(size_t _Ydim, size_t _Xdim, size_t Nimgs,
+                                double memoryMB, bool useScratch)
+{
+    Ydim = _Ydim;
+    Xdim = _Xdim;
+    size_t imageBytes = Ydim * Xdim * sizeof(double);
+    maxMemoryImages = XMIPP_MIN(Nimgs, (size_t)(memoryMB * 1024 * 1024 / imageBytes));
+    maxScratchImages = useScratch ? Nimgs - maxMemoryImages : 0;
+    // Reserved beforehand so that growing the vector never copies the images
+    memoryImages.clear();
+    memoryImages.reserve(maxMemoryImages);
+    scratchImages.clear();
+    slot.clear();
+}
+
+bool CL2DImageCache::get(size_t objId, MultidimArray<double> &I) const
+{
+    std::map<size_t, size_t>::const_iterator it = slot.find(objId);
+    if (it == slot.end())
+        return false;
+    size_t n = it->second;
+    const double *ptr;
+    if (n < maxMemoryImages)
+        ptr = MULTIDIM_ARRAY(memoryImages[n]);
+    else
+        ptr = MULTIDIM_ARRAY(scratchImages) + (n - maxMemoryImages) * Ydim * Xdim;
+    I.resizeNoCopy(Ydim, Xdim);
+    memcpy(MULTIDIM_ARRAY(I), ptr, Ydim * Xdim * sizeof(double));
+    I.setXmippOrigin();
+    return true;
+}
+
+void CL2DImageCache::put(size_t objId, const MultidimArray<double> &I)
+{
+    size_t n = slot.size();
+    if (n >= maxMemoryImages + maxScratchImages || YSIZE(I) != Ydim || XSIZE(I) != Xdim ||
+        ZSIZE(I) != 1 || slot.find(objId) != slot.end())
+        return;
+    if (n < maxMemoryImages)
+        memoryImages.push_back(I);
+    else
+    {
+        if (MULTIDIM_SIZE(scratchImages) == 0)
+        {
+            scratchImages.setMmap(true);
+            scratchImages.resizeNoCopy(maxScratchImages, 1, Ydim, Xdim);
+        }
+        memcpy(MULTIDIM_ARRAY(scratchImages) + (n - maxMemoryImages) * Ydim * Xdim,
+               MULTIDIM_ARRAY(I), Ydim * Xdim * sizeof(double));
+    }
+    slot[objId] = n;
+}
+
 /* Read image --------------------------------------------------------- */
 void CL2D::readImage(Image<double> &I, size_t objId, bool applyGeo) const
 {
+    FileName fnImg;
     if (applyGeo)
         I.readApplyGeo(*SF, objId);
     else
     {
-        FileName fnImg;
         SF->getValue(MDL_IMAGE, fnImg, objId);
+        // Images without geometry are the same in all iterations
+        if (imageCache.get(objId, I()))
+        {
+            I.setName(fnImg);
+            return;
+        }
         I.read(fnImg);
     }
     I().setXmippOrigin();
     if (prm->normalizeImages)
     	I().statisticsAdjust(0, 1);
+    if (!applyGeo)
+        imageCache.put(objId, I());
 }
 
 /* CL2D initialization ------------------------------------------------ */
@@ -733,6 +801,7 @@ void CL2D::initialize(MetaData &_SF,
 
     SF = &_SF;
     Nimgs = SF->size();
+    imageCache.initialize(prm->Ydim, prm->Xdim, Nimgs, prm->cacheMemory, prm->cacheScratch);
 
     // Start with _Ncodes0 codevectors
     CL2DAssignment assignment;
@@ -1645,6 +1714,8 @@ void ProgClassifyCL2D::readParams()
 	if (useThresholdMask)
 		threshold=getDoubleParam("--useThresholdMask");
 	alignImages = !checkParam("--dontAlign");
+	cacheMemory = getDoubleParam("--cacheImages");
+	cacheScratch = checkParam("--cacheScratch");
 }
 
 void ProgClassifyCL2D::show() const {
@@ -1667,6 +1738,8 @@ void ProgClassifyCL2D::show() const {
 			<< "Normalize images:        " << normalizeImages << std::endl
 			<< "Mirror images:           " << mirrorImages << std::endl
 			<< "Align images:            " << alignImages << std::endl
+			<< "Image cache (Mb):        " << cacheMemory << std::endl
+			<< "Cache scratch stack:     " << cacheScratch << std::endl
 	;
 	if (useThresholdMask)
 		std::cout << "Threshold mask:          " << threshold << std::endl;
@@ -1711,6 +1784,8 @@ void ProgClassifyCL2D::defineParams()
 	addParamsLine("   [--dontMirrorImages]      : By default, input images are studied unmirrored and mirrored");
 	addParamsLine("   [--useThresholdMask <t>]  : Use a mask to compare images. Remove pixels whose value is smaller or equal t");
 	addParamsLine("   [--dontAlign]             : Do not center the class representatives");
+	addParamsLine("   [--cacheImages+ <Mb=0>]   : Memory per process to keep the preprocessed images between iterations");
+	addParamsLine("   [--cacheScratch+]         : Keep the images that do not fit in memory in a temporary stack (in /tmp)");
     addExampleLine("mpirun -np 3 `which xmipp_mpi_classify_CL2D` -i images.stk --nref 256 --oroot class --odir CL2Dresults --iter 10");
 }
 
@@ -77,6 +77,128 @@ TEST_F( FftwTest, directFourierTransformComplex)
     transformer1.cleanup();
 }
 
+TEST_F( FftwTest, planCache)
+{
+    // Plans are shared between transformers and arrays of the same shape
+    MultidimArray< std::complex< double > > FFT1, FFT2, FFT3;
+    MultidimArray< double > img1(8,6), img2(8,6), inv;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img1)
+    {
+        DIRECT_MULTIDIM_ELEM(img1,n)=n%7;
+        DIRECT_MULTIDIM_ELEM(img2,n)=(n*n)%5;
+    }
+    FourierTransformer transformer1, transformer2;
+    transformer1.FourierTransform(img1, FFT1, true);
+    transformer2.FourierTransform(img2, FFT2, true);
+    transformer1.FourierTransform(img2, FFT3, true);
+    EXPECT_EQ(FFT2,FFT3);
+
+    // Arrays with a different alignment
+    MultidimArray< double > buffer(2,8*6+1), unaligned;
+    unaligned.aliasRow(buffer,1);
+    unaligned.setDimensions(6,8,1,1);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img1)
+    DIRECT_MULTIDIM_ELEM(unaligned,n)=DIRECT_MULTIDIM_ELEM(img1,n);
+    transformer2.FourierTransform(unaligned, FFT3, true);
+    EXPECT_EQ(FFT1,FFT3);
+
+    // The plans are recreated after a cleanup
+    transformer1.cleanup();
+    inv.resizeNoCopy(img1);
+    transformer1.inverseFourierTransform(FFT1, inv);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(inv)
+    EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(img1,n),DIRECT_MULTIDIM_ELEM(inv,n),1e-9);
+}
+
+TEST_F( FftwTest, singlePrecision)
+{
+    // The float transforms agree with the double ones
+    MultidimArray< double > img(16,12), Mcorr, shifted;
+    MultidimArray< float > imgf, Mcorrf, shiftedf;
+    FOR_ALL_ELEMENTS_IN_ARRAY2D(img)
+    A2D_ELEM(img,i,j)=exp(-((i-7.0)*(i-7.0)+(j-5.0)*(j-5.0))/8.0)+0.1*((i*j)%3);
+    typeCast(img,imgf);
+    MultidimArray< std::complex< double > > FFT;
+    MultidimArray< std::complex< float > > FFTf;
+    FourierTransformer transformer;
+    FourierTransformerFloat transformerf;
+    transformer.FourierTransform(img, FFT, true);
+    transformerf.FourierTransform(imgf, FFTf, false);
+    ASSERT_TRUE(FFT.sameShape(FFTf));
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FFT)
+    {
+        EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(FFT,n).real(),DIRECT_MULTIDIM_ELEM(FFTf,n).real(),1e-5);
+        EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(FFT,n).imag(),DIRECT_MULTIDIM_ELEM(FFTf,n).imag(),1e-5);
+    }
+    transformerf.inverseFourierTransform();
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img)
+    EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(img,n),DIRECT_MULTIDIM_ELEM(imgf,n),1e-5);
+
+    // Correlation and shift search
+    img.setXmippOrigin();
+    imgf.setXmippOrigin();
+    translate(LINEAR,shifted,img,vectorR2(2.0,-3.0),WRAP);
+    typeCast(shifted,shiftedf);
+    shiftedf.setXmippOrigin();
+    CorrelationAux aux;
+    CorrelationAuxFloat auxf;
+    correlation_matrix(img, shifted, Mcorr, aux);
+    correlation_matrix(imgf, shiftedf, Mcorrf, auxf);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mcorr)
+    EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(Mcorr,n),DIRECT_MULTIDIM_ELEM(Mcorrf,n),1e-4);
+    double shiftX, shiftY, shiftXf, shiftYf;
+    bestShift(img, shifted, shiftX, shiftY, aux);
+    bestShift(imgf, shiftedf, shiftXf, shiftYf, auxf);
+    EXPECT_NEAR(shiftX,shiftXf,1e-3);
+    EXPECT_NEAR(shiftY,shiftYf,1e-3);
+}
+
+TEST_F( FftwTest, batchTransform)
+{
+    // A batch gives the same transforms as the images one by one
+    MultidimArray< double > stack(5,1,8,6), img, inv;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(stack)
+    DIRECT_MULTIDIM_ELEM(stack,n)=(n*n)%11-3.0*(n%4);
+    MultidimArray< std::complex< double > > Fstack, Fimg, Fbatch;
+    BatchFourierTransformer batchTransformer;
+    batchTransformer.setThreadsNumber(2);
+    batchTransformer.FourierTransform(stack, Fstack, true);
+    ASSERT_EQ(NSIZE(Fstack),(size_t)5);
+    FourierTransformer transformer;
+    std::vector< MultidimArray<double> > images(NSIZE(stack));
+    for (size_t n=0; n<NSIZE(stack); ++n)
+    {
+        img.aliasImageInStack(stack,n);
+        images[n]=img;
+        transformer.FourierTransform(images[n], Fimg, true);
+        batchTransformer.getFourierAlias(n, Fbatch);
+        EXPECT_EQ(Fimg,Fbatch);
+    }
+
+    // Vectors of images
+    std::vector< MultidimArray< std::complex<double> > > Fimages;
+    batchTransformer.FourierTransform(images, Fimages);
+    ASSERT_EQ(Fimages.size(),images.size());
+    for (size_t n=0; n<images.size(); ++n)
+    {
+        transformer.FourierTransform(images[n], Fimg, true);
+        EXPECT_EQ(Fimg,Fimages[n]);
+    }
+    std::vector< MultidimArray<double> > invImages(images.size());
+    for (size_t n=0; n<images.size(); ++n)
+        invImages[n].initZeros(images[n]);
+    batchTransformer.inverseFourierTransform(Fimages, invImages);
+    for (size_t k=0; k<images.size(); ++k)
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(images[k])
+        EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(images[k],n),DIRECT_MULTIDIM_ELEM(invImages[k],n),1e-9);
+
+    // Inverse of the whole stack
+    inv.initZeros(stack);
+    batchTransformer.inverseFourierTransform(Fstack, inv);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(stack)
+    EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(stack,n),DIRECT_MULTIDIM_ELEM(inv,n),1e-9);
+}
+
 TEST_F( FftwTest, fft_IDX2DIGFREQ)
 {
 	double w;
@@ -0,0 +1,258 @@
+#include <data/blobs.h>
+#include <data/xmipp_funcs.h>
+#include <data/multidim_array.h>
+#include <reconstruction/fourier_gridding.h>
+#include <sys/time.h>
+#include <iostream>
+#include <gtest/gtest.h>
+// MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
+
+#define TABLE_SIZE 10000
+
+class FourierGriddingTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        // Same blob table as ProgRecFourier
+        blob.radius = 1.9;
+        blob.order = 0;
+        blob.alpha = 15;
+        table.resize(TABLE_SIZE);
+        double tableStep = blob.radius*sqrt(1./(TABLE_SIZE-1));
+        FOR_ALL_ELEMENTS_IN_MATRIX1D(table)
+        VEC_ELEM(table,i) = blob_val(tableStep*sqrt((double)i), blob);
+        iDeltaSqrt = (TABLE_SIZE-1)/(blob.radius*blob.radius);
+
+        volSize = 64;
+        xdim = volSize/2+1;
+        gridder.initialize(table, iDeltaSqrt, blob.radius, volSize);
+        gridderSingle.initialize(table, iDeltaSqrt, blob.radius, volSize);
+
+        // Positions all over the volume, including the X borders of the half-complex layout
+        init_random_generator(1234);
+        for (int n=0; n<500; n++)
+        {
+            double x = (n%5==0) ? rnd_unif(0, 2) : (n%5==1) ? rnd_unif(volSize-2, volSize) :
+                       (n%5==2) ? rnd_unif(volSize/2-2, volSize/2+2) : rnd_unif(0, volSize);
+            if (x>=volSize)
+                x=0;
+            positions.push_back(x);
+            positions.push_back(rnd_unif(0, volSize));
+            positions.push_back(rnd_unif(0, volSize));
+        }
+    }
+
+    /* Gridding as done by the original loop of ProgRecFourier, voxel by voxel */
+    void referenceSplat(MultidimArray<double> &fourier, MultidimArray<double> &weights,
+                        const double *reference, double x, double y, double z,
+                        double re, double im, double w, double wCTF)
+    {
+        int xsize_1 = xdim-1, zsize_1 = volSize-1;
+        double r2 = blob.radius*blob.radius;
+        for (int intz = CEIL(z-blob.radius); intz <= FLOOR(z+blob.radius); ++intz)
+            for (int inty = CEIL(y-blob.radius); inty <= FLOOR(y+blob.radius); ++inty)
+                for (int intx = CEIL(x-blob.radius); intx <= FLOOR(x+blob.radius); ++intx)
+                {
+                    double d2 = (intx-x)*(intx-x) + (inty-y)*(inty-y) + (intz-z)*(intz-z);
+                    if (d2 > r2)
+                        continue;
+                    double wb = VEC_ELEM(table, (int)(d2*iDeltaSqrt+0.5))*w;
+                    int iz = intWRAP(intz, 0, zsize_1), iy = intWRAP(inty, 0, zsize_1), ix = intWRAP(intx, 0, zsize_1);
+                    bool conjugate = ix > xsize_1;
+                    if (conjugate)
+                    {
+                        iz = intWRAP(-iz, 0, zsize_1);
+                        iy = intWRAP(-iy, 0, zsize_1);
+                        ix = intWRAP(-ix, 0, zsize_1);
+                    }
+                    if (reference != NULL)
+                        DIRECT_A3D_ELEM(weights, iz, iy, ix) += wb*reference[2*(((size_t)iz*volSize+iy)*xdim+ix)];
+                    else
+                    {
+                        DIRECT_A3D_ELEM(weights, iz, iy, ix) += wb;
+                        DIRECT_A3D_ELEM(fourier, iz, iy, 2*ix) += wb*wCTF*re;
+                        DIRECT_A3D_ELEM(fourier, iz, iy, 2*ix+1) += (conjugate ? -1 : 1)*wb*wCTF*im;
+                    }
+                }
+    }
+
+    double elapsed(const struct timeval &t0, const struct timeval &t1)
+    {
+        return (t1.tv_sec-t0.tv_sec) + 1e-6*(t1.tv_usec-t0.tv_usec);
+    }
+
+    struct blobtype blob;
+    Matrix1D<double> table;
+    double iDeltaSqrt;
+    int volSize, xdim;
+    BlobGridder<double> gridder;
+    BlobGridder<float> gridderSingle;
+    std::vector<double> positions;
+};
+
+TEST_F( FourierGriddingTest, splat)
+{
+    MultidimArray<double> fourier, weights, fourierRef, weightsRef;
+    fourier.initZeros(volSize, volSize, 2*xdim);
+    weights.initZeros(volSize, volSize, xdim);
+    fourierRef.initZeros(fourier);
+    weightsRef.initZeros(weights);
+    for (size_t n=0; n<positions.size(); n+=3)
+    {
+        double re = rnd_unif(-1, 1), im = rnd_unif(-1, 1), w = rnd_unif(0.5, 1), wCTF = rnd_unif(0.5, 2);
+        gridder.splat(MULTIDIM_ARRAY(fourier), MULTIDIM_ARRAY(weights),
+                      positions[n], positions[n+1], positions[n+2], re, im, w, wCTF);
+        referenceSplat(fourierRef, weightsRef, NULL,
+                       positions[n], positions[n+1], positions[n+2], re, im, w, wCTF);
+    }
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(weights)
+    ASSERT_NEAR(DIRECT_MULTIDIM_ELEM(weights,n), DIRECT_MULTIDIM_ELEM(weightsRef,n), 1e-10);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(fourier)
+    ASSERT_NEAR(DIRECT_MULTIDIM_ELEM(fourier,n), DIRECT_MULTIDIM_ELEM(fourierRef,n), 1e-10);
+}
+
+TEST_F( FourierGriddingTest, splatSingle)
+{
+    MultidimArray<double> fourier, weights;
+    MultidimArray<float> fourierSingle, weightsSingle;
+    fourier.initZeros(volSize, volSize, 2*xdim);
+    weights.initZeros(volSize, volSize, xdim);
+    fourierSingle.initZeros(fourier);
+    weightsSingle.initZeros(weights);
+    for (size_t n=0; n<positions.size(); n+=3)
+    {
+        double re = rnd_unif(-1, 1), im = rnd_unif(-1, 1);
+        gridder.splat(MULTIDIM_ARRAY(fourier), MULTIDIM_ARRAY(weights),
+                      positions[n], positions[n+1], positions[n+2], re, im, 1, 1);
+        gridderSingle.splat(MULTIDIM_ARRAY(fourierSingle), MULTIDIM_ARRAY(weightsSingle),
+                            positions[n], positions[n+1], positions[n+2], (float)re, (float)im, 1.f, 1.f);
+    }
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(weights)
+    ASSERT_NEAR(DIRECT_MULTIDIM_ELEM(weights,n), DIRECT_MULTIDIM_ELEM(weightsSingle,n), 1e-4);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(fourier)
+    ASSERT_NEAR(DIRECT_MULTIDIM_ELEM(fourier,n), DIRECT_MULTIDIM_ELEM(fourierSingle,n), 1e-4);
+}
+
+TEST_F( FourierGriddingTest, splatWeights)
+{
+    MultidimArray<double> reference, weights, weightsRef;
+    reference.resize(volSize, volSize, 2*xdim);
+    reference.initRandom(0, 1);
+    weights.initZeros(volSize, volSize, xdim);
+    weightsRef.initZeros(weights);
+    for (size_t n=0; n<positions.size(); n+=3)
+    {
+        gridder.splatWeights(MULTIDIM_ARRAY(weights), MULTIDIM_ARRAY(reference),
+                             positions[n], positions[n+1], positions[n+2], 0.7);
+        referenceSplat(weightsRef, weightsRef, MULTIDIM_ARRAY(reference),
+                       positions[n], positions[n+1], positions[n+2], 0, 0, 0.7, 1);
+    }
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(weights)
+    ASSERT_NEAR(DIRECT_MULTIDIM_ELEM(weights,n), DIRECT_MULTIDIM_ELEM(weightsRef,n), 1e-10);
+}
+
+// Many coefficients accumulated on the same voxels, as in a reconstruction
+TEST_F( FourierGriddingTest, accumulate)
+{
+    MultidimArray<double> fourier, weights, fourierRef, weightsRef;
+    MultidimArray<float> fourierSingle, weightsSingle;
+    fourier.initZeros(volSize, volSize, 2*xdim);
+    weights.initZeros(volSize, volSize, xdim);
+    fourierRef.initZeros(fourier);
+    weightsRef.initZeros(weights);
+    fourierSingle.initZeros(fourier);
+    weightsSingle.initZeros(weights);
+    for (int r=0; r<20; r++)
+        for (size_t n=0; n<positions.size(); n+=3)
+        {
+            double re = rnd_unif(-1, 1), im = rnd_unif(-1, 1), w = rnd_unif(0.5, 1), wCTF = rnd_unif(0.5, 2);
+            referenceSplat(fourierRef, weightsRef, NULL,
+                           positions[n], positions[n+1], positions[n+2], re, im, w, wCTF);
+            gridder.splat(MULTIDIM_ARRAY(fourier), MULTIDIM_ARRAY(weights),
+                          positions[n], positions[n+1], positions[n+2], re, im, w, wCTF);
+            gridderSingle.splat(MULTIDIM_ARRAY(fourierSingle), MULTIDIM_ARRAY(weightsSingle),
+                                positions[n], positions[n+1], positions[n+2],
+                                (float)re, (float)im, (float)w, (float)wCTF);
+        }
+    // In single precision the table index may be rounded to the next entry
+    double maxWeight = weightsRef.computeMax();
+    EXPECT_GT(maxWeight, 1);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(weights)
+    {
+        EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(weightsRef,n), DIRECT_MULTIDIM_ELEM(weights,n), 1e-9);
+        EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(weightsRef,n), DIRECT_MULTIDIM_ELEM(weightsSingle,n), 1e-3*maxWeight);
+    }
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(fourier)
+    {
+        EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(fourierRef,n), DIRECT_MULTIDIM_ELEM(fourier,n), 1e-9);
+        EXPECT_NEAR(DIRECT_MULTIDIM_ELEM(fourierRef,n), DIRECT_MULTIDIM_ELEM(fourierSingle,n), 1e-3*maxWeight);
+    }
+}
+
+TEST_F( FourierGriddingTest, footprintTooLarge)
+{
+    BlobGridder<double> largeGridder;
+    EXPECT_NO_THROW(largeGridder.initialize(table, iDeltaSqrt, 15.9, volSize));
+    EXPECT_THROW(largeGridder.initialize(table, iDeltaSqrt, 16, volSize), XmippError);
+}
+
+// Timing of the kernel against the voxel by voxel gridding. It is disabled
+// because it only prints the times, run it with
+// test_fourier_gridding --gtest_also_run_disabled_tests --gtest_filter=*benchmark
+TEST_F( FourierGriddingTest, DISABLED_benchmark)
+{
+    // Random positions, and the positions of a central slice row by row as
+    // in a reconstruction
+    std::vector<double> slice;
+    double sinRot = sin(0.3), cosRot = cos(0.3), sinTilt = sin(0.5), cosTilt = cos(0.5);
+    for (int i = -volSize/2; i < volSize/2; i++)
+        for (int j = 0; j < xdim-1; j++)
+        {
+            double x = j*cosRot, y = i*cosTilt + j*sinRot*sinTilt, z = -i*sinTilt + j*sinRot*cosTilt;
+            slice.push_back(x);
+            slice.push_back((y < 0) ? y+volSize : y);
+            slice.push_back((z < 0) ? z+volSize : z);
+        }
+    const std::vector<double> *allPositions[2] = { &positions, &slice };
+    const char *names[2] = { "Random positions", "Central slice" };
+
+    MultidimArray<double> fourier, weights;
+    MultidimArray<float> fourierSingle, weightsSingle;
+    fourier.initZeros(volSize, volSize, 2*xdim);
+    weights.initZeros(volSize, volSize, xdim);
+    fourierSingle.initZeros(fourier);
+    weightsSingle.initZeros(weights);
+    for (int k=0; k<2; k++)
+    {
+        const std::vector<double> &pos = *allPositions[k];
+        int repetitions = 3000000/pos.size();
+        struct timeval t0, t1, t2, t3;
+        gettimeofday(&t0, NULL);
+        for (int r=0; r<repetitions; r++)
+            for (size_t n=0; n<pos.size(); n+=3)
+                referenceSplat(fourier, weights, NULL, pos[n], pos[n+1], pos[n+2], 1, 1, 1, 1);
+        gettimeofday(&t1, NULL);
+        for (int r=0; r<repetitions; r++)
+            for (size_t n=0; n<pos.size(); n+=3)
+                gridder.splat(MULTIDIM_ARRAY(fourier), MULTIDIM_ARRAY(weights),
+                              pos[n], pos[n+1], pos[n+2], 1, 1, 1, 1);
+        gettimeofday(&t2, NULL);
+        for (int r=0; r<repetitions; r++)
+            for (size_t n=0; n<pos.size(); n+=3)
+                gridderSingle.splat(MULTIDIM_ARRAY(fourierSingle), MULTIDIM_ARRAY(weightsSingle),
+                                    pos[n], pos[n+1], pos[n+2], 1.f, 1.f, 1.f, 1.f);
+        gettimeofday(&t3, NULL);
+        double tRef = elapsed(t0, t1), tDouble = elapsed(t1, t2), tSingle = elapsed(t2, t3);
+        std::cout << names[k] << std::endl
+                  << "  Voxel by voxel gridding: " << tRef << " secs." << std::endl
+                  << "  Kernel, double:          " << tDouble << " secs. (x" << tRef/tDouble << ")" << std::endl
+                  << "  Kernel, single:          " << tSingle << " secs. (x" << tRef/tSingle << ")" << std::endl;
+    }
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
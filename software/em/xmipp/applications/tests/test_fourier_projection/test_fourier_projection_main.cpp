@@ -0,0 +1,103 @@
+#include <data/xmipp_funcs.h>
+#include <data/multidim_array.h>
+#include <data/xmipp_fft.h>
+#include <reconstruction/fourier_projection.h>
+#include <iostream>
+#include <gtest/gtest.h>
+// MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
+
+class FourierProjectionTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        volSize = 32;
+        init_random_generator(13);
+        V.resizeNoCopy(volSize, volSize, volSize);
+        V.initRandom(0, 1);
+        V.setXmippOrigin();
+
+        double angles[][3] = {{0,0,0}, {10,20,30}, {-45,95,170}, {123.4,56.7,-89.1}, {200,140,3}, {90,90,90}};
+        for (int n=0; n<6; n++)
+        {
+            rot.push_back(angles[n][0]);
+            tilt.push_back(angles[n][1]);
+            psi.push_back(angles[n][2]);
+        }
+    }
+
+    int volSize;
+    MultidimArray<double> V;
+    std::vector<double> rot, tilt, psi;
+};
+
+// The cubic kernel must give the same values as interpolatedElementBSpline3D
+TEST_F( FourierProjectionTest, bsplineInterpolation)
+{
+    MultidimArray<double> Vcopy(V);
+    FourierProjector projector(Vcopy, 2, 0.4, BSPLINE3);
+    MultidimArray<double> coefsRe, coefsIm;
+    Complex2RealImag(projector.VfourierCoefs, coefsRe, coefsIm);
+    STARTINGX(coefsRe) = STARTINGX(coefsIm) = STARTINGX(projector.VfourierCoefs);
+    STARTINGY(coefsRe) = STARTINGY(coefsIm) = STARTINGY(projector.VfourierCoefs);
+    STARTINGZ(coefsRe) = STARTINGZ(coefsIm) = STARTINGZ(projector.VfourierCoefs);
+
+    Matrix2D<double> E;
+    MultidimArray< std::complex<double> > projFourier(projector.projectionFourier);
+    for (size_t n=0; n<rot.size(); n++)
+    {
+        Euler_angles2matrix(rot[n], tilt[n], psi[n], E);
+        projector.projectToFourier(E, projFourier);
+        double freqx, freqy;
+        FOR_ALL_ELEMENTS_IN_ARRAY2D(projFourier)
+        {
+            FFT_IDX2DIGFREQ(i, volSize, freqy);
+            FFT_IDX2DIGFREQ(j, volSize, freqx);
+            std::complex<double> expected = 0;
+            if (freqx*freqx+freqy*freqy <= 0.4*0.4)
+            {
+                double x = (MAT_ELEM(E,0,0)*freqx+MAT_ELEM(E,1,0)*freqy)*projector.volumePaddedSize;
+                double y = (MAT_ELEM(E,0,1)*freqx+MAT_ELEM(E,1,1)*freqy)*projector.volumePaddedSize;
+                double z = (MAT_ELEM(E,0,2)*freqx+MAT_ELEM(E,1,2)*freqy)*projector.volumePaddedSize;
+                std::complex<double> coef(coefsRe.interpolatedElementBSpline3D(x, y, z),
+                                          coefsIm.interpolatedElementBSpline3D(x, y, z));
+                std::complex<double> shift(A2D_ELEM(projector.phaseShiftImgA, i, j),
+                                           A2D_ELEM(projector.phaseShiftImgB, i, j));
+                expected = coef*shift;
+            }
+            ASSERT_NEAR(A2D_ELEM(projFourier, i, j).real(), expected.real(), 1e-9);
+            ASSERT_NEAR(A2D_ELEM(projFourier, i, j).imag(), expected.imag(), 1e-9);
+        }
+    }
+}
+
+// The projections of a batch must be the same as the ones made one by one
+TEST_F( FourierProjectionTest, batch)
+{
+    int degrees[] = {NEAREST, LINEAR, BSPLINE3};
+    for (int d=0; d<3; d++)
+    {
+        MultidimArray<double> Vcopy(V);
+        FourierProjector projector(Vcopy, 2, 0.4, degrees[d]);
+        MultidimArray<double> stack, stackThreads, P;
+        projector.project(rot, tilt, psi, stack);
+        projector.project(rot, tilt, psi, stackThreads, 3);
+        ASSERT_EQ(NSIZE(stack), rot.size());
+        for (size_t n=0; n<rot.size(); n++)
+        {
+            projector.project(rot[n], tilt[n], psi[n]);
+            P.aliasImageInStack(stack, n);
+            P.setXmippOrigin();
+            ASSERT_TRUE(P.equal(projector.projection(), 1e-12));
+            P.aliasImageInStack(stackThreads, n);
+            P.setXmippOrigin();
+            ASSERT_TRUE(P.equal(projector.projection(), 1e-12));
+        }
+    }
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
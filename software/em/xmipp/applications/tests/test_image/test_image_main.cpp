@@ -5,6 +5,7 @@
 #include <iostream>
 #include <gtest/gtest.h>
 #include <data/metadata.h>
+#include <data/xmipp_program.h>
 // MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
 // This test is named "Size", and belongs to the "MetadataTest"
 // test case.
@@ -187,6 +188,83 @@ TEST_F( ImageTest, writeIMAGICimage)
     XMIPP_CATCH
 }
 
+TEST_F( ImageTest, readStackSlices)
+{
+    XMIPP_TRY
+    FileName auxFn;
+    auxFn.initUniqueName("/tmp/temp_stk_XXXXXX");
+    auxFn.deleteFile();
+    auxFn = auxFn + ".mrcs";
+    Image<double> auxImage(4,4);
+    for (size_t n = FIRST_IMAGE; n <= 5; ++n)
+    {
+        auxImage().initConstant(n);
+        auxImage.write(auxFn, n, true, WRITE_APPEND);
+    }
+
+    // Consecutive and repeated reads of the same stack
+    Image<double> slice;
+    for (int k = 0; k < 2; ++k)
+        for (size_t n = FIRST_IMAGE; n <= 5; ++n)
+        {
+            slice.read(formatString("%lu@%s", n, auxFn.c_str()));
+            EXPECT_DOUBLE_EQ((double)n, slice(0,0));
+        }
+
+    // Images replaced in the stack
+    auxImage().initConstant(30.);
+    auxImage.write(auxFn, 3, true, WRITE_REPLACE);
+    slice.read(formatString("3@%s", auxFn.c_str()));
+    EXPECT_DOUBLE_EQ(30., slice(0,0));
+
+    // Stack written again
+    auxFn.deleteFile();
+    for (size_t n = FIRST_IMAGE; n <= 3; ++n)
+    {
+        auxImage().initConstant(10. * n);
+        auxImage.write(auxFn, n, true, WRITE_APPEND);
+    }
+    slice.read(formatString("2@%s", auxFn.c_str()));
+    EXPECT_DOUBLE_EQ(20., slice(0,0));
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
+TEST_F( ImageTest, prefetchStack)
+{
+    XMIPP_TRY
+    FileName auxFn;
+    auxFn.initUniqueName("/tmp/temp_stk_XXXXXX");
+    auxFn.deleteFile();
+    auxFn = auxFn + ".mrcs";
+    Image<double> auxImage(4,4);
+    MetaData md;
+    for (size_t n = FIRST_IMAGE; n <= 20; ++n)
+    {
+        auxImage().initConstant(n);
+        auxImage.write(auxFn, n, true, WRITE_APPEND);
+        md.setValue(MDL_IMAGE, formatString("%lu@%s", n, auxFn.c_str()), md.addObject());
+    }
+
+    // The prefetcher is destroyed while its thread is reading the stack
+    Image<double> slice;
+    for (int k = 0; k < 10; ++k)
+    {
+        ImagePrefetcher * prefetcher = new ImagePrefetcher(md, MDL_IMAGE, 4);
+        for (size_t n = FIRST_IMAGE; n <= 10; ++n)
+        {
+            prefetcher->advance(n - FIRST_IMAGE);
+            slice.read(formatString("%lu@%s", n, auxFn.c_str()));
+            EXPECT_DOUBLE_EQ((double)n, slice(0,0));
+        }
+        delete prefetcher;
+    }
+    slice.read(formatString("20@%s", auxFn.c_str()));
+    EXPECT_DOUBLE_EQ(20., slice(0,0));
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
 TEST_F( ImageTest, mirrorY)
 {
     XMIPP_TRY
@@ -280,6 +358,65 @@ TEST_F( ImageTest, writeMRCVOLstack)
     XMIPP_CATCH
 }
 
+TEST_F( ImageTest, writeHDF5stack)
+{
+    XMIPP_TRY
+    FileName auxFn;
+    auxFn.initUniqueName("/tmp/temp_h5stk_XXXXXX");
+    auxFn.deleteFile();
+    auxFn = auxFn + ".h5";
+    myStack.write(auxFn);
+    Image<double> auxStack;
+    auxStack.read(auxFn);
+    EXPECT_EQ(myStack,auxStack);
+
+    // Single images of the stack
+    ArrayDim aDim;
+    myStack.getDimensions(aDim);
+    Image<double> slice, mySlice(aDim.xdim, aDim.ydim);
+    for (size_t n = FIRST_IMAGE; n <= aDim.ndim; ++n)
+    {
+        slice.read(formatString("%lu@%s", n, auxFn.c_str()));
+        myStack().getImage(n - 1, mySlice());
+        EXPECT_EQ(mySlice(), slice());
+    }
+
+    // Replaced and appended images
+    Image<double> auxImage(aDim.xdim, aDim.ydim);
+    auxImage().initConstant(3.);
+    auxImage.write(auxFn, 2, true, WRITE_REPLACE);
+    auxImage().initConstant(5.);
+    auxImage.write(auxFn, ALL_IMAGES, true, WRITE_APPEND);
+    auxStack.read(auxFn, HEADER);
+    EXPECT_EQ(aDim.ndim + 1, NSIZE(auxStack()));
+    slice.read(formatString("2@%s", auxFn.c_str()));
+    EXPECT_DOUBLE_EQ(3., slice(0,0));
+    slice.read(formatString("%lu@%s", aDim.ndim + 1, auxFn.c_str()));
+    EXPECT_DOUBLE_EQ(5., slice(0,0));
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
+TEST_F( ImageTest, writeHDF5VOLstack)
+{
+    XMIPP_TRY
+    FileName auxFn;
+    auxFn.initUniqueName("/tmp/temp_h5volstk_XXXXXX");
+    auxFn.deleteFile();
+    auxFn = auxFn + ".h5";
+    myVolStack.write(auxFn);
+    Image<double> auxStack;
+    auxStack.read(auxFn);
+    EXPECT_EQ(myVolStack,auxStack);
+    ArrayDim auxStackArrayDim;
+    ArrayDim StackArrayDim;
+    myVolStack.getDimensions(StackArrayDim);
+    auxStack.getDimensions(auxStackArrayDim);
+    EXPECT_TRUE(StackArrayDim==auxStackArrayDim);
+    auxFn.deleteFile();
+    XMIPP_CATCH
+}
+
 TEST_F( ImageTest, writeTIFimage)
 {
     XMIPP_TRY
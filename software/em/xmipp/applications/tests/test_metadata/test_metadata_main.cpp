@@ -171,6 +171,92 @@ TEST_F( MetadataTest, AddRows)
 
     // Check result.
     EXPECT_EQ(md, mDsource);
+
+    MetaData md2;
+    std::vector<MDRow> rows(row, row + N_ROWS_TEST);
+    md2.addRows(rows);
+    EXPECT_EQ(md2, mDsource);
+
+    // Rows with different labels
+    MDRow row2;
+    row2.setValue(MDL_X, 5.);
+    row2.setValue(MDL_IMAGE, (String)"image.stk");
+    rows.push_back(row2);
+    rows.push_back(row[0]);
+    MetaData md3, md4;
+    md3.addRows(rows);
+    for (size_t n = 0; n < rows.size(); ++n)
+        md4.addRow(rows[n]);
+    EXPECT_EQ(md4, md3);
+}
+
+TEST_F( MetadataTest, SetColumnValues)
+{
+    std::vector<double> x, y;
+    x.push_back(1.);
+    x.push_back(3.);
+    y.push_back(2.);
+    y.push_back(4.);
+    MetaData md;
+    md.setColumnValues(MDL_X, x);
+    md.setColumnValues(MDL_Y, y);
+    EXPECT_EQ(md, mDsource);
+
+    std::vector<double> x2;
+    md.setColumnValues(MDL_X, y);
+    md.getColumnValues(MDL_X, x2);
+    EXPECT_EQ(y, x2);
+    x.push_back(5.);
+    EXPECT_THROW(md.setColumnValues(MDL_X, x), XmippError);
+}
+
+TEST_F( MetadataTest, GetColumnValues)
+{
+    MetaData md;
+    MDRow row;
+    for (int i = 0; i < 5; ++i)
+    {
+        row.setValue(MDL_X, i * 1.5);
+        row.setValue(MDL_REF, 10 - i);
+        row.setValue(MDL_ORDER, (size_t)(2 * i));
+        row.setValue(MDL_IMAGE, formatString("%06d@images.stk", i + 1));
+        md.addRow(row);
+    }
+    md.removeObjects(MDValueEQ(MDL_REF, 8));
+
+    std::vector<double> x;
+    std::vector<int> ref;
+    std::vector<size_t> order;
+    std::vector<String> image;
+    md.getColumnValues(MDL_X, x);
+    md.getColumnValues(MDL_REF, ref);
+    md.getColumnValues(MDL_ORDER, order);
+    md.getColumnValues(MDL_IMAGE, image);
+    ASSERT_EQ((size_t)4, x.size());
+    ASSERT_EQ((size_t)4, image.size());
+    size_t n = 0;
+    FOR_ALL_OBJECTS_IN_METADATA(md)
+    {
+        double xi;
+        int refi;
+        size_t orderi;
+        String imagei;
+        md.getValue(MDL_X, xi, __iter.objId);
+        md.getValue(MDL_REF, refi, __iter.objId);
+        md.getValue(MDL_ORDER, orderi, __iter.objId);
+        md.getValue(MDL_IMAGE, imagei, __iter.objId);
+        EXPECT_EQ(xi, x[n]);
+        EXPECT_EQ(refi, ref[n]);
+        EXPECT_EQ(orderi, order[n]);
+        EXPECT_EQ(imagei, image[n]);
+        ++n;
+    }
+
+    // Missing labels give default values, wrong types are rejected
+    std::vector<double> y;
+    md.getColumnValues(MDL_Y, y);
+    EXPECT_EQ(std::vector<double>(4, 0.), y);
+    EXPECT_THROW(md.getColumnValues(MDL_REF, x), XmippError);
 }
 
 TEST_F( MetadataTest, AddRowsPerformance)
@@ -245,9 +331,17 @@ TEST_F( MetadataTest, AddRowsPerformance)
     s3 = t.toc("Time by set:", false);
     printf("    Speed up from original: %f\n", ((float) s1 / (float) s3));
     printf("    Speed up from row: %f\n", ((float) s2 / (float) s3));
+
+    MetaData md4;
+    std::vector<MDRow> rows(N_ROWS_PERFORMANCE_TEST, row);
+    t.tic();
+    md4.addRows(rows);
+    size_t s4 = t.toc("Time by addRows:", false);
+    printf("    Speed up from original: %f\n", ((float) s1 / (float) s4));
     // Check result.
     EXPECT_EQ(md, md2);
     EXPECT_EQ(md2, md3);
+    EXPECT_EQ(md3, md4);
 }
 
 TEST_F( MetadataTest, addLabelAlias)
@@ -413,6 +507,39 @@ TEST_F( MetadataTest, Copy)
     EXPECT_EQ(mDsource,auxMetadata);
 }
 
+TEST_F( MetadataTest, BinaryBlock)
+{
+    MetaData md, auxMetadata;
+    std::vector<double> v(3);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        v[i] = 0.5 * i;
+        size_t id = md.addObject();
+        md.setValue(MDL_IMAGE, formatString("%06lu@images.stk", i + 1), id);
+        md.setValue(MDL_ANGLE_ROT, 10. * i, id);
+        md.setValue(MDL_ENABLED, (int)i - 1, id);
+        md.setValue(MDL_ITEM_ID, i + 100, id);
+        md.setValue(MDL_FLIP, i % 2 == 0, id);
+        md.setValue(MDL_CLASSIFICATION_DATA, v, id);
+    }
+    std::vector<char> block;
+    md.writeBinaryBlock(block);
+    auxMetadata.addBinaryBlock(&block[0], block.size());
+    EXPECT_EQ(md, auxMetadata);
+
+    //Rows are added after the existing ones
+    auxMetadata = mDsource;
+    mDanotherSource.writeBinaryBlock(block);
+    auxMetadata.addBinaryBlock(&block[0], block.size());
+    EXPECT_EQ(mDunion, auxMetadata);
+
+    //Empty metadata
+    MetaData empty;
+    empty.writeBinaryBlock(block);
+    auxMetadata.addBinaryBlock(&block[0], block.size());
+    EXPECT_EQ(mDunion, auxMetadata);
+}
+
 TEST_F( MetadataTest, MDInfo)
 {
     //char sfnStar[64] = "";
@@ -1309,6 +1436,63 @@ TEST_F( MetadataTest, ReadEmptyBlocksII)
     unlink(sfn);
 }
 
+TEST_F( MetadataTest, ReadStarValues)
+{
+    XMIPP_TRY
+    char sfn[64] = "";
+    strncpy(sfn, "/tmp/testReadStarValues_XXXXXX.xmd", sizeof sfn);
+    if (mkstemps(sfn,4)==-1)
+        REPORT_ERROR(ERR_IO_NOTOPEN,"Cannot create temporary STAR file");
+    std::ofstream fh(sfn);
+    fh << "# XMIPP_STAR_1 *\ndata_noname\nloop_\n_image\n_x\n_ref\n_order_\n_enabled\n_micrograph\n"
+    << " img1.stk 1.5e3 3 7 1 mic1\n"
+    << "# comment\n\n"
+    << "img2.stk -0.25 3.0 8 0 'two  words' \n"
+    << "  img3.stk .5 -2 9 1 \"quoted\"\n"
+    << "img4.stk 5. 4 10 1 mic4\n"
+    << "img5.stk 0.1 5 11 1 mic5\n"
+    << "img6.stk 1.23456789012345678901 6 12 1 mic6\n"
+    << "img7.stk -1E-5 7 13 1 mic7\n";
+    fh.close();
+
+    MetaData md(sfn);
+    EXPECT_EQ((size_t)7, md.size());
+    double x[7];
+    int ref[7];
+    size_t order[7];
+    int enabled[7];
+    String image[7], micrograph[7];
+    size_t n = 0;
+    FOR_ALL_OBJECTS_IN_METADATA(md)
+    {
+        md.getValue(MDL_IMAGE, image[n], __iter.objId);
+        md.getValue(MDL_X, x[n], __iter.objId);
+        md.getValue(MDL_REF, ref[n], __iter.objId);
+        md.getValue(MDL_ORDER, order[n], __iter.objId);
+        md.getValue(MDL_ENABLED, enabled[n], __iter.objId);
+        md.getValue(MDL_MICROGRAPH, micrograph[n], __iter.objId);
+        ++n;
+    }
+    EXPECT_EQ("img1.stk", image[0]);
+    EXPECT_EQ("img3.stk", image[2]);
+    EXPECT_EQ(1500., x[0]);
+    EXPECT_EQ(-0.25, x[1]);
+    EXPECT_EQ(0.5, x[2]);
+    EXPECT_EQ(5., x[3]);
+    EXPECT_EQ(0.1, x[4]);
+    EXPECT_EQ(strtod("1.23456789012345678901", NULL), x[5]);
+    EXPECT_EQ(-1e-5, x[6]);
+    EXPECT_EQ(3, ref[1]);
+    EXPECT_EQ(-2, ref[2]);
+    EXPECT_EQ((size_t)13, order[6]);
+    EXPECT_EQ(0, enabled[1]);
+    EXPECT_EQ("mic1", micrograph[0]);
+    EXPECT_EQ("two words", micrograph[1]);
+    EXPECT_EQ("quoted", micrograph[2]);
+    unlink(sfn);
+    XMIPP_CATCH
+}
+
 TEST_F( MetadataTest, ReadWrite)
 {
     //temp file name
@@ -1324,6 +1508,87 @@ TEST_F( MetadataTest, ReadWrite)
     unlink(sfn);
 }
 
+TEST_F( MetadataTest, ReadWriteBinary)
+{
+    XMIPP_TRY
+    char sfn[64] = "";
+    strncpy(sfn, "/tmp/testWriteBinary_XXXXXX.xmdb", sizeof sfn);
+    if (mkstemps(sfn,5)==-1)
+        REPORT_ERROR(ERR_IO_NOTOPEN,"Cannot create temporary file");
+    FileName fn(sfn);
+
+    MetaData md;
+    std::vector<double> v;
+    MDRow row;
+    for (int i = 0; i < 10; ++i)
+    {
+        row.setValue(MDL_X, i * 0.5);
+        row.setValue(MDL_REF, -i);
+        row.setValue(MDL_ORDER, (size_t)(i + 100));
+        row.setValue(MDL_ENABLED, i % 2);
+        row.setValue(MDL_MICROGRAPH, (String)((i < 5) ? "mic1" : "mic2"));
+        row.setValue(MDL_IMAGE, formatString("%06d@images.stk", i + 1));
+        v.push_back(i);
+        row.setValue(MDL_CLASSIFICATION_DATA, v);
+        md.addRow(row);
+    }
+    md.setComment("binary comment");
+    md.write((String)"first@" + sfn);
+
+    MetaData md2;
+    md2.read((String)"first@" + sfn);
+    EXPECT_EQ(md, md2);
+    EXPECT_EQ("binary comment", md2.getComment());
+
+    // Only the requested columns are loaded
+    std::vector<MDLabel> labels;
+    labels.push_back(MDL_IMAGE);
+    labels.push_back(MDL_X);
+    md2.read((String)"first@" + sfn, &labels);
+    EXPECT_EQ((size_t)10, md2.size());
+    EXPECT_FALSE(md2.containsLabel(MDL_REF));
+    MetaData md3(md);
+    md3.keepLabels(labels);
+    EXPECT_EQ(md3, md2);
+
+    // Second block appended to the file
+    md3.write((String)"second@" + sfn, MD_APPEND);
+    StringVector blocks;
+    getBlocksInMetaDataFile(fn, blocks);
+    ASSERT_EQ((size_t)2, blocks.size());
+    EXPECT_EQ("first", blocks[0]);
+    EXPECT_EQ("second", blocks[1]);
+    EXPECT_TRUE(existsBlockInMetaDataFile(fn, "second"));
+    md2.read((String)"second@" + sfn);
+    EXPECT_EQ(md3, md2);
+    md2.read((String)"first@" + sfn);
+    EXPECT_EQ(md, md2);
+
+    // A block written again replaces the old one, the others are kept
+    MetaData md4(md);
+    md4.fillConstant(MDL_Y, "3");
+    md4.setComment("second version");
+    md4.write((String)"first@" + sfn, MD_APPEND);
+    blocks.clear();
+    getBlocksInMetaDataFile(fn, blocks);
+    ASSERT_EQ((size_t)2, blocks.size());
+    md2.read((String)"first@" + sfn);
+    EXPECT_EQ(md4, md2);
+    EXPECT_EQ("second version", md2.getComment());
+    md2.read((String)"second@" + sfn);
+    EXPECT_EQ(md3, md2);
+
+    // A block without rows keeps its string columns
+    MetaData empty;
+    empty.addLabel(MDL_MICROGRAPH);
+    empty.write((String)"empty@" + sfn, MD_APPEND);
+    md2.read((String)"empty@" + sfn);
+    EXPECT_EQ((size_t)0, md2.size());
+    EXPECT_TRUE(md2.containsLabel(MDL_MICROGRAPH));
+    unlink(sfn);
+    XMIPP_CATCH
+}
+
 TEST_F( MetadataTest, WriteIntermediateBlock)
 {
     //read metadata block between another two
@@ -1537,6 +1802,82 @@ TEST_F( MetadataTest, setGetValue)
     std::cerr << "TEST COMMENT: you should get the ERROR: Mismatch Label (order_) and value type(INT)" <<std::endl;
     EXPECT_THROW(auxMetadata.getValue(MDL_ORDER, i, id), XmippError);
 }
+TEST_F( MetadataTest, ColumnCache)
+{
+    XMIPP_TRY
+    // Enough rows and reads for the columns to be loaded in the cache
+    MetaData md;
+    size_t n = 200;
+    std::vector<size_t> ids;
+    std::vector<double> v(2);
+    for (size_t i = 0; i < n; ++i)
+    {
+        id = md.addObject();
+        ids.push_back(id);
+        md.setValue(MDL_X, (double)i, id);
+        md.setValue(MDL_ORDER, i, id);
+        md.setValue(MDL_IMAGE, formatString("%06lu@images.stk", i), id);
+        v[0] = i;
+        v[1] = -(double)i;
+        md.setValue(MDL_CLASSIFICATION_DATA, v, id);
+    }
+    double x;
+    size_t order;
+    String image;
+    for (int pass = 0; pass < 2; ++pass)
+        for (size_t i = 0; i < n; ++i)
+        {
+            md.getValue(MDL_X, x, ids[i]);
+            md.getValue(MDL_ORDER, order, ids[i]);
+            md.getValue(MDL_IMAGE, image, ids[i]);
+            md.getValue(MDL_CLASSIFICATION_DATA, v, ids[i]);
+            EXPECT_DOUBLE_EQ((double)i, x);
+            EXPECT_EQ(i, order);
+            EXPECT_EQ(formatString("%06lu@images.stk", i), image);
+            EXPECT_DOUBLE_EQ(-(double)i, v[1]);
+        }
+    EXPECT_FALSE(md.getValue(MDL_X, x, ids[n - 1] + 1));
+
+    // Single cell updates
+    md.setValue(MDL_X, -1., ids[10]);
+    md.setValue(MDL_IMAGE, (String)"changed", ids[11]);
+    md.getValue(MDL_X, x, ids[10]);
+    md.getValue(MDL_IMAGE, image, ids[11]);
+    EXPECT_DOUBLE_EQ(-1., x);
+    EXPECT_EQ("changed", image);
+
+    // Changes made through SQL
+    md.operate((String)"X=2*X");
+    md.getValue(MDL_X, x, ids[20]);
+    EXPECT_DOUBLE_EQ(40., x);
+    md.removeObjects(MDValueLT(MDL_ORDER, (size_t)100));
+    EXPECT_FALSE(md.getValue(MDL_X, x, ids[20]));
+    id = md.addObject();
+    md.setValue(MDL_X, 1234., id);
+    md.getValue(MDL_X, x, id);
+    EXPECT_DOUBLE_EQ(1234., x);
+
+    // Cached values must be the same than those read from SQL
+    std::vector<String> rows;
+    MDRow row;
+    FOR_ALL_OBJECTS_IN_METADATA(md)
+    {
+        std::stringstream ss;
+        md.getRow(row, __iter.objId);
+        ss << row;
+        rows.push_back(ss.str());
+    }
+    md.setColumnCache(false);
+    size_t i = 0;
+    FOR_ALL_OBJECTS_IN_METADATA(md)
+    {
+        std::stringstream ss;
+        md.getRow(row, __iter.objId);
+        ss << row;
+        EXPECT_EQ(rows[i++], ss.str());
+    }
+    XMIPP_CATCH
+}
 TEST_F( MetadataTest, Comment)
 {
     XMIPP_TRY
@@ -0,0 +1,103 @@
+#include <reconstruction/movie_alignment_correlation.h>
+#include <data/transformations.h>
+#include <iostream>
+#include <gtest/gtest.h>
+// MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
+
+#define FRAMES 8
+
+class MovieAlignmentCorrelationTest : public ::testing::Test
+{
+protected:
+    //init metadatas
+    virtual void SetUp()
+    {
+        fnRoot.initUniqueName("/tmp/temp_movie_XXXXXX");
+        fnMovie = fnRoot + ".stk";
+        fnShifts = fnRoot + ".xmd";
+
+        // Frames of a blob drifting along the movie
+        init_random_generator(1234);
+        Image<double> I(128, 128);
+        I().setXmippOrigin();
+        FOR_ALL_ELEMENTS_IN_ARRAY2D(I())
+        A2D_ELEM(I(), i, j) = exp(-(i * i + j * j) / 50.0) +
+                              0.5 * exp(-((i - 20) * (i - 20) + (j + 15) * (j + 15)) / 30.0) +
+                              rnd_unif(0, 0.05);
+        Image<double> frame;
+        Matrix1D<double> shift(2);
+        for (int n = 0; n < FRAMES; ++n)
+        {
+            XX(shift) = 0.7 * n;
+            YY(shift) = -0.4 * n;
+            translate(BSPLINE3, frame(), I(), shift, WRAP);
+            frame.write(fnMovie, n + FIRST_IMAGE, true, WRITE_REPLACE);
+        }
+    }
+
+    virtual void TearDown()
+    {
+        fnMovie.deleteFile();
+        fnShifts.deleteFile();
+        fnRoot.deleteFile();
+    }
+
+    /* Align the movie with the given options and read the shifts */
+    void align(const String &options, MetaData &shifts)
+    {
+        ProgMovieAlignmentCorrelation prog;
+        prog.read(formatString("-i %s -o %s -v 0 %s", fnMovie.c_str(), fnShifts.c_str(), options.c_str()));
+        prog.run();
+        shifts.read(fnShifts);
+    }
+
+    /* Compare the shifts of all the frames */
+    void compare(const MetaData &shifts1, const MetaData &shifts2, double tolerance)
+    {
+        std::vector<double> x1, y1, x2, y2;
+        shifts1.getColumnValues(MDL_SHIFT_X, x1);
+        shifts1.getColumnValues(MDL_SHIFT_Y, y1);
+        shifts2.getColumnValues(MDL_SHIFT_X, x2);
+        shifts2.getColumnValues(MDL_SHIFT_Y, y2);
+        ASSERT_EQ((size_t)FRAMES, x1.size());
+        ASSERT_EQ(x1.size(), x2.size());
+        for (size_t n = 0; n < x1.size(); ++n)
+        {
+            EXPECT_NEAR(x1[n], x2[n], tolerance) << "frame " << n;
+            EXPECT_NEAR(y1[n], y2[n], tolerance) << "frame " << n;
+        }
+    }
+
+    FileName fnRoot, fnMovie, fnShifts;
+};
+
+TEST_F( MovieAlignmentCorrelationTest, threads)
+{
+    MetaData serial, threads;
+    align("", serial);
+    align("--thr 3", threads);
+    compare(serial, threads, 1e-9);
+}
+
+TEST_F( MovieAlignmentCorrelationTest, streaming)
+{
+    // All the frames fit in the limit but they are processed in chunks
+    MetaData serial, streaming;
+    align("", serial);
+    align("--thr 2 --memoryLimit 100", streaming);
+    compare(serial, streaming, 1e-9);
+}
+
+TEST_F( MovieAlignmentCorrelationTest, singlePrecision)
+{
+    MetaData serial, single;
+    align("", serial);
+    align("--single --thr 2", single);
+    compare(serial, single, 1e-3);
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
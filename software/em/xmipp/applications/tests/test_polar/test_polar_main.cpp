@@ -2,6 +2,9 @@
 #include <data/filters.h>
 #include <data/xmipp_fftw.h>
 #include <data/polar.h>
+#include <data/polar_reference_bank.h>
+#include <unistd.h>
+#include <stdint.h>
 #include <iostream>
 #include <gtest/gtest.h>
 // MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
@@ -39,6 +42,122 @@ TEST_F( PolarTest, computeAverageAndStddev)
     EXPECT_NEAR(stddev,0.49643800057938808,XMIPP_EQUAL_ACCURACY);
 }
 
+TEST_F( PolarTest, lowPassFourierRings)
+{
+    // Two blobs and their copy rotated 40 degrees
+    MultidimArray<double> I1(32,32), I2, Maux;
+    I1.setXmippOrigin();
+    FOR_ALL_ELEMENTS_IN_ARRAY2D(I1)
+    A2D_ELEM(I1,i,j) = exp(-((i-6)*(i-6)+j*j)/8.) + 0.5*exp(-(i*i+(j-8)*(j-8))/18.);
+    rotate(BSPLINE3,I2,I1,40,'Z',DONT_WRAP);
+
+    Polar<double> P1, P2;
+    Polar_fftw_plans plans;
+    Polar<std::complex<double> > fP1, fP2, fP1low, fP2low;
+    produceSplineCoefficients(BSPLINE3,Maux,I1);
+    P1.getPolarFromCartesianBSpline(Maux,1,14);
+    produceSplineCoefficients(BSPLINE3,Maux,I2);
+    P2.getPolarFromCartesianBSpline(Maux,1,14);
+    P1.calculateFftwPlans(plans);
+    fourierTransformRings(P1,fP1,plans,false);
+    fourierTransformRings(P2,fP2,plans,true);
+
+    // Correlation every 10 degrees with one of each two rings
+    lowPassFourierRings(fP1,fP1low,2,19);
+    lowPassFourierRings(fP2,fP2low,2,19);
+    EXPECT_EQ((fP1.getRingNo()+1)/2,fP1low.getRingNo());
+    EXPECT_EQ(19,fP1low.getSampleNoOuterRing());
+    EXPECT_DOUBLE_EQ(2*fP1.ring_radius[2],fP1low.ring_radius[1]);
+
+    RotationalCorrelationAux aux, auxLow;
+    MultidimArray<double> corr(P1.getSampleNoOuterRing()), corrLow(36), angles;
+    aux.local_transformer.setReal(corr);
+    aux.local_transformer.FourierTransform();
+    double psi = best_rotation(fP1,fP2,aux);
+    auxLow.local_transformer.setReal(corrLow);
+    auxLow.local_transformer.FourierTransform();
+    rotationalCorrelation(fP1low,fP2low,angles,auxLow);
+    int imax;
+    corrLow.maxIndex(imax);
+    double diff = fabs(realWRAP(A1D_ELEM(angles,imax)-psi,-180,180));
+    EXPECT_LE(diff,5.);
+}
+
+TEST_F( PolarTest, referenceBank)
+{
+    XMIPP_TRY
+    FileName fnBank;
+    fnBank.initUniqueName("/tmp/temp_bank_XXXXXX");
+    fnBank.deleteFile();
+    fnBank = fnBank + ".bank";
+
+    // References with the same rings and different values
+    size_t nRefs = 7;
+    MultidimArray<double> I(16,16), Maux;
+    Polar<double> P;
+    Polar_fftw_plans plans;
+    std::vector< Polar<std::complex<double> > > fP(nRefs);
+    std::vector< MultidimArray<double> > refs(nRefs);
+    for (size_t n = 0; n < nRefs; ++n)
+    {
+        I.initRandom(0, 1);
+        I.setXmippOrigin();
+        refs[n] = I;
+        produceSplineCoefficients(BSPLINE3,Maux,I);
+        P.getPolarFromCartesianBSpline(Maux,1,6);
+        if (n == 0)
+            P.calculateFftwPlans(plans);
+        fourierTransformRings(P,fP[n],plans,true);
+    }
+
+    PolarReferenceBank bank;
+    EXPECT_FALSE(bank.open(fnBank,"key"));
+    bank.create(fnBank,"key",nRefs,fP[0],16);
+    for (size_t n = nRefs; n-- > 0; )
+        bank.setReference(n,fP[n],n+0.5,&refs[n]);
+    bank.close();
+    EXPECT_FALSE(bank.open(fnBank,"other key"));
+    ASSERT_TRUE(bank.open(fnBank,"key",0));
+    EXPECT_EQ(nRefs,bank.size());
+    EXPECT_EQ((size_t)16,bank.getImageDim());
+
+    Polar<std::complex<double> > fPbank;
+    MultidimArray<double> Ibank;
+    double stddev;
+    for (size_t n = 0; n < nRefs; ++n)
+    {
+        size_t k = (3*n) % nRefs;
+        bank.getReference(k,fPbank,stddev,&Ibank);
+        EXPECT_DOUBLE_EQ(k+0.5,stddev);
+        EXPECT_EQ(refs[k],Ibank);
+        ASSERT_EQ(fP[k].getRingNo(),fPbank.getRingNo());
+        for (int i = 0; i < fPbank.getRingNo(); ++i)
+        {
+            EXPECT_DOUBLE_EQ(fP[k].ring_radius[i],fPbank.ring_radius[i]);
+            EXPECT_EQ(fP[k].rings[i],fPbank.rings[i]);
+        }
+    }
+    bank.close();
+
+    // Records larger than the rings in the header, with a consistent file size
+    FILE *fh = fopen(fnBank.c_str(), "r+b");
+    ASSERT_TRUE(fh != NULL);
+    uint64_t recordSize;
+    size_t recordSizeOffset = 8 + 6 * sizeof(uint64_t);
+    fseek(fh, recordSizeOffset, SEEK_SET);
+    ASSERT_EQ((size_t)1, fread(&recordSize, sizeof(recordSize), 1, fh));
+    fseek(fh, 0, SEEK_END);
+    long fileSize = ftell(fh);
+    recordSize += 8;
+    fseek(fh, recordSizeOffset, SEEK_SET);
+    fwrite(&recordSize, sizeof(recordSize), 1, fh);
+    fclose(fh);
+    ASSERT_EQ(0, truncate(fnBank.c_str(), fileSize + nRefs * 8));
+    EXPECT_THROW(bank.open(fnBank,"key"), XmippError);
+    fnBank.deleteFile();
+    XMIPP_CATCH
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
@@ -194,6 +194,59 @@ TEST_F(SamplingTest, computeNeighborsC1)
     XMIPP_CATCH
 }
 
+TEST_F(SamplingTest, directionKDTree)
+{
+    XMIPP_TRY
+    // Sampling points plus some repeated ones, so that there are ties
+    std::vector<Matrix1D<double> > directions=mysampling.sampling_points_vector;
+    for (size_t i=0; i<directions.size(); i+=7)
+        directions.push_back(directions[i]);
+    DirectionKDTree tree;
+    tree.build(directions);
+    EXPECT_EQ(directions.size(), tree.size());
+
+    double cosRadius=cos(DEG2RAD(5.));
+    std::vector<size_t> inside, expectedInside;
+    for (size_t n=0; n<mysampling.exp_data_projection_direction_by_L_R.size(); ++n)
+    {
+        const Matrix1D<double> &u=mysampling.exp_data_projection_direction_by_L_R[n];
+        int expected=-1;
+        double expectedDot=-2;
+        expectedInside.clear();
+        for (size_t i=0; i<directions.size(); ++i)
+        {
+            double dot=dotProduct(directions[i],u);
+            if (dot>expectedDot)
+            {
+                expectedDot=dot;
+                expected=i;
+            }
+            if (dot>cosRadius)
+                expectedInside.push_back(i);
+        }
+        double dot;
+        EXPECT_EQ(expected, tree.findClosest(u,dot));
+        EXPECT_EQ(expectedDot, dot);
+        tree.findInsideCone(u,cosRadius,inside);
+        EXPECT_EQ(expectedInside, inside);
+    }
+    XMIPP_CATCH
+}
+
+TEST_F(SamplingTest, computeNeighborsThreads)
+{
+    XMIPP_TRY
+    Sampling s2=mysampling;
+    mysampling.computeNeighbors();
+    s2.numberOfThreads=3;
+    s2.computeNeighbors();
+    EXPECT_EQ(mysampling.my_neighbors, s2.my_neighbors);
+    mysampling.computeNeighbors(true);
+    s2.computeNeighbors(true);
+    EXPECT_EQ(mysampling.my_neighbors, s2.my_neighbors);
+    XMIPP_CATCH
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,180 @@
+#include <data/xmipp_threads.h>
+#include <data/xmipp_error.h>
+#include <unistd.h>
+#include <iostream>
+#include <gtest/gtest.h>
+// MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
+
+#define TASKS 1000
+#define THREADS 4
+
+/* Tasks processed by the threads, each one should be processed once */
+struct TaskCounter
+{
+    ParallelTaskDistributor * distributor;
+    WorkStealingTaskDistributor * stealing;
+    std::vector<int> count;
+    std::vector<size_t> blockFirsts, blockSizes;
+    Mutex mutex;
+    bool identified;
+};
+
+void processTasks(TaskCounter &data, int worker)
+{
+    size_t first, last;
+    while (data.identified ? data.stealing->getTasks(worker, first, last) :
+           data.distributor->getTasks(first, last))
+    {
+        data.mutex.lock();
+        data.blockFirsts.push_back(first);
+        data.blockSizes.push_back(last - first + 1);
+        data.mutex.unlock();
+        for (size_t i = first; i <= last; ++i)
+        {
+            // Very different costs, the first tasks are the most expensive
+            if (i < TASKS / 10)
+                usleep(200);
+            data.mutex.lock();
+            ++data.count[i];
+            data.mutex.unlock();
+        }
+    }
+}
+
+void threadProcessTasks(ThreadArgument &thArg)
+{
+    processTasks(*((TaskCounter *) thArg.data), thArg.thread_id);
+}
+
+class ThreadsTest : public ::testing::Test
+{
+protected:
+    ThreadsTest(): thMgr(THREADS)
+    {}
+
+    virtual void SetUp()
+    {
+        data.count.assign(TASKS, 0);
+        data.identified = false;
+        data.stealing = NULL;
+    }
+
+    void run(ParallelTaskDistributor * distributor)
+    {
+        data.distributor = distributor;
+        data.count.assign(TASKS, 0);
+        data.blockFirsts.clear();
+        data.blockSizes.clear();
+        thMgr.run(threadProcessTasks, &data);
+    }
+
+    void checkAllTasksOnce()
+    {
+        for (size_t i = 0; i < TASKS; ++i)
+            ASSERT_EQ(1, data.count[i]) << "task " << i;
+    }
+
+    TaskCounter data;
+    ThreadManager thMgr;
+};
+
+TEST_F( ThreadsTest, fixedBlocks)
+{
+    ThreadTaskDistributor td(TASKS, 7);
+    run(&td);
+    checkAllTasksOnce();
+    for (size_t i = 0; i < data.blockSizes.size(); ++i)
+        EXPECT_LE(data.blockSizes[i], (size_t)7);
+    td.reset();
+    run(&td);
+    checkAllTasksOnce();
+}
+
+TEST_F( ThreadsTest, guided)
+{
+    ThreadTaskDistributor td(TASKS, 5);
+    td.setGuided(THREADS);
+    size_t first, last, previous = TASKS;
+    size_t total = 0;
+    // The blocks shrink, but never below the block size
+    while (td.getTasks(first, last))
+    {
+        size_t n = last - first + 1;
+        EXPECT_EQ(total, first);
+        EXPECT_LE(n, previous);
+        if (first + 5 <= TASKS)
+        {
+            EXPECT_GE(n, (size_t)5);
+        }
+        previous = n;
+        total += n;
+    }
+    EXPECT_EQ((size_t)TASKS, total);
+    td.reset();
+    run(&td);
+    checkAllTasksOnce();
+}
+
+TEST_F( ThreadsTest, workStealing)
+{
+    WorkStealingTaskDistributor td(TASKS, 10, THREADS);
+    run(&td);
+    checkAllTasksOnce();
+    for (size_t i = 0; i < data.blockSizes.size(); ++i)
+        EXPECT_LE(data.blockSizes[i], (size_t)10);
+    td.clear();
+    run(&td);
+    checkAllTasksOnce();
+}
+
+TEST_F( ThreadsTest, workStealingIdentified)
+{
+    WorkStealingTaskDistributor td(TASKS, 10, THREADS);
+    data.stealing = &td;
+    data.identified = true;
+    run(&td);
+    checkAllTasksOnce();
+    // More workers than threads, the ranges of the others are stolen
+    WorkStealingTaskDistributor td2(TASKS, 3, 2 * THREADS);
+    data.stealing = &td2;
+    run(&td2);
+    checkAllTasksOnce();
+    // A single worker processes everything
+    WorkStealingTaskDistributor td3(TASKS, 16, 1);
+    data.stealing = &td3;
+    data.count.assign(TASKS, 0);
+    processTasks(data, 0);
+    checkAllTasksOnce();
+    size_t first, last;
+    EXPECT_FALSE(td3.getTasks(0, first, last));
+    EXPECT_THROW(td3.getTasks(1, first, last), XmippError);
+}
+
+TEST_F( ThreadsTest, workStealingClear)
+{
+    // The calling threads get the ranges in turns
+    WorkStealingTaskDistributor td(TASKS, 1, 2);
+    ThreadManager other(1);
+    data.distributor = &td;
+    size_t first, last;
+    ASSERT_TRUE(td.getTasks(first, last));
+    EXPECT_EQ((size_t)0, first);
+    ++data.count[first];
+    other.run(threadProcessTasks, &data);
+    checkAllTasksOnce();
+    EXPECT_EQ((size_t)TASKS / 2, data.blockFirsts[0]);
+
+    // After clear the ranges are assigned again from the first one
+    td.clear();
+    data.count.assign(TASKS, 0);
+    data.blockFirsts.clear();
+    other.run(threadProcessTasks, &data);
+    checkAllTasksOnce();
+    EXPECT_EQ((size_t)0, data.blockFirsts[0]);
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
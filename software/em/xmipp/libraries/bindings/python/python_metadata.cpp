@@ -272,6 +272,8 @@ PyMethodDef MetaData_methods[] =
           METH_VARARGS, "Get the value for column(label)" },
         { "getColumnValues", (PyCFunction) MetaData_getColumnValues,
           METH_VARARGS, "Get all values value from column(label)" },
+        { "getColumnValuesArray", (PyCFunction) MetaData_getColumnValuesArray,
+          METH_VARARGS, "Get all values from a numeric column(label) as a NumPy array" },
         { "setColumnValues", (PyCFunction) MetaData_setColumnValues,
           METH_VARARGS, "Set all values value from column(label)" },
         { "getActiveLabels",
@@ -957,7 +959,7 @@ MetaData_getValue(PyObject *obj, PyObject *args, PyObject *kwargs)
     return NULL;
 }
 
-/* getValue */
+/* getColumnValues */
 PyObject *
 MetaData_getColumnValues(PyObject *obj, PyObject *args, PyObject *kwargs)
 {
@@ -967,15 +969,54 @@ MetaData_getColumnValues(PyObject *obj, PyObject *args, PyObject *kwargs)
         try
         {
             MetaDataObject *self = (MetaDataObject*) obj;
+            MDLabel mdLabel = (MDLabel) label;
+            PyObject * list = NULL;
+            MDLabelType type = MDL::isValidLabel(mdLabel) ? MDL::labelType(mdLabel) : LABEL_NOTYPE;
 
-            std::vector<MDObject> v;
-            self->metadata->getColumnValues((MDLabel) label,v);
+            // Basic types are read without building a MDObject per value
+            if (type == LABEL_DOUBLE)
+            {
+                std::vector<double> v;
+                self->metadata->getColumnValues(mdLabel, v);
+                list = PyList_New(v.size());
+                for (size_t i = 0; i < v.size(); ++i)
+                    PyList_SetItem(list, i, PyFloat_FromDouble(v[i]));
+            }
+            else if (type == LABEL_INT)
+            {
+                std::vector<int> v;
+                self->metadata->getColumnValues(mdLabel, v);
+                list = PyList_New(v.size());
+                for (size_t i = 0; i < v.size(); ++i)
+                    PyList_SetItem(list, i, PyInt_FromLong(v[i]));
+            }
+            else if (type == LABEL_SIZET)
+            {
+                std::vector<size_t> v;
+                self->metadata->getColumnValues(mdLabel, v);
+                list = PyList_New(v.size());
+                for (size_t i = 0; i < v.size(); ++i)
+                    PyList_SetItem(list, i, PyLong_FromLong(v[i]));
+            }
+            else if (type == LABEL_STRING)
+            {
+                std::vector<String> v;
+                self->metadata->getColumnValues(mdLabel, v);
+                list = PyList_New(v.size());
+                for (size_t i = 0; i < v.size(); ++i)
+                    PyList_SetItem(list, i, PyString_FromString(v[i].c_str()));
+            }
+            else
+            {
+                std::vector<MDObject> v;
+                self->metadata->getColumnValues(mdLabel, v);
 
-            size_t size=v.size();
-            PyObject * list = PyList_New(size);
+                size_t size=v.size();
+                list = PyList_New(size);
 
-            for (size_t i = 0; i < size; ++i)
-                PyList_SetItem(list, i, getMDObjectValue(&(v[i])));
+                for (size_t i = 0; i < size; ++i)
+                    PyList_SetItem(list, i, getMDObjectValue(&(v[i])));
+            }
 
             return list;
         }
@@ -987,6 +1028,84 @@ MetaData_getColumnValues(PyObject *obj, PyObject *args, PyObject *kwargs)
     return NULL;
 }
 
+/** Just to statically call the function import_array
+ * required to work with NumPy arrays in this file
+ */
+class MetaDataNumpyStaticImport
+{
+public:
+    MetaDataNumpyStaticImport()
+    {
+        import_array();
+    }
+}
+;//class MetaDataNumpyStaticImport
+
+static MetaDataNumpyStaticImport _npyImport;
+
+/* Copy a vector into a new one-dimensional NumPy array */
+template<typename T>
+static PyObject * vectorToNumpy(const std::vector<T> &v, int npyType)
+{
+    npy_intp dims[1];
+    dims[0] = v.size();
+    PyArrayObject * arr = (PyArrayObject*) PyArray_SimpleNew(1, dims, npyType);
+    if (arr != NULL && !v.empty())
+        memcpy(PyArray_DATA(arr), &v[0], v.size() * sizeof(T));
+    return (PyObject*) arr;
+}
+
+/* getColumnValuesArray */
+PyObject *
+MetaData_getColumnValuesArray(PyObject *obj, PyObject *args, PyObject *kwargs)
+{
+    int label;
+    if (PyArg_ParseTuple(args, "i", &label))
+    {
+        try
+        {
+            MetaDataObject *self = (MetaDataObject*) obj;
+            MDLabel mdLabel = (MDLabel) label;
+            MDLabelType type = MDL::isValidLabel(mdLabel) ? MDL::labelType(mdLabel) : LABEL_NOTYPE;
+            switch (type)
+            {
+            case LABEL_DOUBLE:
+                {
+                    std::vector<double> v;
+                    self->metadata->getColumnValues(mdLabel, v);
+                    return vectorToNumpy(v, NPY_DOUBLE);
+                }
+            case LABEL_INT:
+                {
+                    std::vector<int> v;
+                    self->metadata->getColumnValues(mdLabel, v);
+                    return vectorToNumpy(v, NPY_INT);
+                }
+            case LABEL_SIZET:
+                {
+                    std::vector<size_t> v;
+                    self->metadata->getColumnValues(mdLabel, v);
+                    return vectorToNumpy(v, NPY_UINTP);
+                }
+            case LABEL_BOOL:
+                {
+                    std::vector<bool> v;
+                    self->metadata->getColumnValues(mdLabel, v);
+                    std::vector<npy_bool> b(v.begin(), v.end());
+                    return vectorToNumpy(b, NPY_BOOL);
+                }
+            default:
+                PyErr_SetString(PyXmippError, "getColumnValuesArray: only numeric labels are supported");
+            }
+        }
+        catch (XmippError &xe)
+        {
+            PyErr_SetString(PyXmippError, xe.msg.c_str());
+        }
+    }
+    return NULL;
+}
+
 /* setValue */
 PyObject *
 MetaData_setColumnValues(PyObject *obj, PyObject *args, PyObject *kwargs)
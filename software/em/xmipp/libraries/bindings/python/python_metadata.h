@@ -247,10 +247,14 @@ MetaData_removeLabel(PyObject *obj, PyObject *args, PyObject *kwargs);
 PyObject *
 MetaData_getValue(PyObject *obj, PyObject *args, PyObject *kwargs);
 
-/* getValue */
+/* getColumnValues */
 PyObject *
 MetaData_getColumnValues(PyObject *obj, PyObject *args, PyObject *kwargs);
 
+/* getColumnValuesArray */
+PyObject *
+MetaData_getColumnValuesArray(PyObject *obj, PyObject *args, PyObject *kwargs);
+
 /* setValue */
 PyObject *
 MetaData_setColumnValues(PyObject *obj, PyObject *args, PyObject *kwargs);
@@ -1162,7 +1162,8 @@ void covarianceMatrix(const MultidimArray<double> &I, Matrix2D<double> &C)
 }
 
 /* Best shift -------------------------------------------------------------- */
-double bestShift(MultidimArray<double> &Mcorr,
+template<typename T>
+double bestShift(MultidimArray<T> &Mcorr,
                double &shiftX, double &shiftY, const MultidimArray<int> *mask, int maxShift)
 {
     int imax, jmax, i_actual, j_actual;
@@ -1318,6 +1319,36 @@ double bestShift(const MultidimArray< std::complex<double> > &FFTI1,
 	return bestShift(Mcorr, shiftX, shiftY, mask, maxShift);
 }
 
+double bestShift(const MultidimArray<float> &I1, const MultidimArray<float> &I2,
+               double &shiftX, double &shiftY, CorrelationAuxFloat &aux,
+               const MultidimArray<int> *mask, int maxShift)
+{
+    I1.checkDimension(2);
+    I2.checkDimension(2);
+    aux.transformer1.FourierTransform((MultidimArray<float> &)I1, aux.FFT1, false);
+    return bestShift(aux.FFT1,I2,shiftX,shiftY,aux,mask,maxShift);
+}
+
+double bestShift(const MultidimArray< std::complex<float> > &FFTI1,
+                 const MultidimArray<float> &I2,
+                 double &shiftX, double &shiftY, CorrelationAuxFloat &aux,
+                 const MultidimArray<int> *mask, int maxShift)
+{
+    MultidimArray<float> Mcorr;
+    correlation_matrix(FFTI1, I2, Mcorr, aux);
+    return bestShift(Mcorr, shiftX, shiftY, mask, maxShift);
+}
+
+double bestShift(const MultidimArray< std::complex<float> > &FFTI1,
+                 const MultidimArray< std::complex<float> > &FFTI2,
+                 MultidimArray<float> &Mcorr,
+                 double &shiftX, double &shiftY, CorrelationAuxFloat &aux,
+                 const MultidimArray<int> *mask, int maxShift)
+{
+    correlation_matrix(FFTI1, FFTI2, Mcorr, aux);
+    return bestShift(Mcorr, shiftX, shiftY, mask, maxShift);
+}
+
 /* Best shift -------------------------------------------------------------- */
 void bestShift(const MultidimArray<double> &I1, const MultidimArray<double> &I2,
                double &shiftX, double &shiftY, double &shiftZ, CorrelationAux &aux,
@@ -503,6 +503,32 @@ double bestShift(const MultidimArray< std::complex<double> > &FFTI1,
                double &shiftX, double &shiftY, CorrelationAux &aux,
                const MultidimArray<int> *mask=NULL, int maxShift=-1);
 
+/** Translational search in single precision.
+ * Same as the double version with the correlation computed with single
+ * precision transforms. The shifts are the same up to the accuracy of the
+ * float transforms, with half the memory traffic.
+ */
+double bestShift(const MultidimArray<float> &I1, const MultidimArray<float> &I2,
+               double &shiftX, double &shiftY, CorrelationAuxFloat &aux,
+               const MultidimArray<int> *mask=NULL, int maxShift=-1);
+
+/** Translational search in single precision.
+ * Assumes that FFTI1 is already computed.
+ */
+double bestShift(const MultidimArray< std::complex<float> > &FFTI1,
+               const MultidimArray<float> &I2,
+               double &shiftX, double &shiftY, CorrelationAuxFloat &aux,
+               const MultidimArray<int> *mask=NULL, int maxShift=-1);
+
+/** Translational search in single precision.
+ * Assumes that FFTI1 and FFTI2 are already computed. Mcorr must already have the right size.
+ */
+double bestShift(const MultidimArray< std::complex<float> > &FFTI1,
+               const MultidimArray< std::complex<float> > &FFTI2,
+               MultidimArray<float> &Mcorr,
+               double &shiftX, double &shiftY, CorrelationAuxFloat &aux,
+               const MultidimArray<int> *mask=NULL, int maxShift=-1);
+
 /** Translational search (3D)
  * @ingroup Filters
  *
@@ -602,6 +628,18 @@ double alignImages(const MultidimArray< double >& Iref,
                    CorrelationAux &aux2,
                    RotationalCorrelationAux &aux3);
 
+/** Fast version of align two images.
+ * The transforms of Iref are presumed to be precomputed in IrefTransforms.
+ */
+double alignImages(const MultidimArray< double >& Iref,
+                   const AlignmentTransforms& IrefTransforms,
+                   MultidimArray< double >& I,
+                   Matrix2D< double >&M,
+                   bool wrap,
+                   AlignmentAux &aux,
+                   CorrelationAux &aux2,
+                   RotationalCorrelationAux &aux3);
+
 /** Auxiliary class for fast volume alignment */
 class VolumeAlignmentAux
 {
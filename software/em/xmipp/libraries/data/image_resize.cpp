@@ -26,7 +26,9 @@
 #include "image_resize.h"
 
 ProgImageResize::ProgImageResize()
-{}
+{
+    allow_threads = true;
+}
 
 ProgImageResize::~ProgImageResize()
 {}
@@ -184,6 +186,8 @@ void ProgImageResize::preProcess()
 
 void ProgImageResize::processImage(const FileName &fnImg, const FileName &fnImgOut, const MDRow &rowIn, MDRow &rowOut)
 {
+    // Work images are local, images can be processed by several threads
+    ImageGeneric img, imgOut;
     double aux;
     if (apply_geo)
     {
@@ -52,7 +52,6 @@ protected:
     bool            isVol, temporaryOutput;
     //Matrix2D<double> R, T, S, A, B;
     Matrix1D<double>   resizeFactor;
-    ImageGeneric img, imgOut;
 
     void defineParams();
     void readParams();
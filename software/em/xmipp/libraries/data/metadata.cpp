@@ -31,6 +31,8 @@
 #include "xmipp_image.h"
 #include "xmipp_program_sql.h"
 
+static void getBlocksInMetaDataFileBinary(const FileName &inFile, StringVector& blockList);
+
 // Get the blocks available
 void getBlocksInMetaDataFile(const FileName &inFile, StringVector& blockList)
 {
@@ -47,6 +49,10 @@ void getBlocksInMetaDataFile(const FileName &inFile, StringVector& blockList)
     {
         getBlocksInMetaDataFileDB(inFile,blockList);
     }
+    else if(extFile=="xmdb")
+    {
+        getBlocksInMetaDataFileBinary(inFile,blockList);
+    }
     else
     {    //map file
         int fd;
@@ -81,6 +87,13 @@ bool existsBlockInMetaDataFile(const FileName &inFile, const String& inBlock)
     if (!inFile.getBlockName().empty())
         return inBlock == inFile.getBlockName();
 
+    if (inFile.getExtension()=="xmdb")
+    {
+        StringVector blockList;
+        getBlocksInMetaDataFile(inFile, blockList);
+        return std::find(blockList.begin(), blockList.end(), inBlock) != blockList.end();
+    }
+
     MetaData MDaux(inFile);
     //map file
     int fd;
@@ -225,6 +238,21 @@ void MetaData::getColumnValues(const MDLabel label, std::vector<MDObject> &value
     }
 }
 
+#define GET_TYPED_COLUMN_VALUES(type, labelType) \
+void MetaData::getColumnValues(const MDLabel label, std::vector<type> &valuesOut) const\
+{\
+    MDObject(label).labelTypeCheck(labelType);\
+    if (!containsLabel(label))\
+        valuesOut.assign(size(), type());\
+    else if (!myMDSql->getColumnValues(label, valuesOut))\
+        REPORT_ERROR(ERR_MD_SQL, "getColumnValues: cannot read column " + MDL::label2Str(label));\
+}
+
+GET_TYPED_COLUMN_VALUES(double, LABEL_DOUBLE)
+GET_TYPED_COLUMN_VALUES(int, LABEL_INT)
+GET_TYPED_COLUMN_VALUES(size_t, LABEL_SIZET)
+GET_TYPED_COLUMN_VALUES(String, LABEL_STRING)
+
 void MetaData::setColumnValues(const std::vector<MDObject> &valuesIn)
 {
     bool addObjects=false;
@@ -232,18 +260,43 @@ void MetaData::setColumnValues(const std::vector<MDObject> &valuesIn)
         addObjects=true;
     if (valuesIn.size()!=size() && !addObjects)
         REPORT_ERROR(ERR_MD_OBJECTNUMBER,"Input vector must be of the same size as the metadata");
-    if (!addObjects)
+    size_t nmax=valuesIn.size();
+    if (nmax==0)
+        return;
+    MDLabel label=valuesIn[0].label;
+    for (size_t n=1; n<nmax; ++n)
+        if (valuesIn[n].label!=label)
+            REPORT_ERROR(ERR_MD_BADLABEL,"setColumnValues: all values must have the same label");
+    addLabel(label);
+
+    std::vector<MDLabel> labels(1, label);
+    std::vector<MDObject*> noValues;
+    if (addObjects)
     {
-        size_t n=0;
-        FOR_ALL_OBJECTS_IN_METADATA(*this)
-        setValue(valuesIn[n++],__iter.objId);
+        if (!myMDSql->initializeInsert(&labels, noValues))
+            REPORT_ERROR(ERR_MD_SQL,"setColumnValues: cannot prepare the insertion");
+        for (size_t n=0; n<nmax; ++n)
+        {
+            myMDSql->bindValue(myMDSql->preparedStmt, 1, valuesIn[n]);
+            if (!myMDSql->execPreparedStmt())
+                REPORT_ERROR(ERR_MD_SQL,"setColumnValues: cannot insert value");
+        }
     }
     else
     {
-        size_t nmax=valuesIn.size();
+        std::vector<size_t> objectsId;
+        findObjects(objectsId);
+        if (!myMDSql->initializeUpdate(labels))
+            REPORT_ERROR(ERR_MD_SQL,"setColumnValues: cannot prepare the update");
         for (size_t n=0; n<nmax; ++n)
-            setValue(valuesIn[n],addObject());
+        {
+            myMDSql->bindValue(myMDSql->preparedStmt, 1, valuesIn[n]);
+            myMDSql->bindPreparedInt(2, objectsId[n]);
+            if (!myMDSql->execPreparedStmt())
+                REPORT_ERROR(ERR_MD_SQL,"setColumnValues: cannot update value");
+        }
     }
+    myMDSql->finalizePreparedStmt();
 }
 
 bool MetaData::bindValue( size_t id) const
@@ -555,6 +608,47 @@ size_t MetaData::addRow2(const MDRow &row)
 	return(id);
 }
 
+void MetaData::addRows(const std::vector<MDRow> &rows)
+{
+    std::vector<MDLabel> labels, rowLabels;
+    std::vector<MDObject*> noValues;
+    bool prepared=false;
+    size_t nmax=rows.size();
+    for (size_t n=0; n<nmax; ++n)
+    {
+        const MDRow &row=rows[n];
+        rowLabels.clear();
+        for (int i=0; i<row._size; ++i)
+            if (row.containsLabel(row.order[i]))
+                rowLabels.push_back(row.order[i]);
+
+        // A new statement is only prepared when the labels change
+        if (!prepared || rowLabels!=labels)
+        {
+            if (prepared)
+                myMDSql->finalizePreparedStmt();
+            prepared=false;
+            labels=rowLabels;
+            if (labels.empty())
+            {
+                addObject();
+                continue;
+            }
+            for (size_t i=0; i<labels.size(); ++i)
+                addLabel(labels[i]);
+            if (!myMDSql->initializeInsert(&labels, noValues))
+                REPORT_ERROR(ERR_MD_SQL,"addRows: cannot prepare the insertion");
+            prepared=true;
+        }
+        for (size_t i=0; i<labels.size(); ++i)
+            myMDSql->bindValue(myMDSql->preparedStmt, i+1, *(row.getObject(labels[i])));
+        if (!myMDSql->execPreparedStmt())
+            REPORT_ERROR(ERR_MD_SQL,"addRows: cannot insert row");
+    }
+    if (prepared)
+        myMDSql->finalizePreparedStmt();
+}
+
 MetaData::MetaData()
 {
     myMDSql = new MDSql(this);
@@ -594,6 +688,13 @@ MetaData::~MetaData()
 
 //-------- Getters and Setters ----------
 
+void MetaData::setColumnCache(bool enable)
+{
+    myMDSql->columnCache->enabled = enable;
+    if (!enable)
+        myMDSql->invalidateColumns();
+}
+
 bool MetaData::isColumnFormat() const
 {
     return _isColumnFormat;
@@ -910,6 +1011,10 @@ void MetaData::write(const FileName &_outFile, WriteModeMetaData mode) const
     {
         writeDB(outFile, blockName, mode);
     }
+    else if(extFile=="xmdb")
+    {
+        writeBinary(outFile, blockName, mode);
+    }
     else
     {
         writeStar(outFile, blockName, mode);
@@ -1350,22 +1455,226 @@ void MetaData::_readRows(std::istream& is, std::vector<MDObject*> & columnValues
     }
 }
 
+/* Parse a decimal number with the same result than reading a double from a
+ * stream. Numbers with at most 15 significant digits and small exponents are
+ * converted exactly with a single multiplication or division, the others with
+ * strtod. Returns false if the token is not a plain decimal number, or is out
+ * of range, so that the caller falls back to the stream.
+ */
+static bool parseStarNumber(const char *begin, const char *end, double &value)
+{
+    static const double powers10[] =
+        {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+    const char *p = begin;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+
+    size_t mantissa = 0;
+    int digits = 0, significant = 0, exponent = 0;
+    bool exact = true;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+    {
+        if (mantissa == 0 && *p == '0')
+            continue;
+        else if (significant < 15)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            ++significant;
+        }
+        else
+            exact = false;
+    }
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+        {
+            if (mantissa == 0 && *p == '0')
+                --exponent;
+            else if (significant < 15)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                ++significant;
+                --exponent;
+            }
+            else
+                exact = false;
+        }
+    }
+    if (digits == 0)
+        return false;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        bool negativeExp = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negativeExp = (*p++ == '-');
+        if (p == end || *p < '0' || *p > '9')
+            return false;
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p)
+        {
+            if (e < 10000)
+                e = e * 10 + (*p - '0');
+        }
+        exponent += negativeExp ? -e : e;
+    }
+    if (p != end)
+        return false;
+
+    if (mantissa == 0)
+        value = 0.;
+    else if (exact && exponent >= -22 && exponent <= 22)
+    {
+        value = (double)mantissa;
+        if (exponent < 0)
+            value /= powers10[-exponent];
+        else
+            value *= powers10[exponent];
+    }
+    else
+    {
+        char buffer[64];
+        size_t length = end - begin;
+        if (length >= sizeof(buffer))
+            return false;
+        memcpy(buffer, begin, length);
+        buffer[length] = '\0';
+        errno = 0;
+        value = strtod(buffer, NULL);
+        return errno != ERANGE;
+    }
+    if (negative)
+        value = -value;
+    return true;
+}
+
+/* Parse a data row of a STAR file in place and insert it with the prepared
+ * statement. Returns false, without inserting anything, if the row has a
+ * format that this parser does not handle (missing values, numbers that
+ * are not plain decimals,...).
+ */
+bool MetaData::_parseObjectsInPlace(const char *iter, const char *end,
+                                    const std::vector<MDObject*> &columnValues,
+                                    const std::vector<int> &bindPositions,
+                                    std::vector<String> &quotedValues)
+{
+    size_t nCol = columnValues.size();
+    for (size_t i = 0; i < nCol; ++i)
+    {
+        while (iter < end && isspace(*iter))
+            ++iter;
+        if (iter == end)
+            return false;
+        const char *token = iter;
+        while (iter < end && !isspace(*iter))
+            ++iter;
+
+        const MDObject &object = *(columnValues[i]);
+        if (object.label == MDL_UNDEFINED)
+            continue;
+        int position = bindPositions[i];
+        double d;
+        switch (object.type)
+        {
+        case LABEL_DOUBLE:
+        case LABEL_INT:
+        case LABEL_BOOL:
+        case LABEL_SIZET:
+            //int, bool and size_t are read as double as in MDObject::fromStream
+            if (!parseStarNumber(token, iter, d))
+                return false;
+            if (position == 0 || object.failed)
+                break;
+            if (object.type == LABEL_DOUBLE)
+                myMDSql->bindPreparedDouble(position, d);
+            else if (object.type == LABEL_INT)
+                myMDSql->bindPreparedInt(position, (int)d);
+            else if (object.type == LABEL_BOOL)
+                myMDSql->bindPreparedInt(position, ((bool)((int)d)) ? 1 : 0);
+            else
+                myMDSql->bindPreparedInt(position, (int)((size_t)d));
+            break;
+        case LABEL_STRING:
+            if (token[0] == _QUOT || token[0] == _DQUOT)
+            {
+                //Quoted strings may span several tokens, that are joined by
+                //a single space as in MDObject::fromStream
+                char quote = token[0];
+                String &value = quotedValues[i];
+                value.clear();
+                const char *s = token + 1;
+                while (std::find(s, iter, quote) == iter)
+                {
+                    value.append(s, iter - s);
+                    value += ' ';
+                    while (iter < end && isspace(*iter))
+                        ++iter;
+                    if (iter == end)
+                        return false;
+                    s = iter;
+                    while (iter < end && !isspace(*iter))
+                        ++iter;
+                }
+                value.append(s, iter - s - 1);
+                if (position != 0 && !object.failed)
+                    myMDSql->bindPreparedText(position, value.c_str(), value.size());
+            }
+            else if (position != 0 && !object.failed)
+                myMDSql->bindPreparedText(position, token, iter - token);
+            break;
+        default:
+            return false;
+        }
+    }
+    //Values that could not be parsed in previous rows are stored as NULL
+    for (size_t i = 0; i < nCol; ++i)
+        if (bindPositions[i] != 0 && columnValues[i]->failed)
+            myMDSql->bindPreparedNull(bindPositions[i]);
+    myMDSql->execPreparedStmt();
+    return true;
+}
+
 /* This function will be used to parse the rows data in START format
  */
 void MetaData::_readRowsStar(mdBlock &block, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels)
 {
     String line;
-    std::stringstream ss;
     size_t nCol = columnValues.size();
-    size_t id, n = block.end - block.loop;
+    size_t n = block.end - block.loop;
     bool	firstTime=true;
 
     if (n==0)
         return;
 
-    char * buffer = new char[n];
-    memcpy(buffer, block.loop, n);
-    char *iter = buffer, *end = iter + n, * newline = NULL;
+    //Rows are tokenized in place in the mapped file and their values are bound
+    //straight into the prepared insert. The first row (that adds the labels),
+    //the blocks with vector columns and the rows not handled by the fast parser
+    //go through the stream based _parseObjects
+    std::vector<int> bindPositions(nCol, 0);
+    bool inPlace = true;
+    for (size_t j = 0; j < nCol; ++j)
+    {
+        if (columnValues[j]->type == LABEL_VECTOR_DOUBLE || columnValues[j]->type == LABEL_VECTOR_SIZET)
+            inPlace = false;
+        if (desiredLabels == NULL)
+            bindPositions[j] = j + 1;
+    }
+    //Same binding positions than MDSql::setObjectValues
+    if (desiredLabels != NULL)
+        for (size_t i = 0; i < desiredLabels->size(); ++i)
+            for (size_t j = 0; j < nCol; ++j)
+                if (columnValues[j]->label == (*desiredLabels)[i])
+                {
+                    bindPositions[j] = i + 1;
+                    break;
+                }
+    std::vector<String> quotedValues(nCol);
+
+    const char *iter = block.loop, *end = block.end, *newline = NULL;
     _parsedLines = 0; //Check how many lines the md have
 
     if (myMDSql->initializeInsert( desiredLabels, columnValues))
@@ -1373,21 +1682,30 @@ void MetaData::_readRowsStar(mdBlock &block, std::vector<MDObject*> & columnValu
 		while (iter < end) //while there are data lines
 		{
 			//Assing \n position and check if NULL at the same time
-			if (!(newline = END_OF_LINE()))
+			if (!(newline = (const char *) memchr(iter, '\n', end - iter)))
 				newline = end;
-			line.assign(iter, newline - iter);
-			trim(line);
-
-			if (!line.empty() && line[0] != '#')
+			//Trim spaces as trim() does
+			const char *lineBegin = iter, *lineEnd = newline;
+			while (lineBegin < lineEnd && *lineBegin == ' ')
+				++lineBegin;
+			while (lineEnd > lineBegin && lineEnd[-1] == ' ')
+				--lineEnd;
+
+			if (lineBegin < lineEnd && lineBegin[0] != '#')
 			{
 				//_maxRows would be > 0 if we only want to read some
 				// rows from the md for performance reasons...
 				// anyway the number of lines will be counted in _parsedLines
 				if (_maxRows == 0 || _parsedLines < _maxRows)
 				{
-					std::stringstream ss(line);
-					_parseObjects( ss, columnValues, desiredLabels, firstTime);
-					firstTime=false;
+					if (firstTime || !inPlace ||
+						!_parseObjectsInPlace(lineBegin, lineEnd, columnValues, bindPositions, quotedValues))
+					{
+						line.assign(lineBegin, lineEnd - lineBegin);
+						std::stringstream ss(line);
+						_parseObjects( ss, columnValues, desiredLabels, firstTime);
+						firstTime=false;
+					}
 				}
 				_parsedLines++;
 			}
@@ -1397,8 +1715,6 @@ void MetaData::_readRowsStar(mdBlock &block, std::vector<MDObject*> & columnValu
 		// Finalize statement.
 		myMDSql->finalizePreparedStmt();
     }
-
-    delete[] buffer;
 }
 
 /*This function will read the md data if is in row format */
@@ -1448,6 +1764,8 @@ void MetaData::read(const FileName &_filename,
         readXML(inFile, desiredLabels, blockName, decomposeStack);
     else if(extFile=="sqlite")
         readDB(inFile, desiredLabels, blockName, decomposeStack);
+    else if(extFile=="xmdb")
+        readBinary(inFile, desiredLabels, blockName, decomposeStack);
     else
         readStar(_filename, desiredLabels, blockName, decomposeStack);
 
@@ -1457,6 +1775,750 @@ void MetaData::read(const FileName &_filename,
     eFilename = _filename;
 }
 
+/* Binary row blocks ------------------------------------------------------- */
+#define BINARY_BLOCK_MAGIC 0x42444d58 // "XMDB"
+
+template<typename T>
+inline void packBinary(std::vector<char> &buffer, const T &value)
+{
+    const char *ptr = (const char *)&value;
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(T));
+}
+
+template<typename T>
+inline void packBinaryVector(std::vector<char> &buffer, const std::vector<T> &v)
+{
+    packBinary(buffer, v.size());
+    if (!v.empty())
+    {
+        const char *ptr = (const char *)&v[0];
+        buffer.insert(buffer.end(), ptr, ptr + v.size() * sizeof(T));
+    }
+}
+
+/* Cursor over a binary block, checking that no read goes beyond its end */
+class BinaryBlockReader
+{
+public:
+    const char *ptr, *end;
+
+    BinaryBlockReader(const char *buffer, size_t size): ptr(buffer), end(buffer + size)
+    {}
+
+    inline void read(void *out, size_t n)
+    {
+        if ((size_t)(end - ptr) < n)
+            REPORT_ERROR(ERR_MD, "Truncated binary metadata block");
+        memcpy(out, ptr, n);
+        ptr += n;
+    }
+
+    template<typename T>
+    inline void read(T &value)
+    {
+        read(&value, sizeof(T));
+    }
+
+    template<typename T>
+    inline void readVector(std::vector<T> &v)
+    {
+        size_t n;
+        read(n);
+        v.resize(n);
+        if (n > 0)
+            read(&v[0], n * sizeof(T));
+    }
+};
+
+static void packObject(std::vector<char> &buffer, const MDObject &obj)
+{
+    switch (obj.type)
+    {
+    case LABEL_BOOL:
+        packBinary(buffer, (char)obj.data.boolValue);
+        break;
+    case LABEL_INT:
+        packBinary(buffer, obj.data.intValue);
+        break;
+    case LABEL_SIZET:
+        packBinary(buffer, obj.data.longintValue);
+        break;
+    case LABEL_DOUBLE:
+        packBinary(buffer, obj.data.doubleValue);
+        break;
+    case LABEL_STRING:
+        {
+            const String &str = *(obj.data.stringValue);
+            packBinary(buffer, str.size());
+            buffer.insert(buffer.end(), str.begin(), str.end());
+        }
+        break;
+    case LABEL_VECTOR_DOUBLE:
+        packBinaryVector(buffer, *(obj.data.vectorValue));
+        break;
+    case LABEL_VECTOR_SIZET:
+        packBinaryVector(buffer, *(obj.data.vectorValueLong));
+        break;
+    default:
+        REPORT_ERROR(ERR_MD_BADTYPE, "Cannot serialize label " + MDL::label2Str(obj.label));
+    }
+}
+
+static void unpackObject(BinaryBlockReader &reader, MDObject &obj)
+{
+    switch (obj.type)
+    {
+    case LABEL_BOOL:
+        {
+            char c;
+            reader.read(c);
+            obj.data.boolValue = (c != 0);
+        }
+        break;
+    case LABEL_INT:
+        reader.read(obj.data.intValue);
+        break;
+    case LABEL_SIZET:
+        reader.read(obj.data.longintValue);
+        break;
+    case LABEL_DOUBLE:
+        reader.read(obj.data.doubleValue);
+        break;
+    case LABEL_STRING:
+        {
+            size_t n;
+            reader.read(n);
+            String &str = *(obj.data.stringValue);
+            str.resize(n);
+            if (n > 0)
+                reader.read(&str[0], n);
+        }
+        break;
+    case LABEL_VECTOR_DOUBLE:
+        reader.readVector(*(obj.data.vectorValue));
+        break;
+    case LABEL_VECTOR_SIZET:
+        reader.readVector(*(obj.data.vectorValueLong));
+        break;
+    default:
+        REPORT_ERROR(ERR_MD_BADTYPE, "Cannot deserialize label " + MDL::label2Str(obj.label));
+    }
+}
+
+/* Labels written in binary blocks and files, comments and undefined
+ * labels are not stored */
+static void binaryLabels(const std::vector<MDLabel> &activeLabels, std::vector<MDLabel> &labels)
+{
+    labels.clear();
+    for (size_t i = 0; i < activeLabels.size(); ++i)
+        if (activeLabels[i] != MDL_STAR_COMMENT && activeLabels[i] != MDL_UNDEFINED)
+            labels.push_back(activeLabels[i]);
+}
+
+void MetaData::writeBinaryBlock(std::vector<char> &buffer) const
+{
+    // Header: magic number, labels and number of rows
+    buffer.clear();
+    packBinary(buffer, (int)BINARY_BLOCK_MAGIC);
+    std::vector<MDLabel> labels;
+    binaryLabels(activeLabels, labels);
+    packBinary(buffer, labels.size());
+    for (size_t i = 0; i < labels.size(); ++i)
+        packBinary(buffer, (int)labels[i]);
+    size_t nRows = size();
+    packBinary(buffer, nRows);
+    if (labels.empty() || nRows == 0)
+        return;
+
+    // Rows, label values in the order of the header. All the rows are
+    // read with a single SELECT statement
+    std::vector<MDObject> values;
+    myMDSql->initializeSelect(false, labels);
+    for (size_t n = 0; n < nRows; ++n)
+    {
+        values.clear();
+        if (!myMDSql->getObjectsValues(labels, &values))
+            REPORT_ERROR(ERR_MD_SQL, "Cannot read the rows to serialize");
+        for (size_t i = 0; i < values.size(); ++i)
+            packObject(buffer, values[i]);
+    }
+    myMDSql->finalizePreparedStmt();
+}
+
+void MetaData::addBinaryBlock(const char *buffer, size_t bufferSize)
+{
+    BinaryBlockReader reader(buffer, bufferSize);
+    int magic;
+    reader.read(magic);
+    if (magic != BINARY_BLOCK_MAGIC)
+        REPORT_ERROR(ERR_MD, "Invalid binary metadata block");
+    size_t nLabels, nRows;
+    reader.read(nLabels);
+    MDRow row;
+    for (size_t i = 0; i < nLabels; ++i)
+    {
+        int label;
+        reader.read(label);
+        if (!MDL::isValidLabel((MDLabel)label))
+            REPORT_ERROR(ERR_MD_UNDEFINED, "Invalid label in binary metadata block");
+        row.setValue(MDObject((MDLabel)label));
+    }
+    reader.read(nRows);
+    if (nRows == 0)
+        return;
+    if (nLabels == 0)
+    {
+        for (size_t n = 0; n < nRows; ++n)
+            addObject();
+        return;
+    }
+
+    // Rows are inserted with a single prepared statement
+    if (!initAddRow(row))
+        REPORT_ERROR(ERR_MD_SQL, "Cannot prepare the insertion of binary metadata rows");
+    for (size_t n = 0; n < nRows; ++n)
+    {
+        for (int i = 0; i < row._size; ++i)
+            unpackObject(reader, *(row.objects[row.order[i]]));
+        if (!execAddRow(row))
+            REPORT_ERROR(ERR_MD_SQL, "Cannot insert binary metadata rows");
+    }
+    finalizeAddRow();
+}
+
+/* Binary columnar files ---------------------------------------------------
+ * A .xmdb file is a sequence of blocks. Each block has a header (name,
+ * comment, number of rows and a directory with the type, encoding, offset
+ * and size of each column) followed by the columns, each one stored
+ * contiguously:
+ *  - bool, int, size_t and double: one native value per row
+ *  - string: n+1 offsets followed by the characters, or, if there are many
+ *    repeated values, a dictionary of distinct strings and one index per row
+ *  - vectors: n+1 offsets (in elements) followed by the elements
+ */
+#define BINARY_FILE_MAGIC 0x46444d58 // "XMDF"
+#define BINARY_FILE_VERSION 1
+#define BINARY_COLUMN_PLAIN 0
+#define BINARY_COLUMN_DICTIONARY 1
+
+/* Column of a block of a binary file */
+struct BinaryFileColumn
+{
+    int label;
+    int encoding;
+    size_t offset; //from the beginning of the block
+    size_t size;
+};
+
+/* Block of a binary file, the columns point to the mapped file */
+struct BinaryFileBlock
+{
+    const char *begin;
+    size_t size;
+    String name, comment;
+    bool columnFormat;
+    size_t nRows;
+    std::vector<BinaryFileColumn> columns;
+};
+
+static void packBinaryString(std::vector<char> &buffer, const String &str)
+{
+    packBinary(buffer, str.size());
+    buffer.insert(buffer.end(), str.begin(), str.end());
+}
+
+static void unpackBinaryString(BinaryBlockReader &reader, String &str)
+{
+    size_t n;
+    reader.read(n);
+    str.resize(n);
+    if (n > 0)
+        reader.read(&str[0], n);
+}
+
+/* Read the header of the next block, returns false at the end of the file */
+static bool nextBinaryFileBlock(BinaryBlockReader &file, BinaryFileBlock &block)
+{
+    if (file.ptr >= file.end)
+        return false;
+    block.begin = file.ptr;
+    int magic, version;
+    file.read(magic);
+    file.read(version);
+    if (magic != BINARY_FILE_MAGIC || version != BINARY_FILE_VERSION)
+        REPORT_ERROR(ERR_MD, "Invalid binary metadata file");
+    file.read(block.size);
+    if (block.size > (size_t)(file.end - block.begin))
+        REPORT_ERROR(ERR_MD, "Truncated binary metadata file");
+    BinaryBlockReader header(file.ptr, block.begin + block.size - file.ptr);
+    unpackBinaryString(header, block.name);
+    unpackBinaryString(header, block.comment);
+    char columnFormat;
+    header.read(columnFormat);
+    block.columnFormat = columnFormat != 0;
+    header.read(block.nRows);
+    size_t nColumns;
+    header.read(nColumns);
+    block.columns.resize(nColumns);
+    for (size_t i = 0; i < nColumns; ++i)
+    {
+        BinaryFileColumn &column = block.columns[i];
+        header.read(column.label);
+        header.read(column.encoding);
+        header.read(column.offset);
+        header.read(column.size);
+        if (column.offset > block.size || column.size > block.size - column.offset)
+            REPORT_ERROR(ERR_MD, "Corrupted binary metadata file");
+    }
+    file.ptr = block.begin + block.size;
+    return true;
+}
+
+/* Blocks of a binary metadata file */
+static void getBlocksInMetaDataFileBinary(const FileName &inFile, StringVector& blockList)
+{
+    int fd;
+    BUFFER_CREATE(bufferMap);
+    mapFile(inFile, bufferMap.begin, bufferMap.size, fd);
+    BinaryBlockReader file(bufferMap.begin, bufferMap.size);
+    BinaryFileBlock block;
+    while (nextBinaryFileBlock(file, block))
+        blockList.push_back(block.name);
+    unmapFile(bufferMap.begin, bufferMap.size, fd);
+}
+
+void MetaData::writeBinary(const FileName fn, const FileName blockname, WriteModeMetaData mode) const
+{
+    std::vector<MDLabel> labels;
+    binaryLabels(activeLabels, labels);
+    size_t nRows = size();
+    size_t nColumns = labels.size();
+
+    // Columns are filled with a single pass over the rows
+    std::vector< std::vector<char> > columns(nColumns);
+    std::vector< std::vector<size_t> > offsets(nColumns);
+    std::vector< std::map<String, int> > dictionaries(nColumns);
+    std::vector< std::vector<int> > codes(nColumns);
+    for (size_t i = 0; i < nColumns; ++i)
+    {
+        offsets[i].push_back(0);
+        if (MDL::labelType(labels[i]) == LABEL_STRING)
+            codes[i].reserve(nRows);
+    }
+    if (nColumns > 0 && nRows > 0)
+    {
+        std::vector<MDObject> values;
+        myMDSql->initializeSelect(false, labels);
+        for (size_t n = 0; n < nRows; ++n)
+        {
+            values.clear();
+            if (!myMDSql->getObjectsValues(labels, &values))
+                REPORT_ERROR(ERR_MD_SQL, "Cannot read the rows to write");
+            for (size_t i = 0; i < nColumns; ++i)
+            {
+                const MDObject &obj = values[i];
+                std::vector<char> &column = columns[i];
+                switch (obj.type)
+                {
+                case LABEL_BOOL:
+                    packBinary(column, (char)obj.data.boolValue);
+                    break;
+                case LABEL_INT:
+                    packBinary(column, obj.data.intValue);
+                    break;
+                case LABEL_SIZET:
+                    packBinary(column, obj.data.longintValue);
+                    break;
+                case LABEL_DOUBLE:
+                    packBinary(column, obj.data.doubleValue);
+                    break;
+                case LABEL_STRING:
+                    {
+                        const String &str = *(obj.data.stringValue);
+                        column.insert(column.end(), str.begin(), str.end());
+                        offsets[i].push_back(column.size());
+                        std::map<String, int> &dictionary = dictionaries[i];
+                        std::map<String, int>::iterator it = dictionary.find(str);
+                        if (it == dictionary.end())
+                            it = dictionary.insert(std::make_pair(str, (int)dictionary.size())).first;
+                        codes[i].push_back(it->second);
+                    }
+                    break;
+                case LABEL_VECTOR_DOUBLE:
+                    {
+                        const std::vector<double> &v = *(obj.data.vectorValue);
+                        for (size_t k = 0; k < v.size(); ++k)
+                            packBinary(column, v[k]);
+                        offsets[i].push_back(offsets[i].back() + v.size());
+                    }
+                    break;
+                case LABEL_VECTOR_SIZET:
+                    {
+                        const std::vector<size_t> &v = *(obj.data.vectorValueLong);
+                        for (size_t k = 0; k < v.size(); ++k)
+                            packBinary(column, v[k]);
+                        offsets[i].push_back(offsets[i].back() + v.size());
+                    }
+                    break;
+                default:
+                    REPORT_ERROR(ERR_MD_BADTYPE, "Cannot write label " + MDL::label2Str(obj.label));
+                }
+            }
+        }
+        myMDSql->finalizePreparedStmt();
+    }
+
+    // Final layout of the columns. Strings with many repeated values (as
+    // micrograph names) are stored as a dictionary plus one index per row
+    std::vector<int> encodings(nColumns, BINARY_COLUMN_PLAIN);
+    for (size_t i = 0; i < nColumns; ++i)
+    {
+        MDLabelType type = MDL::labelType(labels[i]);
+        std::vector<char> data;
+        if (nRows > 0 && type == LABEL_STRING && 2 * dictionaries[i].size() <= nRows)
+        {
+            encodings[i] = BINARY_COLUMN_DICTIONARY;
+            std::vector<const String *> distinct(dictionaries[i].size());
+            for (std::map<String, int>::const_iterator it = dictionaries[i].begin();
+                 it != dictionaries[i].end(); ++it)
+                distinct[it->second] = &(it->first);
+            packBinary(data, distinct.size());
+            size_t offset = 0;
+            packBinary(data, offset);
+            for (size_t k = 0; k < distinct.size(); ++k)
+            {
+                offset += distinct[k]->size();
+                packBinary(data, offset);
+            }
+            for (size_t k = 0; k < distinct.size(); ++k)
+                data.insert(data.end(), distinct[k]->begin(), distinct[k]->end());
+            const char *ptr = (const char *)&codes[i][0];
+            data.insert(data.end(), ptr, ptr + nRows * sizeof(int));
+        }
+        else if (type == LABEL_STRING || type == LABEL_VECTOR_DOUBLE || type == LABEL_VECTOR_SIZET)
+        {
+            if (offsets[i].size() != nRows + 1)
+                offsets[i].resize(nRows + 1, 0);
+            const char *ptr = (const char *)&offsets[i][0];
+            data.insert(data.end(), ptr, ptr + (nRows + 1) * sizeof(size_t));
+            data.insert(data.end(), columns[i].begin(), columns[i].end());
+        }
+        else
+            data.swap(columns[i]);
+        columns[i].swap(data);
+        std::vector<size_t>().swap(offsets[i]);
+        std::vector<int>().swap(codes[i]);
+    }
+
+    // Block header, its size is needed to compute the column offsets
+    std::vector<char> header;
+    packBinary(header, (int)BINARY_FILE_MAGIC);
+    packBinary(header, (int)BINARY_FILE_VERSION);
+    size_t sizePosition = header.size();
+    packBinary(header, (size_t)0);
+    packBinaryString(header, blockname);
+    packBinaryString(header, comment);
+    packBinary(header, (char)_isColumnFormat);
+    packBinary(header, nRows);
+    packBinary(header, nColumns);
+    size_t offset = header.size() + nColumns * (2 * sizeof(int) + 2 * sizeof(size_t));
+    for (size_t i = 0; i < nColumns; ++i)
+    {
+        packBinary(header, (int)labels[i]);
+        packBinary(header, encodings[i]);
+        packBinary(header, offset);
+        packBinary(header, columns[i].size());
+        offset += columns[i].size();
+    }
+    memcpy(&header[sizePosition], &offset, sizeof(size_t));
+
+    // As in the text files, a block with the same name is replaced: the file
+    // is truncated at that block and the blocks after it are written again
+    // after the new one
+    std::vector<char> tail;
+    if (mode == MD_APPEND && fn.exists() && fn.getFileSize() > 0)
+    {
+        int fd;
+        BUFFER_CREATE(bufferMap);
+        mapFile(fn, bufferMap.begin, bufferMap.size, fd);
+        BinaryBlockReader file(bufferMap.begin, bufferMap.size);
+        BinaryFileBlock block;
+        size_t blockBegin = bufferMap.size;
+        while (nextBinaryFileBlock(file, block))
+            if (block.name == blockname)
+            {
+                blockBegin = block.begin - bufferMap.begin;
+                tail.assign(block.begin + block.size, (const char *)bufferMap.begin + bufferMap.size);
+                break;
+            }
+        unmapFile(bufferMap.begin, bufferMap.size, fd);
+        if (blockBegin < bufferMap.size && truncate(fn.c_str(), blockBegin) != 0)
+            REPORT_ERROR(ERR_IO_NOWRITE, "MetaData::writeBinary: cannot truncate " + fn);
+    }
+
+    FILE *fh = fopen(fn.c_str(), (mode == MD_OVERWRITE) ? "wb" : "ab");
+    if (fh == NULL)
+        REPORT_ERROR(ERR_IO_NOTOPEN, "MetaData::writeBinary: cannot open " + fn);
+    bool ok = fwrite(&header[0], header.size(), 1, fh) == 1;
+    for (size_t i = 0; i < nColumns; ++i)
+        if (!columns[i].empty())
+            ok = ok && fwrite(&columns[i][0], columns[i].size(), 1, fh) == 1;
+    if (!tail.empty())
+        ok = ok && fwrite(&tail[0], tail.size(), 1, fh) == 1;
+    if (fclose(fh) != 0 || !ok)
+        REPORT_ERROR(ERR_IO_NOWRITE, "MetaData::writeBinary: cannot write " + fn);
+}
+
+/* Decoding state of a column of a binary file. For bool, int, size_t and
+ * double columns values points to the array of values. For strings and
+ * vectors, offsets points to the n+1 offsets and values to the characters or
+ * elements. For dictionary strings, offsets and values describe the
+ * dictionary and codes points to the index of each row.
+ */
+struct BinaryColumnData
+{
+    MDLabelType type;
+    int encoding;
+    const char *offsets, *values, *codes;
+    size_t dictionarySize;
+    MDObject *vector;
+    String vectorText;
+};
+
+/* Set the pointers to the data of a column, checking its size */
+static void initBinaryColumnData(const BinaryFileBlock &block, const BinaryFileColumn &column,
+                                 BinaryColumnData &data)
+{
+    data.type = MDL::labelType((MDLabel)column.label);
+    data.encoding = column.encoding;
+    data.offsets = data.codes = NULL;
+    data.values = block.begin + column.offset;
+    data.dictionarySize = 0;
+    data.vector = NULL;
+    size_t n = block.nRows;
+    size_t expected = 0;
+    switch (data.type)
+    {
+    case LABEL_BOOL:
+        expected = n;
+        break;
+    case LABEL_INT:
+        expected = n * sizeof(int);
+        break;
+    case LABEL_SIZET:
+        expected = n * sizeof(size_t);
+        break;
+    case LABEL_DOUBLE:
+        expected = n * sizeof(double);
+        break;
+    default:
+        {
+            size_t nOffsets = n + 1;
+            const char *ptr = block.begin + column.offset;
+            if (column.encoding == BINARY_COLUMN_DICTIONARY)
+            {
+                if (data.type != LABEL_STRING || column.size < sizeof(size_t))
+                    REPORT_ERROR(ERR_MD, "Corrupted column in binary metadata file");
+                memcpy(&data.dictionarySize, ptr, sizeof(size_t));
+                ptr += sizeof(size_t);
+                nOffsets = data.dictionarySize + 1;
+                expected = sizeof(size_t) + n * sizeof(int);
+            }
+            expected += nOffsets * sizeof(size_t);
+            if (expected > column.size)
+                REPORT_ERROR(ERR_MD, "Corrupted column in binary metadata file");
+            data.offsets = ptr;
+            data.values = ptr + nOffsets * sizeof(size_t);
+            size_t nValues;
+            memcpy(&nValues, data.offsets + (nOffsets - 1) * sizeof(size_t), sizeof(size_t));
+            if (data.type == LABEL_VECTOR_DOUBLE)
+                nValues *= sizeof(double);
+            else if (data.type == LABEL_VECTOR_SIZET)
+                nValues *= sizeof(size_t);
+            expected += nValues;
+            if (data.encoding == BINARY_COLUMN_DICTIONARY)
+                data.codes = data.values + nValues;
+            if (data.type != LABEL_STRING)
+                data.vector = new MDObject((MDLabel)column.label);
+        }
+    }
+    if (expected != column.size)
+        REPORT_ERROR(ERR_MD, "Corrupted column in binary metadata file");
+}
+
+/* Range [begin, end) of the k-th string or vector of a column */
+static inline void binaryColumnRange(const BinaryColumnData &data, size_t k, size_t &begin, size_t &end)
+{
+    memcpy(&begin, data.offsets + k * sizeof(size_t), sizeof(size_t));
+    memcpy(&end, data.offsets + (k + 1) * sizeof(size_t), sizeof(size_t));
+    if (end < begin)
+        REPORT_ERROR(ERR_MD, "Corrupted column in binary metadata file");
+}
+
+void MetaData::readBinary(const FileName &filename,
+                          const std::vector<MDLabel> *desiredLabels,
+                          const String & blockRegExp,
+                          bool decomposeStack)
+{
+    if (!(isMetadataFile = filename.isMetaData()))//if not a metadata, try to read as image or stack
+    {
+        _readImageOrStack(filename, decomposeStack);
+        return;
+    }
+    inFile = filename;
+    int fd;
+    BUFFER_CREATE(bufferMap);
+    mapFile(filename, bufferMap.begin, bufferMap.size, fd);
+
+    regex_t re;
+    int rc = regcomp(&re, (blockRegExp+"$").c_str(), REG_EXTENDED|REG_NOSUB);
+    if (blockRegExp.size() && rc != 0)
+        REPORT_ERROR(ERR_ARG_INCORRECT, formatString("Pattern '%s' cannot be parsed: %s",
+                     blockRegExp.c_str(), filename.c_str()));
+    bool singleBlock = blockRegExp.find_first_of(".[*+")==String::npos;
+    bool firstBlock = true;
+
+    BinaryBlockReader file(bufferMap.begin, bufferMap.size);
+    BinaryFileBlock block;
+    while (nextBinaryFileBlock(file, block))
+    {
+        if (blockRegExp.size() != 0 && regexec(&re, block.name.c_str(), (size_t) 0, NULL, 0)!=0)
+            continue;
+        if (firstBlock)
+        {
+            setComment(block.comment);
+            _isColumnFormat = block.columnFormat;
+        }
+        firstBlock = false;
+
+        // Only the desired columns are decoded
+        std::vector<size_t> columnIndexes;
+        std::vector<MDLabel> labels;
+        for (size_t i = 0; i < block.columns.size(); ++i)
+        {
+            MDLabel label = (MDLabel)block.columns[i].label;
+            if (!MDL::isValidLabel(label))
+                REPORT_ERROR(ERR_MD_UNDEFINED, "Invalid label in binary metadata file");
+            if (desiredLabels != NULL && !vectorContainsLabel(*desiredLabels, label))
+                continue;
+            if (vectorContainsLabel(labels, label))
+                continue;
+            columnIndexes.push_back(i);
+            labels.push_back(label);
+            addLabel(label);
+        }
+
+        _parsedLines = block.nRows;
+        size_t nRows = block.nRows;
+        if (_maxRows > 0 && _maxRows < nRows)
+            nRows = _maxRows;
+        if (labels.empty())
+        {
+            for (size_t n = 0; n < nRows; ++n)
+                addObject();
+        }
+        else if (nRows > 0)
+        {
+            size_t nColumns = columnIndexes.size();
+            std::vector<BinaryColumnData> columns(nColumns);
+            for (size_t i = 0; i < nColumns; ++i)
+                initBinaryColumnData(block, block.columns[columnIndexes[i]], columns[i]);
+
+            // Values are bound straight from the mapped file
+            std::vector<MDObject*> noValues;
+            if (!myMDSql->initializeInsert(&labels, noValues))
+                REPORT_ERROR(ERR_MD_SQL, "Cannot prepare the insertion of binary metadata rows");
+            for (size_t n = 0; n < nRows; ++n)
+            {
+                for (size_t i = 0; i < nColumns; ++i)
+                {
+                    BinaryColumnData &column = columns[i];
+                    int position = i + 1;
+                    size_t begin, end;
+                    switch (column.type)
+                    {
+                    case LABEL_BOOL:
+                        myMDSql->bindPreparedInt(position, column.values[n] ? 1 : 0);
+                        break;
+                    case LABEL_INT:
+                        {
+                            int value;
+                            memcpy(&value, column.values + n * sizeof(int), sizeof(int));
+                            myMDSql->bindPreparedInt(position, value);
+                        }
+                        break;
+                    case LABEL_SIZET:
+                        {
+                            size_t value;
+                            memcpy(&value, column.values + n * sizeof(size_t), sizeof(size_t));
+                            myMDSql->bindPreparedInt(position, value);
+                        }
+                        break;
+                    case LABEL_DOUBLE:
+                        {
+                            double value;
+                            memcpy(&value, column.values + n * sizeof(double), sizeof(double));
+                            myMDSql->bindPreparedDouble(position, value);
+                        }
+                        break;
+                    case LABEL_STRING:
+                        {
+                            size_t k = n;
+                            if (column.encoding == BINARY_COLUMN_DICTIONARY)
+                            {
+                                int code;
+                                memcpy(&code, column.codes + n * sizeof(int), sizeof(int));
+                                if (code < 0 || (size_t)code >= column.dictionarySize)
+                                    REPORT_ERROR(ERR_MD, "Corrupted column in binary metadata file");
+                                k = code;
+                            }
+                            binaryColumnRange(column, k, begin, end);
+                            myMDSql->bindPreparedText(position, column.values + begin, end - begin);
+                        }
+                        break;
+                    default:
+                        {
+                            //Vectors are stored in SQL as text
+                            binaryColumnRange(column, n, begin, end);
+                            MDObject &obj = *(column.vector);
+                            if (obj.type == LABEL_VECTOR_DOUBLE)
+                            {
+                                std::vector<double> &v = *(obj.data.vectorValue);
+                                v.resize(end - begin);
+                                if (!v.empty())
+                                    memcpy(&v[0], column.values + begin * sizeof(double), v.size() * sizeof(double));
+                            }
+                            else
+                            {
+                                std::vector<size_t> &v = *(obj.data.vectorValueLong);
+                                v.resize(end - begin);
+                                if (!v.empty())
+                                    memcpy(&v[0], column.values + begin * sizeof(size_t), v.size() * sizeof(size_t));
+                            }
+                            column.vectorText = obj.toString(false, true);
+                            myMDSql->bindPreparedText(position, column.vectorText.c_str(), column.vectorText.size());
+                        }
+                    }
+                }
+                if (!myMDSql->execPreparedStmt())
+                    REPORT_ERROR(ERR_MD_SQL, "Cannot insert the rows of a binary metadata file");
+            }
+            myMDSql->finalizePreparedStmt();
+            for (size_t i = 0; i < nColumns; ++i)
+                delete columns[i].vector;
+        }
+
+        if (singleBlock)
+            break;
+    }
+
+    unmapFile(bufferMap.begin, bufferMap.size, fd);
+    regfree(&re);
+    if (firstBlock)
+        REPORT_ERROR(ERR_MD_BADBLOCK, formatString("Block: '%s': %s",
+                     blockRegExp.c_str(), filename.c_str()));
+}
+
 #define LINE_LENGTH 1024
 void MetaData::readPlain(const FileName &inFile, const String &labelsString, const String &separator)
 {
@@ -1567,6 +2629,31 @@ void MetaData::readDB(const FileName &filename,
 {
     myMDSql->copyTableFromFileDB(blockRegExp, filename, desiredLabels, _maxRows);
 }
+void MetaData::_readImageOrStack(const FileName &filename, bool decomposeStack)
+{
+    size_t id;
+    Image<char> image;
+    if (decomposeStack) // If not decomposeStack it is no necessary to read the image header
+        image.read(filename, HEADER);
+    if ( !decomposeStack || image().ndim == 1 ) //single image // !decomposeStack must be first
+    {
+        id = addObject();
+        setValue(MDL_IMAGE, filename, id);
+        setValue(MDL_ENABLED, 1, id);
+    }
+    else //stack
+    {
+        FileName fnTemp;
+        for (size_t i = 1; i <= image().ndim; ++i)
+        {
+            fnTemp.compose(i, filename);
+            id = addObject();
+            setValue(MDL_IMAGE, fnTemp, id);
+            setValue(MDL_ENABLED, 1, id);
+        }
+    }
+}
+
 void MetaData::readStar(const FileName &filename,
                         const std::vector<MDLabel> *desiredLabels,
                         const String & blockRegExp,
@@ -1578,26 +2665,7 @@ void MetaData::readStar(const FileName &filename,
 
     if (!(isMetadataFile = inFile.isMetaData()))//if not a metadata, try to read as image or stack
     {
-        Image<char> image;
-        if (decomposeStack) // If not decomposeStack it is no necessary to read the image header
-            image.read(filename, HEADER);
-        if ( !decomposeStack || image().ndim == 1 ) //single image // !decomposeStack must be first
-        {
-            id = addObject();
-            setValue(MDL_IMAGE, filename, id);
-            setValue(MDL_ENABLED, 1, id);
-        }
-        else //stack
-        {
-            FileName fnTemp;
-            for (size_t i = 1; i <= image().ndim; ++i)
-            {
-                fnTemp.compose(i, filename);
-                id = addObject();
-                setValue(MDL_IMAGE, fnTemp, id);
-                setValue(MDL_ENABLED, 1, id);
-            }
-        }
+        _readImageOrStack(filename, decomposeStack);
         return;
     }
 
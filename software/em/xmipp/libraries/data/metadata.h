@@ -323,6 +323,11 @@ protected:
     void _readRowsStar(mdBlock &block, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels);
     void _readRowFormat(std::istream& is);
 
+    /** Add one row per image of a file that is not a metadata.
+     * A stack is decomposed in its images if decomposeStack is set.
+     */
+    void _readImageOrStack(const FileName &filename, bool decomposeStack);
+
     /** This two variables will be used to read the metadata information (labels and size)
      * or maybe a few rows only
      */
@@ -398,6 +403,14 @@ public:
       return _parsedLines;
     }
 
+    /** Enable or disable the columnar cache (enabled by default).
+     * Columns read cell by cell with getValue or getRow are loaded once in
+     * memory, so that iterating over a large metadata does not issue one SQL
+     * statement per value. Disable it to save memory when the metadata is
+     * huge and only read once.
+     */
+    void setColumnCache(bool enable);
+
     /**Set precision (number of decimal digits) use by operator == when comparing
      * metadatas with double data. "2" is a good value for angles
      */
@@ -434,6 +447,12 @@ public:
      */
     void writeDB(const FileName fn, const FileName blockname, WriteModeMetaData mode) const;
 
+    /** Write metadata in a binary columnar file (.xmdb).
+     * Each block has a header with the offset of every column, so that
+     * readers can decode only the columns they need.
+     */
+    void writeBinary(const FileName fn, const FileName blockname, WriteModeMetaData mode) const;
+
     /** Write metadata in text file as plain data without header.
      *
      */
@@ -441,6 +460,16 @@ public:
 
     void _parseObjects(std::istream &is, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels, bool firstTime);
 
+    /* Parse a STAR data row in the read buffer and insert it, binding the
+     * values straight into the prepared insert. bindPositions are the
+     * positions of the columns in the insert (0 if not inserted). Returns
+     * false if the row must be parsed with _parseObjects.
+     */
+    bool _parseObjectsInPlace(const char *iter, const char *end,
+                              const std::vector<MDObject*> &columnValues,
+                              const std::vector<int> &bindPositions,
+                              std::vector<String> &quotedValues);
+
     /* Helper function to parse an MDObject and set its value.
      * The parsing will be from an input stream(istream)
      * and if parsing fails, an error will be raised
@@ -613,30 +642,35 @@ public:
      */
     void getColumnValues(const MDLabel label, std::vector<MDObject> &valuesOut) const;
 
+    /** Get all values of a column as a vector.
+     * Columns of these types are read with a single query, sorted by objId,
+     * without building an MDObject per value. If the label is not in the
+     * metadata, the vector is filled with default values.
+     */
+    void getColumnValues(const MDLabel label, std::vector<double> &valuesOut) const;
+    void getColumnValues(const MDLabel label, std::vector<int> &valuesOut) const;
+    void getColumnValues(const MDLabel label, std::vector<size_t> &valuesOut) const;
+    void getColumnValues(const MDLabel label, std::vector<String> &valuesOut) const;
+
     /** Set all values of a column as a vector.
-     * The input vector must have the same size as the Metadata.
+     * The input vector must have the same size as the Metadata. If the
+     * metadata is empty, one object is added for each value.
+     * All values are written with a single prepared statement.
      */
     template<class T>
     void setColumnValues(const MDLabel label, const std::vector<T> &valuesIn)
     {
-        bool addObjects=false;
-        if (size()==0)
-            addObjects=true;
-        if (valuesIn.size()!=size() && !addObjects)
-            REPORT_ERROR(ERR_MD_OBJECTNUMBER,"Input vector must be of the same size as the metadata");
-        size_t n=0;
-        if (!addObjects)
-            FOR_ALL_OBJECTS_IN_METADATA(*this)
-            setValue(label,valuesIn[n++],__iter.objId);
-        else
-        {
-            size_t nmax=valuesIn.size();
-            for (size_t n=0; n<nmax; ++n)
-                setValue(label,valuesIn[n],addObject());
-        }
+        std::vector<MDObject> values;
+        size_t nmax = valuesIn.size();
+        values.reserve(nmax);
+        for (size_t n = 0; n < nmax; ++n)
+            values.push_back(MDObject(label, valuesIn[n]));
+        setColumnValues(values);
     }
 
-    /** Get all values of a column as a vector.
+    /** Set all values of a column as a vector.
+     * All the objects must have the same label.
+     * @see setColumnValues
      */
     void setColumnValues(const std::vector<MDObject> &valuesIn);
 
@@ -663,6 +697,13 @@ public:
     size_t 	addRow(const MDRow &row);
     size_t 	addRow2(const MDRow &row);
 
+    /** Add several rows.
+     * Consecutive rows with the same labels are inserted with a single
+     * prepared statement, so this is much faster than calling addRow for
+     * each of them.
+     */
+    void 	addRows(const std::vector<MDRow> &rows);
+
     /** Set label values from string representation.
      */
     bool setValueFromStr(const MDLabel label, const String &value, size_t id);
@@ -859,12 +900,34 @@ public:
                 const String & blockRegExp=DEFAULT_BLOCK_NAME,
                 bool decomposeStack=true);
 
+    /** Read metadata from a binary columnar file (.xmdb).
+     * The file is mapped in memory and only the columns in desiredLabels
+     * (all if NULL) are decoded.
+     */
+    void readBinary(const FileName &inFile,
+                    const std::vector<MDLabel> *desiredLabels= NULL,
+                    const String & blockRegExp=DEFAULT_BLOCK_NAME,
+                    bool decomposeStack=true);
+
     /** Read data from file. Guess the blockname from the filename
      * @code
      * inFilename="first@md1.doc" -> filename = md1.doc, blockname = first
      * @endcode
      */
     void read(const FileName &inFile, const std::vector<MDLabel> *desiredLabels = NULL, bool decomposeStack=true);
+
+    /** Serialize the metadata into a binary row block.
+     * The buffer holds the active labels followed by the values of all the
+     * rows in native binary representation. It is meant to move metadata
+     * between processes of the same run (e.g. MPI nodes), not to be stored.
+     */
+    void writeBinaryBlock(std::vector<char> &buffer) const;
+
+    /** Add the rows of a binary row block.
+     * The labels of the block are added to the metadata if needed and the
+     * rows are inserted directly into the table, after the existing ones.
+     */
+    void addBinaryBlock(const char *buffer, size_t bufferSize);
     /** @} */
 
     /** Try to read a metadata from plain text with some columns.
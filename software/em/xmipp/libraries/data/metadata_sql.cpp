@@ -40,6 +40,16 @@ char *MDSql::errmsg;
 const char *MDSql::zLeftover;
 int MDSql::rc;
 Mutex sqlMutex; //Mutex to syncronize db access
+//MDSql of each table id, used to invalidate the columnar caches
+std::map<int, MDSql*> columnCacheTables;
+Mutex columnCacheMutex;
+//Number of tables with cached columns, and whether the update hook is set
+static size_t tablesWithColumns = 0;
+static bool updateHookSet = false;
+//Rows are only cached if the objId->row index is not much larger than the table
+static const size_t maxIndexRatio = 4;
+//Cell reads of a column before loading it
+static const size_t minLoadThreshold = 32;
 
 std::stringstream MDSql::preparedStream;	// Stream.
 sqlite3_stmt * MDSql::preparedStmt;
@@ -117,12 +127,21 @@ MDSql::MDSql(MetaData *md)
     sqlMutex.unlock();
     myMd = md;
     myCache = new MDCache();
-
+    columnCache = new MDColumnCache();
+    columnCacheMutex.lock();
+    columnCacheTables[tableId] = this;
+    columnCacheMutex.unlock();
 }
 
 MDSql::~MDSql()
 {
+    columnCacheMutex.lock();
+    columnCacheTables.erase(tableId);
+    if (columnCache->clear())
+        --tablesWithColumns;
+    columnCacheMutex.unlock();
     delete myCache;
+    delete columnCache;
 }
 
 bool MDSql::createMd()
@@ -269,6 +288,7 @@ bool MDSql::renameColumn(const std::vector<MDLabel> oldLabel, const std::vector<
     result = execSingleStmt(sqlCommand);
     tableId=oldTableId;
     myMd->activeLabels=v1;
+    invalidateColumns();
     return result;
 }
 
@@ -333,6 +353,42 @@ bool MDSql::setObjectValues( size_t id, const std::vector<MDObject*> columnValue
     return r;
 }
 
+void MDSql::bindPreparedInt(int position, int value)
+{
+    sqlite3_bind_int(this->preparedStmt, position, value);
+}
+
+void MDSql::bindPreparedDouble(int position, double value)
+{
+    sqlite3_bind_double(this->preparedStmt, position, value);
+}
+
+void MDSql::bindPreparedText(int position, const char *text, int length)
+{
+    sqlite3_bind_text(this->preparedStmt, position, text, length, SQLITE_STATIC);
+}
+
+void MDSql::bindPreparedNull(int position)
+{
+    sqlite3_bind_null(this->preparedStmt, position);
+}
+
+bool MDSql::execPreparedStmt()
+{
+    bool r = true;
+    int rc = sqlite3_step(this->preparedStmt);
+    if (rc != SQLITE_OK && rc != SQLITE_ROW && rc != SQLITE_DONE)
+    {
+        std::cerr << "MDSql::execPreparedStmt: " << std::endl
+        << "   " << this->preparedStream.str() << std::endl
+        <<"    code: " << rc << " error: " << sqlite3_errmsg(db) << std::endl;
+        r = false;
+    }
+    sqlite3_clear_bindings(this->preparedStmt);
+    sqlite3_reset(this->preparedStmt);
+    return r;
+}
+
 void MDSql::finalizePreparedStmt(void)
 {
 	if (this->preparedStmt != NULL)
@@ -391,14 +447,20 @@ bool MDSql::setObjectValue(const int objId, const MDObject &value)
     sqlite3_reset(stmt);
     bindValue(stmt, 1, value);
     sqlite3_bind_int(stmt, 2, objId);
+    //Only this cell changes, so the cached columns are updated instead of dropped
+    columnCache->updatingInPlace = true;
     rc = sqlite3_step(stmt);
+    columnCache->updatingInPlace = false;
     if (rc != SQLITE_OK && rc != SQLITE_ROW && rc != SQLITE_DONE)
     {
         std::cerr << "MDSql::setObjectValue: " << std::endl
         << "   " << ss.str() << std::endl
         <<"    code: " << rc << " error: " << sqlite3_errmsg(db) << std::endl;
+        invalidateColumns();
         r = false;
     }
+    else
+        columnCache->setValue(objId, value);
 
     return r;
 }
@@ -456,6 +518,11 @@ bool MDSql::initializeInsert(const std::vector<MDLabel> *labels, const std::vect
 	int		length=0;			// # labels.
 	bool	createdOK=true;		// Return value.
 
+	// Bulk insertions run without the hook if no table has cached columns
+	columnCacheMutex.lock();
+	setUpdateHook();
+	columnCacheMutex.unlock();
+
 	// Clear preparedStream.
 	this->preparedStream.str(std::string());
 
@@ -517,6 +584,11 @@ bool MDSql::initializeUpdate( std::vector<MDLabel> labels)
 	// Check there are labels.
 	if (length > 0)
 	{
+		// Bulk updates run without the hook if no table has cached columns
+		columnCacheMutex.lock();
+		setUpdateHook();
+		columnCacheMutex.unlock();
+
 		// Clear preparedStream.
 		this->preparedStream.str(std::string());
 
@@ -580,8 +652,19 @@ bool MDSql::getObjectsValues( std::vector<MDLabel> labels, std::vector<MDObject>
 
 bool MDSql::getObjectValue(const int objId, MDObject  &value)
 {
-    std::stringstream ss;
     MDLabel column = value.label;
+
+    //Columns read many times are served from the columnar cache
+    if (columnCache->enabled)
+    {
+        MDColumnCache::Column *cached = columnCache->getColumn(column);
+        if (cached == NULL && ++(columnCache->cellReads[column]) >= columnCache->loadThreshold)
+            cached = loadColumn(column);
+        if (cached != NULL)
+            return columnCache->getValue(*cached, objId, value);
+    }
+
+    std::stringstream ss;
     sqlite3_stmt * &stmt = myCache->getValueCache[column];
 
     if (stmt == NULL)//prepare stmt if not exists
@@ -645,6 +728,8 @@ void MDSql::selectObjects(std::vector<size_t> &objectsOut, const MDQuery *queryP
 
 size_t MDSql::deleteObjects(const MDQuery *queryPtr)
 {
+    //SQLite does not report the rows removed when the whole table is emptied
+    invalidateColumns();
     std::stringstream ss;
     ss << "DELETE FROM " << tableName(tableId);
     if (queryPtr != NULL)
@@ -1417,6 +1502,8 @@ bool MDSql::sqlCommitTrans()
 
 bool MDSql::dropTable()
 {
+    invalidateColumns();
+    columnCache->loadThreshold = minLoadThreshold;
     std::stringstream ss;
     ss << "DROP TABLE IF EXISTS " << tableName(tableId) << ";";
     return execSingleStmt(ss);
@@ -1424,6 +1511,7 @@ bool MDSql::dropTable()
 
 bool MDSql::createTable(const std::vector<MDLabel> * labelsVector, bool withObjID)
 {
+    invalidateColumns();
     std::stringstream ss;
     ss << "CREATE TABLE " << tableName(tableId) << "(";
     std::string sep = "";
@@ -1452,6 +1540,9 @@ void MDSql::prepareStmt(const std::stringstream &ss, sqlite3_stmt *stmt)
 
 bool MDSql::execSingleStmt(const std::stringstream &ss)
 {
+    columnCacheMutex.lock();
+    setUpdateHook();
+    columnCacheMutex.unlock();
 
     sqlite3_stmt * stmt;
     sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, &zLeftover);
@@ -1642,3 +1733,306 @@ void MDCache::clear()
         addRowStmt = NULL;
     }
 }
+
+/* Value of the first column of the current row of a statement */
+static inline void extractColumnValue(sqlite3_stmt *stmt, double &value)
+{
+    value = sqlite3_column_double(stmt, 0);
+}
+
+static inline void extractColumnValue(sqlite3_stmt *stmt, int &value)
+{
+    value = sqlite3_column_int(stmt, 0);
+}
+
+static inline void extractColumnValue(sqlite3_stmt *stmt, size_t &value)
+{
+    value = sqlite3_column_int(stmt, 0);
+}
+
+static inline void extractColumnValue(sqlite3_stmt *stmt, String &value)
+{
+    const unsigned char *text = sqlite3_column_text(stmt, 0);
+    if (text == NULL)
+        value.clear();
+    else
+        value.assign((const char *)text, sqlite3_column_bytes(stmt, 0));
+}
+
+/* Run a query returning a single column and store it in values */
+template<typename T>
+static bool selectColumnValues(sqlite3 *db, const String &query, std::vector<T> &values)
+{
+    sqlite3_stmt *stmt;
+    const char *leftover;
+    values.clear();
+    if (sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, &leftover) != SQLITE_OK)
+    {
+        std::cerr << "MDSql::getColumnValues: " << query << std::endl
+        << "    error: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        values.push_back(T());
+        extractColumnValue(stmt, values.back());
+    }
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE;
+}
+
+#define COLUMN_VALUES_QUERY(column) \
+    ((String)"SELECT " + MDL::label2StrSql(column) + " FROM " + tableName(tableId) + " ORDER BY objID;")
+
+bool MDSql::getColumnValues(MDLabel column, std::vector<double> &values)
+{
+    return selectColumnValues(db, COLUMN_VALUES_QUERY(column), values);
+}
+
+bool MDSql::getColumnValues(MDLabel column, std::vector<int> &values)
+{
+    return selectColumnValues(db, COLUMN_VALUES_QUERY(column), values);
+}
+
+bool MDSql::getColumnValues(MDLabel column, std::vector<size_t> &values)
+{
+    return selectColumnValues(db, COLUMN_VALUES_QUERY(column), values);
+}
+
+bool MDSql::getColumnValues(MDLabel column, std::vector<String> &values)
+{
+    return selectColumnValues(db, COLUMN_VALUES_QUERY(column), values);
+}
+
+MDColumnCache::Column * MDSql::loadColumn(MDLabel column)
+{
+    std::stringstream ss;
+    sqlite3_stmt *stmt;
+    ss << "SELECT objID, " << MDL::label2StrSql(column)
+    << " FROM " << tableName(tableId) << ";";
+    if (sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, &zLeftover) != SQLITE_OK)
+    {
+        columnCache->cellReads[column] = 0;
+        return NULL;
+    }
+
+    std::vector<size_t> objIds;
+    MDColumnCache::Column values;
+    MDObject value(column);
+    MDLabelType type = MDL::labelType(column);
+    size_t maxObjId = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        size_t objId = sqlite3_column_int(stmt, 0);
+        objIds.push_back(objId);
+        maxObjId = std::max(maxObjId, objId);
+        switch (type)
+        {
+        case LABEL_DOUBLE:
+            values.doubleValues.push_back(sqlite3_column_double(stmt, 1));
+            break;
+        case LABEL_INT:
+        case LABEL_BOOL:
+            extractValue(stmt, 1, value);
+            values.intValues.push_back(type == LABEL_BOOL ? (int)value.data.boolValue : value.data.intValue);
+            break;
+        case LABEL_SIZET:
+            extractValue(stmt, 1, value);
+            values.sizetValues.push_back(value.data.longintValue);
+            break;
+        default:
+            {
+                //Strings are stored as text, vectors are parsed when read
+                const unsigned char *text = sqlite3_column_text(stmt, 1);
+                values.stringValues.push_back(text == NULL ? String() : String((const char *)text));
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    size_t n = objIds.size();
+    if (n == 0 || maxObjId + 1 > maxIndexRatio * n + minLoadThreshold)
+    {
+        columnCache->cellReads[column] = 0;
+        return NULL;
+    }
+
+    //The first loaded column sets the row order, the others are permuted to it
+    MDColumnCache &cache = *columnCache;
+    std::vector<size_t> rows;
+    if (cache.nRows == 0)
+    {
+        cache.rowIndex.assign(maxObjId + 1, -1);
+        for (size_t i = 0; i < n; ++i)
+            cache.rowIndex[objIds[i]] = (int)i;
+        cache.nRows = n;
+        //From now on the modifications of the table must drop the columns
+        columnCacheMutex.lock();
+        ++tablesWithColumns;
+        setUpdateHook();
+        columnCacheMutex.unlock();
+    }
+    else
+    {
+        if (n != cache.nRows || maxObjId >= cache.rowIndex.size())
+        {
+            //Not expected, the index is dropped on every change
+            invalidateColumns();
+            return NULL;
+        }
+        rows.resize(n);
+        for (size_t i = 0; i < n; ++i)
+            rows[i] = cache.rowIndex[objIds[i]];
+    }
+
+    MDColumnCache::Column &cached = cache.columns[column];
+    if (rows.empty())
+        std::swap(cached, values);
+    else
+    {
+        cached.doubleValues.resize(values.doubleValues.size());
+        for (size_t i = 0; i < values.doubleValues.size(); ++i)
+            cached.doubleValues[rows[i]] = values.doubleValues[i];
+        cached.intValues.resize(values.intValues.size());
+        for (size_t i = 0; i < values.intValues.size(); ++i)
+            cached.intValues[rows[i]] = values.intValues[i];
+        cached.sizetValues.resize(values.sizetValues.size());
+        for (size_t i = 0; i < values.sizetValues.size(); ++i)
+            cached.sizetValues[rows[i]] = values.sizetValues[i];
+        cached.stringValues.resize(values.stringValues.size());
+        for (size_t i = 0; i < values.stringValues.size(); ++i)
+            cached.stringValues[rows[i]].swap(values.stringValues[i]);
+    }
+    cache.cellReads.erase(column);
+    return &cached;
+}
+
+void MDSql::invalidateColumns()
+{
+    columnCacheMutex.lock();
+    if (columnCache->clear())
+        --tablesWithColumns;
+    setUpdateHook();
+    columnCacheMutex.unlock();
+}
+
+void MDSql::setUpdateHook()
+{
+    bool needed = tablesWithColumns > 0;
+    if (needed != updateHookSet)
+    {
+        sqlite3_update_hook(db, needed ? updateHook : NULL, NULL);
+        updateHookSet = needed;
+    }
+}
+
+void MDSql::updateHook(void * /*arg*/, int op, const char *dbName,
+                       const char *table, sqlite3_int64 /*rowId*/)
+{
+    static const char prefix[] = "MDTable_";
+    if (strcmp(dbName, "main") || strncmp(table, prefix, sizeof(prefix) - 1))
+        return;
+    int id = atoi(table + sizeof(prefix) - 1);
+    columnCacheMutex.lock();
+    std::map<int, MDSql*>::iterator it = columnCacheTables.find(id);
+    if (it != columnCacheTables.end())
+    {
+        MDColumnCache &cache = *(it->second->columnCache);
+        //The hook itself is removed later, SQLite does not allow it here
+        if (!(cache.updatingInPlace && op == SQLITE_UPDATE) && cache.clear())
+            --tablesWithColumns;
+    }
+    columnCacheMutex.unlock();
+}
+
+MDColumnCache::MDColumnCache()
+{
+    enabled = true;
+    updatingInPlace = false;
+    nRows = 0;
+    loadThreshold = minLoadThreshold;
+}
+
+bool MDColumnCache::clear()
+{
+    if (nRows == 0 && cellReads.empty())
+        return false;
+    bool loaded = nRows > 0;
+    //Tables modified while being read are reloaded only if the cell reads
+    //saved pay for the loading
+    if (nRows > 0)
+        loadThreshold = std::max(minLoadThreshold, nRows / maxIndexRatio);
+    columns.clear();
+    cellReads.clear();
+    rowIndex.clear();
+    nRows = 0;
+    return loaded;
+}
+
+bool MDColumnCache::getValue(const Column &column, size_t objId, MDObject &value) const
+{
+    if (objId >= rowIndex.size() || rowIndex[objId] < 0)
+        return false;
+    size_t row = rowIndex[objId];
+    switch (value.type)
+    {
+    case LABEL_BOOL:
+        value.data.boolValue = column.intValues[row] == 1;
+        break;
+    case LABEL_INT:
+        value.data.intValue = column.intValues[row];
+        break;
+    case LABEL_SIZET:
+        value.data.longintValue = column.sizetValues[row];
+        break;
+    case LABEL_DOUBLE:
+        value.data.doubleValue = column.doubleValues[row];
+        break;
+    case LABEL_STRING:
+        value.data.stringValue->assign(column.stringValues[row]);
+        break;
+    default:
+        {
+            std::stringstream ss(column.stringValues[row]);
+            value.fromStream(ss);
+        }
+    }
+    return true;
+}
+
+void MDColumnCache::setValue(size_t objId, const MDObject &value)
+{
+    std::map<MDLabel, Column>::iterator it = columns.find(value.label);
+    if (it == columns.end() || objId >= rowIndex.size() || rowIndex[objId] < 0)
+        return;
+    //A NULL is stored for values that could not be parsed
+    if (value.failed)
+    {
+        columns.erase(it);
+        return;
+    }
+    Column &column = it->second;
+    size_t row = rowIndex[objId];
+    //Same conversions than binding the value and extracting it from SQLite
+    switch (value.type)
+    {
+    case LABEL_BOOL:
+        column.intValues[row] = value.data.boolValue ? 1 : 0;
+        break;
+    case LABEL_INT:
+        column.intValues[row] = value.data.intValue;
+        break;
+    case LABEL_SIZET:
+        column.sizetValues[row] = (size_t)(int)value.data.longintValue;
+        break;
+    case LABEL_DOUBLE:
+        column.doubleValues[row] = value.data.doubleValue;
+        break;
+    case LABEL_STRING:
+        column.stringValues[row] = *(value.data.stringValue);
+        break;
+    default:
+        column.stringValues[row] = value.toString(false, true);
+    }
+}
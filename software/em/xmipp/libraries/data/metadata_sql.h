@@ -67,6 +67,71 @@ int getBlocksInMetaDataFileDB(const FileName &inFile, StringVector& blockList);
 /*support for the REGEXP operator in sqlite*/
 void sqlite_regexp(sqlite3_context* context, int argc, sqlite3_value** values);
 
+/** Columnar copy of some columns of a metadata table.
+ * Reading a metadata cell by cell costs one SQLite statement per value, so the
+ * columns that are read repeatedly are loaded at once in typed contiguous
+ * arrays, with an index from objId to row. The SQL table is always the
+ * storage of record and is used for queries, aggregates and joins. Any change
+ * made to the table through SQL drops the copy (see MDSql::updateHook), except
+ * the single cell updates of MDSql::setObjectValue, that are also applied here.
+ * The hook is only registered while some table has cached columns, so that
+ * bulk insertions do not pay for it otherwise.
+ */
+class MDColumnCache
+{
+public:
+    /// Values of a cached column, only the array of its type is used
+    struct Column
+    {
+        /// LABEL_DOUBLE
+        std::vector<double> doubleValues;
+        /// LABEL_INT and LABEL_BOOL
+        std::vector<int> intValues;
+        /// LABEL_SIZET
+        std::vector<size_t> sizetValues;
+        /// LABEL_STRING, and vectors in their SQL text form
+        std::vector<String> stringValues;
+    };
+
+    /// Columns are only cached if enabled
+    bool enabled;
+    /// Set during the updates that are applied to the cache
+    bool updatingInPlace;
+    /// Row of each objId, -1 if there is no such object
+    std::vector<int> rowIndex;
+    /// Number of rows, the index is not built if it is 0
+    size_t nRows;
+    /// Cached columns
+    std::map<MDLabel, Column> columns;
+    /// Cell reads of each column not in the cache since the last invalidation
+    std::map<MDLabel, size_t> cellReads;
+    /// Cell reads after which a column is loaded
+    size_t loadThreshold;
+
+    MDColumnCache();
+
+    /** Drop all the cached columns.
+     * Returns true if there were columns loaded.
+     */
+    bool clear();
+
+    /// Cached column of a label, NULL if not in the cache
+    Column * getColumn(MDLabel label)
+    {
+        std::map<MDLabel, Column>::iterator it = columns.find(label);
+        return (it == columns.end()) ? NULL : &(it->second);
+    }
+
+    /** Get a value from a cached column.
+     * Returns false if there is no object with this objId.
+     */
+    bool getValue(const Column &column, size_t objId, MDObject &value) const;
+
+    /** Set a value already written to the table in its cached column, if any.
+     */
+    void setValue(size_t objId, const MDObject &value);
+};
+
 /** This class will manage SQL database interactions.
  * This class is designed to used inside a MetaData.
  */
@@ -155,6 +220,20 @@ private:
      */
     bool setObjectValues( size_t id, const std::vector<MDObject*> columnValues, const std::vector<MDLabel> *desiredLabels=NULL);
 
+    /** Bind a value of the prepared insert (see initializeInsert).
+     * Used by the parsers to insert values without filling a MDObject.
+     * Positions start at 1. The text is not copied, it must remain valid
+     * until execPreparedStmt.
+     */
+    void bindPreparedInt(int position, int value);
+    void bindPreparedDouble(int position, double value);
+    void bindPreparedText(int position, const char *text, int length);
+    void bindPreparedNull(int position);
+
+    /** Execute the prepared statement with the bound values and clear them.
+     */
+    bool execPreparedStmt();
+
     /**Set the value of an object in an specified column.
      */
     bool setObjectValue(const int objId, const MDObject &value);
@@ -298,10 +377,40 @@ private:
     static std::stringstream preparedStream;	// Stream.
     static sqlite3_stmt * preparedStmt;	// SQL statement.
 
+    /** Load a column in the columnar cache.
+     * Returns NULL if the column cannot be cached (for instance, when the
+     * objIds are too sparse for the objId->row index).
+     */
+    MDColumnCache::Column * loadColumn(MDLabel column);
+
+    /** Discard the columnar copy of this table. */
+    void invalidateColumns();
+
+    /** Get the values of a column, sorted by objId, with a single query.
+     * The label type must match the type of the vector.
+     */
+    bool getColumnValues(MDLabel column, std::vector<double> &values);
+    bool getColumnValues(MDLabel column, std::vector<int> &values);
+    bool getColumnValues(MDLabel column, std::vector<size_t> &values);
+    bool getColumnValues(MDLabel column, std::vector<String> &values);
+
+    /** Called by SQLite whenever a row of any table is inserted, updated or
+     * deleted, used to invalidate the columnar copies of modified tables.
+     */
+    static void updateHook(void *arg, int op, const char *dbName,
+                           const char *table, sqlite3_int64 rowId);
+
+    /** Register updateHook if some table has cached columns, and remove it
+     * otherwise. It must not be called while a statement is being stepped,
+     * and columnCacheMutex must be locked.
+     */
+    static void setUpdateHook();
+
     ///Non-static attributes
     int tableId;
     MetaData *myMd;
     MDCache *myCache;
+    MDColumnCache *columnCache;
 
     friend class MDSqlStaticInit;
     friend class MetaData;
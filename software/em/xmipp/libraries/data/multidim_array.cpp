@@ -374,6 +374,64 @@ void MultidimArray< std::complex< double > >::maxIndex(size_t &lmax, int& kmax,
     REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::maxIndex not implemented for complex.");
 }
 
+// Show a single precision complex array ----------------------------------
+template<>
+std::ostream& operator<<(std::ostream& ostrm,
+                         const MultidimArray< std::complex<float> >& v)
+{
+    if (v.xdim == 0)
+        ostrm << "NULL MultidimArray\n";
+    else
+        ostrm << std::endl;
+
+    for (size_t l = 0; l < NSIZE(v); l++)
+    {
+        if (NSIZE(v)>1)
+            ostrm << "Image No. " << l << std::endl;
+        for (int k = STARTINGZ(v); k <= FINISHINGZ(v); k++)
+        {
+            if (ZSIZE(v)>1)
+                ostrm << "Slice No. " << k << std::endl;
+            for (int i = STARTINGY(v); i <= FINISHINGY(v); i++)
+            {
+                for (int j = STARTINGX(v); j <= FINISHINGX(v); j++)
+                    ostrm << A3D_ELEM(v, k, i, j) << ' ';
+                ostrm << std::endl;
+            }
+        }
+    }
+
+    return ostrm;
+}
+
+template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMax(double& minval, double& maxval) const
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::computeDoubleMinMax not implemented for complex.");
+}
+template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMaxRange(double& minval, double& maxval, size_t pos, size_t size) const
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::computeDoubleMinMax not implemented for complex.");
+}
+template<>
+void MultidimArray< std::complex< float > >::rangeAdjust(std::complex< float > minF, std::complex< float > maxF)
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::rangeAdjust not implemented for complex.");
+}
+
+template<>
+double MultidimArray< std::complex< float > >::computeAvg() const
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::computeAvg not implemented for complex.");
+}
+
+template<>
+void MultidimArray< std::complex< float > >::maxIndex(size_t &lmax, int& kmax, int& imax, int& jmax) const
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::maxIndex not implemented for complex.");
+}
+
 template<>
 void MultidimArray<double>::computeAvgStdev(double& avg, double& stddev) const
 {
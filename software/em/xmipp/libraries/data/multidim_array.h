@@ -1366,7 +1366,7 @@ public:
                 mFd = mmapFile(data, nzyxdim);
             }
         }
-        memset(data,0,nzyxdim*sizeof(T));
+        memset((void *)data,0,nzyxdim*sizeof(T));
         nzyxdimAlloc = nzyxdim;
     }
 
@@ -1394,7 +1394,7 @@ public:
             if (data == NULL)
                 REPORT_ERROR(ERR_MEM_NOTENOUGH, "Allocate: No space left");
         }
-        memset(data,0,nzyxdim*sizeof(T));
+        memset((void *)data,0,nzyxdim*sizeof(T));
         nzyxdimAlloc = nzyxdim;
     }
 
@@ -1605,7 +1605,7 @@ public:
             else
                 new_data = new T [NZYXdim];
 
-            memset(new_data,0,NZYXdim*sizeof(T));
+            memset((void *)new_data,0,NZYXdim*sizeof(T));
         }
         catch (std::bad_alloc &)
         {
@@ -4300,7 +4300,7 @@ public:
     {
         if (data == NULL || !sameShape(op))
             resizeNoCopy(op);
-        memset(data,0,nzyxdim*sizeof(T));
+        memset((void *)data,0,nzyxdim*sizeof(T));
     }
 
     /** Initialize to zeros with current size.
@@ -4314,7 +4314,7 @@ public:
      */
     inline void initZeros()
     {
-        memset(data,0,nzyxdim*sizeof(T));
+        memset((void *)data,0,nzyxdim*sizeof(T));
     }
 
     /** Initialize to zeros with a given size.
@@ -4323,7 +4323,7 @@ public:
     {
         if (xdim!=Xdim || ydim!=Ydim || zdim!=Zdim || ndim!=Ndim)
             resize(Ndim, Zdim,Ydim,Xdim,false);
-        memset(data,0,nzyxdim*sizeof(T));
+        memset((void *)data,0,nzyxdim*sizeof(T));
     }
 
     /** Initialize to zeros with a given size.
@@ -4690,7 +4690,7 @@ public:
 
     /** Cumulative Density Function.
      * For each entry in the array, give what is the probability of having a value smaller or equal than this entry.*/
-    void cumlativeDensityFunction(MultidimArray<double> &cdf)
+    void cumlativeDensityFunction(MultidimArray<double> &cdf) const
     {
         MultidimArray<int> indx;
         indexSort(indx);
@@ -5664,6 +5664,18 @@ template<>
 bool operator==(const MultidimArray< std::complex< double > >& op1,
                 const MultidimArray< std::complex< double > >& op2);
 template<>
+std::ostream& operator<<(std::ostream& ostrm, const MultidimArray< std::complex<float> >& v);
+template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMax(double& minval, double& maxval) const;
+template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMaxRange(double& minval, double& maxval, size_t pos, size_t size) const;
+template<>
+void MultidimArray< std::complex< float > >::rangeAdjust(std::complex< float > minF, std::complex< float > maxF);
+template<>
+double MultidimArray< std::complex< float > >::computeAvg() const;
+template<>
+void MultidimArray< std::complex< float > >::maxIndex(size_t &lmax, int& kmax, int& imax, int& jmax) const;
+template<>
 double MultidimArray<double>::interpolatedElement2D(double x, double y, double outside_value) const;
 template<>
 void MultidimArray< std::complex< double > >::getReal(MultidimArray<double> & realImg) const;
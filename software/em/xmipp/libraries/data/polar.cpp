@@ -115,6 +115,23 @@ void rotationalCorrelation(const Polar<std::complex<double> > &M1,
 		DIRECT_A1D_ELEM(angles,i) = (double) i * Kaux;
 }
 
+// Low-pass rings ----------------------------------------------------------
+void lowPassFourierRings(const Polar<std::complex<double> > &in,
+		Polar<std::complex<double> > &out, int ringStep, int nFreq) {
+	out.clear();
+	out.mode = in.mode;
+	out.oversample = in.oversample;
+	for (int iring = 0; iring < in.getRingNo(); iring += ringStep) {
+		const MultidimArray<std::complex<double> > &ring = in.rings[iring];
+		int n = XMIPP_MIN((int) XSIZE(ring), nFreq);
+		MultidimArray<std::complex<double> > lowRing(n);
+		memcpy(MULTIDIM_ARRAY(lowRing), MULTIDIM_ARRAY(ring),
+				n * sizeof(std::complex<double>));
+		out.rings.push_back(lowRing);
+		out.ring_radius.push_back(in.ring_radius[iring] * ringStep);
+	}
+}
+
 // Compute the normalized Polar Fourier transform --------------------------
 void normalizedPolarFourierTransform(const MultidimArray<double> &in,
 		Polar<std::complex<double> > &out, bool flag, int first_ring,
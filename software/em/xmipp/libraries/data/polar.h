@@ -802,6 +802,18 @@ void rotationalCorrelation(const Polar<std::complex<double> > &M1,
                            MultidimArray<double> &angles,
                            RotationalCorrelationAux &aux);
 
+/** Low-pass filter and downsample the Fourier transforms of the rings.
+ * Only one of every ringStep rings is kept, and only the first nFreq
+ * angular frequencies of each of them. The radii of the kept rings are
+ * multiplied by ringStep, so that rotationalCorrelation weights them as
+ * the rings they replace. The rotational correlation of two low-pass
+ * polars needs a local_transformer with 2*(nFreq-1) real samples, that is,
+ * an angular step of 180/(nFreq-1) degrees.
+ */
+void lowPassFourierRings(const Polar<std::complex<double> > &in,
+                         Polar<std::complex<double> > &out,
+                         int ringStep, int nFreq);
+
 /** Compute a normalized polar Fourier transform of the input image.
     If plans is NULL, they are computed and returned. */
 void normalizedPolarFourierTransform(const MultidimArray<double> &in,
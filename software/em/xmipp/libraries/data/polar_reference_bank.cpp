@@ -0,0 +1,422 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#ifndef __MINGW32__
+ #include <sys/mman.h>
+#endif
+#include "polar_reference_bank.h"
+
+#define BANK_MAGIC "XMIPPPRB"
+#define BANK_VERSION 1
+// Bytes of the records mapped together
+#define BANK_WINDOW_BYTES (((size_t)64)<<20)
+
+// Fixed part of the header of the file. It is followed by the radius and
+// number of samples of each ring and by the key
+struct PolarReferenceBankHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t nRings;
+    uint64_t nRefs;
+    uint64_t imgDim;
+    int64_t mode;
+    double oversample;
+    uint64_t recordSize;
+    uint64_t dataOffset;
+    uint64_t keyLength;
+};
+
+// Read or write exactly size bytes at offset, returns false on failure
+static bool readAt(int fd, void *buffer, size_t size, size_t offset)
+{
+    if (lseek(fd, offset, SEEK_SET)==(off_t)-1)
+        return false;
+    char *ptr=(char *)buffer;
+    while (size>0)
+    {
+        ssize_t n=read(fd, ptr, size);
+        if (n<=0)
+            return false;
+        ptr+=n;
+        size-=n;
+    }
+    return true;
+}
+
+static bool writeAt(int fd, const void *buffer, size_t size, size_t offset)
+{
+    if (lseek(fd, offset, SEEK_SET)==(off_t)-1)
+        return false;
+    const char *ptr=(const char *)buffer;
+    while (size>0)
+    {
+        ssize_t n=write(fd, ptr, size);
+        if (n<=0)
+            return false;
+        ptr+=n;
+        size-=n;
+    }
+    return true;
+}
+
+PolarReferenceBank::PolarReferenceBank()
+{
+    fd=-1;
+    writing=false;
+    nRefs=imgDim=ringValues=recordSize=dataOffset=0;
+    mode=FULL_CIRCLES;
+    oversample=1.;
+    recordsPerWindow=maxWindows=1;
+}
+
+PolarReferenceBank::~PolarReferenceBank()
+{
+    try
+    {
+        if (writing)
+            discard();
+        else
+            close();
+    }
+    catch (XmippError &XE)
+    {
+        std::cerr << XE << std::endl;
+    }
+}
+
+void PolarReferenceBank::create(const FileName &fn, const String &key, size_t _nRefs,
+                                const Polar<std::complex<double> > &fPtemplate, size_t _imgDim)
+{
+    close();
+    fnBank=fn;
+    fnTmp=fn+".tmp";
+    nRefs=_nRefs;
+    imgDim=_imgDim;
+    mode=fPtemplate.mode;
+    oversample=fPtemplate.oversample;
+    size_t nRings=fPtemplate.getRingNo();
+    ringRadius=fPtemplate.ring_radius;
+    ringSize.resize(nRings);
+    ringValues=0;
+    for (size_t i=0; i<nRings; ++i)
+    {
+        ringSize[i]=fPtemplate.getSampleNo(i);
+        ringValues+=ringSize[i];
+    }
+    recordSize=sizeof(double)+ringValues*sizeof(std::complex<double>)+imgDim*imgDim*sizeof(double);
+
+    PolarReferenceBankHeader header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,BANK_MAGIC,8);
+    header.version=BANK_VERSION;
+    header.nRings=nRings;
+    header.nRefs=nRefs;
+    header.imgDim=imgDim;
+    header.mode=mode;
+    header.oversample=oversample;
+    header.recordSize=recordSize;
+    header.keyLength=key.size();
+    size_t headerSize=sizeof(header)+nRings*(sizeof(double)+sizeof(uint64_t))+key.size();
+    dataOffset=header.dataOffset=((headerSize+7)/8)*8;
+
+    std::vector<char> buffer(dataOffset,0);
+    char *ptr=&buffer[0];
+    memcpy(ptr,&header,sizeof(header));
+    ptr+=sizeof(header);
+    for (size_t i=0; i<nRings; ++i)
+    {
+        uint64_t samples=ringSize[i];
+        memcpy(ptr,&ringRadius[i],sizeof(double));
+        memcpy(ptr+sizeof(double),&samples,sizeof(uint64_t));
+        ptr+=sizeof(double)+sizeof(uint64_t);
+    }
+    if (key.size()>0)
+        memcpy(ptr,key.c_str(),key.size());
+
+    fd=::open(fnTmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IREAD | S_IWRITE);
+    if (fd==-1)
+        REPORT_ERROR(ERR_IO_NOTOPEN,(String)"Cannot create the reference bank "+fnTmp);
+    writing=true;
+    if (!writeAt(fd,&buffer[0],dataOffset,0) ||
+        ftruncate(fd,dataOffset+nRefs*recordSize)!=0)
+        REPORT_ERROR(ERR_IO_NOWRITE,(String)"Cannot write the reference bank "+fnTmp);
+}
+
+void PolarReferenceBank::setReference(size_t n, const Polar<std::complex<double> > &fP,
+                                      double stddev, const MultidimArray<double> *img)
+{
+    if (!writing)
+        REPORT_ERROR(ERR_IO_NOWRITE,"The reference bank is not being created");
+    if (n>=nRefs)
+        REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS,formatString("Reference %lu is not in the bank",n));
+    if ((size_t)fP.getRingNo()!=ringSize.size())
+        REPORT_ERROR(ERR_MULTIDIM_SIZE,"The reference does not have the rings of the bank");
+    if (imgDim>0 && (img==NULL || MULTIDIM_SIZE(*img)!=imgDim*imgDim))
+        REPORT_ERROR(ERR_MULTIDIM_SIZE,"The reference image does not have the size of the bank");
+
+    std::vector<char> buffer(recordSize);
+    char *ptr=&buffer[0];
+    memcpy(ptr,&stddev,sizeof(double));
+    ptr+=sizeof(double);
+    for (size_t i=0; i<ringSize.size(); ++i)
+    {
+        const MultidimArray<std::complex<double> > &ring=fP.rings[i];
+        if (MULTIDIM_SIZE(ring)!=ringSize[i])
+            REPORT_ERROR(ERR_MULTIDIM_SIZE,"The reference does not have the rings of the bank");
+        memcpy(ptr,MULTIDIM_ARRAY(ring),ringSize[i]*sizeof(std::complex<double>));
+        ptr+=ringSize[i]*sizeof(std::complex<double>);
+    }
+    if (imgDim>0)
+        memcpy(ptr,MULTIDIM_ARRAY(*img),imgDim*imgDim*sizeof(double));
+
+    mutex.lock();
+    bool ok=writeAt(fd,&buffer[0],recordSize,dataOffset+n*recordSize);
+    mutex.unlock();
+    if (!ok)
+        REPORT_ERROR(ERR_IO_NOWRITE,(String)"Cannot write the reference bank "+fnTmp);
+}
+
+bool PolarReferenceBank::open(const FileName &fn, const String &key, size_t maxMappedBytes)
+{
+    close();
+    int fdIn=::open(fn.c_str(), O_RDONLY);
+    if (fdIn==-1)
+        return false;
+
+    // Check that the file is a bank with this key
+    PolarReferenceBankHeader header;
+    struct stat fileStatus;
+    bool ok=readAt(fdIn,&header,sizeof(header),0) &&
+            memcmp(header.magic,BANK_MAGIC,8)==0 &&
+            header.version==BANK_VERSION &&
+            header.keyLength==key.size() &&
+            fstat(fdIn,&fileStatus)==0 &&
+            (size_t)fileStatus.st_size==header.dataOffset+header.nRefs*header.recordSize;
+    std::vector<char> buffer;
+    if (ok)
+    {
+        size_t size=header.nRings*(sizeof(double)+sizeof(uint64_t))+header.keyLength;
+        buffer.resize(size+1);
+        ok=readAt(fdIn,&buffer[0],size,sizeof(header)) &&
+           key.compare(0,key.size(),&buffer[size-header.keyLength],header.keyLength)==0;
+    }
+    if (!ok)
+    {
+        ::close(fdIn);
+        return false;
+    }
+
+    fnBank=fn;
+    fd=fdIn;
+    writing=false;
+    nRefs=header.nRefs;
+    imgDim=header.imgDim;
+    mode=(int)header.mode;
+    oversample=header.oversample;
+    recordSize=header.recordSize;
+    dataOffset=header.dataOffset;
+    ringRadius.resize(header.nRings);
+    ringSize.resize(header.nRings);
+    ringValues=0;
+    const char *ptr=&buffer[0];
+    for (size_t i=0; i<header.nRings; ++i)
+    {
+        uint64_t samples;
+        memcpy(&ringRadius[i],ptr,sizeof(double));
+        memcpy(&samples,ptr+sizeof(double),sizeof(uint64_t));
+        ringSize[i]=samples;
+        ringValues+=samples;
+        ptr+=sizeof(double)+sizeof(uint64_t);
+    }
+    if (recordSize!=sizeof(double)+ringValues*sizeof(std::complex<double>)+imgDim*imgDim*sizeof(double))
+    {
+        close();
+        REPORT_ERROR(ERR_IO_SIZE,(String)"The record size does not match the rings of the reference bank "+fn);
+    }
+
+    recordsPerWindow=std::max((size_t)1,BANK_WINDOW_BYTES/recordSize);
+    maxWindows=std::max((size_t)1,maxMappedBytes/(recordsPerWindow*recordSize));
+    return true;
+}
+
+void PolarReferenceBank::unmapWindows()
+{
+#ifdef XMIPP_MMAP
+    for (std::map<size_t, Window>::iterator it=windows.begin(); it!=windows.end(); ++it)
+        munmap(it->second.map,it->second.size);
+#endif
+    windows.clear();
+    lru.clear();
+}
+
+void PolarReferenceBank::close()
+{
+    unmapWindows();
+    if (fd>=0)
+    {
+        ::close(fd);
+        fd=-1;
+        if (writing && rename(fnTmp.c_str(),fnBank.c_str())!=0)
+            REPORT_ERROR(ERR_IO_NOWRITE,(String)"Cannot rename "+fnTmp+" to "+fnBank);
+    }
+    writing=false;
+}
+
+void PolarReferenceBank::discard()
+{
+    if (!writing)
+        return;
+    ::close(fd);
+    fd=-1;
+    writing=false;
+    unlink(fnTmp.c_str());
+}
+
+const char * PolarReferenceBank::pinRecord(size_t n, std::vector<char> &buffer)
+{
+    size_t offset=dataOffset+n*recordSize;
+#ifdef XMIPP_MMAP
+    size_t w=n/recordsPerWindow;
+    std::map<size_t, Window>::iterator it=windows.find(w);
+    if (it==windows.end())
+    {
+        // Unmap the least recently used window that is not in use
+        if (windows.size()>=maxWindows)
+            for (std::list<size_t>::reverse_iterator itLru=lru.rbegin(); itLru!=lru.rend(); ++itLru)
+            {
+                std::map<size_t, Window>::iterator itOld=windows.find(*itLru);
+                if (itOld->second.users==0)
+                {
+                    munmap(itOld->second.map,itOld->second.size);
+                    lru.erase(itOld->second.lruPosition);
+                    windows.erase(itOld);
+                    break;
+                }
+            }
+
+        // Map the window, its start must be aligned to the page size
+        static size_t pageSize=sysconf(_SC_PAGESIZE);
+        size_t first=dataOffset+w*recordsPerWindow*recordSize;
+        size_t last=dataOffset+std::min(nRefs,(w+1)*recordsPerWindow)*recordSize;
+        Window window;
+        window.start=(first/pageSize)*pageSize;
+        window.size=last-window.start;
+        window.users=0;
+        window.map=(char *)mmap(0,window.size,PROT_READ,MAP_SHARED,fd,window.start);
+        if (window.map==MAP_FAILED)
+            REPORT_ERROR(ERR_MMAP,(String)"Cannot map the reference bank "+fnBank);
+        lru.push_front(w);
+        window.lruPosition=lru.begin();
+        it=windows.insert(std::make_pair(w,window)).first;
+    }
+    else
+        lru.splice(lru.begin(),lru,it->second.lruPosition);
+    ++it->second.users;
+    return it->second.map+(offset-it->second.start);
+#else
+
+    buffer.resize(recordSize);
+    if (!readAt(fd,&buffer[0],recordSize,offset))
+        REPORT_ERROR(ERR_IO_NOREAD,(String)"Cannot read the reference bank "+fnBank);
+    return &buffer[0];
+#endif
+}
+
+void PolarReferenceBank::unpinRecord(size_t n)
+{
+#ifdef XMIPP_MMAP
+    std::map<size_t, Window>::iterator it=windows.find(n/recordsPerWindow);
+    if (--it->second.users==0 && windows.size()>maxWindows)
+    {
+        // The window was mapped while all the others were in use
+        munmap(it->second.map,it->second.size);
+        lru.erase(it->second.lruPosition);
+        windows.erase(it);
+    }
+#endif
+}
+
+void PolarReferenceBank::getReference(size_t n, Polar<std::complex<double> > &fP,
+                                      double &stddev, MultidimArray<double> *img)
+{
+    if (!isOpen())
+        REPORT_ERROR(ERR_IO_NOTOPEN,"The reference bank is not open");
+    if (n>=nRefs)
+        REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS,formatString("Reference %lu is not in the bank",n));
+
+    // Reshape the rings if needed
+    size_t nRings=ringSize.size();
+    bool reshape=(size_t)fP.getRingNo()!=nRings;
+    for (size_t i=0; !reshape && i<nRings; ++i)
+        reshape=MULTIDIM_SIZE(fP.rings[i])!=ringSize[i];
+    if (reshape)
+    {
+        fP.clear();
+        fP.mode=mode;
+        fP.oversample=oversample;
+        fP.ring_radius=ringRadius;
+        fP.rings.resize(nRings);
+        for (size_t i=0; i<nRings; ++i)
+            fP.rings[i].resizeNoCopy(ringSize[i]);
+    }
+    if (img!=NULL && imgDim>0)
+    {
+        img->resizeNoCopy(imgDim,imgDim);
+        img->setXmippOrigin();
+    }
+
+    // The window is only pinned with the mutex locked, the copy is done
+    // without it
+    std::vector<char> buffer;
+    mutex.lock();
+    const char *ptr;
+    try
+    {
+        ptr=pinRecord(n,buffer);
+    }
+    catch (XmippError &XE)
+    {
+        mutex.unlock();
+        throw;
+    }
+    mutex.unlock();
+    memcpy(&stddev,ptr,sizeof(double));
+    ptr+=sizeof(double);
+    for (size_t i=0; i<nRings; ++i)
+    {
+        memcpy(MULTIDIM_ARRAY(fP.rings[i]),ptr,ringSize[i]*sizeof(std::complex<double>));
+        ptr+=ringSize[i]*sizeof(std::complex<double>);
+    }
+    if (img!=NULL && imgDim>0)
+        memcpy(MULTIDIM_ARRAY(*img),ptr,imgDim*imgDim*sizeof(double));
+    mutex.lock();
+    unpinRecord(n);
+    mutex.unlock();
+}
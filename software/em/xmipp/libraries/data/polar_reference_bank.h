@@ -0,0 +1,186 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef POLAR_REFERENCE_BANK_H
+#define POLAR_REFERENCE_BANK_H
+
+#include <list>
+#include <map>
+#include "polar.h"
+#include "xmipp_threads.h"
+
+/// @addtogroup Polar
+//@{
+
+/** Bank of precomputed references on disk.
+ * Each reference is the Fourier transform of its polar rings, its standard
+ * deviation and, optionally, the reference image itself. All references have
+ * the same rings, whose radii and sizes are kept in the header of the file,
+ * so that every reference is a record of fixed size.
+ *
+ * The file is read through memory maps of windows of consecutive records.
+ * At most a given number of bytes are mapped at the same time, and the least
+ * recently used window is unmapped when a new one is needed. Since the maps
+ * are shared, several processes of the same node reading the same bank use
+ * a single copy of the data in the page cache.
+ *
+ * The header also keeps a key provided by the creator (e.g., the name of the
+ * reference stack and the parameters used to compute the rings), and the
+ * bank is only opened if the key matches.
+ *
+ * The bank is created in a temporary file that is renamed when closed, so
+ * that readers never see a partial bank.
+ *
+ * @code
+ * PolarReferenceBank bank;
+ * if (!bank.open(fnBank, key))
+ * {
+ *     bank.create(fnBank, key, Nrefs, fPtemplate, dim);
+ *     for (size_t n=0; n<Nrefs; ++n)
+ *         bank.setReference(n, fP[n], stddev[n], &img[n]);
+ *     bank.close();
+ *     bank.open(fnBank, key);
+ * }
+ * bank.getReference(n, fP, stddev, &img);
+ * @endcode
+ */
+class PolarReferenceBank
+{
+public:
+    /// Empty constructor
+    PolarReferenceBank();
+
+    /** Destructor, a bank being created is discarded.
+     * Errors are printed instead of thrown.
+     */
+    ~PolarReferenceBank();
+
+    /** Create a bank with room for nRefs references.
+     * The rings of all references must have the radii and sizes of fPtemplate.
+     * If imgDim is not 0, an image of imgDim x imgDim pixels is stored with
+     * each reference.
+     */
+    void create(const FileName &fn, const String &key, size_t nRefs,
+                const Polar<std::complex<double> > &fPtemplate, size_t imgDim=0);
+
+    /** Store the reference n of a bank being created.
+     * It can be called concurrently for different references.
+     */
+    void setReference(size_t n, const Polar<std::complex<double> > &fP, double stddev,
+                      const MultidimArray<double> *img=NULL);
+
+    /** Open an existing bank for reading.
+     * Returns false if the file does not exist, it is not a bank or its key
+     * is different from key. An error is reported if the size of its
+     * records does not match its rings. At most maxMappedBytes of the file
+     * are mapped at the same time.
+     */
+    bool open(const FileName &fn, const String &key, size_t maxMappedBytes=((size_t)1)<<30);
+
+    /** Close the bank.
+     * If the bank was being created, its file is renamed to the final name.
+     */
+    void close();
+
+    /** Close a bank being created without keeping it.
+     * The temporary file is removed.
+     */
+    void discard();
+
+    /** Get the reference n.
+     * fP is reshaped if it does not have the rings of the bank. The image is
+     * only copied if img is not NULL and the bank has images. It can be called
+     * concurrently from several threads, the copies are made without locking
+     * the bank.
+     */
+    void getReference(size_t n, Polar<std::complex<double> > &fP, double &stddev,
+                      MultidimArray<double> *img=NULL);
+
+    /// Number of references
+    size_t size() const
+    {
+        return nRefs;
+    }
+
+    /// Size of the images (0 if the bank has no images)
+    size_t getImageDim() const
+    {
+        return imgDim;
+    }
+
+    /// True if the bank is open for reading
+    bool isOpen() const
+    {
+        return fd>=0 && !writing;
+    }
+
+protected:
+    /// Window of the file mapped in memory
+    struct Window
+    {
+        char *map;
+        size_t start, size;
+        // Number of readers copying from the window
+        size_t users;
+        std::list<size_t>::iterator lruPosition;
+    };
+
+    // File names of the bank and of its temporary file
+    FileName fnBank, fnTmp;
+    // File descriptor
+    int fd;
+    // True while the bank is being created
+    bool writing;
+    // Number of references and size of their images
+    size_t nRefs, imgDim;
+    // Rings of all references
+    int mode;
+    double oversample;
+    std::vector<double> ringRadius;
+    std::vector<size_t> ringSize;
+    // Number of complex values of all rings
+    size_t ringValues;
+    // Bytes of a record and offset of the first one
+    size_t recordSize, dataOffset;
+    // Number of records of a window, and maximum number of windows mapped
+    // at the same time (exceeded only while all of them are in use)
+    size_t recordsPerWindow, maxWindows;
+    // Mapped windows and their order of use (most recent first)
+    std::map<size_t, Window> windows;
+    std::list<size_t> lru;
+    // Mutex for the windows
+    Mutex mutex;
+
+    // Pointer to the record n, mapping its window if needed. The window is
+    // kept mapped until unpinRecord is called. When the file is not mapped,
+    // the record is read into buffer. Must be called with the mutex locked
+    const char * pinRecord(size_t n, std::vector<char> &buffer);
+
+    // Release the window of the record n. Must be called with the mutex locked
+    void unpinRecord(size_t n);
+
+    // Unmap all windows
+    void unmapWindows();
+};
+//@}
+#endif
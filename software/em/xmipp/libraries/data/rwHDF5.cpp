@@ -118,7 +118,48 @@ hid_t ImageBase::H5Datatype(DataType datatype)
 
 
 
-int ImageBase::readHDF5(size_t select_img)
+/* Minimum size of the chunk cache of the datasets read */
+#define HDF5_CHUNK_CACHE_SIZE (32*1024*1024)
+/* Number of chunks that fit at least in the chunk cache */
+#define HDF5_CHUNK_CACHE_CHUNKS 4
+
+/* Open a dataset to read. The default chunk cache of HDF5 (1 MB) is smaller
+ * than the chunks of most stacks, so chunks holding several images are read
+ * (and uncompressed) again for each image. Chunked datasets are opened with
+ * a cache that holds several chunks.
+ */
+static hid_t openDatasetHDF5(hid_t fhdf5, const String &dsname)
+{
+    hid_t dataset = H5Dopen2(fhdf5, dsname.c_str(), H5P_DEFAULT);
+    if (dataset < 0)
+        return dataset;
+
+    hid_t cparms = H5Dget_create_plist(dataset);
+    if (H5Pget_layout(cparms) == H5D_CHUNKED)
+    {
+        hsize_t chunkDims[4];
+        int rank = H5Pget_chunk(cparms, 4, chunkDims);
+        hid_t h5datatype = H5Dget_type(dataset);
+        size_t chunkSize = H5Tget_size(h5datatype);
+        H5Tclose(h5datatype);
+        for (int i = 0; i < rank; ++i)
+            chunkSize *= chunkDims[i];
+
+        size_t cacheSize = std::max((size_t)HDF5_CHUNK_CACHE_SIZE, HDF5_CHUNK_CACHE_CHUNKS * chunkSize);
+        // The number of slots should be about 100 times the number of chunks in the cache
+        size_t nSlots = 100 * (cacheSize / chunkSize) + 1;
+
+        hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+        H5Pset_chunk_cache(dapl, nSlots, cacheSize, 1.0);
+        H5Dclose(dataset);
+        dataset = H5Dopen2(fhdf5, dsname.c_str(), dapl);
+        H5Pclose(dapl);
+    }
+    H5Pclose(cparms);
+    return dataset;
+}
+
+int ImageBase::readHDF5(size_t select_img, ImageFHandler* hFile)
 {
     bool isStack = false;
 
@@ -166,10 +207,25 @@ int ImageBase::readHDF5(size_t select_img)
         }
     }
 
-    dataset = H5Dopen2(fhdf5, dsname.c_str(), H5P_DEFAULT);
+    // The dataset is kept open in the file handler, so that its chunk
+    // cache is reused when the following images are read
+    if (hFile != NULL && hFile->dhdf5 >= 0 && hFile->dsname == dsname)
+        dataset = hFile->dhdf5;
+    else
+    {
+        dataset = openDatasetHDF5(fhdf5, dsname);
 
-    if( dataset < 0)
-        REPORT_ERROR(ERR_IO_NOTEXIST, formatString("readHDF5: Dataset '%s' not found",dsname.c_str()));
+        if( dataset < 0)
+            REPORT_ERROR(ERR_IO_NOTEXIST, formatString("readHDF5: Dataset '%s' not found",dsname.c_str()));
+
+        if (hFile != NULL)
+        {
+            if (hFile->dhdf5 >= 0)
+                H5Dclose(hFile->dhdf5);
+            hFile->dhdf5 = dataset;
+            hFile->dsname = dsname;
+        }
+    }
 
     cparms = H5Dget_create_plist(dataset); /* Get properties handle first. */
 
@@ -204,12 +260,14 @@ int ImageBase::readHDF5(size_t select_img)
     }
 
     DataType datatype = datatypeH5(h5datatype);
+    H5Tclose(h5datatype);
     MDMainHeader.setValue(MDL_DATATYPE,(int) datatype);
 
     // Setting isStack depending on provider
     switch (provider.first)
     {
     case MISTRAL: // rank 3 arrays are stacks
+    case XMIPP_H5:
         isStack = true;
         break;
         //    case EMAN: // Images in stack are stored in separated groups
@@ -236,7 +294,13 @@ int ImageBase::readHDF5(size_t select_img)
 
     //Read header only
     if(dataMode == HEADER || (dataMode == _HEADER_ALL && aDim.ndim > 1))
+    {
+        H5Pclose(cparms);
+        H5Sclose(filespace);
+        if (hFile == NULL)
+            H5Dclose(dataset);
         return errCode;
+    }
 
 
     // EMAN stores each image in a separate dataset
@@ -252,7 +316,13 @@ int ImageBase::readHDF5(size_t select_img)
     MD.resize(imgEnd - imgStart,MDL::emptyHeader);
 
     if (dataMode < DATA)   // Don't read  data if not necessary but read the header
+    {
+        H5Pclose(cparms);
+        H5Sclose(filespace);
+        if (hFile == NULL)
+            H5Dclose(dataset);
         return errCode;
+    }
 
     if ( H5Pget_layout(cparms) == H5D_CONTIGUOUS ) //We can read it directly
         readData(fimg, select_img, datatype, 0);
@@ -262,70 +332,161 @@ int ImageBase::readHDF5(size_t select_img)
         //if memory already allocated use it (no resize allowed)
         mdaBase->coreAllocateReuse();
 
-        hid_t       memspace;
-
         hsize_t offset[4]; // Hyperslab offset in the file
         hsize_t  count[4]; // Size of the hyperslab in the file
 
-        // Define the offset and count of the hyperslab to be read.
-
-        switch (rank)
+        // The whole range of images is read with a single hyperslab, so
+        // that HDF5 reads each chunk once and in the order of the file
+        for (int i = 0; i < rank; ++i)
         {
-        case 4:
-            count[0] = 1;
-        case 3:
-            //            if (stack)
-            count[rank-3] = aDim.zdim;
-            offset[rank-2]  = 0;
-        case 2:
-            count[rank-2]  = aDim.ydim;
-            offset[rank-2]  = 0;
-            break;
+            offset[i] = 0;
+            count[i] = dims[i];
         }
-        count[rank-1]  = aDim.xdim;
-        offset[rank-1]  = 0;
-
-        aDim.xdim = dims[rank-1];
-        aDim.ydim = (rank>1)?dims[rank-2]:1;
-        aDim.zdim = (rank == 4)?dims[1]:1;
-        // size_t nDimFile = (rank>2)?dims[0]:1 ;
-
-        // Define the memory space to read a hyperslab.
-        memspace = H5Screate_simple(rank,count,NULL);
-
-        size_t data = (size_t) this->mdaBase->getArrayPointer();
-        size_t pad = aDim.zyxdim*gettypesize(myT());
-
-
-        for (size_t idx = imgStart, imN = 0; idx < imgEnd; ++idx, ++imN)
+        if (rank > 3 || (rank == 3 && isStack))
         {
+            offset[0] = imgStart;
+            count[0] = imgEnd - imgStart;
+        }
 
-            // Set the offset of the hyperslab to be read
-            offset[0] = idx;
+        if ( H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
+                                 count, NULL) < 0 )
+            REPORT_ERROR(ERR_IO_NOREAD, formatString("readHDF5: Error selecting hyperslab %d from filename %s",
+                         imgStart, filename.c_str()));
 
-            if ( H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
-                                     count, NULL) < 0 )
-                REPORT_ERROR(ERR_IO_NOREAD, formatString("readHDF5: Error selecting hyperslab %d from filename %s",
-                             imgStart, filename.c_str()));
+        // Define the memory space to read the hyperslab
+        hid_t memspace = H5Screate_simple(rank,count,NULL);
 
-            //            movePointerTo(ALL_SLICES,imN);
-            // Read
-            if ( H5Dread(dataset, H5Datatype(myT()), memspace, filespace,
-                         H5P_DEFAULT, (void*)(data + pad*imN)) < 0 )
-                REPORT_ERROR(ERR_IO_NOREAD,formatString("readHDF5: Error reading hyperslab %d from filename %s",
-                                                        imgStart, filename.c_str()));
-        }
+        if ( H5Dread(dataset, H5Datatype(myT()), memspace, filespace,
+                     H5P_DEFAULT, this->mdaBase->getArrayPointer()) < 0 )
+            REPORT_ERROR(ERR_IO_NOREAD,formatString("readHDF5: Error reading hyperslab %d from filename %s",
+                                                    imgStart, filename.c_str()));
         H5Sclose(memspace);
     }
 
     H5Pclose(cparms);
     H5Sclose(filespace);
-    H5Dclose(dataset);
+    if (hFile == NULL)
+        H5Dclose(dataset);
 
     return errCode;
 }
 
+/* Deflate level of the written datasets, 0 is no compression */
+static int compressionLevelHDF5()
+{
+    const char *level = getenv("XMIPP_HDF5_DEFLATE");
+    if (level == NULL)
+        return 0;
+    int value = textToInteger(level);
+    if (value < 0 || value > 9)
+        REPORT_ERROR(ERR_VALUE_INCORRECT, "writeHDF5: XMIPP_HDF5_DEFLATE must be between 0 and 9.");
+    return value;
+}
+
 int ImageBase::writeHDF5(size_t select_img, bool isStack, int mode, String bitDepth, CastWriteMode castMode)
 {
-    REPORT_ERROR(ERR_NOT_IMPLEMENTED, "writeHDF5: Not implemented yet.");
+    ArrayDim aDim;
+    mdaBase->getDimensions(aDim);
+
+    DataType wDType;
+    if (bitDepth == "" || bitDepth == "default")
+        wDType = myT();
+    else
+        wDType = datatypeRAW(bitDepth);
+    hid_t h5memType = H5Datatype(myT());
+    hid_t h5fileType = H5Datatype(wDType);
+
+    String dsname = filename.getBlockName();
+    if (dsname.empty())
+        dsname = H5ProviderMap.find("Xmipp")->second.second;
+
+    // Images are stored as n x y x x arrays, volumes as n x z x y x x
+    int rank = (aDim.zdim > 1) ? 4 : 3;
+    hsize_t dims[4], maxDims[4], chunkDims[4];
+    dims[rank-1] = chunkDims[rank-1] = aDim.xdim;
+    dims[rank-2] = chunkDims[rank-2] = aDim.ydim;
+    if (rank == 4)
+        dims[1] = chunkDims[1] = aDim.zdim;
+    for (int i = 1; i < rank; ++i)
+        maxDims[i] = dims[i];
+    maxDims[0] = H5S_UNLIMITED;
+    chunkDims[0] = 1; // One chunk per image
+
+    hid_t dataset = -1;
+    if (mode != WRITE_OVERWRITE && H5Lexists(fhdf5, dsname.c_str(), H5P_DEFAULT) > 0)
+        dataset = H5Dopen2(fhdf5, dsname.c_str(), H5P_DEFAULT);
+
+    size_t nDimFile = 0;
+    if (dataset >= 0)
+    {
+        hid_t filespace = H5Dget_space(dataset);
+        hsize_t fileDims[4];
+        int fileRank = H5Sget_simple_extent_dims(filespace, fileDims, NULL);
+        H5Sclose(filespace);
+        if (fileRank != rank)
+            REPORT_ERROR(ERR_MULTIDIM_SIZE, formatString("writeHDF5: dataset '%s' of %s has a different number of dimensions",
+                         dsname.c_str(), filename.c_str()));
+        nDimFile = fileDims[0];
+    }
+
+    // First image to be written
+    size_t imgStart;
+    if (mode == WRITE_APPEND)
+        imgStart = nDimFile;
+    else
+        imgStart = (select_img == ALL_IMAGES) ? 0 : IMG_INDEX(select_img);
+    dims[0] = std::max(nDimFile, imgStart + aDim.ndim);
+
+    if (dataset < 0)
+    {
+        hid_t cparms = H5Pcreate(H5P_DATASET_CREATE);
+        H5Pset_chunk(cparms, rank, chunkDims);
+        int level = compressionLevelHDF5();
+        if (level > 0)
+        {
+            H5Pset_shuffle(cparms);
+            H5Pset_deflate(cparms, level);
+        }
+        hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+        H5Pset_create_intermediate_group(lcpl, 1);
+        hid_t filespace = H5Screate_simple(rank, dims, maxDims);
+
+        dataset = H5Dcreate2(fhdf5, dsname.c_str(), h5fileType, filespace, lcpl, cparms, H5P_DEFAULT);
+
+        H5Sclose(filespace);
+        H5Pclose(lcpl);
+        H5Pclose(cparms);
+        if (dataset < 0)
+            REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeHDF5: Cannot create dataset '%s' in %s",
+                         dsname.c_str(), filename.c_str()));
+    }
+    else if (dims[0] > nDimFile && H5Dset_extent(dataset, dims) < 0)
+        REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeHDF5: Cannot extend dataset '%s' in %s",
+                     dsname.c_str(), filename.c_str()));
+
+    // All the images are written with a single hyperslab
+    hsize_t offset[4], count[4];
+    for (int i = 0; i < rank; ++i)
+    {
+        offset[i] = 0;
+        count[i] = dims[i];
+    }
+    offset[0] = imgStart;
+    count[0] = aDim.ndim;
+
+    hid_t filespace = H5Dget_space(dataset);
+    hid_t memspace = H5Screate_simple(rank, count, NULL);
+    H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL, count, NULL);
+
+    herr_t status = H5Dwrite(dataset, h5memType, memspace, filespace, H5P_DEFAULT,
+                             mdaBase->getArrayPointer());
+
+    H5Sclose(memspace);
+    H5Sclose(filespace);
+    H5Dclose(dataset);
+
+    if (status < 0)
+        REPORT_ERROR(ERR_IO_NOWRITE, formatString("writeHDF5: Error writing images to %s", filename.c_str()));
+
+    return 0;
 }
@@ -44,10 +44,16 @@ hid_t H5Datatype(DataType datatype);
 
 
 /** Read Images from HDF5 container files.
+  * All the images requested are read with a single hyperslab. If hFile is
+  * given, the dataset is kept open in it to be reused by the next reads.
   */
-int readHDF5(size_t select_img);
+int readHDF5(size_t select_img, ImageFHandler* hFile = NULL);
 
 /** Write Images to HDF5 container files.
+  * Images are written in a dataset (/Xmipp/images by default) of n x y x x
+  * elements (n x z x y x x for volumes) with one chunk per image, that is
+  * extended when appending. The chunks are compressed with deflate if the
+  * environment variable XMIPP_HDF5_DEFLATE is set to the level (1-9).
   */
 int writeHDF5(size_t select_img, bool isStack=false, int mode=WRITE_OVERWRITE, String bitDepth="", CastWriteMode castMode = CW_CAST);
 
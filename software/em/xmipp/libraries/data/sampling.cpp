@@ -22,8 +22,352 @@
  *  All comments concerning this program package may be sent to the
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
+#include <algorithm>
+#include <limits>
 #include "sampling.h"
 #include "matrix2d.h"
+#include "xmipp_threads.h"
+
+// Maximum number of directions in a leaf of the DirectionKDTree
+#define DIRECTION_KDTREE_LEAF 8
+
+/* Empty constructor ------------------------------------------------------- */
+DirectionKDTree::DirectionKDTree()
+{}
+
+/* Order of the directions along one axis */
+struct DirectionAxisOrder
+{
+    const double *coords;
+    int axis;
+    bool operator()(size_t i, size_t j) const
+    {
+        return coords[3*i+axis]<coords[3*j+axis];
+    }
+};
+
+/* Build ------------------------------------------------------------------- */
+void DirectionKDTree::build(const std::vector<Matrix1D<double> > &directions)
+{
+    size_t N=directions.size();
+    std::vector<double> allCoords(3*N);
+    index.resize(N);
+    for (size_t i=0; i<N; ++i)
+    {
+        const Matrix1D<double> &direction=directions[i];
+        allCoords[3*i]=XX(direction);
+        allCoords[3*i+1]=YY(direction);
+        allCoords[3*i+2]=ZZ(direction);
+        index[i]=i;
+    }
+    nodes.clear();
+    if (N>0)
+        buildNode(0,N,allCoords);
+
+    // Keep the directions of each leaf together
+    coords.resize(3*N);
+    for (size_t i=0; i<N; ++i)
+        for (int a=0; a<3; ++a)
+            coords[3*i+a]=allCoords[3*index[i]+a];
+}
+
+int DirectionKDTree::buildNode(size_t first, size_t last, const std::vector<double> &allCoords)
+{
+    Node node;
+    node.first=first;
+    node.last=last;
+    node.left=node.right=-1;
+    for (int a=0; a<3; ++a)
+        node.minCorner[a]=node.maxCorner[a]=allCoords[3*index[first]+a];
+    for (size_t i=first+1; i<last; ++i)
+        for (int a=0; a<3; ++a)
+        {
+            double x=allCoords[3*index[i]+a];
+            node.minCorner[a]=XMIPP_MIN(node.minCorner[a],x);
+            node.maxCorner[a]=XMIPP_MAX(node.maxCorner[a],x);
+        }
+    int n=(int)nodes.size();
+    nodes.push_back(node);
+
+    if (last-first>DIRECTION_KDTREE_LEAF)
+    {
+        // Split at the median of the longest side of the box
+        DirectionAxisOrder order;
+        order.coords=&allCoords[0];
+        order.axis=0;
+        for (int a=1; a<3; ++a)
+            if (node.maxCorner[a]-node.minCorner[a]>
+                node.maxCorner[order.axis]-node.minCorner[order.axis])
+                order.axis=a;
+        size_t middle=(first+last)/2;
+        std::nth_element(index.begin()+first,index.begin()+middle,
+                         index.begin()+last,order);
+        int left=buildNode(first,middle,allCoords);
+        int right=buildNode(middle,last,allCoords);
+        nodes[n].left=left;
+        nodes[n].right=right;
+    }
+    return n;
+}
+
+/* Bound of the dot product ------------------------------------------------ */
+double DirectionKDTree::boundDot(const Node &node, const double *u) const
+{
+    // The maximum of a linear function in a box is at one of its corners.
+    // Products and sums are rounded monotonically, so the bound is never
+    // smaller than the dot product computed for any direction of the box
+    double bound=0;
+    for (int a=0; a<3; ++a)
+        bound+=u[a]*(u[a]>=0 ? node.maxCorner[a] : node.minCorner[a]);
+    return bound;
+}
+
+/* Closest direction ------------------------------------------------------- */
+int DirectionKDTree::findClosest(const Matrix1D<double> &u, double &dot) const
+{
+    int best=-1;
+    dot=-std::numeric_limits<double>::infinity();
+    if (!nodes.empty())
+        findClosest(0,MATRIX1D_ARRAY(u),best,dot);
+    return best;
+}
+
+void DirectionKDTree::findClosest(int n, const double *u, int &best, double &bestDot) const
+{
+    const Node &node=nodes[n];
+    if (node.left<0)
+    {
+        for (size_t i=node.first; i<node.last; ++i)
+        {
+            const double *p=&coords[3*i];
+            double dot=0;
+            dot+=u[0]*p[0];
+            dot+=u[1]*p[1];
+            dot+=u[2]*p[2];
+            int candidate=(int)index[i];
+            if (dot>bestDot || (dot==bestDot && candidate<best))
+            {
+                best=candidate;
+                bestDot=dot;
+            }
+        }
+        return;
+    }
+
+    // Visit first the child that may have the largest dot product. A child
+    // whose bound equals the best dot product may still have a tie with
+    // a lower index
+    int first=node.left, second=node.right;
+    double boundFirst=boundDot(nodes[first],u);
+    double boundSecond=boundDot(nodes[second],u);
+    if (boundSecond>boundFirst)
+    {
+        std::swap(first,second);
+        std::swap(boundFirst,boundSecond);
+    }
+    if (boundFirst>=bestDot)
+        findClosest(first,u,best,bestDot);
+    if (boundSecond>=bestDot)
+        findClosest(second,u,best,bestDot);
+}
+
+/* Directions inside a cone ------------------------------------------------ */
+void DirectionKDTree::findInsideCone(const Matrix1D<double> &u, double cosRadius,
+                                     std::vector<size_t> &result) const
+{
+    result.clear();
+    if (!nodes.empty())
+        findInsideCone(0,MATRIX1D_ARRAY(u),cosRadius,result);
+    std::sort(result.begin(),result.end());
+}
+
+void DirectionKDTree::findInsideCone(int n, const double *u, double cosRadius,
+                                     std::vector<size_t> &result) const
+{
+    const Node &node=nodes[n];
+    if (boundDot(node,u)<=cosRadius)
+        return;
+    if (node.left<0)
+    {
+        for (size_t i=node.first; i<node.last; ++i)
+        {
+            const double *p=&coords[3*i];
+            double dot=0;
+            dot+=u[0]*p[0];
+            dot+=u[1]*p[1];
+            dot+=u[2]*p[2];
+            if (dot>cosRadius)
+                result.push_back(index[i]);
+        }
+    }
+    else
+    {
+        findInsideCone(node.left,u,cosRadius,result);
+        findInsideCone(node.right,u,cosRadius,result);
+    }
+}
+
+/* Data shared by the threads that look for the closest sampling points and
+   the neighbors of the experimental images */
+struct SamplingQueryThreads
+{
+    Sampling *sampling;
+    // Index of the directions where the search is done
+    DirectionKDTree tree;
+    WorkStealingTaskDistributor *distributor;
+    bool onlyWinner;
+    // Closest sampling point of each experimental image, and the projection
+    // direction (by L and R) of the image closest to it
+    std::vector<int> winner, winnerExp;
+    // Sampling points closer to the experimental data than the neighborhood
+    std::vector<char> close;
+};
+
+// Experimental images (or sampling points) given to a thread at a time
+#define SAMPLING_QUERY_BLOCK 16
+
+/* Run a query of nTasks tasks with the threads of the sampling. The cost
+   of each task depends on the number of neighbors, so that the threads
+   steal work from each other */
+static void runSamplingQuery(ThreadFunction function, SamplingQueryThreads &data, size_t nTasks)
+{
+    if (nTasks==0)
+        return;
+    int nThreads=XMIPP_MAX(data.sampling->numberOfThreads,1);
+    WorkStealingTaskDistributor distributor(nTasks,XMIPP_MIN(nTasks,SAMPLING_QUERY_BLOCK),nThreads);
+    data.distributor=&distributor;
+    if (nThreads>1)
+    {
+        ThreadManager thMgr(nThreads,&data);
+        thMgr.run(function);
+    }
+    else
+    {
+        ThreadArgument thArg;
+        thArg.thread_id=0;
+        thArg.workClass=&data;
+        function(thArg);
+    }
+    data.distributor=NULL;
+}
+
+/* Closest sampling point to each experimental image */
+static void threadClosestSamplingPoint(ThreadArgument &thArg)
+{
+    SamplingQueryThreads &data=*((SamplingQueryThreads *)thArg.workClass);
+    const Sampling &sampling=*(data.sampling);
+    size_t Nsym=sampling.R_repository.size();
+    size_t first, last;
+    double dot;
+    while (data.distributor->getTasks(thArg.thread_id,first,last))
+        for (size_t l=first; l<=last; ++l)
+        {
+            // The first symmetric direction wins in case of tie
+            double winnerDot=-2;
+            int winner=-1, winnerExp=-1;
+            for (size_t k=0, i=l*Nsym; k<Nsym; ++k, ++i)
+            {
+                int j=data.tree.findClosest(sampling.exp_data_projection_direction_by_L_R[i],dot);
+                if (j>=0 && dot>winnerDot)
+                {
+                    winnerDot=dot;
+                    winner=j;
+                    winnerExp=(int)i;
+                }
+            }
+            data.winner[l]=winner;
+            data.winnerExp[l]=winnerExp;
+        }
+}
+
+/* Closest sampling point to all experimental images, in data.winner */
+static void findClosestSamplingPoints(SamplingQueryThreads &data)
+{
+    const Sampling &sampling=*(data.sampling);
+    size_t Nsym=sampling.R_repository.size();
+    size_t Nimages=(Nsym==0) ? 0 : sampling.exp_data_projection_direction_by_L_R.size()/Nsym;
+    data.tree.build(sampling.no_redundant_sampling_points_vector);
+    data.winner.resize(Nimages,-1);
+    data.winnerExp.resize(Nimages,-1);
+    runSamplingQuery(threadClosestSamplingPoint,data,Nimages);
+}
+
+/* Sampling points in the neighborhood of each experimental image */
+static void threadComputeNeighbors(ThreadArgument &thArg)
+{
+    SamplingQueryThreads &data=*((SamplingQueryThreads *)thArg.workClass);
+    Sampling &sampling=*(data.sampling);
+    size_t Nsym=sampling.R_repository.size();
+    std::vector<size_t> inside;
+    size_t first, last, done=0;
+    size_t nThreads=XMIPP_MAX(sampling.numberOfThreads,1);
+    double dot;
+    while (data.distributor->getTasks(thArg.thread_id,first,last))
+    {
+        // The blocks of a thread are not consecutive, the progress is
+        // estimated from the images processed by the first thread
+        if (thArg.thread_id==0 && sampling.verbose)
+            progress_bar(XMIPP_MIN(done*nThreads,sampling.my_neighbors.size())*Nsym);
+        done+=last-first+1;
+        for (size_t l=first; l<=last; ++l)
+        {
+            std::vector<size_t> &neighbors=sampling.my_neighbors[l];
+#ifdef MYPSI
+
+            std::vector<double> &neighbors_psi=sampling.my_neighbors_psi[l];
+#endif
+
+            for (size_t k=0, i=l*Nsym; k<Nsym; ++k, ++i)
+            {
+                const Matrix1D<double> &direction=sampling.exp_data_projection_direction_by_L_R[i];
+                if (data.onlyWinner)
+                {
+                    // Only the closest sampling point of each symmetric
+                    // direction, if it is in the neighborhood
+                    int j=data.tree.findClosest(direction,dot);
+                    if (j<0 || dot<=sampling.cos_neighborhood_radius)
+                        continue;
+                    inside.assign(1,(size_t)j);
+                }
+                else
+                    data.tree.findInsideCone(direction,sampling.cos_neighborhood_radius,inside);
+                for (size_t n=0; n<inside.size(); ++n)
+                {
+                    size_t neighbor=sampling.no_redundant_sampling_points_index[inside[n]];
+                    //same sampling point should appear only once
+                    //note that psi recorded here may be different from psi
+                    //recorded in _closest_sampling_points because
+                    //may refer to a different sampling point
+                    //in fact every point is degenerated
+                    if (!data.onlyWinner && k>0 &&
+                        std::find(neighbors.begin(),neighbors.end(),neighbor)!=neighbors.end())
+                        continue;
+                    neighbors.push_back(neighbor);
+#ifdef MYPSI
+
+                    neighbors_psi.push_back(sampling.exp_data_projection_direction_by_L_R_psi[i]);
+#endif
+
+                }
+            }
+        }
+    }
+}
+
+/* Sampling points closer to the experimental data than the neighborhood */
+static void threadNearExperimentalData(ThreadArgument &thArg)
+{
+    SamplingQueryThreads &data=*((SamplingQueryThreads *)thArg.workClass);
+    const Sampling &sampling=*(data.sampling);
+    size_t first, last;
+    double dot;
+    while (data.distributor->getTasks(thArg.thread_id,first,last))
+        for (size_t i=first; i<=last; ++i)
+        {
+            int j=data.tree.findClosest(sampling.no_redundant_sampling_points_vector[i],dot);
+            data.close[i]=(j>=0 && dot>sampling.cos_neighborhood_radius);
+        }
+}
 
 /* Default Constructor */
 Sampling::Sampling()
@@ -90,6 +434,7 @@ Sampling::Sampling()
     exp_data_fileNames.clear();
 
     verbose=1;
+    numberOfThreads=1;
     //#define DEBUG1
 #ifdef  DEBUG1
 
@@ -1698,144 +2043,37 @@ void Sampling::readSamplingFile(const FileName &fn_base,
 
 void Sampling::computeNeighbors(bool only_winner)
 {
-
-    double my_dotProduct;
-    double winner_dotProduct;
-    Matrix2D<double>  L(4, 4), R(4, 4);
-    std::vector<size_t>  aux_neighbors;
-    bool new_reference=true;
+    // calculate some sizes only once
+    size_t exp_data_projection_direction_by_L_R_size = exp_data_projection_direction_by_L_R.size();
+    size_t Nimages = R_repository.size()==0 ? 0 :
+                     exp_data_projection_direction_by_L_R_size / R_repository.size();
     my_neighbors.clear();
+    my_neighbors.resize(Nimages);
 #ifdef MYPSI
-    std::vector<double> aux_neighbors_psi;
+
     my_neighbors_psi.clear();
+    my_neighbors_psi.resize(Nimages);
 #endif
 
-    // calculate some sizes only once
-    size_t exp_data_projection_direction_by_L_R_size = exp_data_projection_direction_by_L_R.size();
-    size_t no_redundant_sampling_points_vector_size = no_redundant_sampling_points_vector.size();
-
     if (verbose)
     {
         std::cout << "Find valid sampling points based on the neighborhood" <<std::endl;
         init_progress_bar(exp_data_projection_direction_by_L_R_size);
     }
-    size_t ratio = exp_data_projection_direction_by_L_R_size / 60;
-    ratio = XMIPP_MAX(ratio, 1);
 
-    for(size_t j = 0; j < exp_data_projection_direction_by_L_R_size;)
+    if (cos_neighborhood_radius <= -1.0)
     {
-        if ((j%ratio) == 0 && verbose)
-            progress_bar(j);
-
-#ifdef MYPSI
-
-        aux_neighbors_psi.clear();
-#endif
-
-        aux_neighbors.clear();
-    	if (cos_neighborhood_radius <= -1.0)
-    	{
-    		aux_neighbors=no_redundant_sampling_points_index;
-    		j+=R_repository.size();
-    	}
-    	else
-    	{
-			size_t * aux_neighborsArray = NULL;
-			for (size_t k = 0; k < R_repository.size(); k++,j++)
-			{
-				winner_dotProduct = -1.;
-				for (size_t i = 0; i < no_redundant_sampling_points_vector_size; ++i)
-				{
-					my_dotProduct = dotProduct(no_redundant_sampling_points_vector[i],
-											   exp_data_projection_direction_by_L_R[j]);
-
-					if (my_dotProduct > cos_neighborhood_radius)
-					{
-						if(aux_neighbors.size()==0)
-						{
-							aux_neighbors.push_back(no_redundant_sampling_points_index[i]);
-							winner_dotProduct=my_dotProduct;
-
-	#ifdef MYPSI
-
-							aux_neighbors_psi.push_back(exp_data_projection_direction_by_L_R_psi[j]);
-	#endif
-
-						}
-						else
-						{
-							new_reference = true;
-							if(only_winner)
-							{
-								if(winner_dotProduct<my_dotProduct)
-								{
-									if(winner_dotProduct!=-1)
-										aux_neighbors.pop_back();
-	#ifdef MYPSI
-
-									if(winner_dotProduct!=-1)
-										aux_neighbors_psi.pop_back();
-	#endif
-
-									winner_dotProduct=my_dotProduct;
-								}
-								else
-								{
-									new_reference=false;
-								}
-							}
-							else
-							{
-								//precalculate size saves time here but
-								//not in the whole loop
-								aux_neighborsArray =  &aux_neighbors[0];
-								size_t _size = aux_neighbors.size();
-								//std::cerr << "DEBUG_JM: no_redundant_sampling_points_index[i]: " << no_redundant_sampling_points_index[i] << std::endl;
-								// for (size_t kkk = 0; kkk < aux_neighbors.size(); ++kkk)
-								//   std::cerr << aux_neighbors[kkk] << " ";
-								for( size_t l=0;l<  _size;l++)
-								{
-									//if (aux_neighbors[l]==i)
-									if (aux_neighborsArray[l]==no_redundant_sampling_points_index[i])
-									{
-										new_reference=false;
-										break;
-									}
-								}
-								//std::cerr << "DEBUG_JM: new_reference: " << new_reference << std::endl;
-							}
-							if (new_reference)
-							{
-								//std::cerr << formatString("DEBUG_JM: j %lu k %lu i %lu ", j, k, i) << std::endl;
-								aux_neighbors.push_back(no_redundant_sampling_points_index[i]);
-
-								//for (size_t kkk = 0; kkk < aux_neighbors.size(); ++kkk)
-								//  std::cerr << aux_neighbors[kkk] << " ";
-								// std::cerr << std::endl;
-
-	#ifdef MYPSI
-
-								aux_neighbors_psi.push_back(exp_data_projection_direction_by_L_R_psi[j]);
-	#endif
-
-							}
-						}
-						//same sampling point should appear only once
-						//note that psi recorded here may be different from psi
-						//recorded in _closest_sampling_points because
-						//may refer to a different sampling point
-						//in fact every point is degenerated
-					}
-				}//for i;
-			}//for k
-    	}
-        my_neighbors.push_back(aux_neighbors);
-#ifdef MYPSI
-
-        my_neighbors_psi.push_back(aux_neighbors_psi);
-#endif
-
-    }//for j
+        for (size_t l = 0; l < Nimages; l++)
+            my_neighbors[l]=no_redundant_sampling_points_index;
+    }
+    else
+    {
+        SamplingQueryThreads data;
+        data.sampling=this;
+        data.onlyWinner=only_winner;
+        data.tree.build(no_redundant_sampling_points_vector);
+        runSamplingQuery(threadComputeNeighbors,data,Nimages);
+    }
     if (verbose)
         progress_bar(exp_data_projection_direction_by_L_R_size);
 
@@ -1911,31 +2149,28 @@ void Sampling::computeNeighbors(bool only_winner)
 
 void Sampling::removePointsFarAwayFromExperimentalData()
 {
-    double my_dotProduct;
-    Matrix1D<double>  row(3),direction(3);
-    Matrix2D<double>  L(4, 4), R(4, 4);
+    if (no_redundant_sampling_points_vector.empty())
+        return;
 
-    size_t my_end = no_redundant_sampling_points_vector.size() - 1;
+    SamplingQueryThreads data;
+    data.sampling=this;
+    data.tree.build(exp_data_projection_direction_by_L_R);
+    data.close.resize(no_redundant_sampling_points_vector.size(),0);
+    runSamplingQuery(threadNearExperimentalData,data,data.close.size());
 
+    size_t my_end = no_redundant_sampling_points_vector.size() - 1;
     for (size_t i = 0; i <= my_end; i++)
     {
-        bool my_delete=true;
-        for (size_t j=0; my_delete && j< exp_data_projection_direction_by_L_R.size();j++)
-        {
-            my_dotProduct = dotProduct(no_redundant_sampling_points_vector[i],
-                                       exp_data_projection_direction_by_L_R[j]);
-            if (my_dotProduct > cos_neighborhood_radius)
-                my_delete=false;
-        }//for j
-        if(my_delete)
+        if(!data.close[i])
         {
             REMOVE_LAST(no_redundant_sampling_points_vector);
             REMOVE_LAST(no_redundant_sampling_points_angles);
             REMOVE_LAST(no_redundant_sampling_points_index);
+            REMOVE_LAST(data.close);
 
             --my_end;
             --i;//since a point has been swaped we should repeat the same index
-        }// if(my_delete)
+        }// if(!close)
     }//for i end
     //#define CHIMERA
 #ifdef CHIMERA
@@ -1975,16 +2210,10 @@ void Sampling::findClosestSamplingPoint(const FileName &FnexperimentalImages,
 void Sampling::findClosestSamplingPoint(MetaData &DFi,
                                         const FileName &output_file_root)
 {
-    double my_dotProduct,my_dotProduct_aux;
-    Matrix1D<double>  row(3),direction(3);
-    Matrix1D<double> docline;
-    docline.initZeros(7);//three original angles, one winnir, new angles
-    Matrix2D<double>  L(4, 4), R(4, 4);
-    int winner_sampling=-1;
-#if defined(CHIMERA) || defined(MYPSI)
-
-    int winner_exp_L_R=-1;
-#endif
+    SamplingQueryThreads data;
+    data.sampling=this;
+    findClosestSamplingPoints(data);
+    size_t Nimages = data.winner.size();
 
     MetaData DFo;
     size_t id;
@@ -1996,45 +2225,21 @@ void Sampling::findClosestSamplingPoint(MetaData &DFi,
 
     std::ofstream filestr;
     filestr.open ("find_closest_sampling_point.bild");
-    int exp_image=1;
+    size_t exp_image=1;
 #endif
 
     MDIterator iter(DFi);
-    for(size_t i=0;i< exp_data_projection_direction_by_L_R.size();)
+    for(size_t l=0;l< Nimages;l++)
     {
-        my_dotProduct=-2;
-        for (size_t k = 0; k < R_repository.size(); k++,i++)
-        {
+        int winner_sampling=data.winner[l];
 #ifdef  DEBUG3
-            //experimental points plus symmetry
-            if( i>(exp_image*R_repository.size()-1) && i< ((exp_image+1)*R_repository.size()))
-            {
+        //experimental points plus symmetry
+        if (l==exp_image)
+        {
+            for (size_t i=l*R_repository.size(); i<(l+1)*R_repository.size(); i++)
                 filestr    <<  ".color red" << std::endl
                 <<  ".sphere "   << exp_data_projection_direction_by_L_R[i]
                 <<  " .019"      << std::endl;
-            }
-#endif
-            for(size_t j=0;j< no_redundant_sampling_points_vector.size();j++)
-            {
-                my_dotProduct_aux =
-                    dotProduct(exp_data_projection_direction_by_L_R[i],
-                               no_redundant_sampling_points_vector[j]);
-
-                if ( my_dotProduct_aux > my_dotProduct)
-                {
-                    my_dotProduct = my_dotProduct_aux;
-                    winner_sampling = j;
-#if defined(CHIMERA) || defined(MYPSI)
-
-                    winner_exp_L_R  = i;
-#endif
-
-                }
-            }//for j
-        }//for k
-#ifdef  DEBUG3
-        if( i==  ((exp_image+1)*R_repository.size()) )
-        {
             filestr    <<  ".color yellow" << std::endl
             <<  ".sphere "   << no_redundant_sampling_points_vector[winner_sampling]
             <<  " .020"      << std::endl;
@@ -2060,7 +2265,7 @@ void Sampling::findClosestSamplingPoint(MetaData &DFi,
         DFo.setValue(MDL_REF, winner_sampling, id);
 #ifdef MYPSI
 
-        DFo.set(6, exp_data_projection_direction_by_L_R_psi[winner_exp_L_R]);
+        DFo.set(6, exp_data_projection_direction_by_L_R_psi[data.winnerExp[l]]);
 #endif
 
         DFo.setValue(MDL_NEIGHBOR, no_redundant_sampling_points_index[winner_sampling], id);
@@ -2069,7 +2274,7 @@ void Sampling::findClosestSamplingPoint(MetaData &DFi,
         DFo.setValue(MDL_ANGLE_PSI,ZZ(no_redundant_sampling_points_angles[winner_sampling]), id);
 
         iter.moveNext();
-    }//for i
+    }//for l
     if (output_file_root.size() > 0)
         DFo.write(output_file_root+ "_closest_sampling_points.doc");
 #ifdef  DEBUG3
@@ -2081,10 +2286,6 @@ void Sampling::findClosestSamplingPoint(MetaData &DFi,
 
 void Sampling::findClosestExperimentalPoint()
 {
-    double my_dotProduct,my_dotProduct_aux;
-    Matrix1D<double>  row(3),direction(3);
-    int winner_sampling=-1;
-    int winner_exp=-1;
     //#define CHIMERA
 #ifdef CHIMERA
 
@@ -2098,37 +2299,20 @@ void Sampling::findClosestExperimentalPoint()
     aux_my_exp_img_per_sampling_point.resize(
         no_redundant_sampling_points_vector.size());
 
-    for(size_t i=0,l=0;i< exp_data_projection_direction_by_L_R.size();l++)
-    {
-        my_dotProduct=-2;
-        for (size_t k = 0; k < R_repository.size(); k++,i++)
-        {
-            for(size_t j=0;j< no_redundant_sampling_points_vector.size();j++)
-            {
-                my_dotProduct_aux =
-                    dotProduct(exp_data_projection_direction_by_L_R[i],
-                               no_redundant_sampling_points_vector[j]);
-
-                if ( my_dotProduct_aux > my_dotProduct)
-                {
-                    my_dotProduct = my_dotProduct_aux;
-                    winner_sampling = j;
-#ifdef CHIMERA
+    SamplingQueryThreads data;
+    data.sampling=this;
+    findClosestSamplingPoints(data);
+    size_t Nimages = data.winner.size();
 
-                    winner_exp_L_R  = i;
-#endif
-
-                    winner_exp = l;
-                }
-            }//for j
-        }//for k
-        aux_my_exp_img_per_sampling_point[winner_sampling].push_back(winner_exp);
+    for(size_t l=0;l< Nimages;l++)
+    {
+        aux_my_exp_img_per_sampling_point[data.winner[l]].push_back(l);
 #ifdef CHIMERA
 
-        aux_vec[winner_sampling].push_back(winner_exp_L_R);
+        aux_vec[data.winner[l]].push_back(data.winnerExp[l]);
 #endif
 
-    }//for i aux_my_exp_img_per_sampling_point
+    }//for l aux_my_exp_img_per_sampling_point
     for(size_t i=0;i< aux_my_exp_img_per_sampling_point.size();i++)
         if(aux_my_exp_img_per_sampling_point[i].size()!=0)
             my_exp_img_per_sampling_point.push_back(aux_my_exp_img_per_sampling_point[i]);
@@ -38,6 +38,75 @@
 /**@defgroup SphereSampling sampling (Sampling the projection sphere)
    @ingroup DataLibrary */
 //@{
+/** Spatial index of projection directions.
+    The directions are stored in a kd-tree, each node keeping the bounding box
+    of its directions. The largest dot product between a direction and the
+    directions of a box is bounded by the dot product with one of the box
+    corners, so that the queries only visit the nodes that may contain the
+    answer. Finding the closest direction or the directions inside a cone
+    takes O(log N) for N well spread directions.
+
+    The queries give the same results as comparing the dot products with all
+    directions: ties are broken in favour of the lowest index.
+    Once built, the index can be used concurrently by several threads.
+*/
+class DirectionKDTree
+{
+public:
+    /** Empty constructor */
+    DirectionKDTree();
+
+    /** Build the index of a set of directions.
+        The directions are copied, the index does not depend on the vector
+        once built. */
+    void build(const std::vector<Matrix1D<double> > &directions);
+
+    /** Number of directions */
+    size_t size() const
+    {
+        return index.size();
+    }
+
+    /** Closest direction.
+        Returns the index of the direction with the largest dot product with u
+        (the lowest index if there are several), and this dot product in dot.
+        Returns -1 if the index is empty. */
+    int findClosest(const Matrix1D<double> &u, double &dot) const;
+
+    /** Directions inside a cone.
+        The indexes of all directions whose dot product with u is larger than
+        cosRadius are returned sorted in increasing order. */
+    void findInsideCone(const Matrix1D<double> &u, double cosRadius,
+                        std::vector<size_t> &result) const;
+
+protected:
+    /* Node of the tree. The leaves have no children */
+    struct Node
+    {
+        double minCorner[3], maxCorner[3];
+        size_t first, last;
+        int left, right;
+    };
+
+    // Coordinates of the directions in the order of the leaves
+    std::vector<double> coords;
+    // Original index of each direction in the order of the leaves
+    std::vector<size_t> index;
+    // Nodes of the tree, the root is the first one
+    std::vector<Node> nodes;
+
+    // Create the node of the directions first to last-1 and its children
+    int buildNode(size_t first, size_t last, const std::vector<double> &allCoords);
+
+    // Largest dot product of u with the directions of a node
+    double boundDot(const Node &node, const double *u) const;
+
+    void findClosest(int n, const double *u, int &best, double &bestDot) const;
+
+    void findInsideCone(int n, const double *u, double cosRadius,
+                        std::vector<size_t> &result) const;
+};
+
 /** Routines with sampling the direction Sphere
     A triangular grid based on an icosahedron was first introduced in a
     meteorological model by Sadourny et al. (1968) and Williamson (1969). The
@@ -127,6 +196,10 @@ public:
     /** Verbose */
     int verbose;
 
+    /** Number of threads used to look for the closest sampling points and
+        the neighbors of the experimental images */
+    int numberOfThreads;
+
     /** Default constructor. sampling in degrees*/
     Sampling();
 
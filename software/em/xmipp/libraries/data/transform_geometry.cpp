@@ -26,7 +26,9 @@
 #include "transform_geometry.h"
 
 ProgTransformGeometry::ProgTransformGeometry()
-{}
+{
+    allow_threads = true;
+}
 
 ProgTransformGeometry::~ProgTransformGeometry()
 {}
@@ -194,12 +196,15 @@ void ProgTransformGeometry::preProcess()
 
 void ProgTransformGeometry::processImage(const FileName &fnImg, const FileName &fnImgOut, const MDRow &rowIn, MDRow &rowOut)
 {
+    // Work variables are local, images can be processed by several threads
+    Matrix2D<double> B, T;
+    ImageGeneric img, imgOut;
 
     if (checkParam("--matrix"))
     {
       // In this case we are directly reading the transformation matrix
       // from the arguments passed
-      matrixStr = getParam("--matrix");
+      String matrixStr = getParam("--matrix");
       string2TransformationMatrix(matrixStr, T);
     }
     else
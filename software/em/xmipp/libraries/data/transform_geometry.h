@@ -45,9 +45,7 @@ public:
 protected:
     int             splineDegree, dim;
     bool            applyTransform, inverse, wrap, isVol, flip, mdVol;
-    Matrix2D<double> R, A, B, T;
-    ImageGeneric img, imgOut;
-    String matrixStr; // To read directly the matrix
+    Matrix2D<double> R, A;
 
     void defineParams();
     void readParams();
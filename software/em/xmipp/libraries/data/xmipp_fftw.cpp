@@ -28,19 +28,315 @@
 #include "args.h"
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <map>
+#include <climits>
 
 static pthread_mutex_t fftw_plan_mutex = PTHREAD_MUTEX_INITIALIZER;
-bool	planCreated=false;
-int		nInstances=0;
+
+// Plan cache --------------------------------------------------------------
+// The plans are shared by all the transformers and are not destroyed until
+// the end of the program (or an explicit cleanup). All the calls to the
+// FFTW planner must be done under fftw_plan_mutex. Double and single
+// precision plans share the cache, the kind of the plan tells which
+// library (fftw or fftwf) created it.
+enum FFTWPlanKind
+{
+    PLAN_R2C, PLAN_C2R, PLAN_C2C_FORWARD, PLAN_C2C_BACKWARD,
+    PLAN_R2C_FLOAT, PLAN_C2R_FLOAT,
+    PLAN_R2C_MANY, PLAN_C2R_MANY
+};
+
+static inline bool isFloatPlan(int kind)
+{
+    return kind == PLAN_R2C_FLOAT || kind == PLAN_C2R_FLOAT;
+}
+
+struct FFTWPlanKey
+{
+    // howmany is the number of transforms of the batched plans (0 otherwise)
+    int kind, ndim, N[3], howmany, inAlignment, outAlignment, nthreads;
+    unsigned flags;
+
+    bool operator<(const FFTWPlanKey &other) const
+    {
+        return memcmp(this, &other, sizeof(FFTWPlanKey)) < 0;
+    }
+};
+
+// The values are fftw_plan or fftwf_plan depending on the kind of the key
+typedef std::map<FFTWPlanKey, void *> FFTWPlanCache;
+static FFTWPlanCache planCache;
+static int planCacheGeneration = 0;
+static bool fftwInitialized = false;
+static bool fftwThreadsInitialized = false;
+static bool fftwfThreadsInitialized = false;
+static bool fftwfUsed = false;
+static bool plannerSet = false;
+static unsigned plannerFlags = FFTW_ESTIMATE;
+static FileName fnWisdom;
+static bool wisdomChanged = false;
+static bool floatWisdomChanged = false;
+
+/* Destroy all cached plans, with the mutex locked */
+static void clearPlanCache()
+{
+    for (FFTWPlanCache::iterator it = planCache.begin(); it != planCache.end(); ++it)
+        if (isFloatPlan(it->first.kind))
+            fftwf_destroy_plan((fftwf_plan)it->second);
+        else
+            fftw_destroy_plan((fftw_plan)it->second);
+    planCache.clear();
+    planCacheGeneration++;
+}
+
+/* The single precision wisdom is kept in a file next to the double one */
+static FileName floatWisdomFile()
+{
+    return fnWisdom + ".fftwf";
+}
+
+/* Save the wisdom, with the mutex locked. A temporary file is renamed, so
+ * that processes sharing the file never read it partially written */
+static void exportWisdom()
+{
+    if (fnWisdom.empty())
+        return;
+    if (wisdomChanged)
+    {
+        FileName fnTmp = formatString("%s.%d", fnWisdom.c_str(), (int)getpid());
+        if (fftw_export_wisdom_to_filename(fnTmp.c_str()) && rename(fnTmp.c_str(), fnWisdom.c_str()) == 0)
+            wisdomChanged = false;
+        else
+            remove(fnTmp.c_str());
+    }
+    if (floatWisdomChanged)
+    {
+        FileName fnFloat = floatWisdomFile();
+        FileName fnTmp = formatString("%s.%d", fnFloat.c_str(), (int)getpid());
+        if (fftwf_export_wisdom_to_filename(fnTmp.c_str()) && rename(fnTmp.c_str(), fnFloat.c_str()) == 0)
+            floatWisdomChanged = false;
+        else
+            remove(fnTmp.c_str());
+    }
+}
+
+static void exitFFTW()
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    exportWisdom();
+    clearPlanCache();
+    if (fftwThreadsInitialized)
+        fftw_cleanup_threads();
+    else
+        fftw_cleanup();
+    if (fftwfThreadsInitialized)
+        fftwf_cleanup_threads();
+    else if (fftwfUsed)
+        fftwf_cleanup();
+    pthread_mutex_unlock(&fftw_plan_mutex);
+}
+
+static void importWisdom(const FileName &fn)
+{
+    fnWisdom = fn;
+    if (!fnWisdom.empty() && fnWisdom.exists() && !fftw_import_wisdom_from_filename(fnWisdom.c_str()))
+        std::cerr << "Warning: cannot read FFTW wisdom from " << fnWisdom << std::endl;
+    FileName fnFloat = floatWisdomFile();
+    if (!fnWisdom.empty() && fnFloat.exists() && !fftwf_import_wisdom_from_filename(fnFloat.c_str()))
+        std::cerr << "Warning: cannot read FFTW wisdom from " << fnFloat << std::endl;
+    if (!plannerSet && !fnWisdom.empty())
+        plannerFlags = FFTW_MEASURE;
+}
+
+/* Read the environment the first time, with the mutex locked */
+static void initFFTW()
+{
+    if (fftwInitialized)
+        return;
+    fftwInitialized = true;
+    const char *planner = getenv("XMIPP_FFTW_PLANNER");
+    if (planner != NULL)
+    {
+        String strPlanner = planner;
+        plannerSet = true;
+        if (strPlanner == "measure")
+            plannerFlags = FFTW_MEASURE;
+        else if (strPlanner == "patient")
+            plannerFlags = FFTW_PATIENT;
+        else
+            plannerFlags = FFTW_ESTIMATE;
+    }
+    const char *wisdom = getenv("XMIPP_FFTW_WISDOM");
+    if (wisdom != NULL && fnWisdom.empty())
+        importWisdom(wisdom);
+    atexit(exitFFTW);
+}
+
+void setFFTWWisdomFile(const FileName &fn)
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    initFFTW();
+    importWisdom(fn);
+    pthread_mutex_unlock(&fftw_plan_mutex);
+}
+
+void setFFTWPlanner(unsigned flags)
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    initFFTW();
+    plannerSet = true;
+    plannerFlags = flags;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+}
+
+/* Get a plan from the cache, creating it if needed, with the mutex locked.
+ * The result is a fftw_plan or a fftwf_plan depending on the kind */
+static void *getCachedPlan(FFTWPlanKey &key)
+{
+    initFFTW();
+    key.flags = plannerFlags;
+    FFTWPlanCache::iterator it = planCache.find(key);
+    if (it != planCache.end())
+        return it->second;
+
+    // The plan is created with temporary arrays of the same alignment as
+    // the actual ones, so that measuring does not overwrite the user data
+    size_t n = 1;
+    for (int i = 0; i < key.ndim; ++i)
+        n *= key.N[i];
+    size_t nHalf = (n / key.N[key.ndim - 1]) * (key.N[key.ndim - 1] / 2 + 1);
+    bool floatPlan = isFloatPlan(key.kind);
+    size_t realSize = floatPlan ? sizeof(float) : sizeof(double);
+    size_t howmany = (key.howmany > 0) ? key.howmany : 1;
+    size_t inSize, outSize;
+    switch (key.kind)
+    {
+    case PLAN_R2C:
+    case PLAN_R2C_FLOAT:
+    case PLAN_R2C_MANY:
+        inSize = howmany * n * realSize;
+        outSize = howmany * nHalf * 2 * realSize;
+        break;
+    case PLAN_C2R:
+    case PLAN_C2R_FLOAT:
+    case PLAN_C2R_MANY:
+        inSize = howmany * nHalf * 2 * realSize;
+        outSize = howmany * n * realSize;
+        break;
+    default:
+        inSize = outSize = n * 2 * realSize;
+    }
+    char *inBuffer = (char *)fftw_malloc(inSize + key.inAlignment);
+    char *outBuffer = (char *)fftw_malloc(outSize + key.outAlignment);
+    if (inBuffer == NULL || outBuffer == NULL)
+        REPORT_ERROR(ERR_MEM_NOTENOUGH, "Cannot allocate memory for FFTW planning");
+    void *in = inBuffer + key.inAlignment;
+    void *out = outBuffer + key.outAlignment;
+
+    if (floatPlan)
+    {
+        fftwfUsed = true;
+        if (key.nthreads > 1 && !fftwfThreadsInitialized)
+        {
+            if (fftwf_init_threads() == 0)
+                REPORT_ERROR(ERR_THREADS_NOTINIT, "FFTW cannot init threads");
+            fftwfThreadsInitialized = true;
+        }
+        if (fftwfThreadsInitialized)
+            fftwf_plan_with_nthreads(key.nthreads);
+    }
+    else
+    {
+        if (key.nthreads > 1 && !fftwThreadsInitialized)
+        {
+            if (fftw_init_threads() == 0)
+                REPORT_ERROR(ERR_THREADS_NOTINIT, "FFTW cannot init threads");
+            fftwThreadsInitialized = true;
+        }
+        if (fftwThreadsInitialized)
+            fftw_plan_with_nthreads(key.nthreads);
+    }
+
+    void *plan = NULL;
+    switch (key.kind)
+    {
+    case PLAN_R2C:
+        plan = fftw_plan_dft_r2c(key.ndim, key.N, (double *)in, (fftw_complex *)out, key.flags);
+        break;
+    case PLAN_C2R:
+        plan = fftw_plan_dft_c2r(key.ndim, key.N, (fftw_complex *)in, (double *)out, key.flags);
+        break;
+    case PLAN_C2C_FORWARD:
+        plan = fftw_plan_dft(key.ndim, key.N, (fftw_complex *)in, (fftw_complex *)out, FFTW_FORWARD, key.flags);
+        break;
+    case PLAN_C2C_BACKWARD:
+        plan = fftw_plan_dft(key.ndim, key.N, (fftw_complex *)in, (fftw_complex *)out, FFTW_BACKWARD, key.flags);
+        break;
+    case PLAN_R2C_FLOAT:
+        plan = fftwf_plan_dft_r2c(key.ndim, key.N, (float *)in, (fftwf_complex *)out, key.flags);
+        break;
+    case PLAN_C2R_FLOAT:
+        plan = fftwf_plan_dft_c2r(key.ndim, key.N, (fftwf_complex *)in, (float *)out, key.flags);
+        break;
+    case PLAN_R2C_MANY:
+        plan = fftw_plan_many_dft_r2c(key.ndim, key.N, key.howmany,
+                                      (double *)in, NULL, 1, (int)n,
+                                      (fftw_complex *)out, NULL, 1, (int)nHalf, key.flags);
+        break;
+    case PLAN_C2R_MANY:
+        plan = fftw_plan_many_dft_c2r(key.ndim, key.N, key.howmany,
+                                      (fftw_complex *)in, NULL, 1, (int)nHalf,
+                                      (double *)out, NULL, 1, (int)n, key.flags);
+        break;
+    }
+    fftw_free(inBuffer);
+    fftw_free(outBuffer);
+    if (plan == NULL)
+        REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
+    if (key.flags != FFTW_ESTIMATE)
+    {
+        if (floatPlan)
+            floatWisdomChanged = true;
+        else
+            wisdomChanged = true;
+    }
+    planCache[key] = plan;
+    return plan;
+}
+
+/* Set the rank and the sizes of a plan key for an array of this shape */
+static void setPlanDimensions(FFTWPlanKey &key, size_t zdim, size_t ydim, size_t xdim)
+{
+    key.ndim=3;
+    if (zdim==1)
+    {
+        key.ndim=2;
+        if (ydim==1)
+            key.ndim=1;
+    }
+    switch (key.ndim)
+    {
+    case 1:
+        key.N[0]=xdim;
+        break;
+    case 2:
+        key.N[0]=ydim;
+        key.N[1]=xdim;
+        break;
+    case 3:
+        key.N[0]=zdim;
+        key.N[1]=ydim;
+        key.N[2]=xdim;
+        break;
+    }
+}
 
 // Constructors and destructors --------------------------------------------
 FourierTransformer::FourierTransformer()
 {
     init();
     nthreads=1;
-    pthread_mutex_lock(&fftw_plan_mutex);
-    nInstances++;
-    pthread_mutex_unlock(&fftw_plan_mutex);
     threadsSetOn=false;
     normSign = FFTW_FORWARD;
 }
@@ -48,9 +344,6 @@ FourierTransformer::FourierTransformer()
 FourierTransformer::FourierTransformer(int _normSign)
 {
     init();
-    pthread_mutex_lock(&fftw_plan_mutex);
-    nInstances++;
-    pthread_mutex_unlock(&fftw_plan_mutex);
     nthreads=1;
     threadsSetOn=false;
     normSign = _normSign;
@@ -73,40 +366,28 @@ void FourierTransformer::init()
     fPlanBackward    = NULL;
     dataPtr          = NULL;
     complexDataPtr   = NULL;
+    planGeneration   = -1;
+    planInAlignment  = planOutAlignment = -1;
+    planThreads      = 0;
 }
 
 void FourierTransformer::clear()
 {
     fFourier.clear();
-    // Anything to do with plans has to be protected for threads!
-    pthread_mutex_lock(&fftw_plan_mutex);
-    if (fPlanForward !=NULL)
-        fftw_destroy_plan(fPlanForward);
-    if (fPlanBackward!=NULL)
-        fftw_destroy_plan(fPlanBackward);
-    pthread_mutex_unlock(&fftw_plan_mutex);
-
+    // The plans belong to the plan cache
     init();
 }
 
 FourierTransformer::~FourierTransformer()
 {
     clear();
+}
 
+void FourierTransformer::cleanup()
+{
     pthread_mutex_lock(&fftw_plan_mutex);
-    nInstances--;
-
-    // Check if a plan was already created.
-    if (planCreated)
-    {
-    	// Check if this is last instance of a FFT.
-        if (nInstances == 0)
-        {
-        	destroyThreads();
-        	planCreated = false;
-        	cleanup();
-        }
-    }
+    clearPlanCache();
+    fftw_cleanup();
     pthread_mutex_unlock(&fftw_plan_mutex);
 }
 
@@ -124,60 +405,20 @@ const MultidimArray<std::complex<double> > &FourierTransformer::getComplex() con
 
 void FourierTransformer::setReal(MultidimArray<double> &input)
 {
+    // The plans do not depend on the arrays but on their shape and alignment
     bool recomputePlan=false;
     if (fReal==NULL)
         recomputePlan=true;
-    else if (dataPtr!=MULTIDIM_ARRAY(input))
-        recomputePlan=true;
     else
         recomputePlan=!(fReal->sameShape(input));
     fFourier.resizeNoCopy(ZSIZE(input),YSIZE(input),XSIZE(input)/2+1);
     fReal=&input;
+    fComplex=NULL;
+    complexDataPtr=NULL;
+    dataPtr=MULTIDIM_ARRAY(input);
 
-    if (recomputePlan)
-    {
-        int ndim=3;
-        if (ZSIZE(input)==1)
-        {
-            ndim=2;
-            if (YSIZE(input)==1)
-                ndim=1;
-        }
-        int N[3];
-        switch (ndim)
-        {
-        case 1:
-            N[0]=XSIZE(input);
-            break;
-        case 2:
-            N[0]=YSIZE(input);
-            N[1]=XSIZE(input);
-            break;
-        case 3:
-            N[0]=ZSIZE(input);
-            N[1]=YSIZE(input);
-            N[2]=XSIZE(input);
-            break;
-        }
-
-        pthread_mutex_lock(&fftw_plan_mutex);
-        if (fPlanForward!=NULL)
-            fftw_destroy_plan(fPlanForward);
-        fPlanForward=NULL;
-        fPlanForward = fftw_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
-                                         (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
-        if (fPlanBackward!=NULL)
-            fftw_destroy_plan(fPlanBackward);
-        fPlanBackward=NULL;
-        fPlanBackward = fftw_plan_dft_c2r(ndim, N,
-                                          (fftw_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
-                                          FFTW_ESTIMATE);
-        if (fPlanForward == NULL || fPlanBackward == NULL)
-            REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
-        dataPtr=MULTIDIM_ARRAY(*fReal);
-        planCreated = true;
-        pthread_mutex_unlock(&fftw_plan_mutex);
-    }
+    if (recomputePlan || plansOutdated())
+        computePlans();
 }
 
 void FourierTransformer::setReal(MultidimArray<std::complex<double> > &input)
@@ -185,56 +426,72 @@ void FourierTransformer::setReal(MultidimArray<std::complex<double> > &input)
     bool recomputePlan=false;
     if (fComplex==NULL)
         recomputePlan=true;
-    else if (complexDataPtr!=MULTIDIM_ARRAY(input))
-        recomputePlan=true;
     else
         recomputePlan=!(fComplex->sameShape(input));
     fFourier.resizeNoCopy(input);
     fComplex=&input;
+    fReal=NULL;
+    dataPtr=NULL;
+    complexDataPtr=MULTIDIM_ARRAY(input);
 
-    if (recomputePlan)
-    {
-        int ndim=3;
-        if (ZSIZE(input)==1)
-        {
-            ndim=2;
-            if (YSIZE(input)==1)
-                ndim=1;
-        }
-        int *N = new int[ndim];
-        switch (ndim)
-        {
-        case 1:
-            N[0]=XSIZE(input);
-            break;
-        case 2:
-            N[0]=YSIZE(input);
-            N[1]=XSIZE(input);
-            break;
-        case 3:
-            N[0]=ZSIZE(input);
-            N[1]=YSIZE(input);
-            N[2]=XSIZE(input);
-            break;
-        }
+    if (recomputePlan || plansOutdated())
+        computePlans();
+}
 
-        pthread_mutex_lock(&fftw_plan_mutex);
-        if (fPlanForward!=NULL)
-            fftw_destroy_plan(fPlanForward);
-        fPlanForward=NULL;
-        fPlanForward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(*fComplex),
-                                     (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
-        if (fPlanBackward!=NULL)
-            fftw_destroy_plan(fPlanBackward);
-        fPlanBackward=NULL;
-        fPlanBackward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
-                                      (fftw_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
-        if (fPlanForward == NULL || fPlanBackward == NULL)
-            REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
-        delete [] N;
-        complexDataPtr=MULTIDIM_ARRAY(*fComplex);
-        pthread_mutex_unlock(&fftw_plan_mutex);
+bool FourierTransformer::plansOutdated() const
+{
+    if (fReal==NULL && fComplex==NULL)
+        return true;
+    if (fPlanForward==NULL || planGeneration!=planCacheGeneration || planThreads!=nthreads)
+        return true;
+    double *in = (fReal!=NULL) ? MULTIDIM_ARRAY(*fReal) : (double*)MULTIDIM_ARRAY(*fComplex);
+    return fftw_alignment_of(in)!=planInAlignment ||
+           fftw_alignment_of((double*)MULTIDIM_ARRAY(fFourier))!=planOutAlignment;
+}
+
+void FourierTransformer::computePlans()
+{
+    FFTWPlanKey key;
+    memset(&key, 0, sizeof(key));
+    size_t xdim, ydim, zdim;
+    double *in;
+    if (fReal!=NULL)
+    {
+        zdim=ZSIZE(*fReal);
+        ydim=YSIZE(*fReal);
+        xdim=XSIZE(*fReal);
+        in=MULTIDIM_ARRAY(*fReal);
     }
+    else if (fComplex!=NULL)
+    {
+        zdim=ZSIZE(*fComplex);
+        ydim=YSIZE(*fComplex);
+        xdim=XSIZE(*fComplex);
+        in=(double*)MULTIDIM_ARRAY(*fComplex);
+    }
+    else
+        REPORT_ERROR(ERR_UNCLASSIFIED,"No complex nor real data defined");
+
+    setPlanDimensions(key, zdim, ydim, xdim);
+    key.nthreads=nthreads;
+    int inAlignment=fftw_alignment_of(in);
+    int outAlignment=fftw_alignment_of((double*)MULTIDIM_ARRAY(fFourier));
+
+    pthread_mutex_lock(&fftw_plan_mutex);
+    FFTWPlanKey backwardKey=key;
+    key.kind=(fReal!=NULL) ? PLAN_R2C : PLAN_C2C_FORWARD;
+    key.inAlignment=inAlignment;
+    key.outAlignment=outAlignment;
+    backwardKey.kind=(fReal!=NULL) ? PLAN_C2R : PLAN_C2C_BACKWARD;
+    backwardKey.inAlignment=outAlignment;
+    backwardKey.outAlignment=inAlignment;
+    fPlanForward=(fftw_plan)getCachedPlan(key);
+    fPlanBackward=(fftw_plan)getCachedPlan(backwardKey);
+    planGeneration=planCacheGeneration;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    planInAlignment=inAlignment;
+    planOutAlignment=outAlignment;
+    planThreads=nthreads;
 }
 
 void FourierTransformer::setFourier(const MultidimArray<std::complex<double> > &inputFourier)
@@ -246,9 +503,15 @@ void FourierTransformer::setFourier(const MultidimArray<std::complex<double> > &
 // Transform ---------------------------------------------------------------
 void FourierTransformer::Transform(int sign)
 {
+    if (plansOutdated())
+        computePlans();
+    fftw_complex *ptrFourier=(fftw_complex*)MULTIDIM_ARRAY(fFourier);
     if (sign == FFTW_FORWARD)
     {
-        fftw_execute(fPlanForward);
+        if (fReal!=NULL)
+            fftw_execute_dft_r2c(fPlanForward, MULTIDIM_ARRAY(*fReal), ptrFourier);
+        else
+            fftw_execute_dft(fPlanForward, (fftw_complex*)MULTIDIM_ARRAY(*fComplex), ptrFourier);
 
         if (sign == normSign)
         {
@@ -283,7 +546,10 @@ void FourierTransformer::Transform(int sign)
     }
     else if (sign == FFTW_BACKWARD)
     {
-        fftw_execute(fPlanBackward);
+        if (fReal!=NULL)
+            fftw_execute_dft_c2r(fPlanBackward, ptrFourier, MULTIDIM_ARRAY(*fReal));
+        else
+            fftw_execute_dft(fPlanBackward, ptrFourier, (fftw_complex*)MULTIDIM_ARRAY(*fComplex));
 
         if (sign == normSign)
         {
@@ -380,6 +646,350 @@ void FourierTransformer::enforceHermitianSymmetry()
     }
 }
 
+// Single precision transformer --------------------------------------------
+FourierTransformerFloat::FourierTransformerFloat(int _normSign)
+{
+    init();
+    nthreads=1;
+    normSign=_normSign;
+}
+
+FourierTransformerFloat::FourierTransformerFloat(const FourierTransformerFloat& fTransform)
+{
+    REPORT_ERROR(ERR_UNCLASSIFIED,"Fourier transformers should not be copied");
+}
+
+FourierTransformerFloat & FourierTransformerFloat::operator= (const FourierTransformerFloat & other)
+{
+    REPORT_ERROR(ERR_UNCLASSIFIED,"Fourier transformers should not be copied");
+}
+
+FourierTransformerFloat::~FourierTransformerFloat()
+{
+    clear();
+}
+
+void FourierTransformerFloat::init()
+{
+    fReal=NULL;
+    fPlanForward=NULL;
+    fPlanBackward=NULL;
+    planGeneration=-1;
+    planInAlignment=planOutAlignment=-1;
+    planThreads=0;
+}
+
+void FourierTransformerFloat::clear()
+{
+    fFourier.clear();
+    // The plans belong to the plan cache
+    init();
+}
+
+const MultidimArray<float> &FourierTransformerFloat::getReal() const
+{
+    return (*fReal);
+}
+
+void FourierTransformerFloat::setReal(MultidimArray<float> &input)
+{
+    bool recomputePlan=(fReal==NULL || !fReal->sameShape(input));
+    fFourier.resizeNoCopy(ZSIZE(input),YSIZE(input),XSIZE(input)/2+1);
+    fReal=&input;
+    if (recomputePlan || plansOutdated())
+        computePlans();
+}
+
+void FourierTransformerFloat::setFourier(const MultidimArray<std::complex<float> > &inputFourier)
+{
+    memcpy(MULTIDIM_ARRAY(fFourier),MULTIDIM_ARRAY(inputFourier),
+           MULTIDIM_SIZE(inputFourier)*2*sizeof(float));
+}
+
+bool FourierTransformerFloat::plansOutdated() const
+{
+    if (fReal==NULL)
+        return true;
+    if (fPlanForward==NULL || planGeneration!=planCacheGeneration || planThreads!=nthreads)
+        return true;
+    return fftwf_alignment_of(MULTIDIM_ARRAY(*fReal))!=planInAlignment ||
+           fftwf_alignment_of((float*)MULTIDIM_ARRAY(fFourier))!=planOutAlignment;
+}
+
+void FourierTransformerFloat::computePlans()
+{
+    if (fReal==NULL)
+        REPORT_ERROR(ERR_UNCLASSIFIED,"No real data defined");
+    FFTWPlanKey key;
+    memset(&key, 0, sizeof(key));
+    setPlanDimensions(key, ZSIZE(*fReal), YSIZE(*fReal), XSIZE(*fReal));
+    key.nthreads=nthreads;
+    int inAlignment=fftwf_alignment_of(MULTIDIM_ARRAY(*fReal));
+    int outAlignment=fftwf_alignment_of((float*)MULTIDIM_ARRAY(fFourier));
+
+    pthread_mutex_lock(&fftw_plan_mutex);
+    FFTWPlanKey backwardKey=key;
+    key.kind=PLAN_R2C_FLOAT;
+    key.inAlignment=inAlignment;
+    key.outAlignment=outAlignment;
+    backwardKey.kind=PLAN_C2R_FLOAT;
+    backwardKey.inAlignment=outAlignment;
+    backwardKey.outAlignment=inAlignment;
+    fPlanForward=(fftwf_plan)getCachedPlan(key);
+    fPlanBackward=(fftwf_plan)getCachedPlan(backwardKey);
+    planGeneration=planCacheGeneration;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    planInAlignment=inAlignment;
+    planOutAlignment=outAlignment;
+    planThreads=nthreads;
+}
+
+void FourierTransformerFloat::Transform(int sign)
+{
+    if (plansOutdated())
+        computePlans();
+    fftwf_complex *ptrFourier=(fftwf_complex*)MULTIDIM_ARRAY(fFourier);
+    if (sign == FFTW_FORWARD)
+    {
+        fftwf_execute_dft_r2c(fPlanForward, MULTIDIM_ARRAY(*fReal), ptrFourier);
+        if (sign == normSign)
+        {
+            float isize=1.0f/MULTIDIM_SIZE(*fReal);
+            float *ptr=(float*)MULTIDIM_ARRAY(fFourier);
+            size_t nmax=2*MULTIDIM_SIZE(fFourier);
+            for (size_t n=0; n<nmax; ++n)
+                ptr[n] *= isize;
+        }
+    }
+    else if (sign == FFTW_BACKWARD)
+    {
+        fftwf_execute_dft_c2r(fPlanBackward, ptrFourier, MULTIDIM_ARRAY(*fReal));
+        if (sign == normSign)
+        {
+            float isize=1.0f/MULTIDIM_SIZE(*fReal);
+            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(*fReal)
+            DIRECT_MULTIDIM_ELEM(*fReal,n) *= isize;
+        }
+    }
+}
+
+void FourierTransformerFloat::FourierTransform()
+{
+    Transform(FFTW_FORWARD);
+}
+
+void FourierTransformerFloat::inverseFourierTransform()
+{
+    Transform(FFTW_BACKWARD);
+}
+
+// Batched transformer -----------------------------------------------------
+BatchFourierTransformer::BatchFourierTransformer(int _normSign)
+{
+    init();
+    nthreads=1;
+    normSign=_normSign;
+}
+
+BatchFourierTransformer::BatchFourierTransformer(const BatchFourierTransformer& fTransform)
+{
+    REPORT_ERROR(ERR_UNCLASSIFIED,"Fourier transformers should not be copied");
+}
+
+BatchFourierTransformer & BatchFourierTransformer::operator= (const BatchFourierTransformer & other)
+{
+    REPORT_ERROR(ERR_UNCLASSIFIED,"Fourier transformers should not be copied");
+}
+
+BatchFourierTransformer::~BatchFourierTransformer()
+{
+    clear();
+}
+
+void BatchFourierTransformer::init()
+{
+    fReal=NULL;
+    fPlanForward=NULL;
+    fPlanBackward=NULL;
+    planGeneration=-1;
+    planInAlignment=planOutAlignment=-1;
+    planThreads=0;
+}
+
+void BatchFourierTransformer::clear()
+{
+    fFourier.clear();
+    fPacked.clear();
+    // The plans belong to the plan cache
+    init();
+}
+
+void BatchFourierTransformer::setReal(MultidimArray<double> &stack)
+{
+    bool recomputePlan=(fReal==NULL || !fReal->sameShape(stack));
+    fFourier.resizeNoCopy(NSIZE(stack),ZSIZE(stack),YSIZE(stack),XSIZE(stack)/2+1);
+    fReal=&stack;
+    if (recomputePlan || plansOutdated())
+        computePlans();
+}
+
+void BatchFourierTransformer::setFourier(const MultidimArray<std::complex<double> > &Fstack)
+{
+    if (MULTIDIM_SIZE(Fstack)!=MULTIDIM_SIZE(fFourier))
+        REPORT_ERROR(ERR_MULTIDIM_SIZE,"BatchFourierTransformer: the Fourier stack does not match the real stack");
+    memcpy(MULTIDIM_ARRAY(fFourier),MULTIDIM_ARRAY(Fstack),
+           MULTIDIM_SIZE(Fstack)*2*sizeof(double));
+}
+
+bool BatchFourierTransformer::plansOutdated() const
+{
+    if (fReal==NULL)
+        return true;
+    if (fPlanForward==NULL || planGeneration!=planCacheGeneration || planThreads!=nthreads)
+        return true;
+    return fftw_alignment_of(MULTIDIM_ARRAY(*fReal))!=planInAlignment ||
+           fftw_alignment_of((double*)MULTIDIM_ARRAY(fFourier))!=planOutAlignment;
+}
+
+void BatchFourierTransformer::computePlans()
+{
+    if (fReal==NULL)
+        REPORT_ERROR(ERR_UNCLASSIFIED,"No real data defined");
+    if (ZYXSIZE(*fReal)>INT_MAX)
+        REPORT_ERROR(ERR_MULTIDIM_SIZE,"BatchFourierTransformer: the images are too large");
+    FFTWPlanKey key;
+    memset(&key, 0, sizeof(key));
+    setPlanDimensions(key, ZSIZE(*fReal), YSIZE(*fReal), XSIZE(*fReal));
+    key.howmany=NSIZE(*fReal);
+    key.nthreads=nthreads;
+    int inAlignment=fftw_alignment_of(MULTIDIM_ARRAY(*fReal));
+    int outAlignment=fftw_alignment_of((double*)MULTIDIM_ARRAY(fFourier));
+
+    pthread_mutex_lock(&fftw_plan_mutex);
+    FFTWPlanKey backwardKey=key;
+    key.kind=PLAN_R2C_MANY;
+    key.inAlignment=inAlignment;
+    key.outAlignment=outAlignment;
+    backwardKey.kind=PLAN_C2R_MANY;
+    backwardKey.inAlignment=outAlignment;
+    backwardKey.outAlignment=inAlignment;
+    fPlanForward=(fftw_plan)getCachedPlan(key);
+    fPlanBackward=(fftw_plan)getCachedPlan(backwardKey);
+    planGeneration=planCacheGeneration;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    planInAlignment=inAlignment;
+    planOutAlignment=outAlignment;
+    planThreads=nthreads;
+}
+
+void BatchFourierTransformer::Transform(int sign)
+{
+    if (plansOutdated())
+        computePlans();
+    fftw_complex *ptrFourier=(fftw_complex*)MULTIDIM_ARRAY(fFourier);
+    // Each image is normalized by its own number of pixels
+    double isize=1.0/ZYXSIZE(*fReal);
+    if (sign == FFTW_FORWARD)
+    {
+        fftw_execute_dft_r2c(fPlanForward, MULTIDIM_ARRAY(*fReal), ptrFourier);
+        if (sign == normSign)
+        {
+            double *ptr=(double*)MULTIDIM_ARRAY(fFourier);
+            size_t nmax=2*MULTIDIM_SIZE(fFourier);
+            for (size_t n=0; n<nmax; ++n)
+                ptr[n] *= isize;
+        }
+    }
+    else if (sign == FFTW_BACKWARD)
+    {
+        fftw_execute_dft_c2r(fPlanBackward, ptrFourier, MULTIDIM_ARRAY(*fReal));
+        if (sign == normSign)
+            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(*fReal)
+            DIRECT_MULTIDIM_ELEM(*fReal,n) *= isize;
+    }
+}
+
+void BatchFourierTransformer::FourierTransform()
+{
+    Transform(FFTW_FORWARD);
+}
+
+void BatchFourierTransformer::inverseFourierTransform()
+{
+    Transform(FFTW_BACKWARD);
+}
+
+void BatchFourierTransformer::FourierTransform(MultidimArray<double> &stack,
+        MultidimArray< std::complex<double> > &Fstack, bool getCopy)
+{
+    setReal(stack);
+    Transform(FFTW_FORWARD);
+    if (getCopy)
+        Fstack=fFourier;
+    else
+        Fstack.alias(fFourier);
+}
+
+void BatchFourierTransformer::inverseFourierTransform(const MultidimArray< std::complex<double> > &Fstack,
+        MultidimArray<double> &stack)
+{
+    setReal(stack);
+    setFourier(Fstack);
+    Transform(FFTW_BACKWARD);
+}
+
+void BatchFourierTransformer::FourierTransform(const std::vector< MultidimArray<double> > &images,
+        std::vector< MultidimArray< std::complex<double> > > &Fimages)
+{
+    size_t N=images.size();
+    Fimages.resize(N);
+    if (N==0)
+        return;
+    const MultidimArray<double> &first=images[0];
+    fPacked.resizeNoCopy(N,ZSIZE(first),YSIZE(first),XSIZE(first));
+    size_t imageSize=ZYXSIZE(first);
+    for (size_t n=0; n<N; ++n)
+    {
+        if (!images[n].sameShape(first))
+            REPORT_ERROR(ERR_MULTIDIM_SIZE,"BatchFourierTransformer: all the images must have the same size");
+        memcpy(MULTIDIM_ARRAY(fPacked)+n*imageSize,MULTIDIM_ARRAY(images[n]),imageSize*sizeof(double));
+    }
+    setReal(fPacked);
+    Transform(FFTW_FORWARD);
+    size_t fourierSize=ZYXSIZE(fFourier);
+    for (size_t n=0; n<N; ++n)
+    {
+        Fimages[n].resizeNoCopy(ZSIZE(fFourier),YSIZE(fFourier),XSIZE(fFourier));
+        memcpy(MULTIDIM_ARRAY(Fimages[n]),MULTIDIM_ARRAY(fFourier)+n*fourierSize,
+               fourierSize*2*sizeof(double));
+    }
+}
+
+void BatchFourierTransformer::inverseFourierTransform(const std::vector< MultidimArray< std::complex<double> > > &Fimages,
+        std::vector< MultidimArray<double> > &images)
+{
+    size_t N=Fimages.size();
+    if (N==0)
+        return;
+    if (images.size()!=N)
+        REPORT_ERROR(ERR_MULTIDIM_SIZE,"BatchFourierTransformer: the number of images does not match");
+    const MultidimArray<double> &first=images[0];
+    fPacked.resizeNoCopy(N,ZSIZE(first),YSIZE(first),XSIZE(first));
+    setReal(fPacked);
+    size_t fourierSize=ZYXSIZE(fFourier);
+    for (size_t n=0; n<N; ++n)
+    {
+        if (NZYXSIZE(Fimages[n])!=fourierSize || !images[n].sameShape(first))
+            REPORT_ERROR(ERR_MULTIDIM_SIZE,"BatchFourierTransformer: all the images must have the same size");
+        memcpy(MULTIDIM_ARRAY(fFourier)+n*fourierSize,MULTIDIM_ARRAY(Fimages[n]),
+               fourierSize*2*sizeof(double));
+    }
+    Transform(FFTW_BACKWARD);
+    size_t imageSize=ZYXSIZE(first);
+    for (size_t n=0; n<N; ++n)
+        memcpy(MULTIDIM_ARRAY(images[n]),MULTIDIM_ARRAY(fPacked)+n*imageSize,imageSize*sizeof(double));
+}
+
 /* FFT Magnitude  ------------------------------------------------------- */
 void FFT_magnitude(const MultidimArray< std::complex<double> > &v,
                    MultidimArray<double> &mag)
@@ -412,22 +1022,29 @@ void convolutionFFTStack(const MultidimArray<double> &img,
     if (&result != &img)
         result = img;
 
-    MultidimArray<double> imgTemp;
-    MultidimArray< std::complex< double> > FFTIm, FFTK;
-    FourierTransformer transformer1(FFTW_BACKWARD), transformer2(FFTW_BACKWARD);
+    MultidimArray<double> slices, imgTemp;
+    MultidimArray< std::complex< double> > FFTSlices, FFTK;
+    FourierTransformer transformer2(FFTW_BACKWARD);
+    BatchFourierTransformer transformer1(FFTW_BACKWARD);
 
     transformer2.FourierTransform((MultidimArray<double> &)kernel, FFTK, false);
 
-    for (size_t n = 0; n < ZSIZE(result); n++)
-    {
-        imgTemp.aliasSlice(result, n);
-        transformer1.FourierTransform(imgTemp, FFTIm, false);
+    // The slices are transformed as a batch of images
+    slices.alias(result);
+    slices.setDimensions(XSIZE(result), YSIZE(result), 1, ZSIZE(result));
+    transformer1.FourierTransform(slices, FFTSlices, false);
 
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FFTIm)
-        DIRECT_MULTIDIM_ELEM(FFTIm,n) *= DIRECT_MULTIDIM_ELEM(FFTK,n);
+    size_t sliceSize = YXSIZE(FFTSlices);
+    std::complex<double> *ptrFFT = MULTIDIM_ARRAY(FFTSlices);
+    for (size_t k = 0; k < NSIZE(FFTSlices); k++, ptrFFT += sliceSize)
+        for (size_t n = 0; n < sliceSize; n++)
+            ptrFFT[n] *= DIRECT_MULTIDIM_ELEM(FFTK,n);
 
-        transformer1.inverseFourierTransform();
+    transformer1.inverseFourierTransform();
 
+    for (size_t n = 0; n < ZSIZE(result); n++)
+    {
+        imgTemp.aliasSlice(result, n);
         CenterFFT(imgTemp, false);
     }
 
@@ -849,13 +1466,14 @@ void correlation_matrix(const MultidimArray<double> & m1,
     correlation_matrix(aux.FFT1,m2,R,aux,center);
 }
 
-void correlationInFourier(const MultidimArray< std::complex< double > > & FF1, MultidimArray< std::complex< double > > & FF2, double dSize)
+template<typename T>
+void correlationInFourierT(const MultidimArray< std::complex< T > > & FF1, MultidimArray< std::complex< T > > & FF2, T dSize)
 {
     // Multiply FFT1 * FFT2'
-    double mdSize=-dSize;
-    double a, b, c, d; // a+bi, c+di
-    double *ptrFFT2=(double*)MULTIDIM_ARRAY(FF2);
-    double *ptrFFT1=(double*)MULTIDIM_ARRAY(FF1);
+    T mdSize=-dSize;
+    T a, b, c, d; // a+bi, c+di
+    T *ptrFFT2=(T*)MULTIDIM_ARRAY(FF2);
+    T *ptrFFT1=(T*)MULTIDIM_ARRAY(FF1);
     FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FF1)
     {
         a=*ptrFFT1++;
@@ -867,6 +1485,11 @@ void correlationInFourier(const MultidimArray< std::complex< double > > & FF1, M
     }
 }
 
+void correlationInFourier(const MultidimArray< std::complex< double > > & FF1, MultidimArray< std::complex< double > > & FF2, double dSize)
+{
+    correlationInFourierT(FF1, FF2, dSize);
+}
+
 
 void correlation_matrix(const MultidimArray< std::complex< double > > & FF1,
                         const MultidimArray<double> & m2,
@@ -896,6 +1519,44 @@ void correlation_matrix(const MultidimArray< std::complex< double > > & FFT1,
         CenterFFT(R, true);
 }
 
+void correlation_matrix(const MultidimArray<float> & m1,
+                        const MultidimArray<float> & m2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center)
+{
+    aux.transformer1.FourierTransform((MultidimArray<float> &)m1, aux.FFT1, false);
+    correlation_matrix(aux.FFT1,m2,R,aux,center);
+}
+
+void correlation_matrix(const MultidimArray< std::complex< float > > & FF1,
+                        const MultidimArray<float> & m2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center)
+{
+    R=m2;
+    aux.transformer2.FourierTransform(R, aux.FFT2, false);
+    correlationInFourierT(FF1,aux.FFT2,(float)MULTIDIM_SIZE(R));
+    aux.transformer2.inverseFourierTransform();
+    if (center)
+        CenterFFT(R, true);
+}
+
+void correlation_matrix(const MultidimArray< std::complex< float > > & FFT1,
+                        const MultidimArray< std::complex< float > > & FFT2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center)
+{
+    aux.transformer2.setReal(R);
+    aux.transformer2.setFourier(FFT2);
+    correlationInFourierT(FFT1,aux.transformer2.fFourier,(float)MULTIDIM_SIZE(R));
+    aux.transformer2.inverseFourierTransform();
+    if (center)
+        CenterFFT(R, true);
+}
+
 void fast_correlation_vector(const MultidimArray< std::complex<double> > & FFT1,
                         const MultidimArray< std::complex<double> > & FFT2,
                         MultidimArray< double >& R,
@@ -56,6 +56,12 @@
  * FOR_ALL_ELEMENTS_IN_ARRAY3D(Vmag)
  *     Vmag(k,i,j)=20*log10(abs(Vfft(k,i,j)));
  * @endcode
+ *
+ * The FFTW plans are kept in a cache shared by all the transformers of
+ * the program, indexed by the kind of transform, the array sizes, the
+ * alignment of the arrays and the number of threads. They are executed
+ * with the new-array interface of FFTW, so that a plan is only created
+ * the first time a shape is used, whatever the arrays or the transformer.
  */
 class FourierTransformer
 {
@@ -145,14 +151,13 @@ public:
         fftw_plan_with_nthreads(nthreads);
     }
 
-    /** Destroy Threads. Do not execute any previously created
-     *  plans after calling this function   */
+    /** Destroy Threads.
+     *  Subsequent transforms of this object are computed with one thread.
+     *  The FFTW threads themselves are released at the end of the program,
+     *  since the plans are shared by all the transformers. */
     void destroyThreads(void )
     {
         nthreads = 1;
-        if(threadsSetOn)
-            fftw_cleanup_threads();
-
         threadsSetOn=false;
     }
 
@@ -349,6 +354,15 @@ public:
     /* Pointer to the array of complex<double> with which the plan was computed */
     std::complex<double> * complexDataPtr;
 
+    /* Generation of the plan cache from which the plans were taken */
+    int planGeneration;
+
+    /* Alignment of the input and output arrays of the plans */
+    int planInAlignment, planOutAlignment;
+
+    /* Number of threads of the plans */
+    int planThreads;
+
     /* Init object*/
     void init();
     /** Clear object */
@@ -357,12 +371,17 @@ public:
      * such as the accumulated wisdom and a list of algorithms available
      * in the current configuration. If you want to deallocate all of that
      * and reset FFTW to the pristine state it was in when
-     * you started your program, you can call:
+     * you started your program, you can call this function. All the
+     * cached plans are destroyed, the transformers will get new plans
+     * in their next transform.
      */
-    void cleanup(void)
-    {
-        fftw_cleanup();
-    }
+    void cleanup(void);
+
+    /** Get the plans for the current arrays from the plan cache */
+    void computePlans();
+
+    /** True if the plans do not correspond to the current arrays */
+    bool plansOutdated() const;
     /** Computes the transform, specified in Init() function
         If normalization=true the forward transform is normalized
         (no normalization is made in the inverse transform)
@@ -406,6 +425,313 @@ public:
 
 };
 
+/** Single precision Fourier Transformer class.
+ * @ingroup FourierW
+ *
+ * Same as FourierTransformer for real arrays of floats, with the single
+ * precision FFTW library (fftwf). The arrays take half the memory and the
+ * transforms move half the data, at the cost of a relative accuracy of
+ * about 1e-6. The plans are taken from the same cache as the double ones.
+ *
+ * @code
+ * FourierTransformerFloat transformer;
+ * MultidimArray<float> I;
+ * MultidimArray< std::complex<float> > Ifft;
+ * transformer.FourierTransform(I,Ifft,false);
+ * // Process Ifft in place
+ * transformer.inverseFourierTransform();
+ * @endcode
+ */
+class FourierTransformerFloat
+{
+public:
+    /** Real array, in fact a pointer to the user array is stored. */
+    MultidimArray<float> *fReal;
+
+    /** Fourier array  */
+    MultidimArray< std::complex<float> > fFourier;
+
+    /* fftwf Forward plan */
+    fftwf_plan fPlanForward;
+
+    /* fftwf Backward plan */
+    fftwf_plan fPlanBackward;
+
+    /* number of threads*/
+    int nthreads;
+
+    /* Sign where the normalization is applied */
+    int normSign;
+
+    /* Generation of the plan cache from which the plans were taken */
+    int planGeneration;
+
+    /* Alignment of the input and output arrays of the plans */
+    int planInAlignment, planOutAlignment;
+
+    /* Number of threads of the plans */
+    int planThreads;
+
+public:
+    /** Constructor setting the sign of normalization application*/
+    FourierTransformerFloat(int _normSign=FFTW_FORWARD);
+
+    /** Copy constructor */
+    FourierTransformerFloat(const FourierTransformerFloat& fTransform);
+
+    /** Assignment operator */
+    FourierTransformerFloat & operator= (const FourierTransformerFloat & other);
+
+    /** Destructor */
+    ~FourierTransformerFloat();
+
+    /** Set the number of threads of the transforms of this object */
+    void setThreadsNumber(int tNumber)
+    {
+        nthreads = tNumber;
+    }
+
+    /** Compute the Fourier transform of a MultidimArray, 1D, 2D and 3D.
+        If getCopy is false, an alias to the transformed data is returned. */
+    template <typename T, typename T1>
+    void FourierTransform(T& v, T1& V, bool getCopy=true)
+    {
+        setReal(v);
+        Transform(FFTW_FORWARD);
+        if (getCopy)
+            getFourierCopy(V);
+        else
+            getFourierAlias(V);
+    }
+
+    /** Compute the Fourier transform of the current real array. */
+    void FourierTransform();
+
+    /** Compute the inverse Fourier transform.
+        The result is stored in the real array of the forward transform. */
+    void inverseFourierTransform();
+
+    /** Compute the inverse Fourier transform of V into v.
+        v must already have the right size. */
+    template <typename T, typename T1>
+    void inverseFourierTransform(T& V, T1& v)
+    {
+        setReal(v);
+        setFourier(V);
+        Transform(FFTW_BACKWARD);
+    }
+
+    /** Get Fourier coefficients. */
+    template <typename T>
+    void getFourierAlias(T& V)
+    {
+        V.alias(fFourier);
+    }
+
+    /** Get Fourier coefficients. */
+    template <typename T>
+    void getFourierCopy(T& V)
+    {
+        V.resizeNoCopy(fFourier);
+        memcpy(MULTIDIM_ARRAY(V),MULTIDIM_ARRAY(fFourier),
+               MULTIDIM_SIZE(fFourier)*2*sizeof(float));
+    }
+
+    /* Init object*/
+    void init();
+
+    /** Clear object */
+    void clear();
+
+    /** Get the plans for the current arrays from the plan cache */
+    void computePlans();
+
+    /** True if the plans do not correspond to the current arrays */
+    bool plansOutdated() const;
+
+    /** Computes the transform in the given direction (FFTW_FORWARD or
+        FFTW_BACKWARD), normalizing in the direction of normSign. */
+    void Transform(int sign);
+
+    /** Get the Multidimarray that is being used as input. */
+    const MultidimArray<float> &getReal() const;
+
+    /** Set a Multidimarray for input.
+        In backward transforms the result is stored in img. */
+    void setReal(MultidimArray<float> &img);
+
+    /** Set the Fourier coefficients.
+        The values are copied in the internal array, that must already
+        have the size of imgFourier. */
+    void setFourier(const MultidimArray<std::complex<float> > &imgFourier);
+
+    /* Set normalization sign. */
+    void setNormalizationSign(int _normSign)
+    {
+        normSign = _normSign;
+    }
+};
+
+/** Batched Fourier Transformer class.
+ * @ingroup FourierW
+ *
+ * Fourier transform of all the images of a stack (NSIZE>1) with a single
+ * FFTW plan (fftw_plan_many_dft_r2c and c2r). The per image overhead of
+ * FourierTransformer disappears and, with several threads, FFTW
+ * distributes the images of the batch among them. This is the transformer
+ * of choice for thousands of small images.
+ *
+ * The Fourier transform is a stack of the same number of images of size
+ * Z x Y x (X/2+1). The memory of the real stack is handled externally as in
+ * FourierTransformer. A vector of images can also be transformed, they are
+ * packed in an internal stack first.
+ *
+ * @code
+ * BatchFourierTransformer transformer;
+ * transformer.setThreadsNumber(4);
+ * MultidimArray<double> particles; // N x 1 x 128 x 128
+ * MultidimArray< std::complex<double> > Fparticles;
+ * transformer.FourierTransform(particles,Fparticles,false);
+ * // Filter Fparticles in place
+ * transformer.inverseFourierTransform();
+ * @endcode
+ */
+class BatchFourierTransformer
+{
+public:
+    /** Real stack, in fact a pointer to the user array is stored. */
+    MultidimArray<double> *fReal;
+
+    /** Stack of Fourier transforms */
+    MultidimArray< std::complex<double> > fFourier;
+
+    /** Internal real stack for vectors of images */
+    MultidimArray<double> fPacked;
+
+    /* fftw Forward plan */
+    fftw_plan fPlanForward;
+
+    /* fftw Backward plan */
+    fftw_plan fPlanBackward;
+
+    /* number of threads*/
+    int nthreads;
+
+    /* Sign where the normalization is applied */
+    int normSign;
+
+    /* Generation of the plan cache from which the plans were taken */
+    int planGeneration;
+
+    /* Alignment of the input and output arrays of the plans */
+    int planInAlignment, planOutAlignment;
+
+    /* Number of threads of the plans */
+    int planThreads;
+
+public:
+    /** Constructor setting the sign of normalization application*/
+    BatchFourierTransformer(int _normSign=FFTW_FORWARD);
+
+    /** Copy constructor */
+    BatchFourierTransformer(const BatchFourierTransformer& fTransform);
+
+    /** Assignment operator */
+    BatchFourierTransformer & operator= (const BatchFourierTransformer & other);
+
+    /** Destructor */
+    ~BatchFourierTransformer();
+
+    /** Set the number of threads of the transforms of this object.
+     * The images of the batch are distributed among the threads. */
+    void setThreadsNumber(int tNumber)
+    {
+        nthreads = tNumber;
+    }
+
+    /** Fourier transform of all the images of a stack.
+        If getCopy is false, an alias to the transformed stack is returned. */
+    void FourierTransform(MultidimArray<double> &stack,
+                          MultidimArray< std::complex<double> > &Fstack, bool getCopy=true);
+
+    /** Fourier transform of a vector of images of the same size.
+        Fimages(n) is the Fourier transform of images(n). */
+    void FourierTransform(const std::vector< MultidimArray<double> > &images,
+                          std::vector< MultidimArray< std::complex<double> > > &Fimages);
+
+    /** Compute the Fourier transform of the current real stack. */
+    void FourierTransform();
+
+    /** Compute the inverse Fourier transform.
+        The result is stored in the real stack of the forward transform. */
+    void inverseFourierTransform();
+
+    /** Inverse Fourier transform of a stack of Fourier transforms.
+        stack must already have the right size. */
+    void inverseFourierTransform(const MultidimArray< std::complex<double> > &Fstack,
+                                 MultidimArray<double> &stack);
+
+    /** Inverse Fourier transform of a vector of Fourier transforms.
+        The images must already have the right size. */
+    void inverseFourierTransform(const std::vector< MultidimArray< std::complex<double> > > &Fimages,
+                                 std::vector< MultidimArray<double> > &images);
+
+    /** Get the Fourier transform of image n of the batch (alias). */
+    void getFourierAlias(size_t n, MultidimArray< std::complex<double> > &V)
+    {
+        V.aliasImageInStack(fFourier, n);
+    }
+
+    /* Init object*/
+    void init();
+
+    /** Clear object */
+    void clear();
+
+    /** Get the plans for the current arrays from the plan cache */
+    void computePlans();
+
+    /** True if the plans do not correspond to the current arrays */
+    bool plansOutdated() const;
+
+    /** Computes the transform in the given direction (FFTW_FORWARD or
+        FFTW_BACKWARD), normalizing in the direction of normSign. */
+    void Transform(int sign);
+
+    /** Set the real stack.
+        In backward transforms the result is stored in stack. */
+    void setReal(MultidimArray<double> &stack);
+
+    /** Set the Fourier coefficients of the whole batch.
+        The values are copied in the internal array. */
+    void setFourier(const MultidimArray<std::complex<double> > &Fstack);
+
+    /* Set normalization sign. */
+    void setNormalizationSign(int _normSign)
+    {
+        normSign = _normSign;
+    }
+};
+
+/** Use a FFTW wisdom file.
+ * The wisdom in the file (if it exists) is imported now, and all the
+ * wisdom gathered by the plans of the program is saved back to the file
+ * at exit. When a wisdom file is used the plans are measured
+ * (FFTW_MEASURE) unless another planner is set, so that programs run many
+ * times with the same sizes do not need to plan again. The wisdom file can
+ * also be given with the environment variable XMIPP_FFTW_WISDOM or with
+ * the --fftw_wisdom option of any program.
+ */
+void setFFTWWisdomFile(const FileName &fnWisdom);
+
+/** Set the planning rigor of the FFTW plans.
+ * FFTW_ESTIMATE (default without wisdom file), FFTW_MEASURE or FFTW_PATIENT.
+ * It can also be given with the environment variable
+ * XMIPP_FFTW_PLANNER=estimate|measure|patient. Only the plans created after
+ * this call are affected.
+ */
+void setFFTWPlanner(unsigned flags);
+
 /** FFT Magnitude 1D
  * @ingroup FourierOperations
  */
@@ -560,6 +886,41 @@ void correlation_matrix(const MultidimArray< std::complex< double > > & FFT1,
                         CorrelationAux &aux,
                         bool center=true);
 
+/** Correlation auxiliary for single precision images. */
+class CorrelationAuxFloat
+{
+public:
+    MultidimArray< std::complex< float > > FFT1, FFT2;
+    FourierTransformerFloat transformer1, transformer2;
+};
+
+/** Single precision correlation of two nD images
+ * @ingroup FourierOperations
+ *
+ * Same as the double version with the transforms computed in single
+ * precision.
+ */
+void correlation_matrix(const MultidimArray<float> & m1,
+                        const MultidimArray<float> & m2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center=true);
+
+void correlation_matrix(const MultidimArray< std::complex< float > > & FFT1,
+                        const MultidimArray<float> & m2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center=true);
+
+/** Single precision correlation matrix.
+ * R must already be with the right size.
+ */
+void correlation_matrix(const MultidimArray< std::complex< float > > & FFT1,
+                        const MultidimArray< std::complex< float > > & FFT2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center=true);
+
 /** Autocorrelation function of an image
  * @ingroup FourierOperations
  *
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <algorithm>
+#include <pthread.h>
 #include "xmipp_filename.h"
 #include "xmipp_funcs.h"
 #include "xmipp_image_macros.h"
@@ -282,7 +283,7 @@ bool FileName::hasMetadataExtension() const
     String ext = getFileFormat();
     return (ext == "sel"    || ext == "xmd" || ext == "doc" ||
             ext == "ctfdat" || ext == "ctfparam" || ext == "pos" ||
-            ext == "sqlite" || ext == "xml" || ext == "star");
+            ext == "sqlite" || ext == "xml" || ext == "star" || ext == "xmdb");
 }
 
 // Init random .............................................................
@@ -861,12 +862,34 @@ void deleteFile(const FileName &fn)
 	fn.deleteFile();
 }
 
+/* Mutex taken by the FileLocks of all threads. It is recursive because a
+ * writer may lock the header and the data files at the same time */
+static pthread_mutex_t fileLockMutex;
+static pthread_once_t fileLockMutexOnce = PTHREAD_ONCE_INIT;
+
+static void initFileLockMutex()
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&fileLockMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void lockFileLockMutex()
+{
+    pthread_once(&fileLockMutexOnce, initFileLockMutex);
+    pthread_mutex_lock(&fileLockMutex);
+}
+
 void FileLock::lock(int _fileno)
 {
 #ifndef __MINGW32__
     if (islocked)
         unlock();
 
+    lockFileLockMutex();
+
     if (_fileno != 0)
         filenum = _fileno;
 
@@ -885,6 +908,8 @@ void FileLock::lock(FILE * hdlFile)
     if (hdlFile != NULL)
         this->filenum = fileno(hdlFile);
 
+    lockFileLockMutex();
+
 #ifdef __MINGW32__
 
     HANDLE hFile = (HANDLE)_get_osfhandle(filenum);
@@ -917,6 +942,7 @@ void FileLock::unlock()
 #endif
 
         islocked = false;
+        pthread_mutex_unlock(&fileLockMutex);
     }
 }
 
@@ -733,6 +733,11 @@ public:
 
 /** Lock/unlock files
  *
+ * The lock is taken on the whole file for other processes and, as the
+ * locks of fcntl are owned by the process, also on a mutex shared by all
+ * the FileLocks of the process, so that threads writing to the same file
+ * do not interleave their writes either. The lock is released when the
+ * object is destroyed.
  */
 class FileLock
 {
@@ -765,8 +770,21 @@ public:
 
     FileLock(int fileno)
     {
-        FileLock();
-        this->filenum = fileno;
+#ifndef __MINGW32__
+        fl.l_type   = F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        fl.l_start  = 0;
+        fl.l_len    = 0;
+        fl.l_pid    = getpid();
+#endif
+        islocked = false;
+        filenum = fileno;
+    }
+
+    /// Destructor, unlock the file if still locked
+    ~FileLock()
+    {
+        unlock();
     }
 
     /// Lock file
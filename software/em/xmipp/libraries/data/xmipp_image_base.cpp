@@ -26,6 +26,9 @@
 #include "xmipp_image_base.h"
 #include "xmipp_image.h"
 #include "xmipp_error.h"
+#include <list>
+#include <pthread.h>
+#include <sys/stat.h>
 
 //This is needed for static memory allocation
 
@@ -64,7 +67,7 @@ int ImageBase::read(const FileName &name, DataMode datamode, size_t select_img,
     if (!mapData)
         mode = WRITE_READONLY; //TODO: Check if openfile other than readonly is necessary
 
-    hFile = openFile(name, mode);
+    hFile = mapData ? openFile(name, mode) : openReadFile(name);
     int err = _read(name, hFile, datamode, select_img, mapData);
     closeFile(hFile);
     return err;
@@ -157,7 +160,7 @@ void ImageBase::mapFile2Write(size_t Xdim, size_t Ydim, size_t Zdim, const FileN
 /** Macros for don't type */
 #define GET_ROW()               MDRow row; md.getRow(row, objId)
 
-#define READ_AND_RETURN()        ImageFHandler* hFile = openFile(name);\
+#define READ_AND_RETURN()        ImageFHandler* hFile = openReadFile(name);\
                                   int err = _read(name, hFile, params.datamode, params.select_img); \
                                   applyGeo(row, params.only_apply_shifts, params.wrap); \
                                   closeFile(hFile); \
@@ -487,6 +490,8 @@ void ImageBase::getInfo(const FileName &name, ImageInfo &imgInfo)
 /** Open file function
   * Open the image file and returns its file hander.
   */
+static void releasePooledFile(const FileName &fileName);
+
 ImageFHandler* ImageBase::openFile(const FileName &name, int mode) const
 {
     if (name.empty())
@@ -512,6 +517,8 @@ ImageFHandler* ImageBase::openFile(const FileName &name, int mode) const
          sizeZero = fileName.getFileSize() <= 0;
     hFile->exist = exist && !sizeZero;
     hFile->mode = mode;
+    hFile->pooled = false;
+    hFile->dhdf5 = -1;
 
     String wmChar;
 
@@ -545,16 +552,32 @@ ImageFHandler* ImageBase::openFile(const FileName &name, int mode) const
     }
     else if (ext_name.contains("hdf") || ext_name.contains("h5"))
     {
-        if ((hFile->fhdf5 = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT)) == -1 )
-            REPORT_ERROR(ERR_IO_NOTOPEN,"ImageBase::openFile: There is a problem opening the HDF5 file.");
-        //        hFile->fimg = NULL;
+        if (mode == WRITE_READONLY)
+        {
+            if ((hFile->fhdf5 = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT)) == -1 )
+                REPORT_ERROR(ERR_IO_NOTOPEN,"ImageBase::openFile: There is a problem opening the HDF5 file.");
 
-        if ( (hFile->fimg = fopen(fileName.c_str(), wmChar.c_str())) == NULL )
+            if ( (hFile->fimg = fopen(fileName.c_str(), wmChar.c_str())) == NULL )
+            {
+                if (errno == EACCES)
+                    REPORT_ERROR(ERR_IO_NOPERM,formatString("Image::openFile: permission denied when opening %s",fileName.c_str()));
+                else
+                    REPORT_ERROR(ERR_IO_NOTOPEN,formatString("Image::openFile cannot open: %s", fileName.c_str()));
+            }
+        }
+        else
         {
-            if (errno == EACCES)
-                REPORT_ERROR(ERR_IO_NOPERM,formatString("Image::openFile: permission denied when opening %s",fileName.c_str()));
+            // HDF5 cannot open for writing a file that is still open to read
+            releasePooledFile(fileName);
+            if (mode == WRITE_OVERWRITE || !hFile->exist)
+                hFile->fhdf5 = H5Fcreate(fileName.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
             else
-                REPORT_ERROR(ERR_IO_NOTOPEN,formatString("Image::openFile cannot open: %s", fileName.c_str()));
+                hFile->fhdf5 = H5Fopen(fileName.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+            if (hFile->fhdf5 < 0)
+                REPORT_ERROR(ERR_IO_NOTOPEN,formatString("ImageBase::openFile: There is a problem opening the HDF5 file %s to write.",
+                             fileName.c_str()));
+            // Data are written through the HDF5 library only
+            hFile->fimg = NULL;
         }
 
         hFile->fhed = NULL;
@@ -619,6 +642,129 @@ ImageFHandler* ImageBase::openFile(const FileName &name, int mode) const
     return hFile;
 }
 
+/* Pool of files open to read ---------------------------------------------- */
+/** Maximum number of files kept open by each thread */
+#define IMAGE_READ_POOL_SIZE 8
+
+/** File kept open to be read again */
+struct PooledImageFile
+{
+    String         key;    // Name without image number
+    ImageFHandler* hFile;
+    struct stat    info;   // Status of the file when it was opened
+};
+
+/** Files open by a thread, the most recently read first */
+typedef std::list<PooledImageFile> ImageReadPool;
+
+static pthread_key_t imageReadPoolKey;
+static pthread_once_t imageReadPoolOnce = PTHREAD_ONCE_INIT;
+
+static void closePooledFile(PooledImageFile &file)
+{
+    ImageFHandler* hFile = file.hFile;
+    if (hFile->ext_name.contains("hdf") || hFile->ext_name.contains("h5"))
+    {
+        if (hFile->dhdf5 >= 0)
+            H5Dclose(hFile->dhdf5);
+        H5Fclose(hFile->fhdf5);
+    }
+    if (hFile->fimg != NULL)
+        fclose(hFile->fimg);
+    if (hFile->fhed != NULL)
+        fclose(hFile->fhed);
+    delete hFile;
+}
+
+/* Called when a thread finishes */
+static void destroyImageReadPool(void *ptr)
+{
+    ImageReadPool *pool = (ImageReadPool *) ptr;
+    for (ImageReadPool::iterator it = pool->begin(); it != pool->end(); ++it)
+        closePooledFile(*it);
+    delete pool;
+}
+
+static void createImageReadPoolKey()
+{
+    pthread_key_create(&imageReadPoolKey, destroyImageReadPool);
+}
+
+/* Close the file if it is kept open by this thread */
+static void releasePooledFile(const FileName &fileName)
+{
+    pthread_once(&imageReadPoolOnce, createImageReadPoolKey);
+    ImageReadPool *pool = (ImageReadPool *) pthread_getspecific(imageReadPoolKey);
+    if (pool == NULL)
+        return;
+    for (ImageReadPool::iterator it = pool->begin(); it != pool->end(); ++it)
+        if (it->hFile->fileName == fileName)
+        {
+            closePooledFile(*it);
+            pool->erase(it);
+            return;
+        }
+}
+
+/* True if the file has not been replaced or modified */
+static bool sameFileStatus(const struct stat &a, const struct stat &b)
+{
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino &&
+           a.st_size == b.st_size && a.st_mtime == b.st_mtime;
+}
+
+ImageFHandler* ImageBase::openReadFile(const FileName &name) const
+{
+    // Only the images of a stack are read repeatedly from the same file
+    FileName ext_name = name.getFileFormat();
+    if (!name.isInStack() || ext_name.contains("tif"))
+        return openFile(name, WRITE_READONLY);
+
+    pthread_once(&imageReadPoolOnce, createImageReadPoolKey);
+    ImageReadPool *pool = (ImageReadPool *) pthread_getspecific(imageReadPoolKey);
+    if (pool == NULL)
+    {
+        pool = new ImageReadPool;
+        pthread_setspecific(imageReadPoolKey, pool);
+    }
+
+    String key = name.removeAllPrefixes();
+    struct stat info;
+    for (ImageReadPool::iterator it = pool->begin(); it != pool->end(); ++it)
+        if (it->key == key)
+        {
+            PooledImageFile file = *it;
+            pool->erase(it);
+            if (stat(file.hFile->fileName.c_str(), &info) == 0 && sameFileStatus(info, file.info))
+            {
+                // Discard the buffered data, the file may have been written in place
+                if (file.hFile->fimg != NULL)
+                    fflush(file.hFile->fimg);
+                if (file.hFile->fhed != NULL)
+                    fflush(file.hFile->fhed);
+                pool->push_front(file);
+                return file.hFile;
+            }
+            closePooledFile(file);
+            break;
+        }
+
+    ImageFHandler* hFile = openFile(name, WRITE_READONLY);
+    PooledImageFile file;
+    file.key = key;
+    file.hFile = hFile;
+    if (stat(hFile->fileName.c_str(), &file.info) != 0)
+        return hFile;
+    hFile->pooled = true;
+    pool->push_front(file);
+    if (pool->size() > IMAGE_READ_POOL_SIZE)
+    {
+        closePooledFile(pool->back());
+        pool->pop_back();
+    }
+    return hFile;
+}
+
 /** Close file function.
   * Close the image file according to its name and file handler.
   */
@@ -629,6 +775,9 @@ void ImageBase::closeFile(ImageFHandler* hFile) const
     TIFF* tif;
     hid_t fhdf5;
 
+    if (hFile != NULL && hFile->pooled)
+        return;
+
     if (hFile != NULL)
     {
         fileName = hFile->fileName;
@@ -661,8 +810,10 @@ void ImageBase::closeFile(ImageFHandler* hFile) const
     }
     else if (ext_name.contains("hdf") || ext_name.contains("h5"))
     {
+        if (hFile != NULL && hFile->dhdf5 >= 0)
+            H5Dclose(hFile->dhdf5);
         H5Fclose(fhdf5);
-        if (fclose(fimg) != 0 )
+        if (fimg != NULL && fclose(fimg) != 0 )
             REPORT_ERROR(ERR_IO_NOCLOSED,(String)"Can not close image file "+ filename);
     }
     else
@@ -766,7 +917,7 @@ int ImageBase::_read(const FileName &name, ImageFHandler* hFile, DataMode datamo
     else if (ext_name.contains("jpg"))//SPE
         err = readJPEG(select_img);
     else if (ext_name.contains("hdf") || ext_name.contains("h5"))//SPE
-        err = readHDF5(select_img);
+        err = readHDF5(select_img, hFile);
     else
         err = readSPIDER(select_img);
 
@@ -799,6 +950,7 @@ void ImageBase::_write(const FileName &name, ImageFHandler* hFile, size_t select
     fimg = hFile->fimg;
     fhed = hFile->fhed;
     tif  = hFile->tif;
+    fhdf5 = hFile->fhdf5;
 
     FileName ext_name = hFile->ext_name;
 
@@ -914,7 +1066,7 @@ void ImageBase::_write(const FileName &name, ImageFHandler* hFile, size_t select
     else if (ext_name.contains("jpg"))
         writeJPEG(select_img);
     else if (ext_name.contains("hdf5") || ext_name.contains("h5"))
-        writeHDF5(select_img);
+        err = writeHDF5(select_img, isStack, mode, imParam, castMode);
     else
         err = writeSPIDER(select_img,isStack,mode);
 
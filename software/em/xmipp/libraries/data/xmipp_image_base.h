@@ -107,11 +107,14 @@ struct ImageFHandler
     FILE*     fhed;       // Image File header handler
     TIFF*     tif;        // TIFF Image file handler
     hid_t     fhdf5;   // HDF5 File handler
+    hid_t     dhdf5;   // HDF5 dataset kept open to be read again (-1 if none)
+    String    dsname;  // Name of the HDF5 dataset kept open
     FileName  fileName;   // Image file name
     FileName  headName;   // Header file name
     FileName  ext_name;   // Filename extension
     bool     exist;       // Shows if the file exists. Equal 0 means file does not exist or not stack.
     int        mode;   // Opening mode behavior
+    bool     pooled;      // Kept open to be read again (see ImageBase::openReadFile), closeFile ignores it
 };
 
 struct ImageInfo
@@ -798,6 +801,15 @@ protected:
       */
     ImageFHandler* openFile(const FileName &name, int mode = WRITE_READONLY) const;
 
+    /** Open a file to read it.
+      * The handlers of the stacks read by image number (N@stack) are kept
+      * open in a small pool of each thread, so that reading consecutive
+      * images of a stack does not open and close the file each time.
+      * A pooled handler is reused while the file is not replaced or modified.
+      * closeFile does not close pooled handlers.
+      */
+    ImageFHandler* openReadFile(const FileName &name) const;
+
     /** Close file function.
       * Close the image file according to its name and file handler.
       */
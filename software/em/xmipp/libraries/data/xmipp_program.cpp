@@ -27,6 +27,9 @@
 #include "xmipp_program.h"
 #include "metadata_extension.h"
 #include "args.h"
+#include "xmipp_fftw.h"
+#include "xmipp_image_generic.h"
+
 void XmippProgram::initComments()
 {
     CommentList comments;
@@ -60,6 +63,8 @@ void XmippProgram::defineCommons()
     addParamsLine("alias --help;");
     addParamsLine("[--gui*]                 : Show a GUI to launch the program.");
     addParamsLine("[--more*]                : Show additional options.");
+    addParamsLine("[--fftw_wisdom+ <file>]  : Read FFTW plans from this file and save the new ones in it at exit.");
+    addParamsLine("                         : The environment variable XMIPP_FFTW_WISDOM has the same effect.");
 
     ///This are a set of internal command for MetaProgram usage
     ///they should be hidden
@@ -257,6 +262,8 @@ void XmippProgram::read(int argc, const char ** argv, bool reportErrors)
             {
                 if (verbose) //if 0, ignore the parameter, useful for mpi programs
                     verbose = getIntParam("--verbose");
+                if (checkParam("--fftw_wisdom"))
+                    setFFTWWisdomFile(getParam("--fftw_wisdom"));
                 this->readParams();
                 doRun = !checkParam("--xmipp_validate_params"); //just validation, not run
             }
@@ -480,6 +487,64 @@ int XmippProgram::version() const
     REPORT_ERROR(ERR_NOT_IMPLEMENTED,"");
 }
 
+ImagePrefetcher::ImagePrefetcher(const MetaData &md, MDLabel label, size_t ahead)
+{
+    md.getColumnValues(label, filenames);
+    this->ahead = ahead;
+    current = next = 0;
+    finished = false;
+    start();
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    condition.lock();
+    finished = true;
+    condition.signal();
+    condition.unlock();
+    // Joined here, the thread uses the members destroyed before ~Thread
+    join();
+}
+
+void ImagePrefetcher::advance(size_t index)
+{
+    condition.lock();
+    current = index;
+    condition.signal();
+    condition.unlock();
+}
+
+void ImagePrefetcher::run()
+{
+    ImageGeneric img;
+    FileName fnImg;
+    condition.lock();
+    while (true)
+    {
+        while (!finished && (next >= filenames.size() || next > current + ahead))
+            condition.wait();
+        if (finished)
+            break;
+        // Images already being processed are not worth reading
+        if (next <= current)
+            next = current + 1;
+        if (next >= filenames.size())
+            continue;
+        fnImg = filenames[next++];
+        condition.unlock();
+        try
+        {
+            img.read(fnImg);
+        }
+        catch (XmippError &xe)
+        {
+            // Errors are reported when the program itself reads the image
+        }
+        condition.lock();
+    }
+    condition.unlock();
+}
+
 /// Empty constructor
 XmippMetadataProgram::XmippMetadataProgram()
 {
@@ -505,6 +570,10 @@ XmippMetadataProgram::XmippMetadataProgram()
     save_metadata_stack = false;
     keep_input_columns = false;
     track_origin = false;
+    prefetch = 0;
+    prefetcher = NULL;
+    allow_threads = false;
+    nThreads = 1;
 }
 
 void XmippMetadataProgram::init()
@@ -561,6 +630,10 @@ void XmippMetadataProgram::defineParams()
     addParamsLine("                     : metadata in column imageOriginal.");
     addParamsLine(" [--keep_input_columns+]   : Preserve the columns from the input metadata.");
     addParamsLine("                     : Some of the column values can be changed by the program.");
+    addParamsLine(" [--prefetch+ <n=0>]   : Read the next n input images in a background thread (not with MPI)");
+    addParamsLine("                     : while the current one is being processed.");
+    if (allow_threads)
+        addParamsLine(" [--thr <N=1>]   : Number of threads processing images");
 
     if (allow_apply_geo)
     {
@@ -596,6 +669,9 @@ void XmippMetadataProgram::readParams()
     save_metadata_stack = save_metadata_stack || checkParam("--save_metadata_stack");
     track_origin = track_origin || checkParam("--track_origin");
     keep_input_columns = keep_input_columns || checkParam("--keep_input_columns");
+    prefetch = getIntParam("--prefetch");
+    if (allow_threads)
+        nThreads = getIntParam("--thr");
 
     MetaData * md = new MetaData;
     md->read(fn_in, NULL, decompose_stacks);
@@ -758,6 +834,198 @@ void XmippMetadataProgram::wait()
 	// In the serial implementation, we don't have to wait. This will be useful for MPI programs
 }
 
+bool XmippMetadataProgram::prepareImage(size_t objId, size_t objIndex, MDRow &rowIn, MDRow &rowOut,
+                                        FileName &fnImg, FileName &fnImgOut)
+{
+    mdIn->getRow(rowIn, objId);
+    rowIn.getValue(image_label, fnImg);
+
+    if (fnImg.empty())
+        return false;
+
+    fnImgOut = fnImg;
+
+    if (each_image_produces_an_output)
+    {
+        if (!oroot.empty()) // Compose out name to save as independent images
+        {
+            if (oext.empty()) // If oext is still empty, then use ext of indep input images
+            {
+                if (input_is_stack)
+                    oextBaseName = "spi";
+                else
+                    oextBaseName = fnImg.getFileFormat();
+            }
+
+            if (!baseName.empty() )
+                fnImgOut.compose(oroot.removeFileFormat(), objIndex, oextBaseName);
+            else if (fnImg.isInStack())
+                fnImgOut.compose(pathBaseName + (fnImg.withoutExtension()).getDecomposedFileName(), objIndex, oextBaseName);
+            else
+                fnImgOut = pathBaseName + fnImg.withoutExtension()+ "." + oextBaseName;
+        }
+        else if (!fn_out.empty() )
+        {
+            if (single_image)
+                fnImgOut = fn_out;
+            else
+                fnImgOut.compose(objIndex, fn_out); // Compose out name to save as stacks
+        }
+        else
+            fnImgOut = fnImg;
+        setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+    }
+    else if (produces_a_metadata)
+        setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+
+    return true;
+}
+
+/* Work shared by the threads of runThreads */
+struct MetadataProgramThreadData
+{
+    /// Input objects, in the order they are processed
+    std::vector<size_t> objIds;
+    /// Output rows and whether each one has been processed
+    std::vector<MDRow> rowsOut;
+    std::vector<char> done;
+    /// Distribution of the objects between threads
+    ParallelTaskDistributor * distributor;
+    /// Protects the metadatas, the names and the progress bar
+    Mutex mutex;
+    /// Set when a row without image is found or an image fails
+    bool stop;
+    /// First error found by the threads
+    XmippError * error;
+};
+
+/** Keep the first error of the threads as an XmippError, so that it is
+ * reported from the main thread. Must be called from a catch block with the
+ * mutex of data locked.
+ */
+static void storeThreadError(MetadataProgramThreadData * data)
+{
+    XmippError * error;
+    try
+    {
+        throw;
+    }
+    catch (XmippError &xe)
+    {
+        error = new XmippError(xe);
+    }
+    catch (std::exception &e)
+    {
+        error = new XmippError(ERR_UNCLASSIFIED, e.what(), __FILE__, __LINE__);
+    }
+    catch (...)
+    {
+        error = new XmippError(ERR_UNCLASSIFIED, "Unknown exception processing an image",
+                               __FILE__, __LINE__);
+    }
+    if (data->error == NULL)
+        data->error = error;
+    else
+        delete error;
+    data->stop = true;
+}
+
+void XmippMetadataProgram::processImagesThread(ThreadArgument &thArg)
+{
+    XmippMetadataProgram * self = (XmippMetadataProgram *) thArg.workClass;
+    MetadataProgramThreadData * data = (MetadataProgramThreadData *) thArg.data;
+    FileName fnImg, fnImgOut;
+    MDRow rowIn, rowOut;
+    size_t first, last;
+
+    while (data->distributor->getTasks(first, last))
+        for (size_t i = first; i <= last; ++i)
+        {
+            if (self->prefetcher != NULL)
+                self->prefetcher->advance(i);
+
+            data->mutex.lock();
+            bool ok = false;
+            try
+            {
+                ok = !data->stop &&
+                     self->prepareImage(data->objIds[i], i + 1, rowIn, rowOut, fnImg, fnImgOut);
+            }
+            catch (...)
+            {
+                storeThreadError(data);
+            }
+            if (!ok)
+                data->stop = true;
+            data->mutex.unlock();
+            if (!ok)
+                continue;
+
+            try
+            {
+                self->processImage(fnImg, fnImgOut, rowIn, rowOut);
+            }
+            catch (...)
+            {
+                data->mutex.lock();
+                storeThreadError(data);
+                data->mutex.unlock();
+                continue;
+            }
+
+            data->mutex.lock();
+            data->rowsOut[i] = rowOut;
+            data->done[i] = 1;
+            ++self->time_bar_done;
+            self->showProgress();
+            data->mutex.unlock();
+        }
+}
+
+ParallelTaskDistributor * XmippMetadataProgram::createThreadTaskDistributor(size_t nTasks)
+{
+    return new ThreadTaskDistributor(nTasks, 1);
+}
+
+void XmippMetadataProgram::deleteThreadTaskDistributor(ParallelTaskDistributor * td)
+{
+    delete td;
+}
+
+void XmippMetadataProgram::runThreads()
+{
+    MetadataProgramThreadData data;
+    mdIn->findObjects(data.objIds);
+    size_t n = data.objIds.size();
+    data.rowsOut.resize(n);
+    data.done.resize(n, 0);
+    data.stop = false;
+    data.error = NULL;
+    data.distributor = createThreadTaskDistributor(n);
+
+    ThreadManager thMgr(nThreads, this);
+    thMgr.run(processImagesThread, &data);
+    deleteThreadTaskDistributor(data.distributor);
+
+    // Errors are reported from the main thread
+    if (data.error != NULL)
+    {
+        XmippError xe(*data.error);
+        delete data.error;
+        throw xe;
+    }
+
+    if (each_image_produces_an_output || produces_a_metadata)
+    {
+        std::vector<MDRow> rows;
+        rows.reserve(n);
+        for (size_t i = 0; i < n; ++i)
+            if (data.done[i])
+                rows.push_back(data.rowsOut[i]);
+        mdOut.addRows(rows);
+    }
+}
+
 void XmippMetadataProgram::run()
 {
     FileName fnImg, fnImgOut, fullBaseName;
@@ -770,6 +1038,9 @@ void XmippMetadataProgram::run()
 
     startProcessing();
 
+    if (prefetch > 0 && mdInSize > 1)
+        prefetcher = new ImagePrefetcher(*mdIn, image_label, prefetch);
+
     size_t objIndex = 0;
 
     if (!oroot.empty())
@@ -782,63 +1053,35 @@ void XmippMetadataProgram::run()
         pathBaseName   = fullBaseName.getDir();
     }
 
-    //FOR_ALL_OBJECTS_IN_METADATA(mdIn)
-    while (getImageToProcess(objId, objIndex))
+    if (nThreads > 1 && mdInSize > 1)
+        runThreads();
+    else
     {
-        ++objIndex; //increment for composing starting at 1
+        //FOR_ALL_OBJECTS_IN_METADATA(mdIn)
+        while (getImageToProcess(objId, objIndex))
+        {
+            if (prefetcher != NULL)
+                prefetcher->advance(objIndex);
 
-        mdIn->getRow(rowIn, objId);
-        rowIn.getValue(image_label, fnImg);
+            ++objIndex; //increment for composing starting at 1
 
-        if (fnImg.empty())
-            break;
+            if (!prepareImage(objId, objIndex, rowIn, rowOut, fnImg, fnImgOut))
+                break;
 
-        fnImgOut = fnImg;
+            processImage(fnImg, fnImgOut, rowIn, rowOut);
 
-        if (each_image_produces_an_output)
-        {
-            if (!oroot.empty()) // Compose out name to save as independent images
-            {
-                if (oext.empty()) // If oext is still empty, then use ext of indep input images
-                {
-                    if (input_is_stack)
-                        oextBaseName = "spi";
-                    else
-                        oextBaseName = fnImg.getFileFormat();
-                }
+            if (each_image_produces_an_output || produces_a_metadata)
+                mdOut.addRow(rowOut);
 
-                if (!baseName.empty() )
-                    fnImgOut.compose(fullBaseName, objIndex, oextBaseName);
-                else if (fnImg.isInStack())
-                    fnImgOut.compose(pathBaseName + (fnImg.withoutExtension()).getDecomposedFileName(), objIndex, oextBaseName);
-                else
-                    fnImgOut = pathBaseName + fnImg.withoutExtension()+ "." + oextBaseName;
-            }
-            else if (!fn_out.empty() )
-            {
-                if (single_image)
-                    fnImgOut = fn_out;
-                else
-                    fnImgOut.compose(objIndex, fn_out); // Compose out name to save as stacks
-            }
-            else
-                fnImgOut = fnImg;
-            setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+            showProgress();
         }
-        else if (produces_a_metadata)
-            setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
-
-        processImage(fnImg, fnImgOut, rowIn, rowOut);
-
-        if (each_image_produces_an_output || produces_a_metadata)
-            mdOut.addRow(rowOut);
-
-        showProgress();
     }
     wait();
 
     //free iterator memory
     delete iter;
+    delete prefetcher;
+    prefetcher = NULL;
 
     /* Generate name to save mdOut when output are independent images. It uses as prefix
      * the dirBaseName in order not overwriting files when repeating same command on
@@ -32,6 +32,7 @@
 #include "metadata.h"
 #include "xmipp_image.h"
 #include "xmipp_program_sql.h"
+#include "xmipp_threads.h"
 
 
 /** @defgroup Programs2 Basic structure for Xmipp programs
@@ -258,6 +259,41 @@ public:
 }
 ;//end of class XmippProgram
 
+/** Background reader of the input images of a XmippMetadataProgram.
+ * While an image is being processed, a separate thread reads the
+ * following ones, so that their data is already in the system cache
+ * when processImage reads them. The stacks opened by the reading thread
+ * are kept in its own handler pool, they are not shared with the
+ * processing thread.
+ */
+class ImagePrefetcher: public Thread
+{
+private:
+    /// Input images, in the order they are processed
+    std::vector<String> filenames;
+    /// Number of images to read ahead of the current one
+    size_t ahead;
+    /// Index of the image being processed and of the next one to read
+    size_t current, next;
+    /// Set to stop the reading thread
+    bool finished;
+    /// Protects the indexes above and wakes up the reading thread
+    Condition condition;
+
+public:
+    /** Start reading ahead the images of md (stored in label) */
+    ImagePrefetcher(const MetaData &md, MDLabel label, size_t ahead);
+
+    /** Stop the reading thread */
+    ~ImagePrefetcher();
+
+    /** The image at position index of the metadata is going to be processed */
+    void advance(size_t index);
+
+    /** Main function of the reading thread */
+    void run();
+};
+
 /** Special class of XmippProgram that performs some operation related with processing images.
  * It can receive a file with images(MetaData) or a single image.
  * The function processImage is virtual here and needs to be implemented by derived classes.
@@ -336,6 +372,13 @@ protected:
     bool remove_disabled; // Default true
     /// Show process time bar
     bool allow_time_bar; // Default true
+    /// Number of input images to read ahead in a background thread
+    size_t prefetch; // Default 0 (--prefetch)
+    /// Provide the program with the param --thr to process the images in
+    /// several threads. Only for programs whose processImage is thread-safe
+    bool allow_threads; // Default false
+    /// Number of threads processing images
+    int nThreads; // Default 1 (--thr)
 
     // DEDUCED FLAGS
     /// Input is a metadata
@@ -350,6 +393,8 @@ protected:
     bool create_empty_stackfile; //
     //check whether to delete or not the input metadata
     bool delete_mdIn;
+    /// Background reader of the input images (only if prefetch > 0)
+    ImagePrefetcher * prefetcher;
 
     /// Some time bar related counters
     size_t time_bar_step, time_bar_size, time_bar_done;
@@ -378,6 +423,29 @@ protected:
     /** Define the label param */
     virtual void defineLabelParam();
 
+    /** Read the input row objId and set up the names of the input
+     * and output images and the output row. objIndex starts at 1.
+     * Returns false if the row has no image.
+     */
+    bool prepareImage(size_t objId, size_t objIndex, MDRow &rowIn, MDRow &rowOut,
+                      FileName &fnImg, FileName &fnImgOut);
+
+    /** Process all images distributing them between nThreads threads.
+     * The output rows are added to the output metadata in the input order.
+     */
+    void runThreads();
+
+    /** Function of the threads of runThreads */
+    static void processImagesThread(ThreadArgument &thArg);
+
+    /** Distributor of the images between the threads of runThreads.
+     * By default the images are given one at a time, in order.
+     */
+    virtual ParallelTaskDistributor * createThreadTaskDistributor(size_t nTasks);
+
+    /** Free the distributor given by createThreadTaskDistributor */
+    virtual void deleteThreadTaskDistributor(ParallelTaskDistributor * td);
+
 public:
     XmippMetadataProgram();
 
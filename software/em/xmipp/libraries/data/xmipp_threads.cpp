@@ -25,6 +25,7 @@
 
 #include <stdio.h>
 #include <iostream>
+#include <algorithm>
 
 #include "xmipp_threads.h"
 #include "xmipp_error.h"
@@ -125,11 +126,21 @@ void Barrier::wait()
 
 Thread::Thread()
 {
+    started = false;
 }
 
 Thread::~Thread()
 {
-    pthread_join(thId, NULL);
+    join();
+}
+
+void Thread::join()
+{
+    if (started)
+    {
+        pthread_join(thId, NULL);
+        started = false;
+    }
 }
 
 void Thread::start()
@@ -141,6 +152,7 @@ void Thread::start()
         std::cerr << "Thread: can't start thread." << std::endl;
         exit(1);
     }
+    started = true;
 }
 
 void * _singleThreadMain(void * data){
@@ -294,6 +306,7 @@ ParallelTaskDistributor::ParallelTaskDistributor(size_t nTasks, size_t bSize)
     numberOfTasks = nTasks;
     blockSize = bSize;
     assignedTasks = 0;
+    guidedWorkers = 0;
 }
 
 void ParallelTaskDistributor::clear()
@@ -315,6 +328,21 @@ int ParallelTaskDistributor::getBlockSize() const
     return blockSize;
 }
 
+void ParallelTaskDistributor::setGuided(size_t nWorkers)
+{
+    lock();
+    guidedWorkers = nWorkers;
+    unlock();
+}
+
+size_t ParallelTaskDistributor::nextBlockSize(size_t remaining) const
+{
+    size_t n = blockSize;
+    if (guidedWorkers > 0)
+        n = std::max(n, remaining / (2 * guidedWorkers));
+    return std::min(n, remaining);
+}
+
 bool ParallelTaskDistributor::getTasks(size_t &first, size_t &last)
 {
     lock();
@@ -354,14 +382,142 @@ bool ThreadTaskDistributor::distribute(size_t &first, size_t &last)
     else
     {
         first = assignedTasks;
-        assignedTasks
-        = (assignedTasks + blockSize < numberOfTasks) ? (assignedTasks
-                + blockSize) : numberOfTasks;
+        assignedTasks += nextBlockSize(numberOfTasks - assignedTasks);
         last = assignedTasks - 1;
     }
     return result;
 }
 
+WorkStealingTaskDistributor::WorkStealingTaskDistributor(size_t nTasks, size_t bSize, int nWorkers):
+        ThreadTaskDistributor(nTasks, bSize)
+{
+    if (nWorkers < 1)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "The number of workers should be > 0");
+    numberOfWorkers = nWorkers;
+    ranges = new TaskRange[nWorkers];
+    pthread_key_create(&workerKey, NULL);
+    clear();
+}
+
+WorkStealingTaskDistributor::~WorkStealingTaskDistributor()
+{
+    pthread_key_delete(workerKey);
+    delete [] ranges;
+}
+
+void WorkStealingTaskDistributor::clear()
+{
+    for (int w = 0; w < numberOfWorkers; ++w)
+    {
+        TaskRange &range = ranges[w];
+        range.mutex.lock();
+        range.first = (numberOfTasks * w) / numberOfWorkers;
+        range.end = (numberOfTasks * (w + 1)) / numberOfWorkers;
+        range.mutex.unlock();
+    }
+    mutex.lock();
+    // Forget the ranges assigned to the calling threads, so that the
+    // threads of the next run get them again in turns
+    pthread_key_delete(workerKey);
+    pthread_key_create(&workerKey, NULL);
+    nextWorker = 0;
+    assignedTasks = 0;
+    mutex.unlock();
+}
+
+bool WorkStealingTaskDistributor::getTasks(int worker, size_t &first, size_t &last)
+{
+    if (worker < 0 || worker >= numberOfWorkers)
+        REPORT_ERROR(ERR_ARG_INCORRECT, formatString("Invalid worker %d", worker));
+    first = last = 0;
+    while (!takeBlock(worker, first, last))
+        if (!steal(worker))
+            return false;
+    return true;
+}
+
+bool WorkStealingTaskDistributor::distribute(size_t &first, size_t &last)
+{
+    // The range of the calling thread is stored as (worker + 1) in its
+    // specific data, new threads get the ranges in turns
+    size_t worker = (size_t)pthread_getspecific(workerKey);
+    if (worker == 0)
+    {
+        mutex.lock();
+        worker = (size_t)(nextWorker++ % numberOfWorkers) + 1;
+        mutex.unlock();
+        pthread_setspecific(workerKey, (void *)worker);
+    }
+    return getTasks((int)worker - 1, first, last);
+}
+
+bool WorkStealingTaskDistributor::takeBlock(int worker, size_t &first, size_t &last)
+{
+    TaskRange &range = ranges[worker];
+    bool result = false;
+    range.mutex.lock();
+    if (range.first < range.end)
+    {
+        // The blocks get smaller as the range gets empty, so that the
+        // last tasks can still be stolen by other workers
+        size_t remaining = range.end - range.first;
+        size_t n = std::min(blockSize, (remaining + 1) / 2);
+        first = range.first;
+        last = first + n - 1;
+        range.first += n;
+        result = true;
+    }
+    range.mutex.unlock();
+    return result;
+}
+
+bool WorkStealingTaskDistributor::steal(int worker)
+{
+    while (true)
+    {
+        // Look for the victim with more pending tasks
+        int victim = -1;
+        size_t maxPending = 0;
+        for (int w = 0; w < numberOfWorkers; ++w)
+        {
+            ranges[w].mutex.lock();
+            size_t pending = ranges[w].end - ranges[w].first;
+            ranges[w].mutex.unlock();
+            if (pending > maxPending)
+            {
+                maxPending = pending;
+                victim = w;
+            }
+        }
+        if (victim < 0)
+            return false;
+        if (victim == worker) // refilled by another thread of the same worker
+            return true;
+
+        // Move the second half of its range, both ranges may have changed
+        // meanwhile. The locks are always taken in the same order.
+        TaskRange &own = ranges[worker];
+        TaskRange &range = ranges[victim];
+        TaskRange &lock1 = (worker < victim) ? own : range;
+        TaskRange &lock2 = (worker < victim) ? range : own;
+        lock1.mutex.lock();
+        lock2.mutex.lock();
+        bool stolen = false;
+        if (own.first >= own.end && range.first < range.end)
+        {
+            own.end = range.end;
+            own.first = range.first + (range.end - range.first) / 2;
+            range.end = own.first;
+            stolen = true;
+        }
+        bool ownPending = own.first < own.end;
+        lock2.mutex.unlock();
+        lock1.mutex.unlock();
+        if (stolen || ownPending)
+            return true;
+    }
+}
+
 // =================== OLD THREADS IMPLEMENTATION ============================
 int barrier_init(barrier_t *barrier,int needed)
 {
@@ -193,6 +193,7 @@ class Thread
 {
 private:
     pthread_t thId; ///< pthreads id
+    bool started; ///< the thread was started and not joined yet
 
 public:
     /** Default constructor.
@@ -213,6 +214,12 @@ public:
      * This is the function to be called to start the run() in a separated thread.
      */
      void start();
+
+    /** Wait for the thread to finish.
+     * Subclasses whose run() uses their own members must call it in their
+     * destructor, before those members are destroyed.
+     */
+     void join();
 }
 ;//end of class Condition
 
@@ -370,6 +377,8 @@ protected:
     size_t blockSize;
     //The number of tasks that have been assigned
     size_t assignedTasks;
+    //Number of workers for guided distribution (0 for fixed blocks)
+    size_t guidedWorkers;
 
 public:
     //The total number of tasks to be distributed
@@ -392,7 +401,7 @@ public:
      * before start distributing the tasks between the workers
      * threads.
      */
-    void clear();
+    virtual void clear();
 
     /** Set the number of tasks assigned in each request */
     void setBlockSize(size_t bSize);
@@ -400,6 +409,16 @@ public:
     /** Return the number of tasks assigned in each request */
     int getBlockSize() const;
 
+    /** Guided distribution.
+     * Instead of fixed blocks, each request receives 1/(2*nWorkers) of
+     * the tasks not assigned yet, but never less than the block size.
+     * The first blocks are large (few requests) and they shrink near
+     * the end, so that the workers finish at about the same time even
+     * if the cost of the tasks is very different. nWorkers=0 goes back
+     * to fixed blocks.
+     */
+    void setGuided(size_t nWorkers);
+
     /** Gets parallel tasks.
      *  @ingroup ParallelJobHandler
      *  This function will be called by workers for asking tasks
@@ -441,6 +460,8 @@ protected:
     virtual void unlock() = 0;
     virtual bool distribute(size_t &first, size_t &last) = 0;
 
+    /** Number of tasks of the next request, out of the given remaining ones */
+    size_t nextBlockSize(size_t remaining) const;
 }
 ;//class ParallelTaskDistributor
 
@@ -466,6 +487,65 @@ public:
 }
 ;//end of class ThreadTaskDistributor
 
+/** Work stealing distribution of tasks between threads.
+ * The tasks are initially split in as many contiguous ranges as workers.
+ * Each worker takes blocks from the front of its own range, without
+ * contention with the others, and the blocks shrink as the range gets
+ * empty. When its range is exhausted, the worker steals the second half
+ * of the range with more pending tasks. This way the load is balanced
+ * even when the cost of the tasks is very heterogeneous.
+ *
+ * Workers can identify themselves with getTasks(worker, first, last),
+ * otherwise each calling thread is assigned a range the first time it
+ * asks for tasks.
+ * @code
+ * WorkStealingTaskDistributor td(nImages, 10, nThreads);
+ * //in the thread function
+ * size_t first, last;
+ * while (td.getTasks(thread_id, first, last))
+ *     for (size_t i = first; i <= last; ++i)
+ *         processImage(i);
+ * @endcode
+ */
+class WorkStealingTaskDistributor: public ThreadTaskDistributor
+{
+protected:
+    /// Pending tasks of one worker, from first to end-1
+    struct TaskRange
+    {
+        size_t first, end;
+        Mutex mutex;
+    };
+
+    TaskRange * ranges;
+    int numberOfWorkers;
+    int nextWorker;
+    pthread_key_t workerKey;
+
+public:
+    WorkStealingTaskDistributor(size_t nTasks, size_t bSize, int nWorkers);
+    virtual ~WorkStealingTaskDistributor();
+
+    using ParallelTaskDistributor::getTasks;
+    /** Get tasks for a given worker (0 <= worker < nWorkers) */
+    bool getTasks(int worker, size_t &first, size_t &last);
+
+    /** Split again all the tasks between the workers */
+    virtual void clear();
+    virtual void reset() { clear(); };
+
+protected:
+    // Locks are per worker range
+    virtual void lock() {};
+    virtual void unlock() {};
+    virtual bool distribute(size_t &first, size_t &last);
+    /** Take a block from the range of a worker */
+    bool takeBlock(int worker, size_t &first, size_t &last);
+    /** Move half of the largest pending range to the range of worker */
+    bool steal(int worker);
+}
+;//end of class WorkStealingTaskDistributor
+
 /** @name Old parallel stuff. */
 /** Barrier structure */
 //@{
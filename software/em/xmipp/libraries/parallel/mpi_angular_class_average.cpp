@@ -334,9 +334,7 @@ void MpiProgAngularClassAverage::run()
             }
         }
     }
-    FileName gatherFile;
-    formatStringFast( gatherFile, "%s_GatherMetadata.xmd", fn_out.c_str());
-    node->gatherMetadatas(DFscore, gatherFile);
+    node->gatherMetadatas(DFscore);
 
     if (node->rank == 0)
     {
@@ -224,7 +224,7 @@ bool MpiProgAngularProjectionMatching::requestJobs(
 
 void MpiProgAngularProjectionMatching::writeOutputFiles()
 {
-    node->gatherMetadatas(DFo, fn_out);
+    node->gatherMetadatas(DFo);
     if (node->isMaster())
     {
     	MetaData mdAux;
@@ -242,6 +242,16 @@ void MpiProgAngularProjectionMatching::produceSideInfo()
     node->barrierWait();
 }
 
+void MpiProgAngularProjectionMatching::produceReferenceBank()
+{
+    size_t maxMappedBytes=(size_t)(avail_memory*1024*1024*1024);
+    if (node->isMaster() && !bank.open(fn_bank,referenceBankKey(),maxMappedBytes))
+        buildReferenceBank();
+    node->barrierWait();
+    if (!bank.isOpen() && !bank.open(fn_bank,referenceBankKey(),maxMappedBytes))
+        REPORT_ERROR(ERR_IO_NOTOPEN,(String)"Cannot open the reference bank "+fn_bank);
+}
+
 void MpiProgAngularProjectionMatching::computeChunks()
 {
 	size_t max_number_of_images_in_around_a_sampling_point = 0;
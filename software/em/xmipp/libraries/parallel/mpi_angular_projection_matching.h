@@ -93,6 +93,9 @@ public:
 
     /** Redefine produceSideInfo */
     void produceSideInfo();
+    /** Only the master builds the reference bank, the rest of nodes wait
+     * and open it */
+    void produceReferenceBank();
     /** These two function will be executed only by master */
     void computeChunks();
     void computeChunkAngularDistance(int symmetry, int sym_order);
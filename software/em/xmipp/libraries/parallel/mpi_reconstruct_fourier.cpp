@@ -124,7 +124,7 @@ void ProgMPIRecFourier::run()
     MPI_Group  orig_group, new_group;
     MPI_Comm   new_comm;
     long int total_usecs;
-    double total_time_processing=0., total_time_weightening=0., total_time_communicating=0., total_time;
+    double total_time_processing=0., total_time_weightening=0., total_time_communicating=0.;
     int iter=0;
     int * ranks;
 
@@ -291,9 +291,6 @@ void ProgMPIRecFourier::run()
             // job number
             // job size
             // aux variable
-            double * fourierVolume = (double *)VoutFourier.data;
-            double * fourierWeights = FourierWeights.data;
-
             sizeout = MULTIDIM_SIZE(FourierWeights);
 
             //First
@@ -332,94 +329,26 @@ void ProgMPIRecFourier::run()
                     //a posibility is a non-blocking send
                     MPI_Recv(0, 0, MPI_INT, 0, TAG_COLLECT_FOR_FSC, MPI_COMM_WORLD, &status);
 
+                    // Sum the first half of the images over all workers
+                    reduceDataInChunks((double *)MULTIDIM_ARRAY(VoutFourier), 2*sizeout, new_comm);
+                    reduceDataInChunks(MULTIDIM_ARRAY(FourierWeights), sizeout, new_comm);
+
                     if( node->rank == 1 )
                     {
-                        // Reserve memory for the receive buffer
-                        double * recBuffer = (double *) malloc (sizeof(double)*BUFFSIZE);
-                        int receivedSize;
-                        double * pointer;
-                        pointer = fourierVolume;
-                        int currentSource;
-
-                        if ( nProcs > 2 )
-                        {
-                            // Receive from other workers
-                            for ( size_t i = 2 ; i <= nProcs ; i++)
-                            {
-                                MPI_Recv(0,0, MPI_INT, MPI_ANY_SOURCE, TAG_FREEWORKER,
-                                         MPI_COMM_WORLD, &status);
-
-                                currentSource = status.MPI_SOURCE;
-
-                                pointer = fourierVolume;
-
-                                while (1)
-                                {
-                                    MPI_Probe( currentSource, MPI_ANY_TAG, MPI_COMM_WORLD, &status );
-
-                                    if ( status.MPI_TAG == TAG_FREEWORKER )
-                                    {
-                                        MPI_Recv(0,0, MPI_INT, currentSource, TAG_FREEWORKER, MPI_COMM_WORLD, &status );
-                                        break;
-                                    }
-
-                                    MPI_Recv( recBuffer,
-                                              BUFFSIZE,
-                                              MPI_DOUBLE,
-                                              currentSource,
-                                              MPI_ANY_TAG,
-                                              MPI_COMM_WORLD,
-                                              &status );
-
-                                    MPI_Get_count( &status, MPI_DOUBLE, &receivedSize );
-
-                                    for ( int i = 0 ; i < receivedSize ; i ++ )
-                                    {
-                                        pointer[i] += recBuffer[i];
-                                    }
-
-                                    pointer += receivedSize;
-                                }
-                            }
-                        }
-                        free( recBuffer );
-
-                        Image<double> auxVolume1;
-                        auxVolume1().alias( FourierWeights );
-                        auxVolume1.write((std::string)fn_fsc + "_1_Weights.vol");
-
-                        Image< std::complex<double> > auxFourierVolume1;
-                        auxFourierVolume1().alias( VoutFourier );
-                        auxFourierVolume1.write((std::string) fn_fsc + "_1_Fourier.vol");
-
+                        // Keep the first half in memory, it is added to the second one at the end
+                        VoutFourierHalf = VoutFourier;
+                        FourierWeightsHalf = FourierWeights;
 
                         // Normalize global volume and store data
                         finishComputations(FileName((std::string) fn_fsc + "_split_1.vol"));
-
-                        Vout().initZeros(volPadSizeZ, volPadSizeY, volPadSizeX);
-
-                        transformerVol.setReal(Vout());
-                        Vout().clear();
-                        transformerVol.getFourierAlias(VoutFourier);
-                        FourierWeights.initZeros(VoutFourier);
-                        VoutFourier.initZeros();
                     }
-                    else
-                    {
-
-                        MPI_Send( 0,0,MPI_INT,1,TAG_FREEWORKER, MPI_COMM_WORLD );
-
-                        sendDataInChunks( fourierVolume, 1, 2*sizeout, BUFFSIZE, MPI_COMM_WORLD );
-
-                        MPI_Send( 0,0,MPI_INT,1,TAG_FREEWORKER, MPI_COMM_WORLD );
 
-                        Vout().initZeros(volPadSizeZ, volPadSizeY, volPadSizeX);
-                        transformerVol.setReal(Vout());
-                        Vout().clear();
-                        transformerVol.getFourierAlias(VoutFourier);
-                        FourierWeights.initZeros(VoutFourier);
-                        VoutFourier.initZeros();
-                    }
+                    Vout().initZeros(volPadSizeZ, volPadSizeY, volPadSizeX);
+                    transformerVol.setReal(Vout());
+                    Vout().clear();
+                    transformerVol.getFourierAlias(VoutFourier);
+                    FourierWeights.initZeros(VoutFourier);
+                    VoutFourier.initZeros();
                 }
                 else if (status.MPI_TAG == TAG_TRANSFER)
                 {
@@ -431,9 +360,7 @@ void ProgMPIRecFourier::run()
                     std::cerr << "Wr" << node->rank << " " << "TAG_STOP" << std::endl;
 #endif
 
-                    MPI_Allreduce(MPI_IN_PLACE, fourierWeights,
-                                  sizeout, MPI_DOUBLE,
-                                  MPI_SUM, new_comm);
+                    reduceDataInChunks(MULTIDIM_ARRAY(FourierWeights), sizeout, new_comm, true);
                     /*if (iter != NiterWeight)
                 {
                         MPI_Allreduce(MPI_IN_PLACE, fourierWeights,
@@ -457,62 +384,10 @@ void ProgMPIRecFourier::run()
                         break;
                 }*/
 
+                    reduceDataInChunks((double *)MULTIDIM_ARRAY(VoutFourier), 2*sizeout, new_comm);
+
                     if ( node->rank == 1 )
                     {
-                        // Reserve memory for the receive buffer
-                        double * recBuffer = (double *) malloc (sizeof(double)*BUFFSIZE);
-                        int receivedSize;
-                        double * pointer;
-                        pointer = fourierVolume;
-                        int currentSource;
-
-                        gettimeofday(&start_time,NULL);
-
-                        if ( nProcs > 1 )
-                        {
-                            // Receive from other workers
-
-                            for (size_t i = 0 ; i <= (nProcs-2) ; i++)
-                            {
-                                MPI_Recv(0,0, MPI_INT, MPI_ANY_SOURCE, TAG_FREEWORKER,
-                                         MPI_COMM_WORLD, &status);
-
-                                currentSource = status.MPI_SOURCE;
-
-                                pointer = fourierVolume;
-
-                                while (1)
-                                {
-                                    MPI_Probe( currentSource, MPI_ANY_TAG, MPI_COMM_WORLD, &status );
-
-                                    if ( status.MPI_TAG == TAG_FREEWORKER )
-                                    {
-                                        MPI_Recv(0,0, MPI_INT, currentSource, TAG_FREEWORKER, MPI_COMM_WORLD, &status );
-
-                                        break;
-                                    }
-
-                                    MPI_Recv( recBuffer,
-                                              BUFFSIZE,
-                                              MPI_DOUBLE,
-                                              currentSource,
-                                              MPI_ANY_TAG,
-                                              MPI_COMM_WORLD,
-                                              &status );
-
-                                    MPI_Get_count( &status, MPI_DOUBLE, &receivedSize );
-
-                                    for ( int i = 0 ; i < receivedSize ; i ++ )
-                                    {
-                                        pointer[i] += recBuffer[i];
-                                    }
-
-                                    pointer += receivedSize;
-                                }
-                            }
-                        }
-
-                        free( recBuffer );
                         if (iter==0)
                         {
                             VoutFourierTmp=VoutFourier;
@@ -535,15 +410,9 @@ void ProgMPIRecFourier::run()
 
                         if( fn_fsc != "")
                         {
-
-                            Image<double> auxVolume2;
-                            auxVolume2().alias( FourierWeights );
-                            auxVolume2.write((std::string)fn_fsc + "_2_Weights.vol");
-
-                            Image< std::complex<double> > auxFourierVolume2;
-                            auxFourierVolume2().alias( VoutFourier );
-                            auxFourierVolume2.write((std::string) fn_fsc + "_2_Fourier.vol");
-
+                            // Add the second half to the first one kept in memory
+                            FourierWeightsHalf += FourierWeights;
+                            VoutFourierHalf += VoutFourier;
 
                             // Normalize global volume and store data
                             finishComputations(FileName((std::string) fn_fsc + "_split_2.vol"));
@@ -552,46 +421,10 @@ void ProgMPIRecFourier::run()
                             transformerVol.setReal(Vout());
                             Vout().clear();
                             transformerVol.getFourierAlias(VoutFourier);
-                            FourierWeights.initZeros(VoutFourier);
-                            VoutFourier.initZeros();
-
-                            //int x,y,z;
-
-                            //FourierWeights.getDimension(y,x,z);
-                            gettimeofday(&start_time,NULL);
-
-                            auxVolume2.sumWithFile((std::string) fn_fsc + "_1_Weights.vol");
-
-                            gettimeofday(&end_time,NULL);
-                            total_usecs = (end_time.tv_sec-start_time.tv_sec) * 1000000 + (end_time.tv_usec-start_time.tv_usec);
-                            total_time=(double)total_usecs/(double)1000000;
-                            if (verbose > 0)
-                                std::cout << "SumFile1: " << total_time << " secs." << std::endl;
-
-                            auxVolume2.sumWithFile((std::string) fn_fsc + "_2_Weights.vol");
-
-                            //VoutFourier.getDimension(y,x,z);
-                            auxFourierVolume2.sumWithFile((std::string) fn_fsc + "_1_Fourier.vol");
-                            auxFourierVolume2.sumWithFile((std::string) fn_fsc + "_2_Fourier.vol");
-
-                            //remove temporary files
-                            remove(((std::string) fn_fsc + "_1_Weights.vol").c_str());
-                            remove(((std::string) fn_fsc + "_2_Weights.vol").c_str());
-                            remove(((std::string) fn_fsc + "_1_Fourier.vol").c_str());
-                            remove(((std::string) fn_fsc + "_2_Fourier.vol").c_str());
-                            gettimeofday(&end_time,NULL);
-                            total_usecs = (end_time.tv_sec-start_time.tv_sec) * 1000000 + (end_time.tv_usec-start_time.tv_usec);
-                            total_time=(double)total_usecs/(double)1000000;
-                            if (verbose > 0)
-                                std::cout << "SumFile: " << total_time << " secs." << std::endl;
-
-                            /*Save SUM
-                                                        //this is an image but not an xmipp image
-                                                        auxFourierVolume.write((std::string)fn_fsc + "_all_Fourier.vol",
-                                                                false,VDOUBLE);
-                                                        auxVolume.write((std::string)fn_fsc + "_all_Weights.vol",
-                                                                false,VDOUBLE);
-                            */
+                            FourierWeights = FourierWeightsHalf;
+                            VoutFourier = VoutFourierHalf;
+                            FourierWeightsHalf.clear();
+                            VoutFourierHalf.clear();
                         }
                         if (NiterWeight==0 || iter == NiterWeight-1)
                         {
@@ -608,15 +441,7 @@ void ProgMPIRecFourier::run()
                         break;
                     }
                     else
-                    {
-                        MPI_Send( 0,0,MPI_INT,1,TAG_FREEWORKER, MPI_COMM_WORLD );
-
-                        sendDataInChunks( fourierVolume, 1, 2 * sizeout, BUFFSIZE, MPI_COMM_WORLD);
-
-                        MPI_Send( 0,0,MPI_INT,1,TAG_FREEWORKER, MPI_COMM_WORLD );
-
                         break;
-                    }
                 }
                 else if (status.MPI_TAG == TAG_WORKFORWORKER)
                 {
@@ -663,35 +488,19 @@ void ProgMPIRecFourier::run()
     while(iter<NiterWeight);
 }
 
-int  ProgMPIRecFourier::sendDataInChunks( double * pointer, int dest, int totalSize, int buffSize, MPI_Comm comm )
+void ProgMPIRecFourier::reduceDataInChunks( double * pointer, size_t totalSize, MPI_Comm comm, bool toAll )
 {
-    double * localPointer = pointer;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
 
-    int numChunks =(int)ceil((double)totalSize/(double)buffSize);
-    int packetSize;
-    int err=0;
-
-    for ( int i = 0 ; i < numChunks ; i ++ )
+    for ( size_t offset = 0 ; offset < totalSize ; offset += BUFFSIZE )
     {
-        if ( i == (numChunks-1))
-            packetSize = totalSize-i*buffSize;
+        int packetSize = (int)std::min((size_t)BUFFSIZE, totalSize - offset);
+        if ( toAll )
+            MPI_Allreduce(MPI_IN_PLACE, pointer + offset, packetSize, MPI_DOUBLE, MPI_SUM, comm);
+        else if ( rank == 0 )
+            MPI_Reduce(MPI_IN_PLACE, pointer + offset, packetSize, MPI_DOUBLE, MPI_SUM, 0, comm);
         else
-            packetSize = buffSize;
-
-        if ( (err = MPI_Send( localPointer, packetSize,
-                              MPI_DOUBLE, dest, 0, MPI_COMM_WORLD ))
-             != MPI_SUCCESS )
-        {
-            break;
-        }
-
-        localPointer += packetSize;
+            MPI_Reduce(pointer + offset, NULL, packetSize, MPI_DOUBLE, MPI_SUM, 0, comm);
     }
-
-    return err;
 }
-
-
-
-
-
@@ -66,6 +66,10 @@ public:
     /** Dvide the job in this number block with this number of images */
     int mpi_job_size;
 
+    /** Fourier volume and weights of the first half of the images (for the FSC) */
+    MultidimArray< std::complex<double> > VoutFourierHalf;
+    MultidimArray<double> FourierWeightsHalf;
+
     /** Empty constructor */
     ProgMPIRecFourier()
     {}
@@ -96,7 +100,10 @@ public:
     /* Run --------------------------------------------------------------------- */
     void run();
 
-    int  sendDataInChunks( double * pointer, int dest, int totalSize, int buffSize, MPI_Comm comm );
+    /** Sum an array over all the processes of comm, in chunks of BUFFSIZE.
+     * The result is left in the process with rank 0 in comm or, if toAll, in all of them.
+     */
+    void reduceDataInChunks( double * pointer, size_t totalSize, MPI_Comm comm, bool toAll=false );
 
 };
 //@}
@@ -23,6 +23,7 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 
+#include <climits>
 #include "xmipp_mpi.h"
 #include "data/xmipp_log.h"
 
@@ -32,6 +33,29 @@ MpiTaskDistributor::MpiTaskDistributor(size_t nTasks, size_t bSize,
         ThreadTaskDistributor(nTasks, bSize)
 {
     this->node = node;
+    threadsPerNode = threadBlockSize = 0;
+    localFirst = localEnd = 0;
+    nodeFinished = false;
+}
+
+void MpiTaskDistributor::clear()
+{
+    ThreadTaskDistributor::clear();
+    lock();
+    localFirst = localEnd = 0;
+    nodeFinished = false;
+    unlock();
+}
+
+void MpiTaskDistributor::setHierarchical(size_t nThreads)
+{
+    nThreads = XMIPP_MAX(nThreads, 1);
+    lock();
+    threadsPerNode = nThreads;
+    threadBlockSize = blockSize;
+    blockSize = XMIPP_MIN(blockSize * nThreads, numberOfTasks);
+    unlock();
+    setGuided(XMIPP_MAX(node->size - 1, 1));
 }
 
 bool MpiTaskDistributor::distribute(size_t &first, size_t &last)
@@ -62,12 +86,38 @@ bool MpiTaskDistributor::distributeMaster()
 }
 
 bool MpiTaskDistributor::distributeSlaves(size_t &first, size_t &last)
+{
+    if (threadsPerNode == 0)
+        return requestTasks(first, last);
+
+    // Threads share the node block, another one is requested when it is empty
+    if (localFirst >= localEnd)
+    {
+        size_t nodeFirst, nodeLast;
+        if (!requestTasks(nodeFirst, nodeLast))
+            return false;
+        localFirst = nodeFirst;
+        localEnd = nodeLast + 1;
+    }
+    size_t remaining = localEnd - localFirst;
+    size_t n = XMIPP_MIN(threadBlockSize, (remaining + threadsPerNode - 1) / threadsPerNode);
+    first = localFirst;
+    last = first + n - 1;
+    localFirst += n;
+    return true;
+}
+
+bool MpiTaskDistributor::requestTasks(size_t &first, size_t &last)
 {
   // Worker nodes should ask for task to master
   // Result of workBuffer:
   //   workBuffer[0] = 0 if no more jobs, 1 otherwise
   //   workBuffer[1] = first
   //   workBuffer[2] = last
+  // Once the master has answered that there are no more jobs, it is no
+  // longer listening to this node
+  if (nodeFinished)
+      return false;
   size_t workBuffer[3];
   MPI_Status status;
   //any message from the master, is tag is TAG_STOP then stop
@@ -76,6 +126,7 @@ bool MpiTaskDistributor::distributeSlaves(size_t &first, size_t &last)
 
   first = workBuffer[1];
   last = workBuffer[2];
+  nodeFinished = (workBuffer[0] == 0);
 
   return (workBuffer[0] == 1);
 }
@@ -141,12 +192,15 @@ MpiFileMutex::~MpiFileMutex()
 //------------ MPI ---------------------------
 MpiNode::MpiNode(int &argc, char **& argv)
 {
-    MPI_Init(&argc, &argv);
+    // Several threads of a node may ask the master for tasks, one at a time
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &provided);
     int irank, isize;
     MPI_Comm_rank(MPI_COMM_WORLD, &irank);
     MPI_Comm_size(MPI_COMM_WORLD, &isize);
     rank=irank;
     size=isize;
+    threadsSupported = (provided >= MPI_THREAD_SERIALIZED);
     //comm = new MPI_Comm;
     //MPI_Comm_dup(MPI_COMM_WORLD, comm);
     active = 1;
@@ -193,40 +247,72 @@ size_t MpiNode::getActiveNodes()
 }
 
 #endif
-void MpiNode::gatherMetadatas(MetaData &MD, const FileName &rootname)
+void MpiNode::gatherMetadatas(MetaData &MD)
 {
     if (size == 1)
         return;
 
-    FileName fn;
+    // Workers serialize their partial results, the master keeps its own
+    std::vector<char> block;
+    if (!isMaster())
+        MD.writeBinaryBlock(block);
+    unsigned long long mySize = block.size();
+    std::vector<unsigned long long> blockSizes(size);
+    MPI_Allgather(&mySize, 1, MPI_UNSIGNED_LONG_LONG,
+                  &blockSizes[0], 1, MPI_UNSIGNED_LONG_LONG, MPI_COMM_WORLD);
+
+    // MPI counts and displacements are int, so the blocks are gathered in
+    // rounds of at most INT_MAX bytes, each node sending at most chunk bytes
+    size_t chunk = INT_MAX / size;
+    std::vector<size_t> offsets(size);
+    size_t totalSize = 0, maxSize = 0;
+    for (size_t nodeRank = 0; nodeRank < size; nodeRank++)
+    {
+        offsets[nodeRank] = totalSize;
+        totalSize += blockSizes[nodeRank];
+        maxSize = std::max(maxSize, (size_t)blockSizes[nodeRank]);
+    }
+    if (totalSize == 0)
+        return;
+    size_t nRounds = (maxSize + chunk - 1) / chunk;
 
-    if (!isMaster()) //workers just write down partial results
+    // In a single round the pieces are received at their final place
+    std::vector<char> allBlocks, roundBlocks;
+    if (isMaster())
     {
-        fn = formatString("%s_node%d.xmd", rootname.c_str(), rank);
-        MD.write(fn);
+        allBlocks.resize(totalSize);
+        if (nRounds > 1)
+            roundBlocks.resize(std::min(totalSize, (size_t)INT_MAX));
     }
-    ///Wait for all workers write results
-    barrierWait();
-    if (isMaster()) //master should collect and join workers results
+    std::vector<int> counts(size), displacements(size);
+    for (size_t round = 0; round < nRounds; round++)
     {
-        MetaData mdAll(MD), mdSlave;
-        for (size_t nodeRank = 1; nodeRank < size; nodeRank++)
+        size_t sent = round * chunk;
+        int roundSize = 0;
+        for (size_t nodeRank = 0; nodeRank < size; nodeRank++)
         {
-            fn = formatString("%s_node%d.xmd", rootname.c_str(), nodeRank);
-            mdSlave.read(fn);
-            //make sure file is not empty
-            if (!mdSlave.isEmpty())
-                mdAll.unionAll(mdSlave);
-            //Remove blockname
-            fn = fn.removeBlockName();
-            remove(fn.c_str());
+            size_t nodeSize = blockSizes[nodeRank];
+            counts[nodeRank] = (int)(sent < nodeSize ? std::min(chunk, nodeSize - sent) : 0);
+            displacements[nodeRank] = roundSize;
+            roundSize += counts[nodeRank];
         }
-        //remove first metadata
-        fn = formatString("%s_node%d.xmd", rootname.c_str(), 1);
-        fn = fn.removeBlockName();
-        remove(fn.c_str());
-        MD=mdAll;
+        char *recvBuffer = NULL;
+        if (isMaster())
+            recvBuffer = (nRounds > 1) ? &roundBlocks[0] : &allBlocks[0];
+        MPI_Gatherv(counts[rank] > 0 ? &block[sent] : NULL, counts[rank], MPI_CHAR,
+                    recvBuffer, &counts[0], &displacements[0],
+                    MPI_CHAR, 0, MPI_COMM_WORLD);
+        if (isMaster() && nRounds > 1)
+            for (size_t nodeRank = 0; nodeRank < size; nodeRank++)
+                if (counts[nodeRank] > 0)
+                    memcpy(&allBlocks[offsets[nodeRank] + sent],
+                           &roundBlocks[displacements[nodeRank]], counts[nodeRank]);
     }
+
+    if (isMaster()) //master joins the workers results in its own table
+        for (size_t nodeRank = 1; nodeRank < size; nodeRank++)
+            if (blockSizes[nodeRank] > 0)
+                MD.addBinaryBlock(&allBlocks[offsets[nodeRank]], blockSizes[nodeRank]);
 }
 
 /* -------------------- XmippMPIProgram ---------------------- */
@@ -52,6 +52,8 @@ public:
 
     //MPI_Comm *comm;
     size_t rank, size, active;//, activeNodes;
+    /// Threads of this node may call MPI, one at a time
+    bool threadsSupported;
     MpiNode(int &argc, char **& argv);
     ~MpiNode();
 
@@ -61,8 +63,12 @@ public:
     /** Wait on a barrier for the other MPI nodes */
     void barrierWait();
 
-    /** Gather metadatas */
-    void gatherMetadatas(MetaData &MD, const FileName &rootName);
+    /** Gather metadatas.
+     * The rows of the workers are serialized and gathered in memory by the
+     * master, that adds them to its own metadata. No intermediate files are
+     * written. Blocks larger than INT_MAX bytes are sent in several pieces.
+     */
+    void gatherMetadatas(MetaData &MD);
 
     /** Update the MPI communicator to connect the currently active nodes */
 //    void updateComm();
@@ -90,6 +96,14 @@ class MpiTaskDistributor: public ThreadTaskDistributor
 {
 protected:
     MpiNode * node;
+    // Threads sharing the node blocks (0 if not hierarchical)
+    size_t threadsPerNode;
+    // Maximum number of tasks given to a thread in hierarchical mode
+    size_t threadBlockSize;
+    // Pending tasks of the current node block, from localFirst to localEnd-1
+    size_t localFirst, localEnd;
+    // The master has no more tasks for this node
+    bool nodeFinished;
 
     virtual bool distribute(size_t &first, size_t &last);
 
@@ -100,6 +114,20 @@ public:
      */
     void wait();
 
+    /** Restart the distribution. */
+    virtual void clear();
+    virtual void reset() { clear(); };
+
+    /** Hierarchical distribution for MPI nodes with several threads.
+     * The master hands out guided blocks to the nodes (see setGuided),
+     * never smaller than nThreads*blockSize, and the threads of each node
+     * share the node block locally in blocks of at most blockSize, that
+     * shrink near its end. The number of requests to the master is much
+     * lower than with one request per thread block. It should be called
+     * in all the nodes, before starting the distribution.
+     */
+    void setHierarchical(size_t nThreads);
+
 private:
     /** Method that should be called in the master only.
      * It will listen for job requests from nodes, assign tasks and
@@ -108,6 +136,8 @@ private:
     bool distributeMaster();
     /** Workers should ask for jobs from master. */
     bool distributeSlaves(size_t &first, size_t &last);
+    /** Ask the master for a new block of tasks. */
+    bool requestTasks(size_t &first, size_t &last);
 }
 ;//end of class MpiTaskDistributor
 
@@ -240,6 +270,18 @@ public:\
         mdIn.addLabel(MDL_GATHER_ID);\
         mdIn.fillLinear(MDL_GATHER_ID,1,1);\
         createTaskDistributor(mdIn, blockSize);\
+        /* the blocks of a node are not consecutive, reading ahead in the */\
+        /* metadata order would read the images of the other nodes */\
+        if (node->size > 1)\
+            prefetch = 0;\
+        if (nThreads > 1)\
+        {\
+            if (!node->threadsSupported)\
+                REPORT_ERROR(ERR_NOT_IMPLEMENTED, "The MPI library does not support threads, use --thr 1");\
+            distributor->setHierarchical(nThreads);\
+            if (node->isMaster())\
+                nThreads = 1; /* the master only distributes the images */\
+        }\
     }\
     void startProcessing()\
     {\
@@ -254,6 +296,12 @@ public:\
     {\
         if (node->rank==1)\
         {\
+            if (nThreads > 1) /* estimated from the images of this node */\
+            {\
+                if (time_bar_done % time_bar_step == 0 && allow_time_bar)\
+                    progress_bar(XMIPP_MIN(time_bar_done*(node->size-1), time_bar_size));\
+                return;\
+            }\
             time_bar_done=first+1;\
             baseClassName::showProgress();\
         }\
@@ -262,9 +310,16 @@ public:\
     {\
         return getTaskToProcess(objId, objIndex);\
     }\
+    ParallelTaskDistributor * createThreadTaskDistributor(size_t /*nTasks*/)\
+    {\
+        return distributor; /* node blocks shared by the threads */\
+    }\
+    void deleteThreadTaskDistributor(ParallelTaskDistributor * /*td*/)\
+    {\
+    }\
     void finishProcessing()\
     {\
-        node->gatherMetadatas(*getOutputMd(), fn_out);\
+        node->gatherMetadatas(*getOutputMd());\
     	MetaData MDaux; \
     	MDaux.sort(*getOutputMd(), MDL_GATHER_ID); \
         MDaux.removeLabel(MDL_GATHER_ID); \
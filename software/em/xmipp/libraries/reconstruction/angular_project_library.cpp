@@ -93,6 +93,7 @@ void ProgAngularProjectLibrary::readParams()
         FnexperimentalImages = getParam("--experimental_images");
     fn_groups = getParam("--groups");
     only_winner = checkParam("--only_winner");
+    nThreads = getIntParam("--thr");
 }
 
 /* Usage ------------------------------------------------------------------- */
@@ -134,6 +135,8 @@ void ProgAngularProjectLibrary::defineParams()
     addParamsLine("                                              : nearest:          Nearest Neighborhood  ");
     addParamsLine("                                              : linear:           Linear  ");
     addParamsLine("                                              : bspline:          Cubic BSpline  ");
+    addParamsLine("  [--thr <N=1>]                 : Number of threads (used by the Fourier method and");
+    addParamsLine("                                : to find the neighbors of the experimental images)");
     addParamsLine("  [--perturb <sigma=0.0>]       : gaussian noise projection unit vectors ");
     addParamsLine("                                : a value=sin(sampling_rate)/4  ");
     addParamsLine("                                : may be a good starting point ");
@@ -224,31 +227,54 @@ void ProgAngularProjectLibrary::project_angle_vector (int my_init, int my_end, b
         		                      maxFrequency,
         		                      BSplineDeg);
 
+    // The Fourier projections are computed in blocks of directions, that are
+    // distributed among the threads
+    const int blockSize = (projType == FOURIER) ? 32 * nThreads : 1;
+    MultidimArray<double> projections;
+    std::vector<double> rots, tilts, psis;
     for (double mypsi=0;mypsi<360;mypsi += psi_sampling)
     {
-        for (int i=my_init;i<=my_end;i++)
+        for (int i0=my_init;i0<=my_end;i0+=blockSize)
         {
-            if (verbose)
-                progress_bar(i-my_init);
-            psi= mypsi+ZZ(mysampling.no_redundant_sampling_points_angles[i]);
-            tilt=      YY(mysampling.no_redundant_sampling_points_angles[i]);
-            rot=       XX(mysampling.no_redundant_sampling_points_angles[i]);
-
-//            if (shears)
-//                projectVolume(*VShears, P, Ydim, Xdim, rot,tilt,psi);
-//            else
-//                projectVolume(inputVol(), P, Ydim, Xdim, rot,tilt,psi);
-            if (projType == SHEARS)
-                projectVolume(*Vshears, P, Ydim, Xdim,   rot, tilt, psi);
-            else if (projType == FOURIER)
-                projectVolume(*Vfourier, P, Ydim, Xdim,  rot, tilt, psi);
-            else if (projType == REALSPACE)
-                projectVolume(inputVol(), P, Ydim, Xdim, rot, tilt, psi);
-
-
-            P.setEulerAngles(rot,tilt,psi);
-            P.setDataMode(_DATA_ALL);
-            P.write(output_file,(size_t) (numberStepsPsi * i + mypsi +1),true,WRITE_REPLACE);
+            int i1=std::min(i0+blockSize-1,my_end);
+            if (projType == FOURIER)
+            {
+                rots.clear();
+                tilts.clear();
+                psis.clear();
+                for (int i=i0;i<=i1;i++)
+                {
+                    rots.push_back(XX(mysampling.no_redundant_sampling_points_angles[i]));
+                    tilts.push_back(YY(mysampling.no_redundant_sampling_points_angles[i]));
+                    psis.push_back(mypsi+ZZ(mysampling.no_redundant_sampling_points_angles[i]));
+                }
+                Vfourier->project(rots, tilts, psis, projections, nThreads);
+                P().resizeNoCopy(YSIZE(projections), XSIZE(projections));
+            }
+            for (int i=i0;i<=i1;i++)
+            {
+                if (verbose)
+                    progress_bar(i-my_init);
+                psi= mypsi+ZZ(mysampling.no_redundant_sampling_points_angles[i]);
+                tilt=      YY(mysampling.no_redundant_sampling_points_angles[i]);
+                rot=       XX(mysampling.no_redundant_sampling_points_angles[i]);
+
+//                if (shears)
+//                    projectVolume(*VShears, P, Ydim, Xdim, rot,tilt,psi);
+//                else
+//                    projectVolume(inputVol(), P, Ydim, Xdim, rot,tilt,psi);
+                if (projType == SHEARS)
+                    projectVolume(*Vshears, P, Ydim, Xdim,   rot, tilt, psi);
+                else if (projType == FOURIER)
+                    projections.getImage(i-i0, P());
+                else if (projType == REALSPACE)
+                    projectVolume(inputVol(), P, Ydim, Xdim, rot, tilt, psi);
+
+
+                P.setEulerAngles(rot,tilt,psi);
+                P.setDataMode(_DATA_ALL);
+                P.write(output_file,(size_t) (numberStepsPsi * i + mypsi +1),true,WRITE_REPLACE);
+            }
         }
     }
     if (verbose)
@@ -263,6 +289,7 @@ void ProgAngularProjectLibrary::run()
     /////////////////////////////
     //only rank 0
 	mysampling.verbose=verbose;
+	mysampling.numberOfThreads=nThreads;
     show();
     //all ranks
     mysampling.setSampling(sampling);
@@ -26,6 +26,7 @@
 
 #include "angular_projection_matching.h"
 
+#include <sys/stat.h>
 #include <data/xmipp_image.h>
 
 //#define DEBUG
@@ -52,12 +53,17 @@ void ProgAngularProjectionMatching::readParams()
     search5d_step = getIntParam("--search5d_step");
     max_shift = getDoubleParam("--max_shift");
     numOrientations = getIntParam("--number_orientations");
+    coarse_step = getDoubleParam("--coarse_step");
+    coarse_candidates = getIntParam("--coarse_candidates");
+    if (coarse_step > 0 && coarse_candidates < 1)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "--coarse_candidates must be at least 1 in the hierarchical search");
 
     avail_memory = getDoubleParam("--mem");
     if (checkParam("--ctf"))
         fn_ctf  = getParam("--ctf");
     phase_flipped = checkParam("--phase_flipped");
     threads = getIntParam("--thr");
+    fn_bank = getParam("--ref_bank");
 
     do_scale = checkParam("--scale");
     if (checkParam("--append"))
@@ -101,6 +107,11 @@ void ProgAngularProjectionMatching::defineParams()
     addParamsLine("  [--Ri <ri=1>]               : Inner radius to limit rotational search");
     addParamsLine("  [--Ro <ro=-1>]              : Outer radius to limit rotational search");
     addParamsLine("                        : ro = -1 -> dim/2-1");
+    addParamsLine("  [--coarse_step <step=-1>]   : Hierarchical search: the images are first compared to the references");
+    addParamsLine("                               : closest to a coarse sampling with this step (in degrees) using low-pass rings,");
+    addParamsLine("                               : and then to the references around the best ones.");
+    addParamsLine("                               : step = -1 -> compare to all references");
+    addParamsLine("  [--coarse_candidates <K=5>] : Hierarchical search: number of coarse references refined");
     addParamsLine("  [-s <step=1> <n_steps=3>]    : scale step factor (1 means 0.01 in/de-crements) and number of steps around 1.");
     addParamsLine("                               : with default values: 1 0.01 | 0.02 | 0.03");
     addParamsLine("    alias --scale;");
@@ -112,6 +123,10 @@ void ProgAngularProjectionMatching::defineParams()
     addParamsLine("  [--pad <pad=1>]             : Padding factor (for CTF correction only)");
     addParamsLine("  [--phase_flipped]            : Use this if the experimental images have been phase flipped");
     addParamsLine("  [--thr <threads=1>]           : Number of concurrent threads");
+    addParamsLine("  [--ref_bank <file=\"\">]       : File with the precomputed polar rings of the references.");
+    addParamsLine("                               : It is built if it does not exist or it was computed with other parameters,");
+    addParamsLine("                               : and it can be shared by successive runs and by the MPI processes of a node.");
+    addParamsLine("                               : --mem limits the part of the file mapped in memory");
     addParamsLine("  [--number_orientations <numOrientations=1>]  : Number of possible orientations for each experimental image");
     addParamsLine("  [--append]                : Append (versus overwrite) data to the output file");
 }
@@ -141,6 +156,9 @@ void ProgAngularProjectionMatching::show()
         std::cout << "  Number of references    : " << total_nr_refs << " (all stored in memory)" << std::endl;
     }
     std::cout << "  Max. allowed shift      : +/- " <<max_shift<<" pixels"<<std::endl;
+    if (coarse_step > 0)
+        std::cout << "  Coarse search           : step " << coarse_step << " degrees, "
+        << coarse_refno.size() << " references, " << coarse_candidates << " refined" << std::endl;
     if (search5d_shift > 0)
     {
         std::cout << "  5D-search shift range   : "<<search5d_shift<<" pixels (sampled "<<nr_trans<<" times)"<<std::endl;
@@ -162,6 +180,8 @@ void ProgAngularProjectionMatching::show()
                 std::cout << "    + Assuming images have not been phase flipped " << std::endl;
         }
     }
+    if (fn_bank!="")
+        std::cout << "  Reference bank          : " << fn_bank << std::endl;
     if (threads>1)
     {
         std::cout << "  -> Using "<<threads<<" parallel threads"<<std::endl;
@@ -198,7 +218,7 @@ void ProgAngularProjectionMatching::destroyAndClean()
     delete [] fPm_img;
     delete [] stddev_ref;
     delete [] stddev_img;
-
+    bank.close();
 }
 
 // Side info stuff ===================================================================
@@ -352,6 +372,11 @@ void ProgAngularProjectionMatching::produceSideInfo()
 
         stddev_ref = new double[max_nr_refs_in_memory];
         stddev_img = new double[nr_trans];
+        if (coarse_step > 0)
+        {
+            fPc_img.resize(nr_trans);
+            fPmc_img.resize(nr_trans);
+        }
     }
     catch (std::bad_alloc&)
     {
@@ -399,31 +424,263 @@ void ProgAngularProjectionMatching::produceSideInfo()
 
     //Store the id's of each experimental image from metadata
     DFexp.findObjects(ids);
+
+    if (fn_bank!="")
+        produceReferenceBank();
+
+    if (coarse_step > 0)
+        produceCoarseReferences();
 }
 
-void ProgAngularProjectionMatching::getCurrentReference(int refno,
+void ProgAngularProjectionMatching::produceCoarseReferences()
+{
+    // Coarse sampling of the whole sphere. Each coarse direction is
+    // represented by its closest reference
+    Sampling coarseSampling;
+    coarseSampling.setSampling(coarse_step);
+    coarseSampling.computeSamplingPoints(false);
+    size_t nRefs=mysampling.no_redundant_sampling_points_angles.size();
+    std::vector<Matrix1D<double> > refVectors(nRefs);
+    for (size_t i=0; i<nRefs; ++i)
+    {
+        const Matrix1D<double> &angles=mysampling.no_redundant_sampling_points_angles[i];
+        Euler_direction(XX(angles),YY(angles),ZZ(angles),refVectors[i]);
+    }
+    std::vector<bool> selected(nRefs,false);
+    std::vector<size_t> coarseStackPos;
+    std::vector<Matrix1D<double> > coarseVectors;
+    coarse_refno.clear();
+    for (size_t k=0; k<coarseSampling.sampling_points_vector.size(); ++k)
+    {
+        const Matrix1D<double> &direction=coarseSampling.sampling_points_vector[k];
+        size_t closest=0;
+        double maxDot=-2;
+        for (size_t i=0; i<nRefs; ++i)
+        {
+            double dot=dotProduct(refVectors[i],direction);
+            if (dot>maxDot)
+            {
+                maxDot=dot;
+                closest=i;
+            }
+        }
+        if (!selected[closest])
+        {
+            selected[closest]=true;
+            coarseStackPos.push_back(closest);
+            coarseVectors.push_back(refVectors[closest]);
+            coarse_refno.push_back(mysampling.no_redundant_sampling_points_index[closest]);
+        }
+    }
+
+    // Fine references around each coarse one
+    Sampling refineSampling;
+    refineSampling.verbose=0;
+    refineSampling.no_redundant_sampling_points_vector=refVectors;
+    refineSampling.no_redundant_sampling_points_index=mysampling.no_redundant_sampling_points_index;
+    refineSampling.exp_data_projection_direction_by_L_R=coarseVectors;
+    refineSampling.fillLRRepository();
+    refineSampling.setNeighborhoodRadius(coarse_step);
+    refineSampling.computeNeighbors();
+    coarse_neighbors=refineSampling.my_neighbors;
+
+    // Low-pass rings of the coarse references. The psi step of their
+    // correlation is about the coarse step, and the distance between rings
+    // is half the arc of the coarse step at the outer ring
+    size_t nCoarse=coarse_refno.size();
+    fPc_ref.resize(nCoarse);
+    stddevc_ref.resize(nCoarse);
+    Polar<std::complex<double> > fP;
+    MultidimArray<double> Mref;
+    for (size_t c=0; c<nCoarse; ++c)
+    {
+        if (bank.isOpen())
+            bank.getReference(coarseStackPos[c],fP,stddevc_ref[c]);
+        else
+            computeReference(coarseStackPos[c],fP,stddevc_ref[c],Mref,global_plans);
+        if (c==0)
+        {
+            int nPsi=2*(int)ceil(180./coarse_step);
+            coarse_nfreq=XMIPP_MIN(nPsi/2+1,fP.getSampleNoOuterRing());
+            coarse_ring_step=XMIPP_MAX(1,(int)floor(Ro*DEG2RAD(coarse_step)/2));
+        }
+        lowPassFourierRings(fP,fPc_ref[c],coarse_ring_step,coarse_nfreq);
+    }
+}
+
+void ProgAngularProjectionMatching::prepareCoarseSearch(size_t imgno)
+{
+    const std::vector<size_t> &neighbors=mysampling.my_neighbors[imgno];
+    in_search_range.assign(mysampling.numberSamplesAsymmetricUnit,false);
+    for (size_t i=0; i<neighbors.size(); ++i)
+        in_search_range[neighbors[i]]=true;
+    coarse_search.clear();
+    for (size_t c=0; c<coarse_refno.size(); ++c)
+        if (in_search_range[coarse_refno[c]])
+            coarse_search.push_back(c);
+    coarse_corr.resize(coarse_search.size());
+}
+
+// Sort coarse references by decreasing correlation
+struct CoarseCorrelationOrder
+{
+    const std::vector<double> *corr;
+    bool operator()(size_t a, size_t b) const
+    {
+        if ((*corr)[a]!=(*corr)[b])
+            return (*corr)[a]>(*corr)[b];
+        return a<b;
+    }
+};
+
+void ProgAngularProjectionMatching::selectFineReferences(size_t imgno)
+{
+    // No coarse reference in the search range: check all references
+    if (coarse_search.empty())
+    {
+        fine_search=mysampling.my_neighbors[imgno];
+        return;
+    }
+
+    size_t K=XMIPP_MIN((size_t)coarse_candidates,coarse_search.size());
+    std::vector<size_t> order(coarse_search.size());
+    for (size_t i=0; i<order.size(); ++i)
+        order[i]=i;
+    CoarseCorrelationOrder comparison;
+    comparison.corr=&coarse_corr;
+    std::partial_sort(order.begin(),order.begin()+K,order.end(),comparison);
+
+    // References in the search range are unflagged when added, so that
+    // they are added only once
+    fine_search.clear();
+    for (size_t k=0; k<K; ++k)
+    {
+        const std::vector<size_t> &neighbors=coarse_neighbors[coarse_search[order[k]]];
+        for (size_t i=0; i<neighbors.size(); ++i)
+            if (in_search_range[neighbors[i]])
+            {
+                fine_search.push_back(neighbors[i]);
+                in_search_range[neighbors[i]]=false;
+            }
+    }
+    std::sort(fine_search.begin(),fine_search.end());
+}
+
+String ProgAngularProjectionMatching::referenceBankKey()
+{
+    // The modification time of the references is included, so that
+    // the bank is rebuilt if they change
+    struct stat refStatus;
+    if (stat(fn_ref.removeAllPrefixes().removeBlockName().c_str(),&refStatus)!=0)
+        refStatus.st_mtime=0;
+    return formatString("%s %ld %d %d %lu %s %f %d",fn_ref.c_str(),(long)refStatus.st_mtime,
+                        Ri,Ro,dim,fn_ctf.c_str(),pad,(int)phase_flipped);
+}
+
+void ProgAngularProjectionMatching::produceReferenceBank()
+{
+    size_t maxMappedBytes=(size_t)(avail_memory*1024*1024*1024);
+    if (bank.open(fn_bank,referenceBankKey(),maxMappedBytes))
+        return;
+    buildReferenceBank();
+    if (!bank.open(fn_bank,referenceBankKey(),maxMappedBytes))
+        REPORT_ERROR(ERR_IO_NOTOPEN,(String)"Cannot open the reference bank "+fn_bank);
+}
+
+struct ReferenceBankBuild
+{
+    ProgAngularProjectionMatching *prog;
+    ThreadTaskDistributor *distributor;
+    Mutex mutex;
+    XmippError *error;
+};
+
+static void threadBuildReferenceBank(ThreadArgument &thArg)
+{
+    ReferenceBankBuild *data=(ReferenceBankBuild *)thArg.workClass;
+    ProgAngularProjectionMatching *prog=data->prog;
+    Polar<std::complex<double> > fP;
+    double stddev;
+    MultidimArray<double> Mref;
+    Polar_fftw_plans local_plans;
+    size_t first, last;
+    while (data->distributor->getTasks(first, last))
+        for (size_t n=first+1; n<=last+1; ++n)
+        {
+            try
+            {
+                prog->computeReference(n,fP,stddev,Mref,local_plans);
+                prog->bank.setReference(n,fP,stddev,&Mref);
+            }
+            catch (XmippError &xe)
+            {
+                data->mutex.lock();
+                if (data->error==NULL)
+                    data->error=new XmippError(xe);
+                data->mutex.unlock();
+                return;
+            }
+        }
+}
+
+void ProgAngularProjectionMatching::buildReferenceBank()
+{
+    if (verbose)
+        std::cout << "Building the reference bank " << fn_bank << std::endl;
+
+    // The first reference gives the size of the rings, the rest are
+    // computed by the threads
+    Polar<std::complex<double> > fP;
+    double stddev;
+    MultidimArray<double> Mref;
+    computeReference(0,fP,stddev,Mref,global_plans);
+    bank.create(fn_bank,referenceBankKey(),total_nr_refs,fP,dim);
+    bank.setReference(0,fP,stddev,&Mref);
+
+    if (total_nr_refs==1)
+    {
+        bank.close();
+        return;
+    }
+    ThreadTaskDistributor distributor(total_nr_refs-1,XMIPP_MAX(1,(total_nr_refs-1)/(10*threads)));
+    ReferenceBankBuild data;
+    data.prog=this;
+    data.distributor=&distributor;
+    data.error=NULL;
+    if (threads==1)
+    {
+        ThreadArgument thArg;
+        thArg.thread_id=0;
+        thArg.workClass=&data;
+        threadBuildReferenceBank(thArg);
+    }
+    else
+    {
+        ThreadManager thMgr(threads,&data);
+        thMgr.run(threadBuildReferenceBank);
+    }
+    if (data.error!=NULL)
+    {
+        XmippError error(*data.error);
+        delete data.error;
+        bank.discard();
+        throw error;
+    }
+    bank.close();
+}
+
+void ProgAngularProjectionMatching::computeReference(size_t stackPos,
+        Polar<std::complex<double> > &fP, double &stddev, MultidimArray<double> &Mref,
         Polar_fftw_plans &local_plans)
 {
     FileName                      fnt;
     Image<double>                 img;
-    double                        mean,stddev;
+    double                        mean;
     MultidimArray<double>         Maux;
     Polar<double>                 P;
-    Polar<std::complex <double> > fP;
     FourierTransformer                     local_transformer;
 
-    // Image was not stored yet: read it from disc and store
-    //    std::vector<size_t>::const_iterator found =
-    //        std::find((mysampling.no_redundant_sampling_points_index).begin(),
-    //                  (mysampling.no_redundant_sampling_points_index).end(),
-    //                  (size_t)refno
-    //                 );
-    //    //found = found - (mysampling.no_redundant_sampling_points_index).begin();
-    //    _pointer = found - (mysampling.no_redundant_sampling_points_index).begin();
-    //    if (found == (mysampling.no_redundant_sampling_points_index).end())
-    //        REPORT_ERROR(ERR_VALUE_INCORRECT, "Wrong reference number");
-    //    fnt.compose(_pointer + FIRST_IMAGE, fn_ref);
-    fnt.compose(convert_refno_to_stack_position[refno] + FIRST_IMAGE, fn_ref);
+    fnt.compose(stackPos + FIRST_IMAGE, fn_ref);
     //!a delete _DATA_ALL
     img.read(fnt, _DATA_ALL);
     img().setXmippOrigin();
@@ -435,8 +692,7 @@ void ProgAngularProjectionMatching::getCurrentReference(int refno,
     img.getEulerAngles(rot_tmp,tilt_tmp,psi_tmp);
 
     {
-        std::cerr << "index_found: " << convert_refno_to_stack_position[refno] << std::endl;
-        std::cerr << "refno: " << refno<<std::endl;
+        std::cerr << "index_found: " << stackPos << std::endl;
         std::cerr << "reading image " << fnt << std::endl;
         std::cerr << "rot_tmp,tilt_tmp,psi_tmp: " << rot_tmp<< " "<< tilt_tmp<< " "<<psi_tmp<< std::endl;
         //        std::cerr << "XXXXno_redundant_sampling_points_indexXXXXXX" <<std::endl;
@@ -481,7 +737,26 @@ void ProgAngularProjectionMatching::getCurrentReference(int refno,
     P.getPolarFromCartesianBSpline(Maux,Ri,Ro);
     P.computeAverageAndStddev(mean,stddev);
     P -= mean;
+    if (local_plans.arrays.size()==0)
+        P.calculateFftwPlans(local_plans);
     fourierTransformRings(P,fP,local_plans,true);
+    Mref=img();
+
+}
+
+void ProgAngularProjectionMatching::getCurrentReference(int refno,
+        Polar_fftw_plans &local_plans)
+{
+    double                        stddev;
+    MultidimArray<double>         Mref;
+    Polar<std::complex <double> > fP;
+
+    // Image was not stored yet: take it from the bank or compute it
+    size_t stackPos=convert_refno_to_stack_position[refno];
+    if (bank.isOpen())
+        bank.getReference(stackPos,fP,stddev,&Mref);
+    else
+        computeReference(stackPos,fP,stddev,Mref,local_plans);
 
     pthread_mutex_lock(  &update_refs_in_memory_mutex );
 
@@ -497,7 +772,7 @@ void ProgAngularProjectionMatching::getCurrentReference(int refno,
     pointer_refsinmem2allrefs[counter] = refno;
     fP_ref[counter] = fP;
     stddev_ref[counter] = stddev;
-    proj_ref[counter] = img();
+    proj_ref[counter] = Mref;
     //#define DEBUG
 #ifdef DEBUG
 
@@ -551,7 +826,8 @@ void * threadRotationallyAlignOneImage( void * data )
     double                      mean, stddev;
     Polar<double>               P;
     Polar<std::complex <double> > fP,fPm;
-    RotationalCorrelationAux    rotAux;
+    RotationalCorrelationAux    rotAux, coarseAux;
+    MultidimArray<double>       coarseCorr;
     Polar_fftw_plans            local_plans;
     size_t                         imgno = this_image - FIRST_IMAGE;
 
@@ -580,6 +856,13 @@ void * threadRotationallyAlignOneImage( void * data )
         fourierTransformRings(P,prm->fP_img[itrans],local_plans,false);
         fourierTransformRings(P,prm->fPm_img[itrans],local_plans,true);
         prm->stddev_img[itrans] = stddev;
+        if (prm->coarse_step > 0)
+        {
+            lowPassFourierRings(prm->fP_img[itrans],prm->fPc_img[itrans],
+                                prm->coarse_ring_step,prm->coarse_nfreq);
+            lowPassFourierRings(prm->fPm_img[itrans],prm->fPmc_img[itrans],
+                                prm->coarse_ring_step,prm->coarse_nfreq);
+        }
         done_once=true;
     }
     // If thread did not have to do any itrans, initialize fftw plans
@@ -596,6 +879,35 @@ void * threadRotationallyAlignOneImage( void * data )
     // All threads have to wait until the itrans loop is done
     barrier_wait(&(prm->thread_barrier));
 
+    // Hierarchical search: compare to the coarse references with the
+    // low-pass rings, and keep the references around the best ones
+    const std::vector<size_t> *search_refs = &(prm->mysampling.my_neighbors[imgno]);
+    if (prm->coarse_step > 0)
+    {
+        coarseCorr.resize(2*(prm->coarse_nfreq-1));
+        coarseAux.local_transformer.setReal(coarseCorr);
+        coarseAux.local_transformer.FourierTransform();
+        for (size_t i = thread_id; i < prm->coarse_search.size(); i += thread_num)
+        {
+            size_t c = prm->coarse_search[i];
+            double bestCorr = -99.e99;
+            for (size_t itrans = 0; itrans < prm->nr_trans; itrans++)
+            {
+                double iStddev = 1. / (prm->stddevc_ref[c] * prm->stddev_img[itrans]);
+                rotationalCorrelation(prm->fPc_img[itrans],prm->fPc_ref[c],ang,coarseAux);
+                bestCorr = XMIPP_MAX(bestCorr, coarseCorr.computeMax() * iStddev);
+                rotationalCorrelation(prm->fPmc_img[itrans],prm->fPc_ref[c],ang,coarseAux);
+                bestCorr = XMIPP_MAX(bestCorr, coarseCorr.computeMax() * iStddev);
+            }
+            prm->coarse_corr[i] = bestCorr;
+        }
+        barrier_wait(&(prm->thread_barrier));
+        if (thread_id == 0)
+            prm->selectFineReferences(imgno);
+        barrier_wait(&(prm->thread_barrier));
+        search_refs = &(prm->fine_search);
+    }
+
 #ifdef TIMING
 
     float prepare_img = elapsed_time(t0);
@@ -612,12 +924,12 @@ void * threadRotationallyAlignOneImage( void * data )
     if (prm->loop_forward_refs)
     {
         myinit = 0;
-        myfinal = prm->mysampling.my_neighbors[imgno].size();
+        myfinal = search_refs->size();
         myincr = +1;
     }
     else
     {
-        myinit = prm->mysampling.my_neighbors[imgno].size() - 1;
+        myinit = search_refs->size() - 1;
         myfinal = -1;
         myincr = -1;
     }
@@ -641,7 +953,7 @@ void * threadRotationallyAlignOneImage( void * data )
             // Get pointer to the current reference image
 #ifdef DEBUG
 
-            if(prm->mysampling.my_neighbors[imgno][i]==58)
+            if((*search_refs)[i]==58)
             {
                 std::cerr << "XXXXpointer_allrefs2refsinmemXXXXXX" <<std::endl;
                 for (std::vector<int>::iterator i = prm->
@@ -660,12 +972,12 @@ void * threadRotationallyAlignOneImage( void * data )
             }
 #endif
 
-            refno = prm->pointer_allrefs2refsinmem[prm->mysampling.my_neighbors[imgno][i]];
+            refno = prm->pointer_allrefs2refsinmem[(*search_refs)[i]];
             if (refno == -1)
             {
                 // Reference is not stored in memory (anymore): (re-)read from disc
-                prm->getCurrentReference(prm->mysampling.my_neighbors[imgno][i],local_plans);
-                refno = prm->pointer_allrefs2refsinmem[prm->mysampling.my_neighbors[imgno][i]];
+                prm->getCurrentReference((*search_refs)[i],local_plans);
+                refno = prm->pointer_allrefs2refsinmem[(*search_refs)[i]];
             }
 
 
@@ -677,7 +989,7 @@ void * threadRotationallyAlignOneImage( void * data )
 
             std::cerr << "imgno " << imgno <<std::endl;
             std::cerr<<"Got refno= "<<refno
-            <<" pointer= "<<prm->mysampling.my_neighbors[imgno][i]<<std::endl;
+            <<" pointer= "<<(*search_refs)[i]<<std::endl;
 #endif
 
             // Loop over all 5D-search translations
@@ -720,7 +1032,7 @@ void * threadRotationallyAlignOneImage( void * data )
                 			maxcorr[n] = DIRECT_A1D_ELEM(allCorr,k);
                 			opt_psi[n] = DIRECT_A1D_ELEM(allAng,k);
                 			//FIXME not sure about FIRST_IMAGE
-                			opt_refno[n] = prm->mysampling.my_neighbors[imgno][i];/*+FIRST_IMAGE;*/
+                			opt_refno[n] = (*search_refs)[i];/*+FIRST_IMAGE;*/
                 			if ( k >= XSIZE(corr))
                 				opt_flip[n] = true;
                 			else
@@ -745,7 +1057,7 @@ void * threadRotationallyAlignOneImage( void * data )
 #ifdef DEBUG
             std::cerr << "DEBUG_ROB, imgno:" << imgno << std::endl;
             std::cerr << "DEBUG_ROB, i:" << i << std::endl;
-            std::cerr << "DEBUG_ROB, prm->mysampling.my_neighbors[imgno][i]:" << prm->mysampling.my_neighbors[imgno][i] << std::endl;
+            std::cerr << "DEBUG_ROB, prm->mysampling.my_neighbors[imgno][i]:" << (*search_refs)[i] << std::endl;
             std::cerr<<"straight: corr "<<maxcorr<<std::endl;
 #endif
 #undef DEBUG
@@ -761,7 +1073,7 @@ void * threadRotationallyAlignOneImage( void * data )
     <<" => prep: "<<prepare_img
     <<" all_refs: "<<all_rot_align
     <<" (of which "<<get_refs
-    <<" to get "<< prm->mysampling.my_neighbors[imgno].size()
+    <<" to get "<< (*search_refs).size()
     <<" refs for imgno "<<imgno<<" )"
     <<std::endl;
 #endif
@@ -1044,6 +1356,8 @@ void ProgAngularProjectionMatching::processSomeImages(const std::vector<size_t>
         DFexp.getValue(MDL_IMAGE,pp, imgid);
 
         getCurrentImage(imgid, img);
+        if (coarse_step > 0)
+            prepareCoarseSearch(imgid - FIRST_IMAGE);
         for( int c = 0 ; c < threads ; c++ )
         {
             threads_d[c].thread_id = c;
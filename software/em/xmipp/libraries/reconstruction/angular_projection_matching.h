@@ -34,6 +34,7 @@
 #include <data/filters.h>
 #include <data/mask.h>
 #include <data/polar.h>
+#include <data/polar_reference_bank.h>
 #include <data/xmipp_fftw.h>
 #include <data/xmipp_threads.h>
 #include <pthread.h>
@@ -76,6 +77,8 @@ public:
 
     /** Filenames */
     FileName fn_exp, fn_ref, fn_out, fn_ctf;
+    /** Bank of precomputed references (empty if not used) */
+    FileName fn_bank;
     /** Docfile with experimental images */
     MetaData DFexp;
     /** Docfile with results */
@@ -114,6 +117,8 @@ public:
     MultidimArray<double> *proj_ref;
     /** Global plans for fftw transformers of all polar rings */
     Polar_fftw_plans global_plans;
+    /** Bank with the FTs of the polar rings of all references */
+    PolarReferenceBank bank;
     /** vector with stddevs for all reference projections */
     double *stddev_ref, *stddev_img;
     /** sampling object */
@@ -137,6 +142,31 @@ public:
     int numOrientations;
     /** Number of translations in 5D search */
     size_t nr_trans;
+    /** Hierarchical search: angular step of the coarse search (degrees,
+     * negative for an exhaustive search) */
+    double coarse_step;
+    /** Hierarchical search: number of coarse references refined */
+    int coarse_candidates;
+    /** Hierarchical search: references representing the coarse sampling */
+    std::vector<size_t> coarse_refno;
+    /** Hierarchical search: fine references around each coarse reference */
+    std::vector< std::vector<size_t> > coarse_neighbors;
+    /** Hierarchical search: ring step and number of angular frequencies
+     * of the low-pass rings */
+    int coarse_ring_step, coarse_nfreq;
+    /** Hierarchical search: low-pass rings of the coarse references and their stddevs */
+    std::vector< Polar<std::complex<double> > > fPc_ref;
+    std::vector<double> stddevc_ref;
+    /** Hierarchical search: low-pass rings of the translated images and their mirrors */
+    std::vector< Polar<std::complex<double> > > fPc_img, fPmc_img;
+    /** Hierarchical search: references in the search range of the current image */
+    std::vector<bool> in_search_range;
+    /** Hierarchical search: coarse references checked for the current image
+     * and their maximum correlation */
+    std::vector<size_t> coarse_search;
+    std::vector<double> coarse_corr;
+    /** Hierarchical search: fine references checked for the current image */
+    std::vector<size_t> fine_search;
     /** Thread barrier */
     barrier_t thread_barrier;
 
@@ -165,6 +195,24 @@ public:
     /** Make shiftmask and calculate nr_psi */
     virtual void produceSideInfo();
 
+    /** Prepare the hierarchical search.
+     * The coarse sampling is computed, every coarse direction is represented
+     * by its closest reference, the fine references around each coarse one
+     * are found, and the low-pass rings of the coarse references are computed.
+     */
+    void produceCoarseReferences();
+
+    /** Coarse references to check for an image.
+     * Those in the search range of the image.
+     */
+    void prepareCoarseSearch(size_t imgno);
+
+    /** Fine references to check for an image.
+     * Those in the search range of the image around the coarse_candidates
+     * coarse references with the largest correlation.
+     */
+    void selectFineReferences(size_t imgno);
+
     /** Rotational alignment using polar coordinates
      *  The input image is assumed to be in FTs of polar rings
      */
@@ -190,6 +238,29 @@ public:
       store FT of the polar transform as well as the original image */
     void getCurrentReference(int refno, Polar_fftw_plans &local_plans);
 
+    /** Compute a reference.
+     * The reference at position stackPos of the reference stack is read,
+     * the CTF is applied, and the FT of its polar rings and their stddev
+     * are computed. If local_plans are empty, they are computed.
+     */
+    void computeReference(size_t stackPos, Polar<std::complex<double> > &fP, double &stddev,
+                          MultidimArray<double> &Mref, Polar_fftw_plans &local_plans);
+
+    /** Key of the reference bank.
+     * It identifies the references and the parameters used to compute
+     * their polar rings.
+     */
+    String referenceBankKey();
+
+    /** Compute all references and store them in the bank */
+    void buildReferenceBank();
+
+    /** Open the reference bank, building it if needed.
+     * This function should be overriden in the MPI class, so that only one
+     * process builds the bank.
+     */
+    virtual void produceReferenceBank();
+
     /** Get images to process.
      * This function will return the id's of images to process.
      * It will be specially useful for MPI case when images will be distributed
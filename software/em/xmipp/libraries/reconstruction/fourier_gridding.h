@@ -0,0 +1,279 @@
+/***************************************************************************
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef __FOURIER_GRIDDING_H
+#define __FOURIER_GRIDDING_H
+
+#include <vector>
+#include <cmath>
+#include <data/matrix1d.h>
+#include <data/xmipp_error.h>
+
+/**@defgroup FourierGridding Blob gridding in Fourier space
+   @ingroup ReconsLibrary */
+//@{
+
+/// Maximum number of voxels of the blob footprint along one axis
+#define GRIDDING_MAX_FOOTPRINT 32
+
+/** Blob gridding kernel.
+ * Scatters Fourier coefficients into the half-complex layout produced by
+ * FourierTransformer for a cubic real volume of size volSize
+ * (volSize x volSize x (volSize/2+1) complex values, stored as interleaved
+ * real and imaginary parts). Coefficients falling in the missing half are
+ * stored conjugated at the symmetric position.
+ *
+ * The blob values are looked up in a table indexed by the squared distance,
+ * so that no square root is needed. The table is padded with zeros up to
+ * the largest squared distance of the footprint box, and the box is
+ * precomputed per axis before the innermost loop, that is free of branches
+ * and wrapping logic and can be vectorized by the compiler. The box has
+ * always the same number of positions per axis (those outside the blob get
+ * zero weight), so that the loops have a constant length.
+ *
+ * T is the type of the computations and of the output arrays (double or float).
+ */
+template<typename T>
+class BlobGridder
+{
+public:
+    /// Blob values sampled in squared distance, padded with zeros
+    std::vector<T> blobTable;
+    /// Inverse of the squared distance step of the table
+    T iDeltaSqrt;
+    /// Blob radius (in voxels of the padded volume)
+    double blobRadius;
+    /// Squared blob radius
+    T blobRadius2;
+    /// Size of the padded volume
+    int volSize;
+    /// X size of the half-complex volume
+    int xdim;
+    /// Distance (in complex elements) between consecutive rows and slices
+    size_t yStride, zStride;
+    /// Number of positions of the footprint along each axis
+    int footprint;
+
+public:
+    /// Empty constructor
+    BlobGridder(): iDeltaSqrt(0), blobRadius(0), blobRadius2(0), volSize(0), xdim(0), yStride(0), zStride(0), footprint(0)
+    {}
+
+    /** Set the blob table and the volume size.
+     * blobTableSqrt(i) is the blob value at squared distance i/iDelta.
+     */
+    void initialize(const Matrix1D<double> &blobTableSqrt, double iDelta, double radius, int size)
+    {
+        // The footprint along each axis is kept in arrays of fixed size
+        footprint = (int)floor(2 * radius) + 1;
+        if (footprint > GRIDDING_MAX_FOOTPRINT)
+            REPORT_ERROR(ERR_ARG_INCORRECT,
+                         formatString("BlobGridder: the blob radius (%f) is too large, at most %d voxels are allowed along each axis",
+                                      radius, GRIDDING_MAX_FOOTPRINT));
+        blobRadius = radius;
+        blobRadius2 = (T)(radius * radius);
+        iDeltaSqrt = (T)iDelta;
+        volSize = size;
+        xdim = volSize / 2 + 1;
+        yStride = xdim;
+        zStride = (size_t)volSize * xdim;
+
+        // Any squared distance inside the footprint box must have an entry
+        int boxSide = (int)ceil(radius) + 1;
+        size_t tableSize = (size_t)(3.0 * boxSide * boxSide * iDelta) + 2;
+        tableSize = std::max(tableSize, (size_t)VEC_XSIZE(blobTableSqrt));
+        blobTable.assign(tableSize, (T)0);
+        FOR_ALL_ELEMENTS_IN_MATRIX1D(blobTableSqrt)
+        blobTable[i] = (T)VEC_ELEM(blobTableSqrt, i);
+    }
+
+    /** Footprint of the blob along one axis.
+     * For a blob centered at pos (FFT index coordinates, in [0,volSize)) it
+     * fills the squared distances to the footprint integer positions
+     * starting at the first one inside the blob, their wrapped physical
+     * index and the index of the symmetric position. There are always
+     * footprint positions, the last one may be outside the blob.
+     */
+    inline void axisFootprint(double pos, T *d2, int *idx, int *negIdx) const
+    {
+        int l = CEIL(pos - blobRadius);
+        for (int n = 0; n < footprint; ++n, ++l)
+        {
+            T d = (T)(l - pos);
+            d2[n] = d * d;
+            int w = l;
+            if (w < 0)
+                w += volSize;
+            else if (w >= volSize)
+                w -= volSize;
+            idx[n] = w;
+            negIdx[n] = (w == 0) ? 0 : volSize - w;
+        }
+    }
+
+    /** Add a Fourier coefficient to the volume.
+     * The blob centered at (x,y,z) is weighted by blobWeight and accumulated
+     * in weights, and the coefficient (re,im) multiplied by the blob value,
+     * blobWeight and ctfWeight is accumulated in fourier.
+     */
+    void splat(T *fourier, T *weights, double x, double y, double z,
+               T re, T im, T blobWeight, T ctfWeight) const
+    {
+        // The usual footprints get loops of constant length
+        switch (footprint)
+        {
+        case 3:
+            splatFootprint<3>(fourier, weights, x, y, z, re, im, blobWeight, ctfWeight);
+            break;
+        case 4:
+            splatFootprint<4>(fourier, weights, x, y, z, re, im, blobWeight, ctfWeight);
+            break;
+        case 5:
+            splatFootprint<5>(fourier, weights, x, y, z, re, im, blobWeight, ctfWeight);
+            break;
+        default:
+            splatFootprint<0>(fourier, weights, x, y, z, re, im, blobWeight, ctfWeight);
+        }
+    }
+
+    /** Accumulate the blob-weighted real part of a reference volume.
+     * This is the operation of the weight iterations: weights receives, for
+     * every voxel of the footprint, the blob value times blobWeight times the
+     * real part of reference (same half-complex layout) at that voxel.
+     */
+    template<typename TR>
+    void splatWeights(T *weights, const TR *reference, double x, double y, double z,
+                      T blobWeight) const
+    {
+        switch (footprint)
+        {
+        case 3:
+            splatWeightsFootprint<3>(weights, reference, x, y, z, blobWeight);
+            break;
+        case 4:
+            splatWeightsFootprint<4>(weights, reference, x, y, z, blobWeight);
+            break;
+        case 5:
+            splatWeightsFootprint<5>(weights, reference, x, y, z, blobWeight);
+            break;
+        default:
+            splatWeightsFootprint<0>(weights, reference, x, y, z, blobWeight);
+        }
+    }
+
+protected:
+    /** splat with N footprint positions per axis (footprint if N is 0) */
+    template<int N>
+    void splatFootprint(T *fourier, T *weights, double x, double y, double z,
+                        T re, T im, T blobWeight, T ctfWeight) const
+    {
+        T dz2[GRIDDING_MAX_FOOTPRINT], dy2[GRIDDING_MAX_FOOTPRINT], dx2[GRIDDING_MAX_FOOTPRINT];
+        int iz[GRIDDING_MAX_FOOTPRINT], izneg[GRIDDING_MAX_FOOTPRINT];
+        int iy[GRIDDING_MAX_FOOTPRINT], iyneg[GRIDDING_MAX_FOOTPRINT];
+        int ix[GRIDDING_MAX_FOOTPRINT], conj[GRIDDING_MAX_FOOTPRINT];
+        axisFootprint(z, dz2, iz, izneg);
+        axisFootprint(y, dy2, iy, iyneg);
+        xFootprint(x, dx2, ix, conj);
+
+        const T *table = &blobTable[0];
+        T r2 = blobRadius2;
+        T iDelta = iDeltaSqrt;
+        T reW = re * ctfWeight;
+        T imW[2] = { im * ctfWeight, -im * ctfWeight };
+        const int n = (N > 0) ? N : footprint;
+        for (int kz = 0; kz < n; ++kz)
+            for (int ky = 0; ky < n; ++ky)
+            {
+                T y2z2 = dz2[kz] + dy2[ky];
+                if (y2z2 > r2)
+                    continue;
+
+                // Rows of the positions stored directly and conjugated
+                size_t row[2] = { iz[kz] * zStride + iy[ky] * yStride,
+                                  izneg[kz] * zStride + iyneg[ky] * yStride };
+                for (int kx = 0; kx < n; ++kx)
+                {
+                    T d2 = dx2[kx] + y2z2;
+                    T w = (d2 <= r2) ? table[(int)(d2 * iDelta + (T)0.5)] * blobWeight : (T)0;
+                    size_t m = row[conj[kx]] + ix[kx];
+                    weights[m] += w;
+                    fourier[2 * m] += w * reW;
+                    fourier[2 * m + 1] += w * imW[conj[kx]];
+                }
+            }
+    }
+
+    /** splatWeights with N footprint positions per axis (footprint if N is 0) */
+    template<int N, typename TR>
+    void splatWeightsFootprint(T *weights, const TR *reference, double x, double y, double z,
+                               T blobWeight) const
+    {
+        T dz2[GRIDDING_MAX_FOOTPRINT], dy2[GRIDDING_MAX_FOOTPRINT], dx2[GRIDDING_MAX_FOOTPRINT];
+        int iz[GRIDDING_MAX_FOOTPRINT], izneg[GRIDDING_MAX_FOOTPRINT];
+        int iy[GRIDDING_MAX_FOOTPRINT], iyneg[GRIDDING_MAX_FOOTPRINT];
+        int ix[GRIDDING_MAX_FOOTPRINT], conj[GRIDDING_MAX_FOOTPRINT];
+        axisFootprint(z, dz2, iz, izneg);
+        axisFootprint(y, dy2, iy, iyneg);
+        xFootprint(x, dx2, ix, conj);
+
+        const T *table = &blobTable[0];
+        T r2 = blobRadius2;
+        T iDelta = iDeltaSqrt;
+        const int n = (N > 0) ? N : footprint;
+        for (int kz = 0; kz < n; ++kz)
+            for (int ky = 0; ky < n; ++ky)
+            {
+                T y2z2 = dz2[kz] + dy2[ky];
+                if (y2z2 > r2)
+                    continue;
+
+                size_t row[2] = { iz[kz] * zStride + iy[ky] * yStride,
+                                  izneg[kz] * zStride + iyneg[ky] * yStride };
+                for (int kx = 0; kx < n; ++kx)
+                {
+                    T d2 = dx2[kx] + y2z2;
+                    T w = (d2 <= r2) ? table[(int)(d2 * iDelta + (T)0.5)] * blobWeight : (T)0;
+                    size_t m = row[conj[kx]] + ix[kx];
+                    weights[m] += w * (T)reference[2 * m];
+                }
+            }
+    }
+
+    /** Footprint along X.
+     * The positions outside the half-complex X range are replaced by their
+     * symmetric ones, and conj is set to 1 for them (0 for the others).
+     */
+    inline void xFootprint(double x, T *dx2, int *ix, int *conj) const
+    {
+        int ixneg[GRIDDING_MAX_FOOTPRINT];
+        axisFootprint(x, dx2, ix, ixneg);
+        for (int n = 0; n < footprint; ++n)
+        {
+            conj[n] = (ix[n] < xdim) ? 0 : 1;
+            if (conj[n])
+                ix[n] = ixneg[n];
+        }
+    }
+};
+//@}
+#endif
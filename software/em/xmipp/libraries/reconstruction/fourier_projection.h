@@ -53,8 +53,9 @@ public:
     // Volume to project
     MultidimArray<double> *volume;
 
-    // Real and imaginary B-spline coefficients for Fourier of the volume
-    MultidimArray< double > VfourierRealCoefs, VfourierImagCoefs;
+    // B-spline coefficients for Fourier of the volume (real and imaginary
+    // parts interleaved, so that both are read from the same cache line)
+    MultidimArray< std::complex<double> > VfourierCoefs;
 
     // Projection in Fourier space
     MultidimArray< std::complex<double> > projectionFourier;
@@ -83,6 +84,27 @@ public:
      * This method gets the volume's Fourier and the Euler's angles as the inputs and interpolates the related projection
      */
     void project(double rot, double tilt, double psi, const MultidimArray<double> *ctf=NULL);
+
+    /**
+     * Project the volume along a list of directions.
+     * The projection of direction n (rot[n],tilt[n],psi[n]) is stored in the
+     * image n of projections, that is resized to a stack of volumeSize x volumeSize
+     * images with the origin at the center. The directions are distributed
+     * among nThreads threads, each of them with its own FFT plan. The
+     * projection and projectionFourier members are not modified.
+     */
+    void project(const std::vector<double> &rot, const std::vector<double> &tilt,
+                 const std::vector<double> &psi, MultidimArray<double> &projections,
+                 int nThreads=1, const MultidimArray<double> *ctf=NULL) const;
+
+    /**
+     * Fourier transform of the projection along the direction given by the
+     * Euler matrix E. projFourier must have the size of projectionFourier.
+     * This method does not modify the projector, so that it can be called
+     * concurrently from several threads.
+     */
+    void projectToFourier(const Matrix2D<double> &Euler, MultidimArray< std::complex<double> > &projFourier,
+                          const MultidimArray<double> *ctf=NULL) const;
 private:
     /*
      * This is a private method which provides the values for the class variable
@@ -27,6 +27,7 @@
 #include <data/metadata_extension.h>
 #include <data/xmipp_fftw.h>
 #include <data/filters.h>
+#include <algorithm>
 
 
 #define OUTSIDE_WRAP 0
@@ -58,6 +59,10 @@ void ProgMovieAlignmentCorrelation::readParams()
     useInputShifts = checkParam("--useInputShifts");
     bin = getDoubleParam("--bin");
     BsplineOrder = getIntParam("--Bspline");
+    Nthr = getIntParam("--thr");
+    maxFrameDistance = getIntParam("--maxFrameDistance");
+    memoryLimit = getDoubleParam("--memoryLimit");
+    singlePrecision = checkParam("--single");
     show();
 
     String outside=getParam("--outside");
@@ -96,6 +101,10 @@ void ProgMovieAlignmentCorrelation::show()
 	<< "Use input shifts:    " << useInputShifts     << std::endl
 	<< "Binning factor:      " << bin                << std::endl
 	<< "Bspline:             " << BsplineOrder       << std::endl
+	<< "Threads:             " << Nthr               << std::endl
+	<< "Max. frame distance: " << maxFrameDistance   << std::endl
+	<< "Memory limit (MB):   " << memoryLimit        << std::endl
+	<< "Single precision:    " << singlePrecision    << std::endl
     ;
 }
 
@@ -126,6 +135,16 @@ void ProgMovieAlignmentCorrelation::defineParams()
     addParamsLine("  [--gain <fn=\"\">]           : Gain correction image");
     addParamsLine("  [--useInputShifts]           : Do not calculate shifts and use the ones in the input file");
     addParamsLine("  [--Bspline <order=3>]        : B-spline order for the final interpolation (1 or 3)");
+    addParamsLine("  [--thr <n=1>]                : Number of threads to prepare the frames and compute their shifts");
+    addParamsLine("  [--maxFrameDistance <d=-1>]  : Shifts are only computed between frames at most d frames apart");
+    addParamsLine("                               :+By default, -1, the shifts between all pairs of frames are computed");
+    addParamsLine("  [--memoryLimit <MB=-1>]      : Maximum memory (in MB) used for the frames during the alignment.");
+    addParamsLine("                               :+The frames are processed as a stream and only a sliding window of");
+    addParamsLine("                               :+them is kept in memory, so that the frame distance is limited");
+    addParamsLine("                               :+to the frames that fit in the limit. By default, -1, there is no limit");
+    addParamsLine("  [--single]                   : Keep the frames and compute their shifts in single precision.");
+    addParamsLine("                               :+It halves the memory used by the frames, so that more of them");
+    addParamsLine("                               :+fit in the memory limit");
     addParamsLine("  [--outside <mode=wrap> <v=0>]: How to deal with borders (wrap, substitute by avg, or substitute by value)");
     addParamsLine("      where <mode>");
     addParamsLine("             wrap              : Wrap the image to deal with borders");
@@ -158,6 +177,99 @@ void computeTotalShift(int iref, int j, const Matrix1D<double> &shiftX, const Ma
     }
 }
 
+void ProgMovieAlignmentCorrelation::prepareFrame(const FileName &fnFrame,
+        MultidimArray< std::complex<double> > &reducedFrameFourier,
+        Image<double> &frame, Image<double> &croppedFrame, Image<double> &reducedFrame,
+        FourierTransformer &transformer)
+{
+    if (yDRcorner==-1)
+        croppedFrame.read(fnFrame);
+    else
+    {
+        frame.read(fnFrame);
+        frame().window(croppedFrame(), yLTcorner, xLTcorner, yDRcorner, xDRcorner);
+    }
+    if (XSIZE(dark())>0)
+        croppedFrame()-=dark();
+    if (XSIZE(gain())>0)
+        croppedFrame()*=gain();
+    // Reduce the size of the input frame
+    scaleToSizeFourier(1,newYdim,newXdim,croppedFrame(),reducedFrame());
+
+    // Now do the Fourier transform and filter
+    transformer.FourierTransform(reducedFrame(),reducedFrameFourier,true);
+    std::complex<double> zero=0;
+    for (size_t nn=0; nn<filter.nzyxdim; ++nn)
+    {
+        double wlpf=DIRECT_MULTIDIM_ELEM(filter,nn);
+        if (wlpf!=0)
+            DIRECT_MULTIDIM_ELEM(reducedFrameFourier,nn) *= wlpf;
+        else
+            DIRECT_MULTIDIM_ELEM(reducedFrameFourier,nn) = zero;
+    }
+}
+
+/* Threads read and transform the frames while others are reading, so that
+ * the I/O is overlapped with the computations */
+void threadPrepareFrames(ThreadArgument &thArg)
+{
+    ProgMovieAlignmentCorrelation &prm=*((ProgMovieAlignmentCorrelation *)thArg.workClass);
+    Image<double> frame, croppedFrame, reducedFrame;
+    FourierTransformer transformer;
+    MultidimArray< std::complex<double> > frameFourier;
+    size_t first, last;
+    while (prm.taskDistributor->getTasks(first, last))
+    {
+        for (size_t n=prm.firstChunkFrame+first; n<=prm.firstChunkFrame+last; ++n)
+            if (prm.singlePrecision)
+            {
+                prm.prepareFrame(prm.framesToAlign[n], frameFourier,
+                                 frame, croppedFrame, reducedFrame, transformer);
+                MultidimArray< std::complex<float> > &frameFourierFloat=*prm.frameFourierFloat[n];
+                frameFourierFloat.resizeNoCopy(frameFourier);
+                for (size_t nn=0; nn<frameFourier.nzyxdim; ++nn)
+                {
+                    const std::complex<double> &value=DIRECT_MULTIDIM_ELEM(frameFourier,nn);
+                    DIRECT_MULTIDIM_ELEM(frameFourierFloat,nn)=std::complex<float>((float)value.real(),(float)value.imag());
+                }
+            }
+            else
+                prm.prepareFrame(prm.framesToAlign[n], *prm.frameFourier[n],
+                                 frame, croppedFrame, reducedFrame, transformer);
+        if (prm.verbose && thArg.thread_id==0)
+            progress_bar(prm.firstChunkFrame+last);
+    }
+}
+
+/* Each thread computes the shifts of a subset of the pairs of frames */
+void threadComputeShifts(ThreadArgument &thArg)
+{
+    ProgMovieAlignmentCorrelation &prm=*((ProgMovieAlignmentCorrelation *)thArg.workClass);
+    MultidimArray<double> Mcorr;
+    MultidimArray<float> McorrFloat;
+    if (prm.singlePrecision)
+    {
+        McorrFloat.resizeNoCopy(prm.newYdim,prm.newXdim);
+        McorrFloat.setXmippOrigin();
+    }
+    else
+    {
+        Mcorr.resizeNoCopy(prm.newYdim,prm.newXdim);
+        Mcorr.setXmippOrigin();
+    }
+    CorrelationAux aux;
+    CorrelationAuxFloat auxFloat;
+    size_t first, last;
+    while (prm.taskDistributor->getTasks(first, last))
+        for (size_t idx=first; idx<=last; ++idx)
+            if (prm.singlePrecision)
+                bestShift(*prm.frameFourierFloat[prm.pairI[idx]],*prm.frameFourierFloat[prm.pairJ[idx]],McorrFloat,
+                          VEC_ELEM(prm.pairShiftX,idx),VEC_ELEM(prm.pairShiftY,idx),auxFloat,NULL,prm.maxShift);
+            else
+                bestShift(*prm.frameFourier[prm.pairI[idx]],*prm.frameFourier[prm.pairJ[idx]],Mcorr,
+                          VEC_ELEM(prm.pairShiftX,idx),VEC_ELEM(prm.pairShiftY,idx),aux,NULL,prm.maxShift);
+}
+
 void ProgMovieAlignmentCorrelation::run()
 {
     MetaData movie;
@@ -174,14 +286,14 @@ void ProgMovieAlignmentCorrelation::run()
         movieStack.getDimensions(Xdim,Ydim,Zdim,Ndim);
         if (fnMovie.getExtension()=="mrc" and Ndim ==1)
             Ndim = Zdim;
-        size_t id;
+        std::vector<String> frames(Ndim);
         FileName fn;
         for (size_t i=0;i<Ndim;i++)
         {
-            id = movie.addObject();
             fn.compose(i+FIRST_IMAGE,fnMovie);
-            movie.setValue(MDL_IMAGE, fn, id);
+            frames[i]=fn;
         }
+        movie.setColumnValues(MDL_IMAGE, frames);
     }
 
     if (nfirst<0)
@@ -194,7 +306,7 @@ void ProgMovieAlignmentCorrelation::run()
         nlastSum=movie.size();
 
 	FileName fnFrame;
-	Image<double> frame, croppedFrame, reducedFrame, shiftedFrame, averageMicrograph, dark, gain;
+	Image<double> frame, croppedFrame, reducedFrame, shiftedFrame, averageMicrograph;
     Matrix1D<double> shift(2);
     if (!useInputShifts)
     {
@@ -240,17 +352,6 @@ void ProgMovieAlignmentCorrelation::run()
 			A1D_ELEM(lpf,i)=exp(K*(w*w));
 		}
 
-		// Compute the Fourier transform of all input images
-		if (verbose)
-		{
-			std::cout << "Computing Fourier transform of frames ..." << std::endl;
-			init_progress_bar(movie.size());
-		}
-		int n=0;
-		FourierTransformer transformer;
-		Matrix1D<double> w(2);
-		std::complex<double> zero=0;
-
 		if (fnDark!="")
 		{
 			dark.read(fnDark);
@@ -268,60 +369,125 @@ void ProgMovieAlignmentCorrelation::run()
 				REPORT_ERROR(ERR_ARG_INCORRECT,"The input gain image is incorrect, its inverse produces infinite or nan");
 		}
 
-		MultidimArray<double> filter;
-		bool firstImage=true;
+		// Lowpass filter of the Fourier transform of the reduced frames
+		Matrix1D<double> w(2);
+		filter.initZeros(newYdim,newXdim/2+1);
+		FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(filter)
+		{
+			FFT_IDX2DIGFREQ(i,newYdim,YY(w));
+			FFT_IDX2DIGFREQ(j,newXdim,XX(w));
+			double wabs=w.module();
+			if (wabs<=targetOccupancy)
+				A2D_ELEM(filter,i,j)=lpf.interpolatedElement1D(wabs*newXdim);
+		}
+
+		// Frames to align
+		int n=0;
+		framesToAlign.clear();
 		FOR_ALL_OBJECTS_IN_METADATA(movie)
 		{
 			if (n>=nfirst && n<=nlast)
 			{
 				movie.getValue(MDL_IMAGE,fnFrame,__iter.objId);
-				if (yDRcorner==-1)
-					croppedFrame.read(fnFrame);
+				framesToAlign.push_back(fnFrame);
+			}
+			++n;
+		}
+
+		// Frames kept in memory. Without limits all of them are transformed
+		// at once, otherwise they are processed in chunks of Nthr frames and
+		// only the last window frames are kept for the next chunks
+		size_t N=framesToAlign.size();
+		size_t window=(N>0) ? N-1 : 0;
+		if (maxFrameDistance>0)
+			window=std::min(window,(size_t)maxFrameDistance);
+		size_t chunk=N;
+		if (memoryLimit>0)
+		{
+			// Each thread also needs a full size frame, a reduced frame and
+			// a correlation image
+			double frameBytes=(double)MULTIDIM_SIZE(filter)*
+							  (singlePrecision ? sizeof(std::complex<float>) : sizeof(std::complex<double>));
+			double threadBytes=Nthr*(2.0*Xdim*Ydim+2.0*newXdim*newYdim)*sizeof(double);
+			chunk=std::max(Nthr,1);
+			double availableFrames=floor((memoryLimit*1024*1024-threadBytes)/frameBytes);
+			if (availableFrames<chunk+1)
+				REPORT_ERROR(ERR_ARG_INCORRECT,formatString("The memory limit is too small, at least %.1f MB are needed",
+							 (threadBytes+(chunk+1)*frameBytes)/(1024*1024)));
+			window=std::min(window,(size_t)availableFrames-chunk);
+			if (verbose)
+				std::cout << "Frames are aligned to the " << window << " previous ones" << std::endl;
+		}
+
+		if (singlePrecision)
+			frameFourierFloat.assign(N,(MultidimArray< std::complex<float> > *)NULL);
+		else
+			frameFourier.assign(N,(MultidimArray< std::complex<double> > *)NULL);
+		if (verbose)
+		{
+			std::cout << "Computing Fourier transform of frames and shifts between frames ..." << std::endl;
+			init_progress_bar(N);
+		}
+		ThreadManager thMgr(Nthr,this);
+		// Shift of each pair of frames, indexed by (i,j)
+		typedef std::pair< std::pair<size_t,size_t>, std::pair<double,double> > PairShift;
+		std::vector<PairShift> allPairs;
+		for (firstChunkFrame=0; firstChunkFrame<N; firstChunkFrame+=chunk)
+		{
+			size_t lastChunkFrame=std::min(N,firstChunkFrame+chunk)-1;
+			for (size_t n=firstChunkFrame; n<=lastChunkFrame; ++n)
+				if (singlePrecision)
+					frameFourierFloat[n]=new MultidimArray< std::complex<float> >;
 				else
+					frameFourier[n]=new MultidimArray< std::complex<double> >;
+			ThreadTaskDistributor frameDistributor(lastChunkFrame-firstChunkFrame+1,1);
+			taskDistributor=&frameDistributor;
+			thMgr.run(threadPrepareFrames);
+
+			// Shifts between the new frames and the previous ones
+			pairI.clear();
+			pairJ.clear();
+			for (size_t j=firstChunkFrame; j<=lastChunkFrame; ++j)
+				for (size_t i=(j>window) ? j-window : 0; i<j; ++i)
 				{
-					frame.read(fnFrame);
-					frame().window(croppedFrame(), yLTcorner, xLTcorner, yDRcorner, xDRcorner);
+					pairI.push_back(i);
+					pairJ.push_back(j);
 				}
-				if (XSIZE(dark())>0)
-					croppedFrame()-=dark();
-				if (XSIZE(gain())>0)
-					croppedFrame()*=gain();
-				// Reduce the size of the input frame
-				scaleToSizeFourier(1,newYdim,newXdim,croppedFrame(),reducedFrame());
-
-				// Now do the Fourier transform and filter
-				MultidimArray< std::complex<double> > *reducedFrameFourier=new MultidimArray< std::complex<double> >;
-				transformer.FourierTransform(reducedFrame(),*reducedFrameFourier,true);
-				if (firstImage)
+			pairShiftX.initZeros(pairI.size());
+			pairShiftY.initZeros(pairI.size());
+			ThreadTaskDistributor pairDistributor(pairI.size(),1);
+			pairDistributor.setGuided(Nthr);
+			taskDistributor=&pairDistributor;
+			thMgr.run(threadComputeShifts);
+			taskDistributor=NULL;
+			for (size_t idx=0; idx<pairI.size(); ++idx)
+			{
+				allPairs.push_back(PairShift(std::make_pair(pairI[idx],pairJ[idx]),
+				                             std::make_pair(VEC_ELEM(pairShiftX,idx),VEC_ELEM(pairShiftY,idx))));
+			}
+
+			// Free the frames that are not needed by the next chunks
+			size_t firstNeeded=(lastChunkFrame+1>window) ? lastChunkFrame+1-window : 0;
+			for (size_t n=0; n<firstNeeded; ++n)
+				if (singlePrecision)
 				{
-					filter.initZeros(*reducedFrameFourier);
-					FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(*reducedFrameFourier)
-					{
-						FFT_IDX2DIGFREQ(i,newYdim,YY(w));
-						FFT_IDX2DIGFREQ(j,newXdim,XX(w));
-						double wabs=w.module();
-						if (wabs<=targetOccupancy)
-							A2D_ELEM(filter,i,j)=lpf.interpolatedElement1D(wabs*newXdim);
-					}
-					firstImage = false;
+					delete frameFourierFloat[n];
+					frameFourierFloat[n]=NULL;
 				}
-				for (size_t nn=0; nn<filter.nzyxdim; ++nn)
+				else
 				{
-					double wlpf=DIRECT_MULTIDIM_ELEM(filter,nn);
-					if (wlpf!=0)
-						DIRECT_MULTIDIM_ELEM(*reducedFrameFourier,nn) *= wlpf;
-					else
-						DIRECT_MULTIDIM_ELEM(*reducedFrameFourier,nn) = zero;
+					delete frameFourier[n];
+					frameFourier[n]=NULL;
 				}
-
-				frameFourier.push_back(reducedFrameFourier);
-			}
-			++n;
-			if (verbose)
-				progress_bar(n);
 		}
 		if (verbose)
-			progress_bar(movie.size());
+			progress_bar(N);
+		for (size_t n=0; n<frameFourier.size(); ++n)
+			delete frameFourier[n];
+		frameFourier.clear();
+		for (size_t n=0; n<frameFourierFloat.size(); ++n)
+			delete frameFourierFloat[n];
+		frameFourierFloat.clear();
 
 		// Free useless memory
 		filter.clear();
@@ -329,30 +495,22 @@ void ProgMovieAlignmentCorrelation::run()
 		croppedFrame.clear();
 		frame.clear();
 
-		// Now compute all shifts
-		size_t N=frameFourier.size();
-		Matrix2D<double> A(N*(N-1)/2,N-1);
-		Matrix1D<double> bX(N*(N-1)/2), bY(N*(N-1)/2);
-		if (verbose)
-			std::cout << "Computing shifts between frames ..." << std::endl;
-		int idx=0;
-		MultidimArray<double> Mcorr;
-		Mcorr.resizeNoCopy(newYdim,newXdim);
-		Mcorr.setXmippOrigin();
-		CorrelationAux aux;
-		for (size_t i=0; i<N-1; ++i)
+		// Equation system of the shifts between consecutive frames
+		// The chunks give the pairs by their second frame, they are used
+		// in the usual order, by the first frame
+		std::sort(allPairs.begin(),allPairs.end());
+		size_t Npairs=allPairs.size();
+		Matrix2D<double> A(Npairs,N-1);
+		Matrix1D<double> bX(Npairs), bY(Npairs);
+		for (size_t idx=0; idx<Npairs; ++idx)
 		{
-			for (size_t j=i+1; j<N; ++j)
-			{
-				bestShift(*frameFourier[i],*frameFourier[j],Mcorr,bX(idx),bY(idx),aux,NULL,maxShift);
-				if (verbose)
-					std::cerr << "Frame " << i+nfirst << " to Frame " << j+nfirst << " -> (" << bX(idx) << "," << bY(idx) << ")\n";
-				for (int ij=i; ij<j; ij++)
-					A(idx,ij)=1;
-
-				idx++;
-			}
-			delete frameFourier[i];
+			size_t i=allPairs[idx].first.first, j=allPairs[idx].first.second;
+			bX(idx)=allPairs[idx].second.first;
+			bY(idx)=allPairs[idx].second.second;
+			if (verbose)
+				std::cerr << "Frame " << i+nfirst << " to Frame " << j+nfirst << " -> (" << bX(idx) << "," << bY(idx) << ")\n";
+			for (int ij=i; ij<j; ij++)
+				A(idx,ij)=1;
 		}
 
 		// Finally solve the equation system
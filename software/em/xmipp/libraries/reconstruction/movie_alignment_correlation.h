@@ -27,6 +27,9 @@
 #define _PROG_MOVIE_ALIGNMENT_CORRELATION
 
 #include <data/xmipp_program.h>
+#include <data/xmipp_image.h>
+#include <data/xmipp_threads.h>
+#include <data/xmipp_fftw.h>
 
 /**@defgroup MovieAlignmentCorrelation Movie alignment by correlation
    @ingroup ReconsLibrary */
@@ -70,6 +73,14 @@ public:
     int outsideMode;
     /** Outside value */
     double outsideValue;
+    /** Number of threads */
+    int Nthr;
+    /** Maximum distance between the frames of a pair (-1 for all pairs) */
+    int maxFrameDistance;
+    /** Memory limit for the frames in MB (-1 for no limit) */
+    double memoryLimit;
+    /** Keep the frames and compute their shifts in single precision */
+    bool singlePrecision;
 
     /*****************************/
     /** crop corner **/
@@ -87,6 +98,30 @@ public:
     // Fourier transforms of the input images
 	std::vector< MultidimArray<std::complex<double> > * > frameFourier;
 
+	// Fourier transforms of the input images in single precision
+	std::vector< MultidimArray<std::complex<float> > * > frameFourierFloat;
+
+	// Filenames of the frames to align
+	std::vector<FileName> framesToAlign;
+
+	// Dark and gain correction images
+	Image<double> dark, gain;
+
+	// Lowpass filter of the Fourier transforms of the reduced frames
+	MultidimArray<double> filter;
+
+	// Frames of each pair whose shift is computed
+	std::vector<size_t> pairI, pairJ;
+
+	// Shift of each pair
+	Matrix1D<double> pairShiftX, pairShiftY;
+
+	// Distribution of frames or pairs among threads
+	ThreadTaskDistributor *taskDistributor;
+
+	// First frame of the chunk being transformed
+	size_t firstChunkFrame;
+
 	// Target sampling rate
 	double newTs;
 
@@ -102,6 +137,14 @@ public:
     /// Define parameters
     void defineParams();
 
+    /** Read a frame, correct it with the dark and gain images, reduce its
+     * size and compute its filtered Fourier transform.
+     * The images and the transformer are auxiliary, so that each thread
+     * has its own ones. */
+    void prepareFrame(const FileName &fnFrame, MultidimArray< std::complex<double> > &frameFourier,
+                      Image<double> &frame, Image<double> &croppedFrame, Image<double> &reducedFrame,
+                      FourierTransformer &transformer);
+
     /// Run
     void run();
 
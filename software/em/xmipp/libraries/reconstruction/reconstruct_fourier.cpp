@@ -44,6 +44,11 @@ void ProgRecFourier::defineParams()
     addParamsLine("  [--max_resolution <p=0.5>]     : Max resolution (Nyquist=0.5)");
     addParamsLine("  [--weight]                     : Use weights stored in the image metadata");
     addParamsLine("  [--thr <threads=1> <rows=1>]   : Number of concurrent threads and rows processed at time by a thread");
+    addParamsLine("  [--private_volumes]            : Each thread grids whole images into its own copy of the Fourier volume");
+    addParamsLine("                                 : and the copies are added at the end. It scales much better with the number");
+    addParamsLine("                                 : of threads, but needs one extra Fourier volume and weights per thread");
+    addParamsLine("  [--single_precision]           : Grid in single precision into the private volumes of the threads");
+    addParamsLine("                                 : It halves their memory and is faster. It implies --private_volumes");
     addParamsLine("  [--blob <radius=1.9> <order=0> <alpha=15>] : Blob parameters");
     addParamsLine("                                 : radius in pixels, order of Bessel function in blob and parameter alpha");
     addParamsLine("  [--useCTF]                     : Use CTF information if present");
@@ -73,6 +78,8 @@ void ProgRecFourier::readParams()
     maxResolution = getDoubleParam("--max_resolution");
     numThreads = getIntParam("--thr");
     thrWidth = getIntParam("--thr", 1);
+    useSinglePrecision = checkParam("--single_precision");
+    usePrivateVolumes = checkParam("--private_volumes") || useSinglePrecision;
     NiterWeight = getIntParam("--iter");
     useCTF = checkParam("--useCTF");
     phaseFlipped = checkParam("--phaseFlipped");
@@ -106,6 +113,10 @@ void ProgRecFourier::show()
             << "Sampling rate: " << Ts << std::endl
             << "Phase flipped: " << phaseFlipped << std::endl
             << "Minimum CTF: " << minCTF << std::endl;
+        if (usePrivateVolumes)
+            std::cout << " Using one private volume per thread" << std::endl;
+        if (useSinglePrecision)
+            std::cout << " Gridding in single precision" << std::endl;
         std::cout << "\n Interpolation Function"
         << "\n   blrad                 : "  << blob.radius
         << "\n   blord                 : "  << blob.order
@@ -263,6 +274,9 @@ void ProgRecFourier::produceSideinfo()
     //iDelta        = 1/delta;
     iDeltaSqrt    = 1/deltaSqrt;
     iDeltaFourier = 1/deltaFourier;
+    gridder.initialize(blobTableSqrt, iDeltaSqrt, blob.radius, volPadSizeX);
+    if (useSinglePrecision)
+        gridderSingle.initialize(blobTableSqrt, iDeltaSqrt, blob.radius, volPadSizeX);
 
     // Get symmetries
     Matrix2D<double>  Identity(3,3);
@@ -298,39 +312,19 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
 
     minSeparation+=1;
 
-    Matrix2D<double>  localA(3, 3), localAinv(3, 3);
-    MultidimArray< std::complex<double> > localPaddedFourier;
-    MultidimArray<double> localPaddedImg;
-    FourierTransformer localTransformerImg;
-
-    std::vector<size_t> objId;
-
-    threadParams->selFile->findObjects(objId);
-    ApplyGeoParams params;
-    params.only_apply_shifts = true;
-    MultidimArray<int> zWrapped(3*parent->volPadSizeZ),yWrapped(3*parent->volPadSizeY),xWrapped(3*parent->volPadSizeX),
-    zNegWrapped, yNegWrapped, xNegWrapped;
-    zWrapped.initConstant(-1);
-    yWrapped.initConstant(-1);
-    xWrapped.initConstant(-1);
-    zWrapped.setXmippOrigin();
-    yWrapped.setXmippOrigin();
-    xWrapped.setXmippOrigin();
-    zNegWrapped=zWrapped;
-    yNegWrapped=yWrapped;
-    xNegWrapped=xWrapped;
-
-    MultidimArray<double> x2precalculated(XSIZE(xWrapped)), y2precalculated(XSIZE(yWrapped)), z2precalculated(XSIZE(zWrapped));
-    x2precalculated.initConstant(-1);
-    y2precalculated.initConstant(-1);
-    z2precalculated.initConstant(-1);
-    x2precalculated.setXmippOrigin();
-    y2precalculated.setXmippOrigin();
-    z2precalculated.setXmippOrigin();
-
-    bool hasCTF=(threadParams->selFile->containsLabel(MDL_CTF_MODEL) || threadParams->selFile->containsLabel(MDL_CTF_DEFOCUSU)) &&
+    FourierThreadAux aux;
+    threadParams->selFile->findObjects(aux.objId);
+    aux.params.only_apply_shifts = true;
+    aux.localA.initZeros(3, 3);
+    aux.localAinv.initZeros(3, 3);
+
+    // The private volumes live as long as the thread, the reduction
+    // reaches them through the thread parameters
+    threadParams->aux = &aux;
+
+    aux.hasCTF=(threadParams->selFile->containsLabel(MDL_CTF_MODEL) || threadParams->selFile->containsLabel(MDL_CTF_DEFOCUSU)) &&
                 parent->useCTF;
-    if (hasCTF)
+    if (aux.hasCTF)
     {
         threadParams->ctf.enable_CTF=true;
         threadParams->ctf.enable_CTFnoise=false;
@@ -343,105 +337,7 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
         {
         case PRELOAD_IMAGE:
             {
-
-                threadParams->read = 0;
-
-                if ( threadParams->imageIndex >= 0 )
-                {
-                    // Read input image
-                    double rot, tilt, psi, weight;
-                    Projection proj;
-
-                    //Read projection from selfile, read also angles and shifts if present
-                    //but only apply shifts
-
-                    proj.readApplyGeo(*(threadParams->selFile), objId[threadParams->imageIndex], params);
-                    rot  = proj.rot();
-                    tilt = proj.tilt();
-                    psi  = proj.psi();
-                    weight = proj.weight();
-                    if (hasCTF)
-                    {
-                        threadParams->ctf.readFromMetadataRow(*(threadParams->selFile),objId[threadParams->imageIndex]);
-                        // threadParams->ctf.Tm=threadParams->parent->Ts;
-                        threadParams->ctf.produceSideInfo();
-                    }
-
-                    threadParams->weight = 1.;
-
-                    if(parent->do_weights)
-                        threadParams->weight = weight;
-                    else if (!parent->do_weights)
-                    {
-                        weight=1.0;
-                    }
-                    else if (weight==0.0)
-                    {
-                        threadParams->read = 2;
-                        break;
-                    }
-
-                    // Copy the projection to the center of the padded image
-                    // and compute its Fourier transform
-                    proj().setXmippOrigin();
-                    size_t localPaddedImgSize=(size_t)(parent->imgSize*parent->padding_factor_proj);
-                    if (threadParams->reprocessFlag)
-                        localPaddedFourier.initZeros(localPaddedImgSize,localPaddedImgSize/2+1);
-                    else
-                    {
-                        localPaddedImg.initZeros(localPaddedImgSize,localPaddedImgSize);
-                        localPaddedImg.setXmippOrigin();
-                        const MultidimArray<double> &mProj=proj();
-                        FOR_ALL_ELEMENTS_IN_ARRAY2D(mProj)
-                        A2D_ELEM(localPaddedImg,i,j)=A2D_ELEM(mProj,i,j);
-                        // COSS A2D_ELEM(localPaddedImg,i,j)=weight*A2D_ELEM(mProj,i,j);
-                        CenterFFT(localPaddedImg,true);
-
-                        // Fourier transformer for the images
-                        localTransformerImg.setReal(localPaddedImg);
-                        localTransformerImg.FourierTransform();
-                        localTransformerImg.getFourierAlias(localPaddedFourier);
-                    }
-
-                    // Compute the coordinate axes associated to this image
-                    Euler_angles2matrix(rot, tilt, psi, localA);
-                    localAinv=localA.transpose();
-
-                    threadParams->localweight = weight;
-                    threadParams->localAInv = &localAinv;
-                    threadParams->localPaddedFourier = &localPaddedFourier;
-                    //#define DEBUG22
-#ifdef DEBUG22
-
-                    {//CORRECTO
-
-                        if(threadParams->myThreadID%1==0)
-                        {
-                            proj.write((std::string) integerToString(threadParams->myThreadID)  + "_" +\
-                                       integerToString(threadParams->imageIndex) + "proj.spi");
-
-                            ImageXmipp save44;
-                            save44()=localPaddedImg;
-                            save44.write((std::string) integerToString(threadParams->myThreadID)  + "_" +\
-                                         integerToString(threadParams->imageIndex) + "local_padded_img.spi");
-
-                            FourierImage save33;
-                            save33()=localPaddedFourier;
-                            save33.write((std::string) integerToString(threadParams->myThreadID)  + "_" +\
-                                         integerToString(threadParams->imageIndex) + "local_padded_fourier.spi");
-                            FourierImage save22;
-                            //save22()=*paddedFourier;
-                            save22().alias(*(threadParams->localPaddedFourier));
-                            save22.write((std::string) integerToString(threadParams->myThreadID)  + "_" +\
-                                         integerToString(threadParams->imageIndex) + "_padded_fourier.spi");
-                        }
-
-                    }
-#endif
-                    #undef DEBUG22
-
-                    threadParams->read = 1;
-                }
+                parent->preloadImage(threadParams, aux);
                 break;
             }
         case EXIT_THREAD:
@@ -473,12 +369,26 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
                         }
                 break;
             }
+        case PROCESS_IMAGES_PRIVATE:
+            {
+                if (parent->useSinglePrecision)
+                    parent->processImagesPrivate(threadParams, aux, parent->gridderSingle,
+                                                 aux.privateVoutFourierSingle, aux.privateFourierWeightsSingle);
+                else
+                    parent->processImagesPrivate(threadParams, aux, parent->gridder,
+                                                 aux.privateVoutFourier, aux.privateFourierWeights);
+                break;
+            }
+        case REDUCE_VOLUMES:
+            {
+                parent->reducePrivateVolumes(threadParams);
+                break;
+            }
         case PROCESS_IMAGE:
             {
                 MultidimArray< std::complex<double> > *paddedFourier = threadParams->paddedFourier;
                 if (threadParams->weight==0.0)
                     break;
-                bool reprocessFlag = threadParams->reprocessFlag;
                 int * statusArray = parent->statusArray;
 
                 int minAssignedRow;
@@ -486,10 +396,6 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
                 bool breakCase;
                 bool assigned;
 
-                // Get the inverse of the sampling rate
-                // double iTs=parent->padding_factor_proj/parent->Ts;
-                double iTs=1.0/parent->Ts; // The padding factor is not considered here, but later when the indexes
-                //                         // are converted to digital frequencies
                 do
                 {
                     minAssignedRow = -1;
@@ -562,231 +468,10 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
                         break;
                     }
 
-                    Matrix2D<double> * A_SL = threadParams->symmetry;
-
-                    // Loop over all Fourier coefficients in the padded image
-                    Matrix1D<double> freq(3), gcurrent(3), real_position(3), contFreq(3);
-                    Matrix1D<int> corner1(3), corner2(3);
-
-                    // Some alias and calculations moved from heavy loops
-                    double wCTF=1, wModulator=1.0;
-                    double blobRadiusSquared = parent->blob.radius * parent->blob.radius;
-                    double iDeltaSqrt = parent->iDeltaSqrt;
-                    Matrix1D<double> & blobTableSqrt = parent->blobTableSqrt;
-                    int xsize_1 = XSIZE(parent->VoutFourier) - 1;
-                    int zsize_1 = ZSIZE(parent->VoutFourier) - 1;
-                    MultidimArray< std::complex<double> > &VoutFourier=parent->VoutFourier;
-                    MultidimArray<double> &fourierWeights = parent->FourierWeights;
-                    //                    MultidimArray<double> &prefourierWeights = parent->preFourierWeights;
-                    // Get i value for the thread
-                    for (int i = minAssignedRow; i <= maxAssignedRow ; i ++ )
-                    {
-                        // Discarded rows can be between minAssignedRow and maxAssignedRow, check
-                        if ( statusArray[i] == -1 )
-                            for (int j=STARTINGX(*paddedFourier); j<=FINISHINGX(*paddedFourier); j++)
-                            {
-                                // Compute the frequency of this coefficient in the
-                                // universal coordinate system
-                                FFT_IDX2DIGFREQ(j,XSIZE(parent->paddedImg),XX(freq));
-                                FFT_IDX2DIGFREQ(i,YSIZE(parent->paddedImg),YY(freq));
-                                ZZ(freq)=0;
-                                if (XX(freq)*XX(freq)+YY(freq)*YY(freq)>parent->maxResolution2)
-                                    continue;
-                                wModulator=1.0;
-                                if (hasCTF && !reprocessFlag)
-                                {
-                                    XX(contFreq)=XX(freq)*iTs;
-                                    YY(contFreq)=YY(freq)*iTs;
-                                    threadParams->ctf.precomputeValues(XX(contFreq),YY(contFreq));
-                                    //wCTF=threadParams->ctf.getValueAt();
-                                    wCTF=threadParams->ctf.getValuePureNoKAt();
-                                    //wCTF=threadParams->ctf.getValuePureWithoutDampingAt();
-
-                                    if (std::isnan(wCTF))
-                                    {
-                                    	if (i==0 && j==0)
-                                    		wModulator=wCTF=1.0;
-                                    	else
-                                    		wModulator=wCTF=0.0;
-                                    }
-                                    if (fabs(wCTF)<parent->minCTF)
-                                    {
-                                        wModulator=fabs(wCTF);
-                                        wCTF=SGN(wCTF);
-                                    }
-                                    else
-                                        wCTF=1.0/wCTF;
-                                    if (parent->phaseFlipped)
-                                        wCTF=fabs(wCTF);
-                                }
-
-                                SPEED_UP_temps012;
-                                M3x3_BY_V3x1(freq,*A_SL,freq);
-
-                                // Look for the corresponding index in the volume Fourier transform
-                                DIGFREQ2FFT_IDX_DOUBLE(XX(freq),parent->volPadSizeX,XX(real_position));
-                                DIGFREQ2FFT_IDX_DOUBLE(YY(freq),parent->volPadSizeY,YY(real_position));
-                                DIGFREQ2FFT_IDX_DOUBLE(ZZ(freq),parent->volPadSizeZ,ZZ(real_position));
-
-                                // Put a box around that coefficient
-                                XX(corner1)=CEIL (XX(real_position)-parent->blob.radius);
-                                YY(corner1)=CEIL (YY(real_position)-parent->blob.radius);
-                                ZZ(corner1)=CEIL (ZZ(real_position)-parent->blob.radius);
-                                XX(corner2)=FLOOR(XX(real_position)+parent->blob.radius);
-                                YY(corner2)=FLOOR(YY(real_position)+parent->blob.radius);
-                                ZZ(corner2)=FLOOR(ZZ(real_position)+parent->blob.radius);
-
-#ifdef DEBUG
-
-                                std::cout << "Idx Img=(0," << i << "," << j << ") -> Freq Img=("
-                                << freq.transpose() << ") ->\n    Idx Vol=("
-                                << real_position.transpose() << ")\n"
-                                << "   Corner1=" << corner1.transpose() << std::endl
-                                << "   Corner2=" << corner2.transpose() << std::endl;
-#endif
-                                // Loop within the box
-                                double *ptrIn=(double *)&(A2D_ELEM(*paddedFourier, i,j));
-
-                                // Some precalculations
-                                for (int intz = ZZ(corner1); intz <= ZZ(corner2); ++intz)
-                                {
-                                    double z = intz - ZZ(real_position);
-                                    A1D_ELEM(z2precalculated,intz)=z*z;
-                                    if (A1D_ELEM(zWrapped,intz)<0)
-                                    {
-                                        int iz, izneg;
-                                        fastIntWRAP(iz, intz, 0, zsize_1);
-                                        A1D_ELEM(zWrapped,intz)=iz;
-                                        int miz=-iz;
-                                        fastIntWRAP(izneg, miz,0,zsize_1);
-                                        A1D_ELEM(zNegWrapped,intz)=izneg;
-                                    }
-                                }
-                                for (int inty = YY(corner1); inty <= YY(corner2); ++inty)
-                                {
-                                    double y = inty - YY(real_position);
-                                    A1D_ELEM(y2precalculated,inty)=y*y;
-                                    if (A1D_ELEM(yWrapped,inty)<0)
-                                    {
-                                        int iy, iyneg;
-                                        fastIntWRAP(iy, inty, 0, zsize_1);
-                                        A1D_ELEM(yWrapped,inty)=iy;
-                                        int miy=-iy;
-                                        fastIntWRAP(iyneg, miy,0,zsize_1);
-                                        A1D_ELEM(yNegWrapped,inty)=iyneg;
-                                    }
-                                }
-                                for (int intx = XX(corner1); intx <= XX(corner2); ++intx)
-                                {
-                                    double x = intx - XX(real_position);
-                                    A1D_ELEM(x2precalculated,intx)=x*x;
-                                    if (A1D_ELEM(xWrapped,intx)<0)
-                                    {
-                                        int ix, ixneg;
-                                        fastIntWRAP(ix, intx, 0, zsize_1);
-                                        A1D_ELEM(xWrapped,intx)=ix;
-                                        int mix=-ix;
-                                        fastIntWRAP(ixneg, mix,0,zsize_1);
-                                        A1D_ELEM(xNegWrapped,intx)=ixneg;
-                                    }
-                                }
-
-                                // Actually compute
-                                for (int intz = ZZ(corner1); intz <= ZZ(corner2); ++intz)
-                                {
-                                    double z2 = A1D_ELEM(z2precalculated,intz);
-                                    int iz=A1D_ELEM(zWrapped,intz);
-                                    int izneg=A1D_ELEM(zNegWrapped,intz);
-
-                                    for (int inty = YY(corner1); inty <= YY(corner2); ++inty)
-                                    {
-                                        double y2z2 = A1D_ELEM(y2precalculated,inty) + z2;
-                                        if (y2z2 > blobRadiusSquared)
-                                            continue;
-                                        int iy=A1D_ELEM(yWrapped,inty);
-                                        int iyneg=A1D_ELEM(yNegWrapped,inty);
-
-                                        int	size1=YXSIZE(VoutFourier)*(izneg)+((iyneg)*XSIZE(VoutFourier));
-                                        int	size2=YXSIZE(VoutFourier)*(iz)+((iy)*XSIZE(VoutFourier));
-                                        int	fixSize=0;
-
-                                        for (int intx = XX(corner1); intx <= XX(corner2); ++intx)
-                                        {
-                                            // Compute distance to the center of the blob
-                                            // Compute blob value at that distance
-                                            double d2 = A1D_ELEM(x2precalculated,intx) + y2z2;
-
-                                            if (d2 > blobRadiusSquared)
-                                                continue;
-                                            int aux = (int)(d2 * iDeltaSqrt + 0.5);//Same as ROUND but avoid comparison
-                                            double w = VEC_ELEM(blobTableSqrt, aux)*threadParams->weight *wModulator;
-
-                                            // Look for the location of this logical index
-                                            // in the physical layout
-#ifdef DEBUG
-
-                                            std::cout << "   gcurrent=" << gcurrent.transpose()
-                                            << " d=" << d << std::endl;
-                                            std::cout << "   1: intx=" << intx
-                                            << " inty=" << inty
-                                            << " intz=" << intz << std::endl;
-#endif
-
-                                            int ix=A1D_ELEM(xWrapped,intx);
-#ifdef DEBUG
-
-                                            std::cout << "   2: ix=" << ix << " iy=" << iy
-                                            << " iz=" << iz << std::endl;
-#endif
-
-                                            bool conjugate=false;
-                                            int izp, iyp, ixp;
-                                            if (ix > xsize_1)
-                                            {
-                                                izp = izneg;
-                                                iyp = iyneg;
-                                                ixp = A1D_ELEM(xNegWrapped,intx);
-                                                conjugate=true;
-                                                fixSize = size1;
-                                            }
-                                            else
-                                            {
-                                                izp=iz;
-                                                iyp=iy;
-                                                ixp=ix;
-                                                fixSize = size2;
-                                            }
-#ifdef DEBUG
-                                            std::cout << "   3: ix=" << ix << " iy=" << iy
-                                            << " iz=" << iz << " conj="
-                                            << conjugate << std::endl;
-#endif
-
-                                            // Add the weighted coefficient
-                                            if (reprocessFlag)
-                                            {
-                                                // Use VoutFourier as temporary to save the memory
-                                                double *ptrOut=(double *)&(DIRECT_A3D_ELEM(VoutFourier, izp,iyp,ixp));
-                                                DIRECT_A3D_ELEM(fourierWeights, izp,iyp,ixp) += (w * ptrOut[0]);
-                                            }
-                                            else
-                                            {
-                                                double wEffective=w*wCTF;
-                                                size_t memIdx=fixSize + ixp;//YXSIZE(VoutFourier)*(izp)+((iyp)*XSIZE(VoutFourier))+(ixp);
-                                                double *ptrOut=(double *)&(DIRECT_A1D_ELEM(VoutFourier, memIdx));
-                                                ptrOut[0] += wEffective * ptrIn[0];
-                                                DIRECT_A1D_ELEM(fourierWeights, memIdx) += w;
-
-                                                if (conjugate)
-                                                    ptrOut[1]-=wEffective*ptrIn[1];
-                                                else
-                                                    ptrOut[1]+=wEffective*ptrIn[1];
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                    }
+                    parent->gridRows(threadParams, aux, *(threadParams->symmetry),
+                                     minAssignedRow, maxAssignedRow, statusArray, parent->gridder,
+                                     (double *)MULTIDIM_ARRAY(parent->VoutFourier),
+                                     MULTIDIM_ARRAY(parent->FourierWeights));
 
                     pthread_mutex_lock( &(parent->workLoadMutex) );
 
@@ -827,6 +512,324 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
     while ( 1 );
 }
 
+void ProgRecFourier::preloadImage(ImageThreadParams * threadParams, FourierThreadAux &aux)
+{
+    threadParams->read = 0;
+
+    if ( threadParams->imageIndex < 0 )
+        return;
+
+    // Read input image
+    double rot, tilt, psi, weight;
+    Projection proj;
+
+    //Read projection from selfile, read also angles and shifts if present
+    //but only apply shifts
+
+    size_t objId = aux.objId[threadParams->imageIndex];
+    proj.readApplyGeo(*(threadParams->selFile), objId, aux.params);
+    rot  = proj.rot();
+    tilt = proj.tilt();
+    psi  = proj.psi();
+    weight = proj.weight();
+    if (aux.hasCTF)
+    {
+        threadParams->ctf.readFromMetadataRow(*(threadParams->selFile),objId);
+        // threadParams->ctf.Tm=threadParams->parent->Ts;
+        threadParams->ctf.produceSideInfo();
+    }
+
+    threadParams->weight = 1.;
+
+    if(do_weights)
+        threadParams->weight = weight;
+    else if (!do_weights)
+    {
+        weight=1.0;
+    }
+    else if (weight==0.0)
+    {
+        threadParams->read = 2;
+        return;
+    }
+
+    // Copy the projection to the center of the padded image
+    // and compute its Fourier transform
+    proj().setXmippOrigin();
+    size_t localPaddedImgSize=(size_t)(imgSize*padding_factor_proj);
+    if (threadParams->reprocessFlag)
+        aux.localPaddedFourier.initZeros(localPaddedImgSize,localPaddedImgSize/2+1);
+    else
+    {
+        aux.localPaddedImg.initZeros(localPaddedImgSize,localPaddedImgSize);
+        aux.localPaddedImg.setXmippOrigin();
+        const MultidimArray<double> &mProj=proj();
+        FOR_ALL_ELEMENTS_IN_ARRAY2D(mProj)
+        A2D_ELEM(aux.localPaddedImg,i,j)=A2D_ELEM(mProj,i,j);
+        // COSS A2D_ELEM(localPaddedImg,i,j)=weight*A2D_ELEM(mProj,i,j);
+        CenterFFT(aux.localPaddedImg,true);
+
+        // Fourier transformer for the images
+        aux.localTransformerImg.setReal(aux.localPaddedImg);
+        aux.localTransformerImg.FourierTransform();
+        aux.localTransformerImg.getFourierAlias(aux.localPaddedFourier);
+    }
+
+    // Compute the coordinate axes associated to this image
+    Euler_angles2matrix(rot, tilt, psi, aux.localA);
+    aux.localAinv=aux.localA.transpose();
+
+    threadParams->localweight = weight;
+    threadParams->localAInv = &aux.localAinv;
+    threadParams->localPaddedFourier = &aux.localPaddedFourier;
+    //#define DEBUG22
+#ifdef DEBUG22
+
+    {//CORRECTO
+
+        if(threadParams->myThreadID%1==0)
+        {
+            proj.write((std::string) integerToString(threadParams->myThreadID)  + "_" +\
+                       integerToString(threadParams->imageIndex) + "proj.spi");
+
+            ImageXmipp save44;
+            save44()=aux.localPaddedImg;
+            save44.write((std::string) integerToString(threadParams->myThreadID)  + "_" +\
+                         integerToString(threadParams->imageIndex) + "local_padded_img.spi");
+
+            FourierImage save33;
+            save33()=aux.localPaddedFourier;
+            save33.write((std::string) integerToString(threadParams->myThreadID)  + "_" +\
+                         integerToString(threadParams->imageIndex) + "local_padded_fourier.spi");
+            FourierImage save22;
+            //save22()=*paddedFourier;
+            save22().alias(*(threadParams->localPaddedFourier));
+            save22.write((std::string) integerToString(threadParams->myThreadID)  + "_" +\
+                         integerToString(threadParams->imageIndex) + "_padded_fourier.spi");
+        }
+
+    }
+#endif
+    #undef DEBUG22
+
+    threadParams->read = 1;
+}
+
+template<typename T>
+void ProgRecFourier::gridRows(ImageThreadParams * threadParams, FourierThreadAux &aux,
+                              const Matrix2D<double> &A_SL, int minRow, int maxRow,
+                              const int * statusArray, const BlobGridder<T> &gridder,
+                              T *fourier, T *weights)
+{
+    const MultidimArray< std::complex<double> > &paddedFourier = *(threadParams->paddedFourier);
+    bool reprocessFlag = threadParams->reprocessFlag;
+    bool hasCTF = aux.hasCTF;
+    // In the weight iterations the real part of VoutFourier keeps the weights
+    const double *reference = (const double *)MULTIDIM_ARRAY(VoutFourier);
+
+    // Get the inverse of the sampling rate
+    // double iTs=padding_factor_proj/Ts;
+    double iTs=1.0/Ts; // The padding factor is not considered here, but later when the indexes
+    //                 // are converted to digital frequencies
+
+    // The third column of A_SL is not needed, the image frequencies have Z=0
+    double a00=MAT_ELEM(A_SL,0,0), a01=MAT_ELEM(A_SL,0,1);
+    double a10=MAT_ELEM(A_SL,1,0), a11=MAT_ELEM(A_SL,1,1);
+    double a20=MAT_ELEM(A_SL,2,0), a21=MAT_ELEM(A_SL,2,1);
+
+    double wCTF=1, wModulator=1.0;
+    for (int i = minRow; i <= maxRow ; i ++ )
+    {
+        // Discarded rows can be between minRow and maxRow, check
+        if ( statusArray != NULL && statusArray[i] != -1 )
+            continue;
+        double freqY;
+        FFT_IDX2DIGFREQ(i,YSIZE(paddedImg),freqY);
+        double freqY2=freqY*freqY;
+        for (int j=STARTINGX(paddedFourier); j<=FINISHINGX(paddedFourier); j++)
+        {
+            // Compute the frequency of this coefficient in the
+            // universal coordinate system
+            double freqX;
+            FFT_IDX2DIGFREQ(j,XSIZE(paddedImg),freqX);
+            if (freqX*freqX+freqY2>maxResolution2)
+                continue;
+            wModulator=1.0;
+            if (hasCTF && !reprocessFlag)
+            {
+                threadParams->ctf.precomputeValues(freqX*iTs,freqY*iTs);
+                //wCTF=threadParams->ctf.getValueAt();
+                wCTF=threadParams->ctf.getValuePureNoKAt();
+                //wCTF=threadParams->ctf.getValuePureWithoutDampingAt();
+
+                if (std::isnan(wCTF))
+                {
+                    if (i==0 && j==0)
+                        wModulator=wCTF=1.0;
+                    else
+                        wModulator=wCTF=0.0;
+                }
+                if (fabs(wCTF)<minCTF)
+                {
+                    wModulator=fabs(wCTF);
+                    wCTF=SGN(wCTF);
+                }
+                else
+                    wCTF=1.0/wCTF;
+                if (phaseFlipped)
+                    wCTF=fabs(wCTF);
+            }
+
+            // Look for the corresponding position in the volume Fourier transform
+            double posX, posY, posZ;
+            DIGFREQ2FFT_IDX_DOUBLE(a00*freqX+a01*freqY,volPadSizeX,posX);
+            DIGFREQ2FFT_IDX_DOUBLE(a10*freqX+a11*freqY,volPadSizeY,posY);
+            DIGFREQ2FFT_IDX_DOUBLE(a20*freqX+a21*freqY,volPadSizeZ,posZ);
+
+            T blobWeight=(T)(threadParams->weight*wModulator);
+            if (reprocessFlag)
+                gridder.splatWeights(weights, reference, posX, posY, posZ, blobWeight);
+            else
+            {
+                const double *ptrIn=(const double *)&(A2D_ELEM(paddedFourier, i,j));
+                gridder.splat(fourier, weights, posX, posY, posZ,
+                              (T)ptrIn[0], (T)ptrIn[1], blobWeight, (T)wCTF);
+            }
+        }
+    }
+}
+
+template<typename T>
+void ProgRecFourier::processImagesPrivate(ImageThreadParams * threadParams, FourierThreadAux &aux,
+        const BlobGridder<T> &gridder, MultidimArray<T> &privateFourier,
+        MultidimArray<T> &privateWeights)
+{
+    bool reprocessFlag = threadParams->reprocessFlag;
+
+    // Allocated here, so that the pages are touched first by the thread
+    // that is going to use them. In the reprocessing stage the Fourier
+    // volume is only read, so it is not needed
+    if (!reprocessFlag && MULTIDIM_SIZE(privateFourier)==0)
+        privateFourier.initZeros(ZSIZE(VoutFourier), YSIZE(VoutFourier), 2*XSIZE(VoutFourier));
+    if (MULTIDIM_SIZE(privateWeights)==0)
+        privateWeights.initZeros(FourierWeights);
+    T *ptrFourier = (T *)MULTIDIM_ARRAY(privateFourier);
+    T *ptrWeights = MULTIDIM_ARRAY(privateWeights);
+
+    int repaint = (int)ceil((double)SF.size()/60);
+    while (true)
+    {
+        pthread_mutex_lock( &workLoadMutex );
+        int imgIndex = nextImageIndex++;
+        if (imgIndex <= lastPrivateImageIndex && verbose && imagesProcessed++%repaint==0)
+            progress_bar(imagesProcessed);
+        pthread_mutex_unlock( &workLoadMutex );
+        if (imgIndex > lastPrivateImageIndex)
+            break;
+
+        threadParams->imageIndex = imgIndex;
+        preloadImage(threadParams, aux);
+        if (threadParams->read != 1 || threadParams->weight == 0.0)
+            continue;
+        threadParams->paddedFourier = threadParams->localPaddedFourier;
+
+        // Only the rows below the maximum resolution are gridded
+        int ydim = (int)YSIZE(aux.localPaddedFourier);
+        int conserveRows=(int)ceil((double)ydim * maxResolution * 2.0);
+        conserveRows=(int)ceil((double)conserveRows/2.0);
+        int lastLowRow = std::min(conserveRows, ydim) - 1;
+        int firstHighRow = std::max(conserveRows, ydim - conserveRows);
+
+        for (size_t isym = 0; isym < R_repository.size(); isym++)
+        {
+            Matrix2D<double> A_SL=R_repository[isym]*aux.localAinv;
+            gridRows(threadParams, aux, A_SL, 0, lastLowRow, NULL,
+                     gridder, ptrFourier, ptrWeights);
+            gridRows(threadParams, aux, A_SL, firstHighRow, ydim - 1, NULL,
+                     gridder, ptrFourier, ptrWeights);
+        }
+    }
+}
+
+/* Add n values of in to out and set them to zero */
+template<typename T>
+void addAndClear(double *out, T *in, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        out[i] += in[i];
+        in[i] = 0;
+    }
+}
+
+void ProgRecFourier::reducePrivateVolumes(ImageThreadParams * threadParams)
+{
+    // Each thread adds a contiguous slab of planes from all private volumes
+    size_t zdim = ZSIZE(FourierWeights);
+    size_t k0 = (zdim * threadParams->myThreadID) / numThreads;
+    size_t k1 = (zdim * (threadParams->myThreadID + 1)) / numThreads;
+    size_t offset = k0 * YXSIZE(FourierWeights);
+    size_t n = (k1 - k0) * YXSIZE(FourierWeights);
+    if (n == 0)
+        return;
+    bool reprocessFlag = threadParams->reprocessFlag;
+    double *ptrWeights = MULTIDIM_ARRAY(FourierWeights) + offset;
+    double *ptrFourier = (double *)MULTIDIM_ARRAY(VoutFourier) + 2 * offset;
+
+    for (int nt = 0; nt < numThreads; nt++)
+    {
+        FourierThreadAux &aux = *(th_args[nt].aux);
+        if (MULTIDIM_SIZE(aux.privateFourierWeights) > 0)
+            addAndClear(ptrWeights, MULTIDIM_ARRAY(aux.privateFourierWeights) + offset, n);
+        if (MULTIDIM_SIZE(aux.privateFourierWeightsSingle) > 0)
+            addAndClear(ptrWeights, MULTIDIM_ARRAY(aux.privateFourierWeightsSingle) + offset, n);
+        if (reprocessFlag)
+            continue;
+        if (MULTIDIM_SIZE(aux.privateVoutFourier) > 0)
+            addAndClear(ptrFourier, MULTIDIM_ARRAY(aux.privateVoutFourier) + 2 * offset, 2 * n);
+        if (MULTIDIM_SIZE(aux.privateVoutFourierSingle) > 0)
+            addAndClear(ptrFourier, MULTIDIM_ARRAY(aux.privateVoutFourierSingle) + 2 * offset, 2 * n);
+    }
+}
+
+void ProgRecFourier::processImagesPrivateVolumes(int firstImageIndex, int lastImageIndex, bool reprocessFlag)
+{
+    nextImageIndex = firstImageIndex;
+    lastPrivateImageIndex = lastImageIndex;
+    for ( int nt = 0 ; nt < numThreads ; nt ++ )
+        th_args[nt].reprocessFlag = reprocessFlag;
+
+    // Every thread grids whole images into its own volume
+    threadOpCode = PROCESS_IMAGES_PRIVATE;
+    barrier_wait( &barrier );
+    barrier_wait( &barrier );
+
+    // And then they are all added to the shared volume
+    threadOpCode = REDUCE_VOLUMES;
+    barrier_wait( &barrier );
+    barrier_wait( &barrier );
+}
+
+void ProgRecFourier::saveFSCFirstHalf()
+{
+    // Save Current Fourier, Reconstruction and Weights
+    Image<double> save;
+    save().alias( FourierWeights );
+    save.write((std::string)fn_fsc + "_1_Weights.vol");
+
+    Image< std::complex<double> > save2;
+    save2().alias( VoutFourier );
+    save2.write((std::string) fn_fsc + "_1_Fourier.vol");
+
+    finishComputations(FileName((std::string) fn_fsc + "_1_recons.vol"));
+    Vout().initZeros(volPadSizeZ, volPadSizeY, volPadSizeX);
+    transformerVol.setReal(Vout());
+    Vout().clear();
+    transformerVol.getFourierAlias(VoutFourier);
+    FourierWeights.initZeros(VoutFourier);
+    VoutFourier.initZeros();
+}
+
 //#define DEBUG
 void ProgRecFourier::processImages( int firstImageIndex, int lastImageIndex, bool saveFSC, bool reprocessFlag)
 {
@@ -845,165 +848,165 @@ void ProgRecFourier::processImages( int firstImageIndex, int lastImageIndex, boo
     // FSC purposes
     int current_index;
 
-    do
+    if (usePrivateVolumes)
     {
-        threadOpCode = PRELOAD_IMAGE;
-
-        for ( int nt = 0 ; nt < numThreads ; nt ++ )
+        // Whole images are gridded by each thread into its own volume,
+        // the half sets for the FSC are reduced separately
+        imagesProcessed = 0;
+        if (saveFSC)
         {
-            if ( imgIndex <= lastImageIndex )
-            {
-                th_args[nt].imageIndex = imgIndex;
-                th_args[nt].reprocessFlag = reprocessFlag;
-                imgIndex++;
-            }
-            else
+            processImagesPrivateVolumes(firstImageIndex, FSCIndex, reprocessFlag);
+            saveFSCFirstHalf();
+            processImagesPrivateVolumes(FSCIndex + 1, lastImageIndex, reprocessFlag);
+        }
+        else
+            processImagesPrivateVolumes(firstImageIndex, lastImageIndex, reprocessFlag);
+    }
+    else
+    {
+        do
+        {
+            threadOpCode = PRELOAD_IMAGE;
+
+            for ( int nt = 0 ; nt < numThreads ; nt ++ )
             {
-                th_args[nt].imageIndex = -1;
+                if ( imgIndex <= lastImageIndex )
+                {
+                    th_args[nt].imageIndex = imgIndex;
+                    th_args[nt].reprocessFlag = reprocessFlag;
+                    imgIndex++;
+                }
+                else
+                {
+                    th_args[nt].imageIndex = -1;
+                }
             }
-        }
 
-        // Awaking sleeping threads
-        barrier_wait( &barrier );
-        // here each thread is reading a different image and compute fft
-        // Threads are working now, wait for them to finish
-        // processing current projection
-        barrier_wait( &barrier );
+            // Awaking sleeping threads
+            barrier_wait( &barrier );
+            // here each thread is reading a different image and compute fft
+            // Threads are working now, wait for them to finish
+            // processing current projection
+            barrier_wait( &barrier );
 
-        // each threads have read a different image and now
-        // all the thread will work in a different part of a single image.
-        threadOpCode = PROCESS_IMAGE;
+            // each threads have read a different image and now
+            // all the thread will work in a different part of a single image.
+            threadOpCode = PROCESS_IMAGE;
 
-        processed = false;
+            processed = false;
 
-        for ( int nt = 0 ; nt < numThreads ; nt ++ )
-        {
-            if ( th_args[nt].read == 2 )
-                processed = true;
-            else if ( th_args[nt].read == 1 )
+            for ( int nt = 0 ; nt < numThreads ; nt ++ )
             {
-                processed = true;
-                if (verbose && imgno++%repaint==0)
-                    progress_bar(imgno);
+                if ( th_args[nt].read == 2 )
+                    processed = true;
+                else if ( th_args[nt].read == 1 )
+                {
+                    processed = true;
+                    if (verbose && imgno++%repaint==0)
+                        progress_bar(imgno);
 
-                double weight = th_args[nt].localweight;
-                paddedFourier = th_args[nt].localPaddedFourier;
-                current_index = th_args[nt].imageIndex;
-                Matrix2D<double> *Ainv = th_args[nt].localAInv;
+                    double weight = th_args[nt].localweight;
+                    paddedFourier = th_args[nt].localPaddedFourier;
+                    current_index = th_args[nt].imageIndex;
+                    Matrix2D<double> *Ainv = th_args[nt].localAInv;
 
-                //#define DEBUG22
+                    //#define DEBUG22
 #ifdef DEBUG22
 
-                {
-                    static int ii=0;
-                    if(ii%1==0)
                     {
-                        FourierImage save22;
-                        //save22()=*paddedFourier;
-                        save22().alias(*paddedFourier);
-                        save22.write((std::string) integerToString(ii)  + "_padded_fourier.spi");
+                        static int ii=0;
+                        if(ii%1==0)
+                        {
+                            FourierImage save22;
+                            //save22()=*paddedFourier;
+                            save22().alias(*paddedFourier);
+                            save22.write((std::string) integerToString(ii)  + "_padded_fourier.spi");
+                        }
+                        ii++;
                     }
-                    ii++;
-                }
 #endif
-                #undef DEBUG22
-
-                // Initialized just once
-                if ( statusArray == NULL )
-                {
-                    statusArray = (int *) malloc ( sizeof(int) * paddedFourier->ydim );
-                }
-
-                // Determine how many rows of the fourier
-                // transform are of interest for us. This is because
-                // the user can avoid to explore at certain resolutions
-                size_t conserveRows=(size_t)ceil((double)paddedFourier->ydim * maxResolution * 2.0);
-                conserveRows=(size_t)ceil((double)conserveRows/2.0);
-
-                // Loop over all symmetries
-                for (size_t isym = 0; isym < R_repository.size(); isym++)
-                {
-                    rowsProcessed = 0;
-
-                    // Compute the coordinate axes of the symmetrized projection
-                    Matrix2D<double> A_SL=R_repository[isym]*(*Ainv);
+                    #undef DEBUG22
 
-                    // Fill the thread arguments for each thread
-                    for ( int th = 0 ; th < numThreads ; th ++ )
+                    // Initialized just once
+                    if ( statusArray == NULL )
                     {
-                        // Passing parameters to each thread
-                        th_args[th].symmetry = &A_SL;
-                        th_args[th].paddedFourier = paddedFourier;
-                        th_args[th].weight = weight;
-                        th_args[th].reprocessFlag = reprocessFlag;
+                        statusArray = (int *) malloc ( sizeof(int) * paddedFourier->ydim );
                     }
 
-                    // Init status array
-                    for (size_t i = 0 ; i < paddedFourier->ydim ; i ++ )
+                    // Determine how many rows of the fourier
+                    // transform are of interest for us. This is because
+                    // the user can avoid to explore at certain resolutions
+                    size_t conserveRows=(size_t)ceil((double)paddedFourier->ydim * maxResolution * 2.0);
+                    conserveRows=(size_t)ceil((double)conserveRows/2.0);
+
+                    // Loop over all symmetries
+                    for (size_t isym = 0; isym < R_repository.size(); isym++)
                     {
-                        if ( i >= conserveRows && i < (paddedFourier->ydim-conserveRows))
+                        rowsProcessed = 0;
+
+                        // Compute the coordinate axes of the symmetrized projection
+                        Matrix2D<double> A_SL=R_repository[isym]*(*Ainv);
+
+                        // Fill the thread arguments for each thread
+                        for ( int th = 0 ; th < numThreads ; th ++ )
                         {
-                            // -2 means "discarded"
-                            statusArray[i] = -2;
-                            rowsProcessed++;
+                            // Passing parameters to each thread
+                            th_args[th].symmetry = &A_SL;
+                            th_args[th].paddedFourier = paddedFourier;
+                            th_args[th].weight = weight;
+                            th_args[th].reprocessFlag = reprocessFlag;
                         }
-                        else
+
+                        // Init status array
+                        for (size_t i = 0 ; i < paddedFourier->ydim ; i ++ )
                         {
-                            statusArray[i] = 0;
+                            if ( i >= conserveRows && i < (paddedFourier->ydim-conserveRows))
+                            {
+                                // -2 means "discarded"
+                                statusArray[i] = -2;
+                                rowsProcessed++;
+                            }
+                            else
+                            {
+                                statusArray[i] = 0;
+                            }
                         }
-                    }
 
-                    // Awaking sleeping threads
-                    barrier_wait( &barrier );
-                    // Threads are working now, wait for them to finish
-                    // processing current projection
-                    barrier_wait( &barrier );
+                        // Awaking sleeping threads
+                        barrier_wait( &barrier );
+                        // Threads are working now, wait for them to finish
+                        // processing current projection
+                        barrier_wait( &barrier );
 
-                    //#define DEBUG2
+                        //#define DEBUG2
 #ifdef DEBUG2
 
-                    {
-                        static int ii=0;
-                        if(ii%1==0)
                         {
-                            Image<double> save;
-                            save().alias( FourierWeights );
-                            save.write((std::string) integerToString(ii)  + "_1_Weights.vol");
+                            static int ii=0;
+                            if(ii%1==0)
+                            {
+                                Image<double> save;
+                                save().alias( FourierWeights );
+                                save.write((std::string) integerToString(ii)  + "_1_Weights.vol");
 
-                            Image< std::complex<double> > save2;
-                            save2().alias( VoutFourier );
-                            save2.write((std::string) integerToString(ii)  + "_1_Fourier.vol");
+                                Image< std::complex<double> > save2;
+                                save2().alias( VoutFourier );
+                                save2.write((std::string) integerToString(ii)  + "_1_Fourier.vol");
+                            }
+                            ii++;
                         }
-                        ii++;
-                    }
 #endif
-                    #undef DEBUG2
+                        #undef DEBUG2
 
-                }
+                    }
 
-                if ( current_index == FSCIndex && saveFSC )
-                {
-                    // Save Current Fourier, Reconstruction and Weights
-                    Image<double> save;
-                    save().alias( FourierWeights );
-                    save.write((std::string)fn_fsc + "_1_Weights.vol");
-
-                    Image< std::complex<double> > save2;
-                    save2().alias( VoutFourier );
-                    save2.write((std::string) fn_fsc + "_1_Fourier.vol");
-
-                    finishComputations(FileName((std::string) fn_fsc + "_1_recons.vol"));
-                    Vout().initZeros(volPadSizeZ, volPadSizeY, volPadSizeX);
-                    transformerVol.setReal(Vout());
-                    Vout().clear();
-                    transformerVol.getFourierAlias(VoutFourier);
-                    FourierWeights.initZeros(VoutFourier);
-                    VoutFourier.initZeros();
+                    if ( current_index == FSCIndex && saveFSC )
+                        saveFSCFirstHalf();
                 }
             }
         }
+        while ( processed );
     }
-    while ( processed );
 
     if( saveFSC )
     {
@@ -48,6 +48,7 @@
 
 #include <reconstruction/directions.h>
 #include <reconstruction/symmetrize.h>
+#include <reconstruction/fourier_gridding.h>
 #define BLOB_TABLE_SIZE 5000
 #define BLOB_TABLE_SIZE_SQRT 10000
 
@@ -58,11 +59,14 @@
 #define PROCESS_IMAGE 1
 #define PROCESS_WEIGHTS 2
 #define PRELOAD_IMAGE 3
+#define PROCESS_IMAGES_PRIVATE 4
+#define REDUCE_VOLUMES 5
 
 /**@defgroup FourierReconstruction Fourier reconstruction
    @ingroup ReconsLibrary */
 //@{
 class ProgRecFourier;
+struct FourierThreadAux;
 
 // static pthread_mutex_t mutexDocFile= PTHREAD_MUTEX_INITIALIZER;
 
@@ -81,6 +85,27 @@ struct ImageThreadParams
     double localweight;
     bool reprocessFlag;
     MetaData * selFile;
+    FourierThreadAux * aux;
+};
+
+/** Work space owned by each reconstruction thread */
+struct FourierThreadAux
+{
+    // Object ids of the input metadata
+    std::vector<size_t> objId;
+    ApplyGeoParams params;
+    bool hasCTF;
+    Matrix2D<double> localA, localAinv;
+    MultidimArray< std::complex<double> > localPaddedFourier;
+    MultidimArray<double> localPaddedImg;
+    FourierTransformer localTransformerImg;
+    // Volume and weights of this thread when using private volumes.
+    // The volume keeps real and imaginary parts interleaved along X
+    MultidimArray<double> privateVoutFourier;
+    MultidimArray<double> privateFourierWeights;
+    // Same, when gridding in single precision
+    MultidimArray<float> privateVoutFourierSingle;
+    MultidimArray<float> privateFourierWeightsSingle;
 };
 
 /** Fourier reconstruction parameters. */
@@ -155,6 +180,23 @@ public:
     /// How many image rows are processed at a time by a single thread.
     int thrWidth;
 
+    /** Each thread grids whole images into its own copy of the Fourier
+     * volume and weights, that are added at the end.
+     */
+    bool usePrivateVolumes;
+
+    /// Grid in single precision (into the private volumes)
+    bool useSinglePrecision;
+
+    /// Next image to be taken by a thread when using private volumes
+    int nextImageIndex;
+
+    /// Last image of the range processed with private volumes
+    int lastPrivateImageIndex;
+
+    /// Number of images processed with private volumes (progress bar)
+    int imagesProcessed;
+
 public: // Internal members
     // Size of the original images
     int imgSize;
@@ -170,6 +212,10 @@ public: // Internal members
     // Table with blob values, squared samplinf
     Matrix1D<double> blobTableSqrt, fourierBlobTableSqrt;
 
+    // Blob gridding kernels in double and single precision
+    BlobGridder<double> gridder;
+    BlobGridder<float> gridderSingle;
+
     // Inverse of the delta and deltaFourier used in the tables
     //double iDelta,
     double iDeltaFourier, iDeltaSqrt;
@@ -222,6 +268,38 @@ public:
     /// Process one image
     void processImages( int firstImageIndex, int lastImageIndex, bool saveFSC=false, bool reprocessFlag=false);
 
+    /** Process a range of images with one private volume per thread.
+     * The private volumes are added to VoutFourier and FourierWeights at the end.
+     */
+    void processImagesPrivateVolumes(int firstImageIndex, int lastImageIndex, bool reprocessFlag);
+
+    /// Save the first half of the images for the FSC and reset the volumes
+    void saveFSCFirstHalf();
+
+    /// Read the image of a thread and compute its padded Fourier transform
+    void preloadImage(ImageThreadParams * threadParams, FourierThreadAux &aux);
+
+    /** Grid the rows minRow to maxRow of the thread projection.
+     * If statusArray is not NULL, only the rows marked as assigned (-1) are gridded.
+     * fourier (interleaved complex) and weights have the layout of VoutFourier and
+     * FourierWeights. When reprocessing, only the weights are accumulated.
+     */
+    template<typename T>
+    void gridRows(ImageThreadParams * threadParams, FourierThreadAux &aux,
+                  const Matrix2D<double> &A_SL, int minRow, int maxRow,
+                  const int * statusArray, const BlobGridder<T> &gridder,
+                  T *fourier, T *weights);
+
+    /// Thread side of processImagesPrivateVolumes: grid images until none is left
+    template<typename T>
+    void processImagesPrivate(ImageThreadParams * threadParams, FourierThreadAux &aux,
+                              const BlobGridder<T> &gridder,
+                              MultidimArray<T> &privateFourier,
+                              MultidimArray<T> &privateWeights);
+
+    /// Thread side of the reduction: add one slab of all the private volumes
+    void reducePrivateVolumes(ImageThreadParams * threadParams);
+
     /// Method for the correction of the fourier coefficients
     void correctWeight();
 	
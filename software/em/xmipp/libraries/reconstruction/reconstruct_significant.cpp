@@ -24,6 +24,7 @@
  ***************************************************************************/
 
 #include "reconstruct_significant.h"
+#include <data/xmipp_threads.h>
 #include <algorithm>
 
 // Define params
@@ -62,6 +63,7 @@ void ProgReconstructSignificant::defineParams()
     addParamsLine("  [--dontReconstruct]          : Do not reconstruct");
     addParamsLine("  [--useForValidation <numOrientationsPerParticle=10>] : Use the program for validation. This number defines the number of possible orientations per particle");
     addParamsLine("  [--dontCheckMirrors]         : Don't check mirrors in the alignment process");
+    addParamsLine("  [--thr <N=1>]                : Number of threads");
 
 }
 
@@ -90,6 +92,7 @@ void ProgReconstructSignificant::readParams()
     useForValidation=checkParam("--useForValidation");
     numOrientationsPerParticle = getIntParam("--useForValidation");
     dontCheckMirrors = checkParam("--dontCheckMirrors");
+    Nthr = getIntParam("--thr");
 
     if (!doReconstruct)
     {
@@ -120,6 +123,7 @@ void ProgReconstructSignificant::show()
         std::cout << "Reconstruct                 : "  << doReconstruct << std::endl;
         std::cout << "useForValidation            : "  << useForValidation << std::endl;
         std::cout << "dontCheckMirrors            : "  << dontCheckMirrors << std::endl;
+        std::cout << "Number of threads           : "  << Nthr << std::endl;
 
 
         if (fnSym != "")
@@ -141,17 +145,219 @@ void ProgReconstructSignificant::show()
 
 // Image alignment ========================================================
 //#define DEBUG
-void ProgReconstructSignificant::alignImagesToGallery()
+void ProgReconstructSignificant::alignImageToGallery(SignificantImageAlignment &alignment,
+                                                     SignificantAlignmentAux &aux)
 {
-    AlignmentAux aux;
-    CorrelationAux aux2;
-    RotationalCorrelationAux aux3;
+	size_t Nvols=YSIZE(cc);
+	size_t Ndirs=XSIZE(cc);
+	size_t nImg=alignment.nImg;
+#ifdef DEBUG
+	std::cout << "Processing: " << alignment.fnImg << std::endl;
+#endif
+	aux.I.read(alignment.fnImg);
+	MultidimArray<double> &mCurrentImage=aux.I();
+	mCurrentImage.setXmippOrigin();
+	MultidimArray<double> &mCurrentImageAligned=aux.mCurrentImageAligned;
+	MultidimArray<double> &mGalleryProjection=aux.mGalleryProjection;
+	Matrix2D<double> &M=aux.M;
+	alignment.imgSize=MULTIDIM_SIZE(mCurrentImage);
+	alignment.imgcc.resizeNoCopy(Nvols*Ndirs);
+	alignment.imgimed.resizeNoCopy(Nvols*Ndirs);
+	alignment.allM.clear();
+	alignment.bestCorr=-2;
+	alignment.bestImed=1e38;
+	alignment.bestVolume=-1;
+
+	// Compute all correlations
+	for (size_t nVolume=0; nVolume<Nvols; ++nVolume)
+	{
+		const AlignmentTransforms *transforms=galleryTransforms[nVolume];
+		for (size_t nDir=0; nDir<Ndirs; ++nDir)
+		{
+			mCurrentImageAligned=mCurrentImage;
+			mGalleryProjection.aliasImageInStack(gallery[nVolume](),nDir);
+			mGalleryProjection.setXmippOrigin();
+			double corr;
+			if (! dontCheckMirrors)
+				corr=alignImagesConsideringMirrors(mGalleryProjection,transforms[nDir],
+						mCurrentImageAligned,M,aux.aux,aux.aux2,aux.aux3,DONT_WRAP);
+			else
+				corr = alignImages(mGalleryProjection, transforms[nDir], mCurrentImageAligned,
+				                   M, DONT_WRAP, aux.aux, aux.aux2, aux.aux3);
 
-	Matrix2D<double> M;
-	std::vector< Matrix2D<double> > allM;
+			M=M.inv();
+			double imed=imedDistance(mGalleryProjection, mCurrentImageAligned);
 
+			DIRECT_A3D_ELEM(cc,nImg,nVolume,nDir)=corr;
+			// For the paper plot: std::cout << corr << " " << imed << std::endl;
+			size_t idx=nVolume*Ndirs+nDir;
+			DIRECT_A1D_ELEM(alignment.imgcc,idx)=corr;
+			DIRECT_A1D_ELEM(alignment.imgimed,idx)=imed;
+			alignment.allM.push_back(M);
+
+			if (corr>alignment.bestCorr)
+			{
+				alignment.bestM=M;
+				alignment.bestCorr=corr;
+				alignment.bestVolume=(int)nVolume;
+				alignment.bestRot=mdGallery[nVolume][nDir].rot;
+				alignment.bestTilt=mdGallery[nVolume][nDir].tilt;
+			}
+
+			if (imed<alignment.bestImed)
+				alignment.bestImed=imed;
+		}
+	}
+}
+
+void ProgReconstructSignificant::storeImageAlignment(const SignificantImageAlignment &alignment)
+{
 	size_t Nvols=YSIZE(cc);
 	size_t Ndirs=XSIZE(cc);
+	size_t nImg=alignment.nImg;
+	const MDRow &row=alignment.row;
+	const MultidimArray<double> &imgcc=alignment.imgcc;
+	const MultidimArray<double> &imgimed=alignment.imgimed;
+	double bestCorr=alignment.bestCorr;
+	double bestImed=alignment.bestImed;
+	double one_alpha=1-currentAlpha;
+
+	// Keep the best assignment for the projection matching
+	// Each process keeps a list of the images for each volume
+	MetaData &mdProjectionMatching=mdReconstructionProjectionMatching[alignment.bestVolume];
+	double scale, shiftX, shiftY, anglePsi;
+	bool flip;
+	transformationMatrix2Parameters2D(alignment.bestM,flip,scale,shiftX,shiftY,anglePsi);
+	if (useForValidation && dontCheckMirrors)
+		flip = false;
+
+	if (maxShift<0 || (maxShift>0 && fabs(shiftX)<maxShift && fabs(shiftY)<maxShift))
+	{
+		size_t recId=mdProjectionMatching.addRow(row);
+		mdProjectionMatching.setValue(MDL_ENABLED,1,recId);
+		mdProjectionMatching.setValue(MDL_MAXCC,bestCorr,recId);
+		mdProjectionMatching.setValue(MDL_ANGLE_ROT,alignment.bestRot,recId);
+		mdProjectionMatching.setValue(MDL_ANGLE_TILT,alignment.bestTilt,recId);
+		mdProjectionMatching.setValue(MDL_ANGLE_PSI,anglePsi,recId);
+		mdProjectionMatching.setValue(MDL_SHIFT_X,-shiftX,recId);
+		mdProjectionMatching.setValue(MDL_SHIFT_Y,-shiftY,recId);
+		mdProjectionMatching.setValue(MDL_FLIP,flip,recId);
+	}
+
+	// Compute lower limit of correlation
+	double rl=bestCorr*one_alpha;
+	double z=0.5*log((1+rl)/(1-rl));
+	double zl=z-2.96*sqrt(1.0/alignment.imgSize);
+	double ccl=tanh(zl);
+
+	// Compute the cumulative distributions
+	MultidimArray<double> cdfcc, cdfimed;
+	imgcc.cumlativeDensityFunction(cdfcc);
+	imgimed.cumlativeDensityFunction(cdfimed);
+
+	// Check if force 1 volume
+	size_t firstVolume=0;
+	size_t lastVolume=Nvols-1;
+
+	// Get the best images
+	for (size_t nVolume=firstVolume; nVolume<=lastVolume; ++nVolume)
+	{
+		MetaData &mdPartial=mdReconstructionPartial[nVolume];
+		for (size_t nDir=0; nDir<Ndirs; ++nDir)
+		{
+			size_t idx=nVolume*Ndirs+nDir;
+			double cdfccthis=DIRECT_A1D_ELEM(cdfcc,idx);
+			double cdfimedthis=DIRECT_A1D_ELEM(cdfimed,idx);
+			double cc=DIRECT_A1D_ELEM(imgcc,idx);
+			// bool condition=!useImed || (useImed && cdfimedthis<=currentAlpha);
+			bool condition=true;
+			condition=condition && ((applyFisher && cc>ccl) || !applyFisher);
+			condition=condition && cdfccthis>=one_alpha;
+			if (condition)
+			{
+				double imed=DIRECT_A1D_ELEM(imgimed,idx);
+				transformationMatrix2Parameters2D(alignment.allM[nVolume*Ndirs+nDir],flip,scale,shiftX,shiftY,anglePsi);
+				if (useForValidation && dontCheckMirrors)
+					flip = false;
+
+				if (maxShift>0)
+					if (fabs(shiftX)>maxShift || fabs(shiftY)>maxShift)
+						continue;
+				if (flip)
+					shiftX*=-1;
+
+				double thisWeight=cdfccthis*(cc/bestCorr);
+				// COSS: To promote sparsity in the volume assignment: sum_i(cc_i^p)/sum_i(cc_i)*cc_i^p/cc_i
+				if (useImed)
+					thisWeight*=(1-cdfimedthis)*(bestImed/imed);
+				DIRECT_A3D_ELEM(weight,nImg,nVolume,nDir)=thisWeight;
+				double angleRot=mdGallery[nVolume][nDir].rot;
+				double angleTilt=mdGallery[nVolume][nDir].tilt;
+#ifdef DEBUG
+				std::cout << "   Getting Gallery: " << mdGallery[nVolume][nDir].fnImg
+						  << " corr=" << cc << " imed=" << imed << " weight=" << thisWeight << " rot=" << angleRot
+						  << " tilt=" << angleTilt << std::endl
+				          << "Matrix=" << alignment.allM[nVolume*Ndirs+nDir] << std::endl
+				          << "shiftX=" << shiftX << " shiftY=" << shiftY << std::endl;
+#endif
+
+				size_t recId=mdPartial.addRow(row);
+				mdPartial.setValue(MDL_ENABLED,1,recId);
+				mdPartial.setValue(MDL_MAXCC,cc,recId);
+				mdPartial.setValue(MDL_COST,imed,recId);
+				mdPartial.setValue(MDL_ANGLE_ROT,angleRot,recId);
+				mdPartial.setValue(MDL_ANGLE_TILT,angleTilt,recId);
+				mdPartial.setValue(MDL_ANGLE_PSI,anglePsi,recId);
+				mdPartial.setValue(MDL_SHIFT_X,-shiftX,recId);
+				mdPartial.setValue(MDL_SHIFT_Y,-shiftY,recId);
+				mdPartial.setValue(MDL_FLIP,flip,recId);
+				mdPartial.setValue(MDL_IMAGE_IDX,(size_t)nImg,recId);
+				mdPartial.setValue(MDL_REF,(int)nDir,recId);
+				mdPartial.setValue(MDL_REF3D,(int)nVolume,recId);
+				mdPartial.setValue(MDL_WEIGHT,thisWeight,recId);
+				mdPartial.setValue(MDL_WEIGHT_SIGNIFICANT,thisWeight,recId);
+			}
+		}
+	}
+}
+
+/* Data shared by the alignment threads. The galleries and their transforms
+   are only read, each thread has its own auxiliary variables */
+struct SignificantAlignmentThreads
+{
+	ProgReconstructSignificant *prog;
+	std::vector<SignificantImageAlignment> *block;
+	std::vector<SignificantAlignmentAux *> aux;
+	ThreadTaskDistributor *distributor;
+	Mutex mutex;
+	XmippError *error;
+};
+
+static void threadAlignImagesToGallery(ThreadArgument &thArg)
+{
+	SignificantAlignmentThreads *data=(SignificantAlignmentThreads *)thArg.workClass;
+	SignificantAlignmentAux &aux=*(data->aux[thArg.thread_id]);
+	size_t first, last;
+	while (data->distributor->getTasks(first, last))
+		for (size_t n=first; n<=last; ++n)
+		{
+			try
+			{
+				data->prog->alignImageToGallery((*data->block)[n],aux);
+			}
+			catch (XmippError &xe)
+			{
+				data->mutex.lock();
+				if (data->error==NULL)
+					data->error=new XmippError(xe);
+				data->mutex.unlock();
+			}
+		}
+}
+
+void ProgReconstructSignificant::alignImagesToGallery()
+{
+	size_t Nvols=YSIZE(cc);
 
 	// Clear the previous assignment
 	for (size_t nvol=0; nvol<Nvols; ++nvol)
@@ -160,14 +366,7 @@ void ProgReconstructSignificant::alignImagesToGallery()
 		mdReconstructionProjectionMatching[nvol].clear();
 	}
 
-	MultidimArray<double> imgcc(Nvols*Ndirs), imgimed(Nvols*Ndirs);
-	MultidimArray<double> cdfcc, cdfimed;
 	double one_alpha=1-currentAlpha;
-
-	FileName fnImg;
-	size_t nImg=0;
-	Image<double> I;
-	MultidimArray<double> mCurrentImageAligned, mGalleryProjection;
 	if (rank==0)
 	{
 		std::cout << "Current significance: " << one_alpha << std::endl;
@@ -175,197 +374,70 @@ void ProgReconstructSignificant::alignImagesToGallery()
 		init_progress_bar(mdIn.size());
 	}
 
-	MultidimArray<double> ccVol(Nvols);
-	MDRow row;
-	FOR_ALL_OBJECTS_IN_METADATA(mdIn)
+	// The images of this process are aligned in blocks by the threads,
+	// and their assignments are stored in the order of the input metadata
+	int nThreads=std::max(1,Nthr);
+	SignificantAlignmentThreads data;
+	data.prog=this;
+	data.error=NULL;
+	for (int t=0; t<nThreads; ++t)
+		data.aux.push_back(new SignificantAlignmentAux);
+	ThreadManager *thMgr=NULL;
+	if (nThreads>1)
+		thMgr=new ThreadManager(nThreads,&data);
+
+	size_t blockSize=4*nThreads;
+	std::vector<SignificantImageAlignment> block;
+	data.block=&block;
+	size_t nImg=0;
+	MDIterator mdIter(mdIn);
+	size_t Nimgs=mdIn.size();
+	while (nImg<Nimgs)
 	{
-		if ((nImg+1)%Nprocessors==rank)
-		{
-			mdIn.getValue(MDL_IMAGE,fnImg,__iter.objId);
-			mdIn.getRow(row,__iter.objId);
-#ifdef DEBUG
-			std::cout << "Processing: " << fnImg << std::endl;
-#endif
-			I.read(fnImg);
-			MultidimArray<double> &mCurrentImage=I();
-			mCurrentImage.setXmippOrigin();
-			allM.clear();
-
-			double bestCorr=-2, bestRot, bestTilt, bestImed=1e38, worstImed=-1e38;
-			Matrix2D<double> bestM;
-			int bestVolume=-1;
-
-			// Compute all correlations
-	    	for (size_t nVolume=0; nVolume<Nvols; ++nVolume)
-	    	{
-	    		AlignmentTransforms *transforms=galleryTransforms[nVolume];
-		    	for (size_t nDir=0; nDir<Ndirs; ++nDir)
-				{
-					mCurrentImageAligned=mCurrentImage;
-					mGalleryProjection.aliasImageInStack(gallery[nVolume](),nDir);
-					mGalleryProjection.setXmippOrigin();
-					double corr;
-					if (! dontCheckMirrors)
-						corr=alignImagesConsideringMirrors(mGalleryProjection,transforms[nDir],
-								mCurrentImageAligned,M,aux,aux2,aux3,DONT_WRAP);
-					else
-						corr = alignImages(mGalleryProjection, mCurrentImageAligned,
-						                   M, DONT_WRAP);
-
-//					double corr=alignImagesConsideringMirrors(mGalleryProjection,
-//							mCurrentImageAligned,M,aux,aux2,aux3,DONT_WRAP);
-					M=M.inv();
-					double imed=imedDistance(mGalleryProjection, mCurrentImageAligned);
-
-//					//if (corr>0.99)
-//					//{
-//					//std::cout << prm.mdGallery[nVolume][nDir].fnImg << " corr= " << corr << " imed= " << imed << std::endl;
-//					//std::cout << "Matrix=" << M << std::endl;
-//					//Image<double> save;
-//					//save()=mGalleryProjection;
-//					//save.write("PPPgallery.xmp");
-//					//save()=mCurrentImage;
-//					//save.write("PPPcurrentImage.xmp");
-//					//save()=mCurrentImageAligned;
-//					//save.write("PPPcurrentImageAligned.xmp");
-//					//char c; std::cin >> c;
-//					//}
-
-					DIRECT_A3D_ELEM(cc,nImg,nVolume,nDir)=corr;
-					// For the paper plot: std::cout << corr << " " << imed << std::endl;
-					size_t idx=nVolume*Ndirs+nDir;
-					DIRECT_A1D_ELEM(imgcc,idx)=corr;
-					DIRECT_A1D_ELEM(imgimed,idx)=imed;
-					allM.push_back(M);
-
-					if (corr>bestCorr)
-					{
-						bestM=M;
-						bestCorr=corr;
-						bestVolume=(int)nVolume;
-						bestRot=mdGallery[nVolume][nDir].rot;
-						bestTilt=mdGallery[nVolume][nDir].tilt;
-					}
-
-					if (imed<bestImed)
-						bestImed=imed;
-					else if (imed>worstImed)
-						worstImed=imed;
-				}
-	    	}
-
-	    	// Keep the best assignment for the projection matching
-	    	// Each process keeps a list of the images for each volume
-			MetaData &mdProjectionMatching=mdReconstructionProjectionMatching[bestVolume];
-			double scale, shiftX, shiftY, anglePsi;
-			bool flip;
-			transformationMatrix2Parameters2D(bestM,flip,scale,shiftX,shiftY,anglePsi);
-			if (useForValidation && dontCheckMirrors)
-				flip = false;
-
-			if (maxShift<0 || (maxShift>0 && fabs(shiftX)<maxShift && fabs(shiftY)<maxShift))
+		// Collect the next block of images of this process
+		block.clear();
+		for (; nImg<Nimgs && block.size()<blockSize; ++nImg, mdIter.moveNext())
+			if ((nImg+1)%Nprocessors==rank)
 			{
-				size_t recId=mdProjectionMatching.addRow(row);
-				mdProjectionMatching.setValue(MDL_ENABLED,1,recId);
-				mdProjectionMatching.setValue(MDL_MAXCC,bestCorr,recId);
-				mdProjectionMatching.setValue(MDL_ANGLE_ROT,bestRot,recId);
-				mdProjectionMatching.setValue(MDL_ANGLE_TILT,bestTilt,recId);
-				mdProjectionMatching.setValue(MDL_ANGLE_PSI,anglePsi,recId);
-				mdProjectionMatching.setValue(MDL_SHIFT_X,-shiftX,recId);
-				mdProjectionMatching.setValue(MDL_SHIFT_Y,-shiftY,recId);
-				mdProjectionMatching.setValue(MDL_FLIP,flip,recId);
+				block.push_back(SignificantImageAlignment());
+				SignificantImageAlignment &alignment=block.back();
+				alignment.nImg=nImg;
+				mdIn.getValue(MDL_IMAGE,alignment.fnImg,mdIter.objId);
+				mdIn.getRow(alignment.row,mdIter.objId);
 			}
 
-			// Compute lower limit of correlation
-			double rl=bestCorr*one_alpha;
-			double z=0.5*log((1+rl)/(1-rl));
-			double zl=z-2.96*sqrt(1.0/MULTIDIM_SIZE(mCurrentImage));
-			double ccl=tanh(zl);
-
-			// Compute the cumulative distributions
-			imgcc.cumlativeDensityFunction(cdfcc);
-			imgimed.cumlativeDensityFunction(cdfimed);
-
-			// Check if force 1 volume
-			size_t firstVolume=0;
-			size_t lastVolume=Nvols-1;
-
-	    	// Get the best images
-			for (size_t nVolume=firstVolume; nVolume<=lastVolume; ++nVolume)
+		if (!block.empty())
+		{
+			ThreadTaskDistributor distributor(block.size(),1);
+			data.distributor=&distributor;
+			if (thMgr==NULL)
 			{
-				MetaData &mdPartial=mdReconstructionPartial[nVolume];
-				for (size_t nDir=0; nDir<Ndirs; ++nDir)
-				{
-					size_t idx=nVolume*Ndirs+nDir;
-					double cdfccthis=DIRECT_A1D_ELEM(cdfcc,idx);
-					double cdfimedthis=DIRECT_A1D_ELEM(cdfimed,idx);
-					double cc=DIRECT_A1D_ELEM(imgcc,idx);
-					// bool condition=!useImed || (useImed && cdfimedthis<=currentAlpha);
-//					if (cc>ccl)
-//						std::cout << "Image " << nImg << " " << fnImg << " qualifies by Fisher to dir=" << nDir << std::endl;
-//					if (!(cdfccthis>=one_alpha) && cc>ccl)
-//						std::cout << "Image " << nImg << " " << fnImg << " does not qualify by correlation percentile to " << nDir << " -> " << cdfccthis << " " << one_alpha << std::endl;
-//					if (!condition && cc>ccl)
-//						std::cout << "Image " << nImg << " " << fnImg << " does not qualify by imed percentile to " << nDir << " -> " << cdfimedthis << " " << currentAlpha<< std::endl;
-					bool condition=true;
-					condition=condition && ((applyFisher && cc>ccl) || !applyFisher);
-					condition=condition && cdfccthis>=one_alpha;
-					if (condition)
-					{
-//						std::cout << fnImg << " is selected for dir=" << nDir << std::endl;
-						double imed=DIRECT_A1D_ELEM(imgimed,idx);
-						transformationMatrix2Parameters2D(allM[nVolume*Ndirs+nDir],flip,scale,shiftX,shiftY,anglePsi);
-						if (useForValidation && dontCheckMirrors)
-							flip = false;
-
-						if (maxShift>0)
-							if (fabs(shiftX)>maxShift || fabs(shiftY)>maxShift)
-								continue;
-						if (flip)
-							shiftX*=-1;
-
-						double thisWeight=cdfccthis*(cc/bestCorr);
-						// COSS: To promote sparsity in the volume assignment: sum_i(cc_i^p)/sum_i(cc_i)*cc_i^p/cc_i
-						if (useImed)
-							thisWeight*=(1-cdfimedthis)*(bestImed/imed);
-						DIRECT_A3D_ELEM(weight,nImg,nVolume,nDir)=thisWeight;
-						double angleRot=mdGallery[nVolume][nDir].rot;
-						double angleTilt=mdGallery[nVolume][nDir].tilt;
-			#ifdef DEBUG
-						std::cout << "   Getting Gallery: " << mdGallery[nVolume][nDir].fnImg
-								  << " corr=" << cc << " imed=" << imed << " weight=" << weight << " rot=" << angleRot
-								  << " tilt=" << angleTilt << std::endl
-						          << "Matrix=" << allM[nVolume*Ndirs+nDir] << std::endl
-						          << "shiftX=" << shiftX << " shiftY=" << shiftY << std::endl;
-			#endif
-
-						size_t recId=mdPartial.addRow(row);
-						mdPartial.setValue(MDL_ENABLED,1,recId);
-						mdPartial.setValue(MDL_MAXCC,cc,recId);
-						mdPartial.setValue(MDL_COST,imed,recId);
-						mdPartial.setValue(MDL_ANGLE_ROT,angleRot,recId);
-						mdPartial.setValue(MDL_ANGLE_TILT,angleTilt,recId);
-						mdPartial.setValue(MDL_ANGLE_PSI,anglePsi,recId);
-						mdPartial.setValue(MDL_SHIFT_X,-shiftX,recId);
-						mdPartial.setValue(MDL_SHIFT_Y,-shiftY,recId);
-						mdPartial.setValue(MDL_FLIP,flip,recId);
-						mdPartial.setValue(MDL_IMAGE_IDX,(size_t)nImg,recId);
-						mdPartial.setValue(MDL_REF,(int)nDir,recId);
-						mdPartial.setValue(MDL_REF3D,(int)nVolume,recId);
-						mdPartial.setValue(MDL_WEIGHT,thisWeight,recId);
-						mdPartial.setValue(MDL_WEIGHT_SIGNIFICANT,thisWeight,recId);
-					}
-				}
+				ThreadArgument thArg;
+				thArg.thread_id=0;
+				thArg.workClass=&data;
+				threadAlignImagesToGallery(thArg);
 			}
-#ifdef DEBUG
-			std::cout << "Press any key" << std::endl;
-			char c; std::cin >> c;
-#endif
+			else
+				thMgr->run(threadAlignImagesToGallery);
+			if (data.error!=NULL)
+				break;
+
+			for (size_t n=0; n<block.size(); ++n)
+				storeImageAlignment(block[n]);
 		}
 
 		if (rank==0)
-			progress_bar(nImg+1);
-		nImg++;
+			progress_bar(nImg);
+	}
+
+	delete thMgr;
+	for (int t=0; t<nThreads; ++t)
+		delete data.aux[t];
+	if (data.error!=NULL)
+	{
+		XmippError error(*data.error);
+		delete data.error;
+		throw error;
 	}
 	if (rank==0)
 		progress_bar(mdIn.size());
@@ -592,7 +664,7 @@ void ProgReconstructSignificant::reconstructCurrent()
 		MD.read(fnAngles);
 		std::cout << "Volume " << nVolume << ": number of images=" << MD.size() << std::endl;
 		FileName fnVolume=formatString("%s/volume_iter%03d_%02d.vol",fnDir.c_str(),iter,nVolume);
-		String args=formatString("-i %s -o %s --sym %s --weight -v 0",fnAngles.c_str(),fnVolume.c_str(),fnSym.c_str());
+		String args=formatString("-i %s -o %s --sym %s --weight --thr %d -v 0",fnAngles.c_str(),fnVolume.c_str(),fnSym.c_str(),Nthr);
 		String cmd=(String)"xmipp_reconstruct_fourier "+args;
 		std::cout << cmd << std::endl;
 		if (system(cmd.c_str())==-1)
@@ -630,8 +702,8 @@ void ProgReconstructSignificant::generateProjections()
 			fnGallery=formatString("%s/gallery_iter%03d_%02d.stk",fnDir.c_str(),iter,n);
 			fnAngles=formatString("%s/angles_iter%03d_%02d.xmd",fnDir.c_str(),iter-1,n);
 			fnGalleryMetaData=formatString("%s/gallery_iter%03d_%02d.doc",fnDir.c_str(),iter,n);
-			String args=formatString("-i %s -o %s --sampling_rate %f --sym %s --compute_neighbors --angular_distance -1 --experimental_images %s --min_tilt_angle %f --max_tilt_angle %f -v 0",
-					fnVol.c_str(),fnGallery.c_str(),angularSampling,fnSym.c_str(),fnAngles.c_str(),tilt0,tiltF);
+			String args=formatString("-i %s -o %s --sampling_rate %f --sym %s --compute_neighbors --angular_distance -1 --experimental_images %s --min_tilt_angle %f --max_tilt_angle %f --thr %d -v 0",
+					fnVol.c_str(),fnGallery.c_str(),angularSampling,fnSym.c_str(),fnAngles.c_str(),tilt0,tiltF,Nthr);
 
 			String cmd=(String)"xmipp_angular_project_library "+args;
 			if (system(cmd.c_str())==-1)
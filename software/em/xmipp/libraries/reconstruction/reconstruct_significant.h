@@ -34,6 +34,42 @@
    @ingroup ReconsLibrary */
 //@{
 
+/** Alignment of one input image to all the projections of the galleries */
+class SignificantImageAlignment
+{
+public:
+    /// Index of the image in the input metadata
+    size_t nImg;
+    /// Image filename
+    FileName fnImg;
+    /// Input row of the image
+    MDRow row;
+    /// Correlations and Imed distances with all gallery projections (volume major)
+    MultidimArray<double> imgcc, imgimed;
+    /// Alignment matrices with all gallery projections
+    std::vector< Matrix2D<double> > allM;
+    /// Best alignment
+    Matrix2D<double> bestM;
+    /// Best correlation and its angles, best Imed distance
+    double bestCorr, bestRot, bestTilt, bestImed;
+    /// Volume of the best alignment
+    int bestVolume;
+    /// Number of pixels of the image
+    size_t imgSize;
+};
+
+/** Per-thread auxiliary variables for the image alignment */
+class SignificantAlignmentAux
+{
+public:
+    AlignmentAux aux;
+    CorrelationAux aux2;
+    RotationalCorrelationAux aux3;
+    Image<double> I;
+    MultidimArray<double> mCurrentImageAligned, mGalleryProjection;
+    Matrix2D<double> M;
+};
+
 /** Significant reconstruction parameters. */
 class ProgReconstructSignificant: public XmippProgram
 {
@@ -93,6 +129,8 @@ public:
 
     bool dontCheckMirrors;
 
+    /** Number of threads */
+    int Nthr;
 
 public: // Internal members
     size_t rank, Nprocessors;
@@ -162,6 +200,14 @@ public:
     /// Align images to gallery projections
     void alignImagesToGallery();
 
+    /** Align one image to all gallery projections.
+     * The correlations are stored in cc. This function can be called
+     * concurrently for different images, each thread with its own aux. */
+    void alignImageToGallery(SignificantImageAlignment &alignment, SignificantAlignmentAux &aux);
+
+    /// Add the significant assignments of one aligned image to the metadatas
+    void storeImageAlignment(const SignificantImageAlignment &alignment);
+
     /// Gather alignment
     virtual void gatherAlignment() {}
 